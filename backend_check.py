@@ -0,0 +1,59 @@
+# Renders the same mesh with the gl and the software backend and compares the maps.
+# Exits with 1 if the coverage or the values of a map differ by more than the thresholds.
+import sys
+import torch
+import pyegl
+import trimesh
+
+mesh = trimesh.load('data/bunny_col.obj', process=False)
+mesh.apply_translation(-mesh.centroid).apply_scale(1./mesh.extents)
+n_vertices = mesh.vertices.shape[0]
+n_faces = mesh.faces.shape[0]
+vertices = torch.tensor(mesh.vertices, dtype=torch.float32)
+normals = torch.tensor(mesh.vertex_normals.copy(), dtype=torch.float32)
+colors = torch.ones((n_vertices, 4), dtype=torch.float32)
+uv = torch.tensor(mesh.visual.uv, dtype=torch.float32)
+mask = torch.ones((n_vertices, 1), dtype=torch.float32)
+vertices_data = torch.cat((vertices, normals, colors, uv, mask), dim=-1).cuda()
+faces = torch.tensor(mesh.faces, dtype=torch.int64)
+
+fx, fy, cx, cy, near, far = 1000, 1000, 256, 256, 0.01, 100.0
+intrinsics = [fx, fy, cx, cy, near, far]
+pose = [1., 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 3, 0, 0, 0, 1]
+width, height = 512, 512
+names = ['color', 'position', 'normal', 'uv', 'bary', 'vids']
+
+max_coverage_mismatch = 0.002  # fraction of pixels, edges may be rasterized differently
+max_value_error = 1e-3         # mean absolute error where both cover the pixel
+
+
+def render(backend):
+    pyegl.set_backend(backend)
+    pyegl.init_with_defines(width, height, ['DIFFUSE_SHADING'])
+    pyegl.load_config('data/config.json')
+    maps = pyegl.forward(intrinsics, pose, vertices_data, n_vertices, faces, n_faces)
+    assert pyegl.get_backend() == backend
+    maps = [m.cpu() for m in maps]
+    pyegl.terminate()
+    return maps
+
+
+gl_maps = render('gl')
+software_maps = render('software')
+vids_gl, vids_software = gl_maps[5][..., 0], software_maps[5][..., 0]
+covered = (vids_gl >= 0) & (vids_software >= 0)
+same_face = covered & (gl_maps[5] == software_maps[5]).all(dim=-1)
+
+failed = False
+for name, a, b in zip(names, gl_maps, software_maps):
+    background_a = (a == -1).all(dim=-1)
+    background_b = (b == -1).all(dim=-1)
+    mismatch = (background_a != background_b).float().mean().item()
+    # the vertex ids of a pixel on an edge may come from either face
+    pixels = same_face if name in ('bary', 'vids') else covered
+    error = (a - b).abs()[pixels].mean().item() if pixels.any() else 0.0
+    ok = mismatch <= max_coverage_mismatch and error <= max_value_error
+    failed = failed or not ok
+    print('%-8s coverage mismatch %.5f  mean abs error %.6f  %s' % (name, mismatch, error, 'ok' if ok else 'FAILED'))
+
+sys.exit(1 if failed else 0)
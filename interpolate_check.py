@@ -0,0 +1,69 @@
+# Checks pyegl.interpolate against a reference in torch and its gradients with
+# torch.autograd.gradcheck, on CPU and on every CUDA device (with device 0 current).
+# The maps have background pixels and corners with ids outside of the attributes.
+# Exits with 1 if a value or a gradient differs by more than the thresholds.
+import sys
+import torch
+import pyegl
+
+n_vertices, n_features = 7, 5
+height, width, channels = 4, 6, 4  # channels of the bary and vids maps as rendered
+
+max_value_error = 1e-5
+
+
+def make_maps(device):
+    generator = torch.Generator().manual_seed(0)
+    attributes = torch.randn(n_vertices, n_features, generator=generator)
+    bary = torch.rand(height, width, channels, generator=generator)
+    vids = torch.randint(0, n_vertices, (height, width, channels), generator=generator).float()
+
+    # background as cleared by the render target
+    vids[0] = -1
+    bary[0] = -1
+    vids[2, 3] = -1
+    bary[2, 3] = -1
+    # corners outside of the attributes only drop their weight
+    vids[1, 0, 1] = n_vertices
+    vids[1, 2, 2] = n_vertices + 10
+    vids[3, 4, 1] = -3
+    vids[3, 5, :3] = n_vertices + 1
+    return attributes.to(device), bary.to(device), vids.to(device)
+
+
+def reference(attributes, bary, vids):
+    ids = vids[..., :3].long()
+    valid = (vids[..., :1] >= 0) & (ids >= 0) & (ids < attributes.shape[0])
+    weights = torch.where(valid, bary[..., :3], torch.zeros_like(bary[..., :3]))
+    corners = attributes[ids.clamp(0, attributes.shape[0] - 1)]
+    return (weights.unsqueeze(-1) * corners).sum(dim=-2)
+
+
+def check(device):
+    attributes, bary, vids = make_maps(device)
+    output = pyegl.interpolate(attributes, bary, vids)
+    error = (output - reference(attributes, bary, vids)).abs().max().item()
+    background = output[vids[..., 0] < 0].abs().max().item()
+
+    # the op is float32 only, the tolerances account for the finite differences in float
+    attributes.requires_grad_()
+    bary.requires_grad_()
+    gradients = torch.autograd.gradcheck(lambda a, b: pyegl.interpolate(a, b, vids), (attributes, bary),
+                                         eps=1e-2, atol=1e-3, rtol=1e-2, raise_exception=False)
+
+    ok = error <= max_value_error and background == 0.0 and gradients
+    print('%-8s max abs error %.2e  background %.1f  gradcheck %s  %s' %
+          (device, error, background, 'ok' if gradients else 'failed', 'ok' if ok else 'FAILED'))
+    return ok
+
+
+devices = ['cpu']
+if torch.cuda.is_available():
+    torch.cuda.set_device(0)
+    devices += ['cuda:%d' % i for i in range(torch.cuda.device_count())]
+
+failed = False
+for device in devices:
+    failed = not check(device) or failed
+
+sys.exit(1 if failed else 0)
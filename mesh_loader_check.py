@@ -0,0 +1,310 @@
+# Loads generated OBJ, OFF, PLY and GLB files with pyegl.load_mesh and compares the
+# corners of every triangle with the polygons the files were written from, and
+# data/bunny_col.obj with trimesh. The OBJ file spans several parser chunks with
+# negative indices across them, the OFF files have polygons in text and big endian
+# BINARY, the PLY files polygon lists with properties after the vertex indices and
+# the GLB file interleaved buffer views under a mirroring node. Every file is
+# loaded parsed and a second time from the mesh cache.
+# Exits with 1 if a corner differs by more than the threshold.
+import json
+import math
+import os
+import random
+import struct
+import sys
+import tempfile
+import torch
+import pyegl
+import trimesh
+
+max_value_error = 1e-4  # text is written with 6 decimals, GLB positions are transformed in float
+
+# x y z nx ny nz r g b a u v of a corner, the columns of the (V, 13) vertices without the mask
+ALL = list(range(12))
+WITHOUT_UV = list(range(10))
+
+
+def fan(polygon):
+    return [(polygon[0], polygon[i - 1], polygon[i]) for i in range(2, len(polygon))]
+
+
+def values(rng, n, low=-1.0, high=1.0):
+    return [round(rng.uniform(low, high), 6) for _ in range(n)]
+
+
+def unit(v):
+    length = math.sqrt(sum(c * c for c in v))
+    return [c / length for c in v]
+
+
+def write_obj(filename):
+    # about 12 MB, parsed in chunks of 4 MB that start at line ends
+    rng = random.Random(1)
+    positions, texcoords, normals, triangles = [], [], [], []
+    lines = ['# pyegl mesh_loader_check\n']
+    for block in range(2000):
+        for _ in range(50):
+            positions.append(values(rng, 3) + values(rng, 3, 0.0, 1.0))
+            texcoords.append(values(rng, 2, 0.0, 1.0))
+            normals.append(values(rng, 3))
+            lines.append('v %.6f %.6f %.6f %.6f %.6f %.6f\n' % tuple(positions[-1]))
+            lines.append('vt %.6f %.6f\n' % tuple(texcoords[-1]))
+            lines.append('vn %.6f %.6f %.6f\n' % tuple(normals[-1]))
+
+        # corners up to 3000 vertices back, about 350 kB, written absolute or relative
+        for _ in range(20):
+            n = len(positions)
+            polygon = [[rng.randrange(max(0, n - 3000), n) for _ in range(3)] for _ in range(rng.randint(3, 6))]
+            tokens = ['/'.join(str(i + 1 if rng.random() < 0.5 else i - n) for i in corner) for corner in polygon]
+            lines.append('f %s\n' % ' '.join(tokens))
+            corners = [positions[v][:3] + normals[vn] + positions[v][3:] + [1.0] + texcoords[vt] for v, vt, vn in polygon]
+            triangles += fan(corners)
+    with open(filename, 'w') as file:
+        file.writelines(lines)
+    return triangles, ALL
+
+
+def write_off(filename):
+    rng = random.Random(2)
+    vertices = []
+    lines = ['# pyegl mesh_loader_check\nCNOFF\n\n# counts on the next line\n']
+    n_vertices, n_faces = 500, 400
+    lines.append('%d %d 0\n' % (n_vertices, n_faces))
+    for i in range(n_vertices):
+        position, normal = values(rng, 3), values(rng, 3)
+        if i % 2:
+            # integer colors are in [0, 255]
+            color = [rng.randrange(256) for _ in range(4)]
+            lines.append('%.6f %.6f %.6f %.6f %.6f %.6f %d %d %d %d\n' % tuple(position + normal + color))
+            color = [c / 255.0 for c in color]
+        else:
+            color = values(rng, 3, 0.0, 1.0)
+            lines.append('%.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f\n' % tuple(position + normal + color))
+            color += [1.0]
+        vertices.append(position + normal + color)
+
+    triangles = []
+    for i in range(n_faces):
+        polygon = [rng.randrange(n_vertices) for _ in range(rng.randint(3, 7))]
+        face_color = ' 255 0 0' if i % 3 == 0 else ''
+        lines.append('%d %s%s\n' % (len(polygon), ' '.join(map(str, polygon)), face_color))
+        if i % 50 == 0:
+            lines.append('# comment between faces\n\n')
+        triangles += fan([vertices[v] for v in polygon])
+    with open(filename, 'w') as file:
+        file.writelines(lines)
+    return triangles, WITHOUT_UV
+
+
+def write_off_binary(filename):
+    rng = random.Random(3)
+    n_vertices, n_faces = 700, 500
+    vertices = [values(rng, 3) + values(rng, 3) + values(rng, 4, 0.0, 1.0) + values(rng, 2, 0.0, 1.0) for _ in range(n_vertices)]
+    data = bytearray(b'STCNOFF BINARY\n')
+    data += struct.pack('>3i', n_vertices, n_faces, 0)
+    for vertex in vertices:
+        data += struct.pack('>12f', *vertex)
+
+    triangles = []
+    for _ in range(n_faces):
+        polygon = [rng.randrange(n_vertices) for _ in range(rng.randint(3, 6))]
+        n_colors = rng.choice([0, 3, 4])
+        data += struct.pack('>%di' % (len(polygon) + 1), len(polygon), *polygon)
+        data += struct.pack('>i%df' % n_colors, n_colors, *values(rng, n_colors, 0.0, 1.0))
+        triangles += fan([vertices[v] for v in polygon])
+    with open(filename, 'wb') as file:
+        file.write(data)
+    return triangles, ALL
+
+
+def write_ply_polygons(filename):
+    # not only triangles, and properties before and after the index lists
+    rng = random.Random(4)
+    n_vertices, n_faces = 600, 500
+    header = ['ply', 'format binary_little_endian 1.0', 'comment pyegl mesh_loader_check',
+              'element vertex %d' % n_vertices,
+              'property float x', 'property float y', 'property float z',
+              'property float nx', 'property float ny', 'property float nz',
+              'property uchar red', 'property uchar green', 'property uchar blue', 'property uchar alpha',
+              'property float s', 'property float t', 'property double quality',
+              'element face %d' % n_faces,
+              'property uchar flags', 'property list uchar int vertex_indices',
+              'property list uchar float texcoord', 'property int label',
+              'element edge 1', 'property int vertex1', 'property int vertex2', 'end_header']
+    data = bytearray(('\n'.join(header) + '\n').encode())
+
+    vertices = []
+    for _ in range(n_vertices):
+        position, normal, uv = values(rng, 3), values(rng, 3), values(rng, 2, 0.0, 1.0)
+        color = [rng.randrange(256) for _ in range(4)]
+        data += struct.pack('<6f4B2fd', *(position + normal + color + uv + [rng.random()]))
+        vertices.append(position + normal + [c / 255.0 for c in color] + uv)
+
+    triangles = []
+    for _ in range(n_faces):
+        polygon = [rng.randrange(n_vertices) for _ in range(rng.randint(3, 6))]
+        texcoord = values(rng, 2 * len(polygon))
+        data += struct.pack('<BB%di' % len(polygon), rng.randrange(256), len(polygon), *polygon)
+        data += struct.pack('<B%dfi' % len(texcoord), len(texcoord), *(texcoord + [rng.randrange(100)]))
+        triangles += fan([vertices[v] for v in polygon])
+    data += struct.pack('<2i', 0, 1)
+    with open(filename, 'wb') as file:
+        file.write(data)
+    return triangles, ALL
+
+
+def write_ply_triangles(filename):
+    # triangles with the index list as the only property, read as fixed size faces
+    rng = random.Random(5)
+    n_vertices, n_faces = 400, 700
+    header = ['ply', 'format binary_little_endian 1.0',
+              'element vertex %d' % n_vertices,
+              'property double x', 'property double y', 'property double z',
+              'property ushort r', 'property ushort g', 'property ushort b',
+              'element face %d' % n_faces, 'property list uchar ushort vertex_index', 'end_header']
+    data = bytearray(('\n'.join(header) + '\n').encode())
+
+    vertices = []
+    for _ in range(n_vertices):
+        position = values(rng, 3)
+        color = [rng.randrange(65536) for _ in range(3)]
+        data += struct.pack('<3d3H', *(position + color))
+        vertices.append(position + [0.0, 0.0, 0.0] + [c / 65535.0 for c in color] + [1.0])
+
+    triangles = []
+    for _ in range(n_faces):
+        triangle = [rng.randrange(n_vertices) for _ in range(3)]
+        data += struct.pack('<B3H', 3, *triangle)
+        triangles.append(tuple(vertices[v] for v in triangle))
+    with open(filename, 'wb') as file:
+        file.write(data)
+    return triangles, [0, 1, 2, 6, 7, 8, 9]
+
+
+def write_glb(filename):
+    rng = random.Random(6)
+    f32 = lambda v: [struct.unpack('<f', struct.pack('<f', x))[0] for x in v]
+    buffer, views, accessors = bytearray(), [], []
+
+    def add_view(data, stride=None):
+        while len(buffer) % 4:
+            buffer.append(0)
+        views.append({'buffer': 0, 'byteOffset': len(buffer), 'byteLength': len(data)})
+        if stride:
+            views[-1]['byteStride'] = stride
+        buffer.extend(data)
+        return len(views) - 1
+
+    def add_accessor(view, offset, component_type, count, type, normalized=False):
+        accessors.append({'bufferView': view, 'byteOffset': offset, 'componentType': component_type, 'count': count, 'type': type})
+        if normalized:
+            accessors[-1]['normalized'] = True
+        return len(accessors) - 1
+
+    # mesh 0: positions, normals and uv interleaved, normalized uchar colors, uint16 indices
+    n0, t0 = 300, 400
+    corners0 = [(f32(values(rng, 3)), f32(unit(values(rng, 3))), f32(values(rng, 2, 0.0, 1.0))) for _ in range(n0)]
+    colors0 = [[rng.randrange(256) for _ in range(4)] for _ in range(n0)]
+    indices0 = [rng.randrange(n0) for _ in range(3 * t0)]
+    view = add_view(b''.join(struct.pack('<8f', *(p + n + uv)) for p, n, uv in corners0), 32)
+    attributes0 = {'POSITION': add_accessor(view, 0, 5126, n0, 'VEC3'), 'NORMAL': add_accessor(view, 12, 5126, n0, 'VEC3'),
+                   'TEXCOORD_0': add_accessor(view, 24, 5126, n0, 'VEC2'),
+                   'COLOR_0': add_accessor(add_view(bytes(sum(colors0, []))), 0, 5121, n0, 'VEC4', True)}
+    primitive0 = {'attributes': attributes0, 'indices': add_accessor(add_view(struct.pack('<%dH' % len(indices0), *indices0)), 0, 5123, 3 * t0, 'SCALAR')}
+
+    # mesh 1: positions padded to 16 bytes, float rgb colors, without indices
+    n1 = 270
+    corners1 = [(f32(values(rng, 3)), f32(unit(values(rng, 3))), f32(values(rng, 2, 0.0, 1.0))) for _ in range(n1)]
+    colors1 = [f32(values(rng, 3, 0.0, 1.0)) for _ in range(n1)]
+    attributes1 = {'POSITION': add_accessor(add_view(b''.join(struct.pack('<4f', *(p + [0.0])) for p, _, _ in corners1), 16), 0, 5126, n1, 'VEC3'),
+                   'NORMAL': add_accessor(add_view(b''.join(struct.pack('<3f', *n) for _, n, _ in corners1)), 0, 5126, n1, 'VEC3'),
+                   'TEXCOORD_0': add_accessor(add_view(b''.join(struct.pack('<2f', *uv) for _, _, uv in corners1)), 0, 5126, n1, 'VEC2'),
+                   'COLOR_0': add_accessor(add_view(b''.join(struct.pack('<3f', *c) for c in colors1)), 0, 5126, n1, 'VEC3')}
+    primitive1 = {'attributes': attributes1}
+
+    # the child of a scaled and rotated node mirrors x, its triangles keep their winding
+    rotation, translation, scale = [0.0, 0.38268343, 0.0, 0.92387953], [1.0, 2.0, 3.0], [2.0, 1.0, 0.5]
+    mirror = [-1.0, 0, 0, 0, 0, 1.0, 0, 0, 0, 0, 1.0, 0, 5.0, 0, 0, 1.0]
+    gltf = {'asset': {'version': '2.0'}, 'scene': 0, 'scenes': [{'nodes': [0, 2]}],
+            'nodes': [{'mesh': 0, 'translation': translation, 'rotation': rotation, 'scale': scale, 'children': [1]},
+                      {'mesh': 1, 'matrix': mirror}, {'mesh': 0}],
+            'meshes': [{'primitives': [primitive0]}, {'primitives': [primitive1]}],
+            'accessors': accessors, 'bufferViews': views, 'buffers': [{'byteLength': 0}]}
+    while len(buffer) % 4:
+        buffer.append(0)
+    gltf['buffers'][0]['byteLength'] = len(buffer)
+    text = json.dumps(gltf).encode()
+    text += b' ' * (-len(text) % 4)
+    with open(filename, 'wb') as file:
+        file.write(struct.pack('<5I', 0x46546C67, 2, 28 + len(text) + len(buffer), len(text), 0x4E4F534A) + text)
+        file.write(struct.pack('<2I', len(buffer), 0x004E4942) + buffer)
+
+    # world matrices as rows of [A | t]
+    x, y, z, w = rotation
+    r = [[1 - 2 * (y * y + z * z), 2 * (x * y - z * w), 2 * (x * z + y * w)],
+         [2 * (x * y + z * w), 1 - 2 * (x * x + z * z), 2 * (y * z - x * w)],
+         [2 * (x * z - y * w), 2 * (y * z + x * w), 1 - 2 * (x * x + y * y)]]
+    parent = [[r[i][k] * scale[k] for k in range(3)] + [translation[i]] for i in range(3)]
+    child = [[sum(parent[i][k] * (mirror[4 * j + k] if k < 3 else 0) for k in range(3)) for j in range(3)] +
+             [sum(parent[i][k] * mirror[12 + k] for k in range(3)) + parent[i][3]] for i in range(3)]
+    identity = [[1.0, 0, 0, 0], [0, 1.0, 0, 0], [0, 0, 1.0, 0]]
+
+    def transform(m, corners, colors, triangles):
+        a = [row[:3] for row in m]
+        cofactors = [[a[(i + 1) % 3][(j + 1) % 3] * a[(i + 2) % 3][(j + 2) % 3] - a[(i + 1) % 3][(j + 2) % 3] * a[(i + 2) % 3][(j + 1) % 3]
+                      for j in range(3)] for i in range(3)]
+        det = sum(a[0][j] * cofactors[0][j] for j in range(3))
+        vertices = []
+        for (p, n, uv), color in zip(corners, colors):
+            position = [sum(m[i][k] * p[k] for k in range(3)) + m[i][3] for i in range(3)]
+            normal = unit([math.copysign(1.0, det) * sum(cofactors[i][k] * n[k] for k in range(3)) for i in range(3)])
+            vertices.append(position + normal + color + [uv[0], 1.0 - uv[1]])
+        if det < 0:
+            triangles = [(t[0], t[2], t[1]) for t in triangles]
+        return [tuple(vertices[v] for v in t) for t in triangles]
+
+    colors0 = [[c / 255.0 for c in color] for color in colors0]
+    colors1 = [color + [1.0] for color in colors1]
+    triangles0 = [tuple(indices0[3 * i:3 * i + 3]) for i in range(t0)]
+    triangles1 = [(3 * i, 3 * i + 1, 3 * i + 2) for i in range(n1 // 3)]
+    triangles = transform(parent, corners0, colors0, triangles0) + transform(child, corners1, colors1, triangles1) + \
+        transform(identity, corners0, colors0, triangles0)
+    return triangles, ALL
+
+
+def compare(name, mesh, triangles, columns):
+    if not mesh:
+        print('%-24s not loaded  FAILED' % name)
+        return False
+    corners = mesh['vertices'][mesh['faces']][..., columns]
+    expected = torch.tensor([list(t) for t in triangles], dtype=torch.float32)[..., columns]
+    if corners.shape != expected.shape:
+        print('%-24s %d triangles instead of %d  FAILED' % (name, len(corners), len(expected)))
+        return False
+    error = torch.abs(corners - expected).max().item()
+    ok = error <= max_value_error
+    print('%-24s %7d triangles  max abs error %.2e  %s' % (name, len(corners), error, 'ok' if ok else 'FAILED'))
+    return ok
+
+
+writers = [('chunks.obj', write_obj), ('polygons.off', write_off), ('binary.off', write_off_binary),
+           ('polygons.ply', write_ply_polygons), ('triangles.ply', write_ply_triangles), ('mirrored.glb', write_glb)]
+
+failed = False
+with tempfile.TemporaryDirectory() as directory:
+    pyegl.set_cache_dir(os.path.join(directory, 'cache'))
+    for filename, write in writers:
+        filename = os.path.join(directory, filename)
+        triangles, columns = write(filename)
+        # parsed, parsed and written to the cache, mapped from the cache
+        for cache, source in ((False, 'parsed'), (True, 'cache miss'), (True, 'cache hit')):
+            name = '%s %s' % (os.path.basename(filename), source)
+            failed = not compare(name, pyegl.load_mesh(filename, cache=cache), triangles, columns) or failed
+    pyegl.set_cache_dir('')
+
+# the faces of trimesh may be split at other vertices, their corners are the same
+mesh = trimesh.load('data/bunny_col.obj', process=False)
+reference = [[list(map(float, mesh.vertices[v])) + [0.0] * 9 for v in face] for face in mesh.faces]
+failed = not compare('bunny_col.obj trimesh', pyegl.load_mesh('data/bunny_col.obj'), reference, [0, 1, 2]) or failed
+
+sys.exit(1 if failed else 0)
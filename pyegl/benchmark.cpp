@@ -0,0 +1,594 @@
+// Headless benchmark of the render stages. Renders synthetic spheres with the
+// GL and the software backend over a sweep of triangle counts, resolutions and
+// output sets, and writes the latency percentiles of every stage and the
+// throughput as JSON. Built by `python setup.py build_benchmark`, without CUDA
+// (NO_CUDA) unless --cuda is given, so it also runs on Mesa.
+//
+// Stages of a frame, each one is synchronized before the next one starts:
+//  upload:   vertex data from host memory into the vertex buffer
+//  draw:     clear, draw and wait for the GPU (the whole rasterizer in software)
+//  readback: render target textures straight into the buffers of the maps,
+//            owned by the caller (GL only)
+//  wrap:     copy of the maps into buffers owned by the caller (software only)
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+#include "opengl_helper.h"
+#include "software_rasterizer.h"
+#include "deps/json.h"
+
+
+struct Options
+{
+    std::vector<unsigned int> triangles = {1000, 10000, 100000, 1000000, 10000000};
+    std::vector<std::pair<unsigned int, unsigned int>> resolutions = {{256, 256}, {512, 512}, {1024, 1024}};
+    std::vector<std::string> outputs = {"all", "color", "bary+vids"};
+    std::vector<std::string> backends = {"gl", "software"};
+    unsigned int frames = 50;
+    unsigned int warmup = 5;
+    int device_id = -1;
+    std::string filename = "benchmark.json";
+};
+
+
+static void print_usage()
+{
+    std::cout << "usage: pyegl_benchmark [options]" << std::endl
+              << "  --triangles 1000,100000     triangle counts of the synthetic spheres" << std::endl
+              << "  --resolutions 512,640x480   render target sizes" << std::endl
+              << "  --outputs all,color,bary+vids  sets of maps (color, position, normal, uv, bary, vids)" << std::endl
+              << "  --backends gl,software" << std::endl
+              << "  --frames 50 --warmup 5      measured and discarded frames per configuration" << std::endl
+              << "  --device -1                 EGL device" << std::endl
+              << "  --output benchmark.json" << std::endl;
+}
+
+
+static std::vector<std::string> split(const std::string& list, char separator)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, separator))
+    {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
+
+
+static int parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage();
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            std::cout << "ERROR: missing value of " << arg << std::endl;
+            return -1;
+        }
+
+        std::string value = argv[++i];
+        try
+        {
+            if (arg == "--triangles")
+            {
+                options.triangles.clear();
+                for (const auto& item : split(value, ','))
+                    options.triangles.push_back(std::stoul(item));
+            }
+            else if (arg == "--resolutions")
+            {
+                options.resolutions.clear();
+                for (const auto& item : split(value, ','))
+                {
+                    size_t x = item.find('x');
+                    unsigned int w = std::stoul(item.substr(0, x));
+                    unsigned int h = x == std::string::npos ? w : std::stoul(item.substr(x + 1));
+                    options.resolutions.push_back({w, h});
+                }
+            }
+            else if (arg == "--outputs") options.outputs = split(value, ',');
+            else if (arg == "--backends") options.backends = split(value, ',');
+            else if (arg == "--frames") options.frames = std::stoul(value);
+            else if (arg == "--warmup") options.warmup = std::stoul(value);
+            else if (arg == "--device") options.device_id = std::stoi(value);
+            else if (arg == "--output") options.filename = value;
+            else
+            {
+                std::cout << "ERROR: unknown option " << arg << std::endl;
+                print_usage();
+                return -1;
+            }
+        }
+        catch (std::exception&)
+        {
+            std::cout << "ERROR: invalid value " << value << " of " << arg << std::endl;
+            return -1;
+        }
+    }
+
+    if (options.frames == 0)
+    {
+        std::cout << "ERROR: at least one frame has to be measured" << std::endl;
+        return -1;
+    }
+    return 1;
+}
+
+
+// maps names joined by '+' to the output bits of the render target, 0 for unknown names
+static unsigned int parse_outputs(const std::string& set)
+{
+    static const char* names[] = {"color", "position", "normal", "uv", "bary", "vids"};
+    if (set == "all")
+        return OpenGL::RenderTarget::ALL;
+
+    unsigned int outputs = 0;
+    for (const auto& name : split(set, '+'))
+    {
+        int i = 0;
+        while (i < 6 && name != names[i]) i++;
+        if (i == 6)
+            return 0;
+        outputs |= 1 << i;
+    }
+    return outputs;
+}
+
+
+// uv sphere of radius 1 with stacks x 2 stacks quads, so about n_triangles
+// triangles, front faces counterclockwise seen from outside
+static void make_sphere(unsigned int n_triangles, std::vector<OpenGL::Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+    unsigned int stacks = std::max(2u, (unsigned int)std::lround(std::sqrt(n_triangles / 4.0)));
+    unsigned int slices = 2 * stacks;
+
+    vertices.resize((size_t)(stacks + 1) * (slices + 1));
+    for (unsigned int i = 0; i <= stacks; i++)
+    {
+        float theta = float(M_PI) * i / stacks;
+        for (unsigned int j = 0; j <= slices; j++)
+        {
+            float phi = 2.0f * float(M_PI) * j / slices;
+            OpenGL::Vertex& v = vertices[(size_t)i * (slices + 1) + j];
+            v.x = v.nx = std::sin(theta) * std::cos(phi);
+            v.y = v.ny = std::cos(theta);
+            v.z = v.nz = std::sin(theta) * std::sin(phi);
+            v.r = 0.5f * v.nx + 0.5f;
+            v.g = 0.5f * v.ny + 0.5f;
+            v.b = 0.5f * v.nz + 0.5f;
+            v.u = float(j) / slices;
+            v.v = float(i) / stacks;
+        }
+    }
+
+    indices.clear();
+    indices.reserve((size_t)6 * stacks * slices);
+    for (unsigned int i = 0; i < stacks; i++)
+    {
+        for (unsigned int j = 0; j < slices; j++)
+        {
+            unsigned int a = i * (slices + 1) + j;
+            unsigned int b = a + slices + 1;
+            indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+}
+
+
+// the sphere turns around the y axis in front of the camera
+static OpenGL::mat4 sphere_modelview(unsigned int frame)
+{
+    float angle = 0.01f * frame;
+    OpenGL::mat4 m = OpenGL::mat4::Identity();
+    m.m00 = std::cos(angle);
+    m.m02 = std::sin(angle);
+    m.m20 = -std::sin(angle);
+    m.m22 = std::cos(angle);
+    m.m23 = -3.0f;
+    return m;
+}
+
+
+class Stopwatch
+{
+public:
+    void Start()
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    // milliseconds since Start
+    double Stop() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+
+// latencies of one stage over the measured frames
+struct StageSamples
+{
+    std::string name;
+    std::vector<double> ms;
+};
+
+
+static nlohmann::json summarize(std::vector<double> ms)
+{
+    std::sort(ms.begin(), ms.end());
+    auto percentile = [&](double p)
+    {
+        // nearest rank
+        size_t rank = (size_t)std::ceil(p / 100.0 * ms.size());
+        return ms[std::min(std::max(rank, size_t(1)), ms.size()) - 1];
+    };
+
+    double sum = 0.0;
+    for (double t : ms)
+        sum += t;
+
+    nlohmann::json summary;
+    summary["mean_ms"] = sum / ms.size();
+    summary["min_ms"] = ms.front();
+    summary["p50_ms"] = percentile(50.0);
+    summary["p90_ms"] = percentile(90.0);
+    summary["p99_ms"] = percentile(99.0);
+    summary["max_ms"] = ms.back();
+    return summary;
+}
+
+
+static nlohmann::json report(const std::vector<StageSamples>& stages, size_t n_triangles, unsigned int width, unsigned int height)
+{
+    nlohmann::json result;
+    std::vector<double> frame(stages[0].ms.size(), 0.0);
+    for (const auto& stage : stages)
+    {
+        result["stages"][stage.name] = summarize(stage.ms);
+        for (size_t i = 0; i < frame.size(); i++)
+            frame[i] += stage.ms[i];
+    }
+
+    nlohmann::json frame_summary = summarize(frame);
+    double seconds = frame_summary["mean_ms"].get<double>() / 1000.0;
+    result["frame"] = frame_summary;
+    result["throughput"]["frames_per_s"] = 1.0 / seconds;
+    result["throughput"]["mtriangles_per_s"] = n_triangles / seconds / 1e6;
+    result["throughput"]["mpixels_per_s"] = (double)width * height / seconds / 1e6;
+    return result;
+}
+
+
+// GL state shared by all configurations of the gl backend
+struct GLBackend
+{
+    OpenGL::EGL eglContext;
+    OpenGL::ShaderProgram program;
+    OpenGL::Transformation transformation;
+    OpenGL::UniformBuffer<OpenGL::LightingBlock> lighting;
+    OpenGL::UniformBuffer<OpenGL::ShadingBlock> shading;
+    GLint position_loc, normal_loc, color_loc, uv_loc, mask_loc;
+
+    int Init(int device_id)
+    {
+        try
+        {
+            if (!eglContext.Init(64, 64, device_id))
+                return -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+
+        std::string vertex_src, geometry_src, fragment_src;
+        if (!OpenGL::Shader::ReadShaderSource("basic.vs", {}, vertex_src) ||
+            !OpenGL::Shader::ReadShaderSource("basic.gs", {}, geometry_src) ||
+            !OpenGL::Shader::ReadShaderSource("basic.fs", {}, fragment_src))
+        {
+            std::cout << "ERROR: reading shader sources failed" << std::endl;
+            return -1;
+        }
+        if (program.Begin(vertex_src, geometry_src, fragment_src) < 0 || program.Finish() < 0)
+        {
+            std::cout << "ERROR: initializing shader program failed" << std::endl;
+            return -1;
+        }
+        position_loc = program.GetAttribLocation("in_position");
+        normal_loc = program.GetAttribLocation("in_normal");
+        color_loc = program.GetAttribLocation("in_color");
+        uv_loc = program.GetAttribLocation("in_uv");
+        mask_loc = program.GetAttribLocation("in_mask");
+
+        transformation.Init();
+        lighting.Init(OpenGL::LIGHTING_BINDING);
+        shading.Init(OpenGL::SHADING_BINDING);
+        return 1;
+    }
+
+    void Terminate()
+    {
+        shading.Terminate();
+        lighting.Terminate();
+        transformation.Terminate();
+        program.Terminate();
+        eglContext.Terminate();
+    }
+};
+
+
+static void run_gl(GLBackend& gl, std::vector<OpenGL::Vertex>& vertices, std::vector<unsigned int>& indices, const Options& options,
+                   nlohmann::json& results)
+{
+    unsigned int n_faces = indices.size() / 3;
+    OpenGL::Mesh mesh;
+    mesh.Init(vertices.data(), vertices.size(), indices.data(), n_faces);
+
+    for (const auto& resolution : options.resolutions)
+    {
+        for (const auto& set : options.outputs)
+        {
+            unsigned int width = resolution.first, height = resolution.second;
+            unsigned int outputs = parse_outputs(set);
+            std::cout << "gl: " << n_faces << " triangles, " << width << "x" << height << ", " << set << std::endl;
+
+            OpenGL::RenderTarget renderTarget;
+            if (renderTarget.Init(width, height, outputs) < 0)
+            {
+                renderTarget.Terminate();
+                continue;
+            }
+
+            // caller-owned copies of the maps, on the device of the render target buffers
+            float* copies[6] = {};
+            size_t sizes[6] = {};
+            for (int i = 0; i < 6; i++)
+            {
+                if (!renderTarget.HasOutput(i))
+                    continue;
+                sizes[i] = (size_t)width * height * OpenGL::RenderTarget::GetNumberOfChannels(i) * sizeof(float);
+                #ifndef NO_CUDA
+                checkCudaErrors(cudaMalloc((void**)&copies[i], sizes[i]));
+                #else
+                copies[i] = new float[sizes[i] / sizeof(float)];
+                #endif
+            }
+
+            gl.transformation.SetPinholeZeroOpticalCenterProjection(width, width, width / 2.0f, height / 2.0f, 0.1f, 10.0f, width, height);
+
+            std::vector<StageSamples> stages = {{"upload", {}}, {"draw", {}}, {"readback", {}}};
+            Stopwatch watch;
+            for (unsigned int frame = 0; frame < options.warmup + options.frames; frame++)
+            {
+                watch.Start();
+                mesh.Update(vertices.data(), vertices.size());
+                glFinish();
+                double upload = watch.Stop();
+
+                watch.Start();
+                renderTarget.Use();
+                renderTarget.Clear();
+                gl.program.Use();
+                OpenGL::mat4 modelview = sphere_modelview(frame);
+                gl.transformation.SetModelView(modelview);
+                gl.transformation.Use();
+                gl.lighting.Bind();
+                gl.shading.Bind();
+                mesh.Render(gl.position_loc, gl.normal_loc, gl.color_loc, gl.uv_loc, gl.mask_loc);
+                glFinish();
+                double draw = watch.Stop();
+
+                watch.Start();
+                renderTarget.CopyRenderedTexturesToCUDA(false, copies);
+                #ifndef NO_CUDA
+                checkCudaErrors(cudaDeviceSynchronize());
+                #endif
+                double readback = watch.Stop();
+
+                if (frame >= options.warmup)
+                {
+                    stages[0].ms.push_back(upload);
+                    stages[1].ms.push_back(draw);
+                    stages[2].ms.push_back(readback);
+                }
+            }
+
+            for (int i = 0; i < 6; i++)
+            {
+                #ifndef NO_CUDA
+                if (copies[i])
+                    cudaFree(copies[i]);
+                #else
+                delete[] copies[i];
+                #endif
+            }
+            renderTarget.Terminate();
+
+            nlohmann::json result = report(stages, n_faces, width, height);
+            result["backend"] = "gl";
+            result["triangles"] = n_faces;
+            result["vertices"] = vertices.size();
+            result["width"] = width;
+            result["height"] = height;
+            result["outputs"] = set;
+            results.push_back(result);
+        }
+    }
+
+    mesh.Terminate();
+}
+
+
+static void run_software(SoftwareRasterizer& rasterizer, const std::vector<OpenGL::Vertex>& vertices, const std::vector<unsigned int>& indices, const Options& options,
+                         nlohmann::json& results)
+{
+    unsigned int n_faces = indices.size() / 3;
+    OpenGL::LightingBlock lighting;
+    OpenGL::Transformation transformation;
+
+    // like Forward, the vertices are copied into a contiguous host buffer every frame
+    std::vector<OpenGL::Vertex> staged(vertices.size());
+    std::vector<unsigned int> staged_indices(indices.size());
+
+    for (const auto& resolution : options.resolutions)
+    {
+        for (const auto& set : options.outputs)
+        {
+            unsigned int width = resolution.first, height = resolution.second;
+            unsigned int outputs = parse_outputs(set);
+            std::cout << "software: " << n_faces << " triangles, " << width << "x" << height << ", " << set << std::endl;
+
+            std::vector<std::vector<float>> maps(6), copies(6);
+            float* buffers[6] = {};
+            for (int i = 0; i < 6; i++)
+            {
+                if (!(outputs & (1 << i)))
+                    continue;
+                maps[i].resize((size_t)width * height * OpenGL::RenderTarget::GetNumberOfChannels(i));
+                copies[i].resize(maps[i].size());
+                buffers[i] = maps[i].data();
+            }
+
+            transformation.SetPinholeZeroOpticalCenterProjection(width, width, width / 2.0f, height / 2.0f, 0.1f, 10.0f, width, height);
+
+            std::vector<StageSamples> stages = {{"upload", {}}, {"draw", {}}, {"wrap", {}}};
+            Stopwatch watch;
+            for (unsigned int frame = 0; frame < options.warmup + options.frames; frame++)
+            {
+                watch.Start();
+                std::memcpy(staged.data(), vertices.data(), vertices.size() * sizeof(OpenGL::Vertex));
+                std::memcpy(staged_indices.data(), indices.data(), indices.size() * sizeof(unsigned int));
+                double upload = watch.Stop();
+
+                watch.Start();
+                OpenGL::mat4 modelview = sphere_modelview(frame);
+                rasterizer.Render(staged.data(), staged.size(), staged_indices.data(), n_faces,
+                                  transformation.projection, modelview, width, height,
+                                  OpenGL::ShadingBlock::PER_FACE_NORMAL, lighting, false, buffers);
+                double draw = watch.Stop();
+
+                watch.Start();
+                for (int i = 0; i < 6; i++)
+                {
+                    if (buffers[i])
+                        std::memcpy(copies[i].data(), maps[i].data(), maps[i].size() * sizeof(float));
+                }
+                double wrap = watch.Stop();
+
+                if (frame >= options.warmup)
+                {
+                    stages[0].ms.push_back(upload);
+                    stages[1].ms.push_back(draw);
+                    stages[2].ms.push_back(wrap);
+                }
+            }
+
+            nlohmann::json result = report(stages, n_faces, width, height);
+            result["backend"] = "software";
+            result["triangles"] = n_faces;
+            result["vertices"] = vertices.size();
+            result["width"] = width;
+            result["height"] = height;
+            result["outputs"] = set;
+            results.push_back(result);
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int status = parse_options(argc, argv, options);
+    if (status <= 0)
+        return status < 0 ? 1 : 0;
+
+    for (const auto& set : options.outputs)
+    {
+        if (parse_outputs(set) == 0)
+        {
+            std::cout << "ERROR: unknown output set " << set << std::endl;
+            return 1;
+        }
+    }
+
+    bool use_gl = std::find(options.backends.begin(), options.backends.end(), "gl") != options.backends.end();
+    bool use_software = std::find(options.backends.begin(), options.backends.end(), "software") != options.backends.end();
+    if (!use_gl && !use_software)
+    {
+        std::cout << "ERROR: no backend selected, use gl and/or software" << std::endl;
+        return 1;
+    }
+
+    nlohmann::json output;
+    #ifdef NO_CUDA
+    output["build"]["cuda"] = false;
+    #else
+    output["build"]["cuda"] = true;
+    #endif
+    output["frames"] = options.frames;
+    output["warmup"] = options.warmup;
+    output["cpu_threads"] = std::thread::hardware_concurrency();
+    output["results"] = nlohmann::json::array();
+
+    GLBackend gl;
+    if (use_gl)
+    {
+        if (gl.Init(options.device_id) < 0)
+        {
+            std::cout << "WARNING: initializing EGL/GL failed, skipping the gl backend" << std::endl;
+            use_gl = false;
+        }
+        else
+        {
+            output["gl"]["vendor"] = (const char*)glGetString(GL_VENDOR);
+            output["gl"]["renderer"] = (const char*)glGetString(GL_RENDERER);
+            output["gl"]["version"] = (const char*)glGetString(GL_VERSION);
+        }
+    }
+
+    SoftwareRasterizer rasterizer;
+    std::vector<OpenGL::Vertex> vertices;
+    std::vector<unsigned int> indices;
+    for (unsigned int n_triangles : options.triangles)
+    {
+        make_sphere(n_triangles, vertices, indices);
+        if (use_gl)
+            run_gl(gl, vertices, indices, options, output["results"]);
+        if (use_software)
+            run_software(rasterizer, vertices, indices, options, output["results"]);
+    }
+
+    if (use_gl)
+        gl.Terminate();
+
+    std::ofstream file(options.filename);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: unable to write " << options.filename << std::endl;
+        return 1;
+    }
+    file << output.dump(2) << std::endl;
+    std::cout << "Results written to " << options.filename << std::endl;
+    return 0;
+}
@@ -0,0 +1,638 @@
+#include "mesh_loader.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <sys/stat.h>
+
+#include "deps/json.h"
+#include "deps/path.h"
+
+
+namespace
+{
+
+const uint32_t GLB_MAGIC = 0x46546C67;      // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A; // "JSON"
+const uint32_t GLB_CHUNK_BIN = 0x004E4942;  // "BIN\0"
+
+// vertices and triangles of a primitive are converted in blocks of this size
+const size_t BLOCK_SIZE = 1 << 16;
+
+const int GLTF_TRIANGLES = 4;
+const int GLTF_BYTE = 5120;
+const int GLTF_UNSIGNED_BYTE = 5121;
+const int GLTF_SHORT = 5122;
+const int GLTF_UNSIGNED_SHORT = 5123;
+const int GLTF_UNSIGNED_INT = 5125;
+const int GLTF_FLOAT = 5126;
+
+struct GlbFile
+{
+    std::shared_ptr<MappedFile> file;
+    nlohmann::json json;
+    const char* bin = nullptr;
+    size_t bin_size = 0;
+};
+
+// member of a JSON object by reference, an empty array or object if it is missing
+const nlohmann::json& member(const nlohmann::json& json, const char* key, bool object = false)
+{
+    static const nlohmann::json empty_array = nlohmann::json::array();
+    static const nlohmann::json empty_object = nlohmann::json::object();
+    auto it = json.find(key);
+    if (it != json.end())
+        return *it;
+    return object ? empty_object : empty_array;
+}
+
+inline uint32_t read_u32(const char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+int open_glb(const std::string& filename, GlbFile& glb)
+{
+    glb.file = std::make_shared<MappedFile>();
+    if (glb.file->Open(filename) < 0)
+        return -1;
+
+    const char* data = glb.file->GetData();
+    size_t size = glb.file->GetSize();
+    if (size < 20 || read_u32(data) != GLB_MAGIC || read_u32(data + 4) != 2)
+    {
+        std::cout << "ERROR: " << filename << " is not a glTF 2.0 binary file" << std::endl;
+        return -1;
+    }
+
+    // JSON chunk first, then an optional binary chunk
+    size_t offset = 12;
+    uint32_t json_length = read_u32(data + offset);
+    if (read_u32(data + offset + 4) != GLB_CHUNK_JSON || json_length > size - offset - 8)
+    {
+        std::cout << "ERROR: " << filename << " has no JSON chunk" << std::endl;
+        return -1;
+    }
+    const char* json = data + offset + 8;
+    glb.json = nlohmann::json::parse(json, json + json_length, nullptr, false);
+    if (glb.json.is_discarded() || !glb.json.is_object())
+    {
+        std::cout << "ERROR: " << filename << " has a malformed JSON chunk" << std::endl;
+        return -1;
+    }
+    offset += 8 + ((json_length + 3) & ~3u);
+
+    if (offset + 8 <= size && read_u32(data + offset + 4) == GLB_CHUNK_BIN)
+    {
+        glb.bin = data + offset + 8;
+        glb.bin_size = std::min<size_t>(read_u32(data + offset), size - offset - 8);
+    }
+    return 1;
+}
+
+// elements of an accessor in the binary chunk
+struct Accessor
+{
+    const char* data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int component_type = 0;
+    int n_components = 0;
+    bool normalized = false;
+};
+
+int component_size(int component_type)
+{
+    switch (component_type)
+    {
+    case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: return 1;
+    case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: return 2;
+    case GLTF_UNSIGNED_INT: case GLTF_FLOAT: return 4;
+    default: return 0;
+    }
+}
+
+int type_components(const std::string& type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+// bufferView of the accessor in the binary chunk, sparse accessors and external buffers are not supported
+bool get_buffer_view(const GlbFile& glb, size_t index, const char*& data, size_t& size, size_t& stride)
+{
+    const auto& views = member(glb.json, "bufferViews");
+    if (index >= views.size())
+        return false;
+    const auto& view = views[index];
+    size_t buffer = view.value("buffer", 0);
+    const auto& buffers = member(glb.json, "buffers");
+    if (buffer != 0 || buffers.empty() || buffers[0].contains("uri") || !glb.bin)
+        return false;
+
+    size_t offset = view.value("byteOffset", (size_t)0);
+    size = view.value("byteLength", (size_t)0);
+    stride = view.value("byteStride", (size_t)0);
+    if (offset > glb.bin_size || size > glb.bin_size - offset)
+        return false;
+    data = glb.bin + offset;
+    return true;
+}
+
+bool get_accessor(const GlbFile& glb, int index, Accessor& accessor)
+{
+    const auto& accessors = member(glb.json, "accessors");
+    if (index < 0 || (size_t)index >= accessors.size())
+        return false;
+    const auto& json = accessors[index];
+    if (!json.contains("bufferView") || json.contains("sparse"))
+        return false;
+
+    accessor.count = json.value("count", (size_t)0);
+    accessor.component_type = json.value("componentType", 0);
+    accessor.n_components = type_components(json.value("type", std::string()));
+    accessor.normalized = json.value("normalized", false);
+    size_t element_size = component_size(accessor.component_type) * accessor.n_components;
+    if (element_size == 0)
+        return false;
+
+    const char* view_data;
+    size_t view_size, view_stride;
+    if (!get_buffer_view(glb, json["bufferView"].get<size_t>(), view_data, view_size, view_stride))
+        return false;
+
+    size_t offset = json.value("byteOffset", (size_t)0);
+    accessor.stride = view_stride > 0 ? view_stride : element_size;
+    accessor.data = view_data + offset;
+    return accessor.count == 0 ||
+           (offset <= view_size && (accessor.count - 1) * accessor.stride + element_size <= view_size - offset);
+}
+
+// component k of element i, normalized integers are mapped to [0, 1] or [-1, 1]
+inline float read_float(const Accessor& accessor, size_t i, int k)
+{
+    const char* p = accessor.data + i * accessor.stride;
+    switch (accessor.component_type)
+    {
+    case GLTF_FLOAT: { float v; memcpy(&v, p + 4 * k, 4); return v; }
+    case GLTF_UNSIGNED_BYTE: { uint8_t v; memcpy(&v, p + k, 1); return accessor.normalized ? v / 255.0f : v; }
+    case GLTF_BYTE: { int8_t v; memcpy(&v, p + k, 1); return accessor.normalized ? std::max(v / 127.0f, -1.0f) : v; }
+    case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p + 2 * k, 2); return accessor.normalized ? v / 65535.0f : v; }
+    case GLTF_SHORT: { int16_t v; memcpy(&v, p + 2 * k, 2); return accessor.normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+    case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, p + 4 * k, 4); return (float)v; }
+    }
+    return 0.0f;
+}
+
+inline uint32_t read_index(const Accessor& accessor, size_t i)
+{
+    const char* p = accessor.data + i * accessor.stride;
+    switch (accessor.component_type)
+    {
+    case GLTF_UNSIGNED_BYTE: return (uint8_t)*p;
+    case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case GLTF_UNSIGNED_INT: return read_u32(p);
+    }
+    return std::numeric_limits<uint32_t>::max();
+}
+
+// column major 4x4 matrices as in glTF
+struct Matrix
+{
+    float m[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+    Matrix operator*(const Matrix& o) const
+    {
+        Matrix r;
+        for (int col = 0; col < 4; col++)
+            for (int row = 0; row < 4; row++)
+            {
+                float sum = 0.0f;
+                for (int k = 0; k < 4; k++)
+                    sum += m[k * 4 + row] * o.m[col * 4 + k];
+                r.m[col * 4 + row] = sum;
+            }
+        return r;
+    }
+};
+
+// local transform of a node, either its matrix or T * R * S
+Matrix node_matrix(const nlohmann::json& node)
+{
+    Matrix result;
+    if (node.contains("matrix") && node["matrix"].size() == 16)
+    {
+        for (int i = 0; i < 16; i++)
+            result.m[i] = node["matrix"][i].get<float>();
+        return result;
+    }
+
+    float t[3] = {0, 0, 0}, r[4] = {0, 0, 0, 1}, s[3] = {1, 1, 1};
+    if (node.contains("translation"))
+        for (int i = 0; i < 3; i++) t[i] = node["translation"][i].get<float>();
+    if (node.contains("rotation"))
+        for (int i = 0; i < 4; i++) r[i] = node["rotation"][i].get<float>();
+    if (node.contains("scale"))
+        for (int i = 0; i < 3; i++) s[i] = node["scale"][i].get<float>();
+
+    // quaternion (x, y, z, w) to a rotation matrix
+    float x = r[0], y = r[1], z = r[2], w = r[3];
+    float rotation[9] = {
+        1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+        2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+        2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y),
+    };
+    for (int col = 0; col < 3; col++)
+        for (int row = 0; row < 3; row++)
+            result.m[col * 4 + row] = rotation[col * 3 + row] * s[col];
+    result.m[12] = t[0];
+    result.m[13] = t[1];
+    result.m[14] = t[2];
+    return result;
+}
+
+struct Instance
+{
+    size_t mesh;
+    Matrix matrix;
+};
+
+// meshes of the nodes of the default scene with their world transform, all
+// meshes untransformed if the file has no scene
+std::vector<Instance> collect_instances(const nlohmann::json& json)
+{
+    std::vector<Instance> instances;
+    const auto& nodes = member(json, "nodes");
+    const auto& scenes = member(json, "scenes");
+    if (scenes.empty() || nodes.empty())
+    {
+        size_t n_meshes = member(json, "meshes").size();
+        for (size_t i = 0; i < n_meshes; i++)
+            instances.push_back({i, Matrix()});
+        return instances;
+    }
+
+    size_t scene = json.value("scene", (size_t)0);
+    if (scene >= scenes.size())
+        scene = 0;
+
+    // nodes on the current path are skipped, malformed files may have cycles
+    std::vector<bool> visiting(nodes.size(), false);
+    std::function<void(size_t, const Matrix&)> visit = [&](size_t index, const Matrix& parent)
+    {
+        if (index >= nodes.size() || visiting[index])
+            return;
+        visiting[index] = true;
+        const auto& node = nodes[index];
+        Matrix world = parent * node_matrix(node);
+        if (node.contains("mesh"))
+            instances.push_back({node["mesh"].get<size_t>(), world});
+        for (const auto& child : member(node, "children"))
+            visit(child.get<size_t>(), world);
+        visiting[index] = false;
+    };
+    for (const auto& root : member(scenes[scene], "nodes"))
+        visit(root.get<size_t>(), Matrix());
+    return instances;
+}
+
+struct Primitive
+{
+    Accessor positions, normals, texcoords, colors, indices;
+    bool has_normals = false, has_texcoords = false, has_colors = false, has_indices = false;
+    const Matrix* matrix;
+    float normal_matrix[9]; // cofactors of the upper 3x3, normals are normalized after it
+    bool flip_winding = false;
+    size_t vertex_offset = 0, n_vertices = 0;
+    size_t triangle_offset = 0, n_triangles = 0;
+    unsigned int material_id = 0;
+};
+
+void set_normal_matrix(Primitive& primitive)
+{
+    const float* m = primitive.matrix->m;
+    auto a = [m](int row, int col) { return m[col * 4 + row]; };
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 3; col++)
+        {
+            int r0 = (row + 1) % 3, r1 = (row + 2) % 3, c0 = (col + 1) % 3, c1 = (col + 2) % 3;
+            primitive.normal_matrix[row * 3 + col] = a(r0, c0) * a(r1, c1) - a(r0, c1) * a(r1, c0);
+        }
+    }
+    float det = a(0, 0) * primitive.normal_matrix[0] + a(0, 1) * primitive.normal_matrix[1] + a(0, 2) * primitive.normal_matrix[2];
+    primitive.flip_winding = det < 0.0f;
+    if (primitive.flip_winding)
+        for (float& v : primitive.normal_matrix)
+            v = -v;
+}
+
+struct Block
+{
+    size_t primitive;
+    bool triangles;
+    size_t begin, end;
+};
+
+int load_glb(const GlbFile& glb, const std::string& filename, MeshData& mesh, float scale)
+{
+    for (const auto& extension : member(glb.json, "extensionsRequired"))
+    {
+        std::cout << "ERROR: " << filename << " requires the unsupported extension " << extension.get<std::string>() << std::endl;
+        return -1;
+    }
+
+    // offsets of the primitives in the arrays of the whole mesh
+    std::vector<Instance> instances = collect_instances(glb.json);
+    const auto& meshes = member(glb.json, "meshes");
+    size_t n_materials = member(glb.json, "materials").size();
+    std::vector<Primitive> primitives;
+    size_t n_vertices = 0, n_triangles = 0;
+    bool all_normals = true, any_texcoords = false, any_colors = false;
+    for (const auto& instance : instances)
+    {
+        if (instance.mesh >= meshes.size())
+            continue;
+        for (const auto& json : member(meshes[instance.mesh], "primitives"))
+        {
+            if (json.value("mode", GLTF_TRIANGLES) != GLTF_TRIANGLES)
+            {
+                std::cout << "WARNING: skipping a primitive of " << filename << " that is not a triangle list" << std::endl;
+                continue;
+            }
+
+            Primitive primitive;
+            const auto& attributes = member(json, "attributes", true);
+            if (!attributes.contains("POSITION") || !get_accessor(glb, attributes["POSITION"].get<int>(), primitive.positions) ||
+                primitive.positions.n_components != 3)
+            {
+                std::cout << "ERROR: " << filename << " has a primitive without valid positions" << std::endl;
+                return -1;
+            }
+
+            auto optional = [&](const char* name, Accessor& accessor, int min_components, int max_components)
+            {
+                return attributes.contains(name) && get_accessor(glb, attributes[name].get<int>(), accessor) &&
+                       accessor.count == primitive.positions.count &&
+                       accessor.n_components >= min_components && accessor.n_components <= max_components;
+            };
+            primitive.has_normals = optional("NORMAL", primitive.normals, 3, 3);
+            primitive.has_texcoords = optional("TEXCOORD_0", primitive.texcoords, 2, 2);
+            primitive.has_colors = optional("COLOR_0", primitive.colors, 3, 4);
+
+            if (json.contains("indices"))
+            {
+                primitive.has_indices = get_accessor(glb, json["indices"].get<int>(), primitive.indices);
+                if (!primitive.has_indices || primitive.indices.n_components != 1 || component_size(primitive.indices.component_type) == 0 ||
+                    primitive.indices.component_type == GLTF_FLOAT)
+                {
+                    std::cout << "ERROR: " << filename << " has a primitive with invalid indices" << std::endl;
+                    return -1;
+                }
+            }
+
+            int material = json.value("material", -1);
+            primitive.material_id = material >= 0 && (size_t)material < n_materials ? material : 0;
+            primitive.matrix = &instance.matrix;
+            set_normal_matrix(primitive);
+            primitive.vertex_offset = n_vertices;
+            primitive.n_vertices = primitive.positions.count;
+            primitive.triangle_offset = n_triangles;
+            primitive.n_triangles = (primitive.has_indices ? primitive.indices.count : primitive.n_vertices) / 3;
+
+            n_vertices += primitive.n_vertices;
+            n_triangles += primitive.n_triangles;
+            all_normals = all_normals && primitive.has_normals;
+            any_texcoords = any_texcoords || primitive.has_texcoords;
+            any_colors = any_colors || primitive.has_colors;
+            primitives.push_back(primitive);
+        }
+    }
+
+    if (n_vertices == 0 || n_triangles == 0)
+    {
+        std::cout << "ERROR: " << filename << " has no vertices or faces" << std::endl;
+        return -1;
+    }
+    if (n_vertices > (size_t)std::numeric_limits<unsigned int>::max() || 3 * n_triangles > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+        return -1;
+    }
+
+    // accessors are read in place from the mapping into the final arrays
+    std::vector<Block> blocks;
+    for (size_t i = 0; i < primitives.size(); i++)
+    {
+        for (size_t begin = 0; begin < primitives[i].n_vertices; begin += BLOCK_SIZE)
+            blocks.push_back({i, false, begin, std::min(primitives[i].n_vertices, begin + BLOCK_SIZE)});
+        for (size_t begin = 0; begin < primitives[i].n_triangles; begin += BLOCK_SIZE)
+            blocks.push_back({i, true, begin, std::min(primitives[i].n_triangles, begin + BLOCK_SIZE)});
+    }
+
+    mesh.vertices.resize(n_vertices);
+    mesh.indices.resize(3 * n_triangles);
+    mesh.material_ids.clear();
+    if (n_materials > 0)
+        mesh.material_ids.resize(n_triangles);
+
+    std::atomic<bool> valid(true);
+    MeshLoader::ParallelFor(blocks.size(), [&](size_t b)
+    {
+        const Block& block = blocks[b];
+        const Primitive& primitive = primitives[block.primitive];
+        const float* m = primitive.matrix->m;
+        const float* n = primitive.normal_matrix;
+
+        if (block.triangles)
+        {
+            unsigned int* indices = mesh.indices.data() + 3 * (primitive.triangle_offset + block.begin);
+            for (size_t i = block.begin; i < block.end; i++, indices += 3)
+            {
+                for (int k = 0; k < 3; k++)
+                {
+                    // the winding is kept under mirroring transforms
+                    int corner = primitive.flip_winding && k > 0 ? 3 - k : k;
+                    size_t index = primitive.has_indices ? read_index(primitive.indices, 3 * i + corner) : 3 * i + corner;
+                    if (index >= primitive.n_vertices)
+                        valid = false;
+                    indices[k] = primitive.vertex_offset + index;
+                }
+            }
+            if (!mesh.material_ids.empty())
+                std::fill(mesh.material_ids.begin() + primitive.triangle_offset + block.begin,
+                          mesh.material_ids.begin() + primitive.triangle_offset + block.end, primitive.material_id);
+            return;
+        }
+
+        for (size_t i = block.begin; i < block.end; i++)
+        {
+            OpenGL::Vertex& v = mesh.vertices[primitive.vertex_offset + i];
+            v = OpenGL::Vertex();
+            v.b = 1.0f;
+
+            float x = read_float(primitive.positions, i, 0);
+            float y = read_float(primitive.positions, i, 1);
+            float z = read_float(primitive.positions, i, 2);
+            v.x = (m[0] * x + m[4] * y + m[8] * z + m[12]) * scale;
+            v.y = (m[1] * x + m[5] * y + m[9] * z + m[13]) * scale;
+            v.z = (m[2] * x + m[6] * y + m[10] * z + m[14]) * scale;
+
+            if (primitive.has_normals)
+            {
+                x = read_float(primitive.normals, i, 0);
+                y = read_float(primitive.normals, i, 1);
+                z = read_float(primitive.normals, i, 2);
+                v.nx = n[0] * x + n[1] * y + n[2] * z;
+                v.ny = n[3] * x + n[4] * y + n[5] * z;
+                v.nz = n[6] * x + n[7] * y + n[8] * z;
+                float length = std::sqrt(v.nx * v.nx + v.ny * v.ny + v.nz * v.nz);
+                if (length > 0.0f)
+                {
+                    v.nx /= length;
+                    v.ny /= length;
+                    v.nz /= length;
+                }
+            }
+
+            // glTF has v = 0 at the top of the image, the renderer at the bottom
+            if (primitive.has_texcoords)
+            {
+                v.u = read_float(primitive.texcoords, i, 0);
+                v.v = 1.0f - read_float(primitive.texcoords, i, 1);
+            }
+
+            if (primitive.has_colors)
+            {
+                v.r = read_float(primitive.colors, i, 0);
+                v.g = read_float(primitive.colors, i, 1);
+                v.b = read_float(primitive.colors, i, 2);
+                if (primitive.colors.n_components == 4)
+                    v.a = read_float(primitive.colors, i, 3);
+            }
+        }
+    });
+
+    if (!valid)
+    {
+        std::cout << "ERROR: " << filename << " has faces with invalid vertex indices" << std::endl;
+        return -1;
+    }
+
+    mesh.has_normals = all_normals;
+    mesh.has_uvs = any_texcoords;
+    mesh.has_colors = any_colors;
+    mesh.mtl_filename = n_materials > 0 ? filename : "";
+    return 1;
+}
+
+int load_glb_materials(const GlbFile& glb, const std::string& filename, std::vector<OpenGL::Material>& materials)
+{
+    const auto& json = glb.json;
+    const auto& textures = member(json, "textures");
+    const auto& images = member(json, "images");
+    path directory = path(filename).parent_path();
+
+    // images of an unchanged file are registered once, e.g. for every context of a pool
+    struct stat info;
+    long stamp = stat(filename.c_str(), &info) == 0 ? (long)info.st_mtim.tv_sec * 1000000000L + info.st_mtim.tv_nsec : 0;
+
+    materials.clear();
+    for (const auto& entry : member(json, "materials"))
+    {
+        OpenGL::Material material;
+        material.name = entry.value("name", "material" + std::to_string(materials.size()));
+
+        const auto& pbr = member(entry, "pbrMetallicRoughness", true);
+        if (pbr.contains("baseColorFactor") && pbr["baseColorFactor"].size() == 4)
+        {
+            const auto& factor = pbr["baseColorFactor"];
+            material.diffuse = OpenGL::vec4(factor[0].get<float>(), factor[1].get<float>(), factor[2].get<float>(), factor[3].get<float>());
+        }
+
+        size_t texture = pbr.contains("baseColorTexture") ? pbr["baseColorTexture"].value("index", (size_t)-1) : (size_t)-1;
+        size_t source = texture < textures.size() ? textures[texture].value("source", (size_t)-1) : (size_t)-1;
+        if (source < images.size())
+        {
+            const auto& image = images[source];
+            if (image.contains("bufferView"))
+            {
+                // embedded images stay in the mapping of the file and are
+                // decoded by the texture cache under this name
+                OpenGL::EmbeddedImage embedded;
+                const char* data;
+                size_t size, stride;
+                if (get_buffer_view(glb, image["bufferView"].get<size_t>(), data, size, stride))
+                {
+                    embedded.data = (const unsigned char*)data;
+                    embedded.size = size;
+                    embedded.stamp = stamp;
+                    embedded.owner = glb.file;
+                    material.diffuse_texture = filename + "#image" + std::to_string(source);
+                    material.texture_owner = OpenGL::AddEmbeddedImage(material.diffuse_texture, embedded).owner;
+                }
+            }
+            else if (image.contains("uri"))
+            {
+                std::string uri = image["uri"].get<std::string>();
+                if (uri.compare(0, 5, "data:") == 0)
+                    std::cout << "WARNING: data URIs of images in " << filename << " are not supported" << std::endl;
+                else
+                    material.diffuse_texture = (directory / uri).str();
+            }
+        }
+        materials.push_back(material);
+    }
+
+    return 1;
+}
+
+}
+
+
+int MeshLoader::LoadGlb(const std::string& filename, MeshData& mesh, float scale)
+{
+    TraceSpan trace("MeshLoader::LoadGlb", "io");
+
+    GlbFile glb;
+    if (open_glb(filename, glb) < 0)
+        return -1;
+
+    try
+    {
+        return load_glb(glb, filename, mesh, scale);
+    }
+    catch (nlohmann::json::exception& e)
+    {
+        std::cout << "ERROR: malformed glTF in " << filename << " " << e.what() << std::endl;
+        return -1;
+    }
+}
+
+
+int MeshLoader::LoadGlbMaterials(const std::string& filename, std::vector<OpenGL::Material>& materials)
+{
+    TraceSpan trace("MeshLoader::LoadGlbMaterials", "io");
+
+    GlbFile glb;
+    if (open_glb(filename, glb) < 0)
+        return -1;
+
+    try
+    {
+        return load_glb_materials(glb, filename, materials);
+    }
+    catch (nlohmann::json::exception& e)
+    {
+        std::cout << "ERROR: malformed glTF in " << filename << " " << e.what() << std::endl;
+        return -1;
+    }
+}
@@ -0,0 +1,238 @@
+#include "interpolate.h"
+
+#include <vector>
+#include <c10/cuda/CUDAGuard.h>
+
+
+void interpolate_forward_cpu(const float* attributes, const float* bary, const float* vids,
+                             int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                             float* output)
+{
+    at::parallel_for(0, n_pixels, 1024, [&](int64_t begin, int64_t end)
+    {
+        for (int64_t p = begin; p < end; p++)
+        {
+            float* __restrict__ out = output + p * n_features;
+            const float* ids = vids + p * vids_channels;
+            const float* w = bary + p * bary_channels;
+
+            // a corner outside of the attributes only drops its weight
+            const float* __restrict__ a[3];
+            float weights[3];
+            for (int k = 0; k < 3; k++)
+            {
+                int64_t v = (int64_t)ids[k];
+                bool valid = ids[0] >= 0.0f && v >= 0 && v < n_vertices;
+                a[k] = attributes + (valid ? v : 0) * n_features;
+                weights[k] = valid ? w[k] : 0.0f;
+            }
+
+            if (weights[0] == 0.0f && weights[1] == 0.0f && weights[2] == 0.0f)
+            {
+                for (int64_t f = 0; f < n_features; f++)
+                    out[f] = 0.0f;
+                continue;
+            }
+
+            // contiguous rows, vectorized by the compiler
+            const float* __restrict__ a0 = a[0];
+            const float* __restrict__ a1 = a[1];
+            const float* __restrict__ a2 = a[2];
+            for (int64_t f = 0; f < n_features; f++)
+                out[f] = weights[0] * a0[f] + weights[1] * a1[f] + weights[2] * a2[f];
+        }
+    });
+}
+
+
+void interpolate_backward_cpu(const float* grad_output, const float* attributes, const float* bary, const float* vids,
+                              int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                              float* grad_attributes, float* grad_bary)
+{
+    if (grad_attributes)
+    {
+        // Vertex -> contributions (pixel * 3 + corner), built with a counting
+        // sort, so the scatter runs in parallel over vertices without atomics and
+        // always sums in the same order.
+        std::vector<int64_t> offsets(n_vertices + 1, 0);
+        for (int64_t p = 0; p < n_pixels; p++)
+        {
+            const float* ids = vids + p * vids_channels;
+            if (ids[0] < 0.0f)
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                int64_t v = (int64_t)ids[k];
+                if (v >= 0 && v < n_vertices)
+                    offsets[v + 1]++;
+            }
+        }
+        for (int64_t v = 0; v < n_vertices; v++)
+            offsets[v + 1] += offsets[v];
+
+        std::vector<int64_t> contributions(offsets[n_vertices]);
+        std::vector<int64_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (int64_t p = 0; p < n_pixels; p++)
+        {
+            const float* ids = vids + p * vids_channels;
+            if (ids[0] < 0.0f)
+                continue;
+            for (int k = 0; k < 3; k++)
+            {
+                int64_t v = (int64_t)ids[k];
+                if (v >= 0 && v < n_vertices)
+                    contributions[cursor[v]++] = 3 * p + k;
+            }
+        }
+
+        at::parallel_for(0, n_vertices, 1024, [&](int64_t begin, int64_t end)
+        {
+            for (int64_t v = begin; v < end; v++)
+            {
+                float* grad = grad_attributes + v * n_features;
+                for (int64_t i = offsets[v]; i < offsets[v + 1]; i++)
+                {
+                    int64_t p = contributions[i] / 3;
+                    float w = bary[p * bary_channels + contributions[i] % 3];
+                    const float* g = grad_output + p * n_features;
+                    for (int64_t f = 0; f < n_features; f++)
+                        grad[f] += w * g[f];
+                }
+            }
+        });
+    }
+
+    if (!grad_bary)
+        return;
+
+    at::parallel_for(0, n_pixels, 4096, [&](int64_t begin, int64_t end)
+    {
+        for (int64_t p = begin; p < end; p++)
+        {
+            const float* ids = vids + p * vids_channels;
+            const float* g = grad_output + p * n_features;
+            for (int k = 0; k < 3; k++)
+            {
+                int64_t v = (int64_t)ids[k];
+                float sum = 0.0f;
+                if (ids[0] >= 0.0f && v >= 0 && v < n_vertices)
+                {
+                    const float* a = attributes + v * n_features;
+                    for (int64_t f = 0; f < n_features; f++)
+                        sum += g[f] * a[f];
+                }
+                grad_bary[3 * p + k] = sum;
+            }
+        }
+    });
+}
+
+
+// flattens the leading dimensions of a map, keeping its channels
+static torch::Tensor flatten_map(const torch::Tensor& map)
+{
+    return map.reshape({-1, map.size(-1)}).contiguous();
+}
+
+
+class InterpolateFunction : public torch::autograd::Function<InterpolateFunction>
+{
+public:
+    static torch::Tensor forward(torch::autograd::AutogradContext* ctx, torch::Tensor attributes, torch::Tensor bary, torch::Tensor vids)
+    {
+        attributes = attributes.contiguous();
+        int64_t n_vertices = attributes.size(0);
+        int64_t n_features = attributes.size(1);
+        auto bary_flat = flatten_map(bary);
+        auto vids_flat = flatten_map(vids);
+        int64_t n_pixels = bary_flat.size(0);
+
+        // one pass over the maps, background pixels (vids of -1) are 0
+        auto output = torch::empty({n_pixels, n_features}, attributes.options());
+        if (attributes.is_cuda())
+        {
+            // the kernels run on the stream of the current device
+            c10::cuda::CUDAGuard device_guard(attributes.device());
+            interpolate_forward_cuda(attributes.data_ptr<float>(), bary_flat.data_ptr<float>(), vids_flat.data_ptr<float>(),
+                                     n_pixels, n_vertices, n_features, bary_flat.size(1), vids_flat.size(1),
+                                     output.data_ptr<float>());
+        }
+        else
+        {
+            interpolate_forward_cpu(attributes.data_ptr<float>(), bary_flat.data_ptr<float>(), vids_flat.data_ptr<float>(),
+                                    n_pixels, n_vertices, n_features, bary_flat.size(1), vids_flat.size(1),
+                                    output.data_ptr<float>());
+        }
+
+        // forward returns maps of their own (not views of the render target),
+        // so the saved maps are not overwritten by later renders and in-place
+        // changes are caught by their version counter
+        ctx->save_for_backward({attributes, bary_flat, vids_flat});
+        ctx->saved_data["bary_sizes"] = bary.sizes().vec();
+
+        auto sizes = bary.sizes().vec();
+        sizes.back() = n_features;
+        return output.view(sizes);
+    }
+
+    static torch::autograd::variable_list backward(torch::autograd::AutogradContext* ctx, torch::autograd::variable_list grad_outputs)
+    {
+        auto saved = ctx->get_saved_variables();
+        auto attributes = saved[0].contiguous();
+        auto bary = saved[1];
+        auto vids = saved[2];
+
+        int64_t n_vertices = attributes.size(0);
+        int64_t n_features = attributes.size(1);
+        int64_t n_pixels = bary.size(0);
+        auto grad_output = grad_outputs[0].reshape({n_pixels, n_features}).contiguous();
+
+        // the scatter into the vertices is skipped when only bary needs a gradient
+        torch::Tensor grad_attributes, grad_bary;
+        if (ctx->needs_input_grad(0))
+            grad_attributes = torch::zeros({n_vertices, n_features}, attributes.options());
+        if (ctx->needs_input_grad(1))
+            grad_bary = torch::zeros({n_pixels, 3}, bary.options());
+        if (!grad_attributes.defined() && !grad_bary.defined())
+            return {torch::Tensor(), torch::Tensor(), torch::Tensor()};
+        float* grad_attributes_ptr = grad_attributes.defined() ? grad_attributes.data_ptr<float>() : nullptr;
+        float* grad_bary_ptr = grad_bary.defined() ? grad_bary.data_ptr<float>() : nullptr;
+
+        if (attributes.is_cuda())
+        {
+            c10::cuda::CUDAGuard device_guard(attributes.device());
+            interpolate_backward_cuda(grad_output.data_ptr<float>(), attributes.data_ptr<float>(), bary.data_ptr<float>(), vids.data_ptr<float>(),
+                                      n_pixels, n_vertices, n_features, bary.size(1), vids.size(1),
+                                      grad_attributes_ptr, grad_bary_ptr);
+        }
+        else
+        {
+            interpolate_backward_cpu(grad_output.data_ptr<float>(), attributes.data_ptr<float>(), bary.data_ptr<float>(), vids.data_ptr<float>(),
+                                     n_pixels, n_vertices, n_features, bary.size(1), vids.size(1),
+                                     grad_attributes_ptr, grad_bary_ptr);
+        }
+
+        // the gradient of bary has the channels of the map, only the first three are used
+        if (grad_bary.defined())
+        {
+            auto full = torch::zeros({n_pixels, bary.size(1)}, bary.options());
+            full.narrow(1, 0, 3).copy_(grad_bary);
+            grad_bary = full.view(ctx->saved_data["bary_sizes"].toIntVector());
+        }
+
+        return {grad_attributes, grad_bary, torch::Tensor()};
+    }
+};
+
+
+torch::Tensor interpolate(torch::Tensor attributes, torch::Tensor bary, torch::Tensor vids)
+{
+    TORCH_CHECK(attributes.dim() == 2, "attributes have to be (V, F)");
+    TORCH_CHECK(attributes.scalar_type() == torch::kFloat32 && bary.scalar_type() == torch::kFloat32 && vids.scalar_type() == torch::kFloat32,
+                "attributes, bary and vids have to be float32");
+    TORCH_CHECK(bary.size(-1) >= 3 && vids.size(-1) >= 3, "bary and vids maps need at least 3 channels");
+    TORCH_CHECK(bary.sizes().vec() == vids.sizes().vec(), "bary and vids maps have to be of the same size");
+    TORCH_CHECK(attributes.device() == bary.device() && attributes.device() == vids.device(), "attributes, bary and vids have to be on the same device");
+
+    return InterpolateFunction::apply(attributes, bary, vids);
+}
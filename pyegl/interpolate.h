@@ -0,0 +1,34 @@
+#ifndef INTERPOLATE_H
+#define INTERPOLATE_H
+
+#include <torch/extension.h>
+
+
+// Interpolates per-vertex attributes (V, F) at every pixel of the rendered
+// bary and vids maps (..., C >= 3) and returns (..., F). Pixels whose first
+// vertex id is negative are background (RenderTarget clears to -1) and get 0.
+// Differentiable w.r.t. attributes and bary.
+torch::Tensor interpolate(torch::Tensor attributes, torch::Tensor bary, torch::Tensor vids);
+
+
+// Raw kernels on contiguous float data: n_pixels pixels with bary_channels and
+// vids_channels values each, of which the first three are used.
+// The forward writes every value of output (n_pixels, F).
+void interpolate_forward_cpu(const float* attributes, const float* bary, const float* vids,
+                             int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                             float* output);
+
+void interpolate_forward_cuda(const float* attributes, const float* bary, const float* vids,
+                              int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                              float* output);
+
+// grad_attributes (V, F) has to be zeroed, either gradient may be null to skip it.
+void interpolate_backward_cpu(const float* grad_output, const float* attributes, const float* bary, const float* vids,
+                              int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                              float* grad_attributes, float* grad_bary);
+
+void interpolate_backward_cuda(const float* grad_output, const float* attributes, const float* bary, const float* vids,
+                               int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                               float* grad_attributes, float* grad_bary);
+
+#endif
@@ -0,0 +1,121 @@
+#include <ATen/cuda/CUDAContext.h>
+
+#include "interpolate.h"
+
+
+// one thread per (pixel, feature), threads of a pixel share its bary and vids
+// reads through the cache and write consecutive values
+__global__ void interpolate_forward_kernel(const float* __restrict__ attributes, const float* __restrict__ bary, const float* __restrict__ vids,
+                                           int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                                           float* __restrict__ output)
+{
+    int64_t i = (int64_t)blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n_pixels * n_features)
+        return;
+
+    int64_t p = i / n_features;
+    int64_t f = i % n_features;
+    const float* ids = vids + p * vids_channels;
+
+    float sum = 0.0f;
+    if (ids[0] >= 0.0f)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            int64_t v = (int64_t)ids[k];
+            if (v >= 0 && v < n_vertices)
+                sum += bary[p * bary_channels + k] * attributes[v * n_features + f];
+        }
+    }
+    output[i] = sum;
+}
+
+
+void interpolate_forward_cuda(const float* attributes, const float* bary, const float* vids,
+                              int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                              float* output)
+{
+    const int threads = 256;
+    int64_t n = n_pixels * n_features;
+    if (n == 0)
+        return;
+
+    interpolate_forward_kernel<<<(n + threads - 1) / threads, threads, 0, at::cuda::getCurrentCUDAStream()>>>(
+        attributes, bary, vids, n_pixels, n_vertices, n_features, bary_channels, vids_channels, output);
+    C10_CUDA_KERNEL_LAUNCH_CHECK();
+}
+
+
+// one thread per (pixel, feature), corners of a pixel usually hit different
+// vertices, so the atomics rarely collide
+__global__ void interpolate_backward_attributes_kernel(const float* __restrict__ grad_output, const float* __restrict__ bary, const float* __restrict__ vids,
+                                                       int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                                                       float* __restrict__ grad_attributes)
+{
+    int64_t i = (int64_t)blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n_pixels * n_features)
+        return;
+
+    int64_t p = i / n_features;
+    int64_t f = i % n_features;
+    const float* ids = vids + p * vids_channels;
+    if (ids[0] < 0.0f)
+        return;
+
+    float g = grad_output[i];
+    for (int k = 0; k < 3; k++)
+    {
+        int64_t v = (int64_t)ids[k];
+        if (v >= 0 && v < n_vertices)
+            atomicAdd(&grad_attributes[v * n_features + f], bary[p * bary_channels + k] * g);
+    }
+}
+
+
+// one thread per (pixel, corner)
+__global__ void interpolate_backward_bary_kernel(const float* __restrict__ grad_output, const float* __restrict__ attributes, const float* __restrict__ vids,
+                                                 int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t vids_channels,
+                                                 float* __restrict__ grad_bary)
+{
+    int64_t i = (int64_t)blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= n_pixels * 3)
+        return;
+
+    int64_t p = i / 3;
+    const float* ids = vids + p * vids_channels;
+    int64_t v = (int64_t)ids[i % 3];
+
+    float sum = 0.0f;
+    if (ids[0] >= 0.0f && v >= 0 && v < n_vertices)
+    {
+        const float* g = grad_output + p * n_features;
+        const float* a = attributes + v * n_features;
+        for (int64_t f = 0; f < n_features; f++)
+            sum += g[f] * a[f];
+    }
+    grad_bary[i] = sum;
+}
+
+
+void interpolate_backward_cuda(const float* grad_output, const float* attributes, const float* bary, const float* vids,
+                               int64_t n_pixels, int64_t n_vertices, int64_t n_features, int64_t bary_channels, int64_t vids_channels,
+                               float* grad_attributes, float* grad_bary)
+{
+    const int threads = 256;
+    cudaStream_t stream = at::cuda::getCurrentCUDAStream();
+
+    int64_t n = n_pixels * n_features;
+    if (grad_attributes && n > 0)
+    {
+        interpolate_backward_attributes_kernel<<<(n + threads - 1) / threads, threads, 0, stream>>>(
+            grad_output, bary, vids, n_pixels, n_vertices, n_features, bary_channels, vids_channels, grad_attributes);
+    }
+
+    if (grad_bary && n_pixels > 0)
+    {
+        interpolate_backward_bary_kernel<<<(n_pixels * 3 + threads - 1) / threads, threads, 0, stream>>>(
+            grad_output, attributes, vids, n_pixels, n_vertices, n_features, vids_channels, grad_bary);
+    }
+
+    C10_CUDA_KERNEL_LAUNCH_CHECK();
+}
@@ -0,0 +1,398 @@
+#include "mesh_cache.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <climits>
+#include <limits>
+#include <algorithm>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deps/path.h"
+
+
+namespace
+{
+
+const char CACHE_MAGIC[8] = {'P', 'Y', 'E', 'G', 'L', 'M', 'S', 'H'};
+const uint32_t CACHE_VERSION = 1;
+const size_t SECTION_ALIGNMENT = 64;
+const size_t HASH_CHUNK_SIZE = 1 << 22;
+
+enum CacheFlags
+{
+    HAS_NORMALS = 1,
+    HAS_UVS = 2,
+    HAS_COLORS = 4,
+};
+
+// sections follow the header and the section table, aligned to SECTION_ALIGNMENT
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t vertex_size;
+    uint64_t source_size;
+    int64_t source_mtime; // ns
+    uint64_t source_hash;
+    float scale;
+    uint32_t flags;
+    float bounds_min[3];
+    float bounds_max[3];
+    uint64_t n_vertices;
+    uint64_t n_faces;
+    uint32_t n_sections;
+    uint32_t reserved;
+};
+
+struct CacheSection
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int stat_source(const std::string& filename, uint64_t& size, int64_t& mtime, ino_t* inode=nullptr)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return -1;
+    size = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    if (inode)
+        *inode = st.st_ino;
+    return 1;
+}
+
+// cache files are shared by every path to a source, the files they name are stored resolved
+std::string resolve_filename(const std::string& filename)
+{
+    char resolved[PATH_MAX];
+    if (realpath(filename.c_str(), resolved))
+        return resolved;
+
+    // a missing file is still resolved against the working directory of the loader
+    char cwd[PATH_MAX];
+    if (filename.empty() || filename[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+        return filename;
+    return std::string(cwd) + "/" + filename;
+}
+
+void compute_bounds(const OpenGL::Vertex* vertices, size_t n_vertices, float* bounds_min, float* bounds_max)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        bounds_min[k] = n_vertices > 0 ? std::numeric_limits<float>::max() : 0.0f;
+        bounds_max[k] = n_vertices > 0 ? std::numeric_limits<float>::lowest() : 0.0f;
+    }
+    for (size_t i = 0; i < n_vertices; i++)
+    {
+        const float p[3] = {vertices[i].x, vertices[i].y, vertices[i].z};
+        for (int k = 0; k < 3; k++)
+        {
+            bounds_min[k] = std::min(bounds_min[k], p[k]);
+            bounds_max[k] = std::max(bounds_max[k], p[k]);
+        }
+    }
+}
+
+size_t align(size_t offset)
+{
+    return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+}
+
+}
+
+
+uint64_t MeshCache::HashFile(const MappedFile& file)
+{
+    // FNV-1a per chunk, chunk hashes are combined in order
+    size_t n_chunks = (file.GetSize() + HASH_CHUNK_SIZE - 1) / HASH_CHUNK_SIZE;
+    std::vector<uint64_t> hashes(n_chunks);
+    MeshLoader::ParallelFor(n_chunks, [&](size_t i)
+    {
+        size_t begin = i * HASH_CHUNK_SIZE;
+        size_t size = std::min(HASH_CHUNK_SIZE, file.GetSize() - begin);
+        const char* data = file.GetData() + begin;
+
+        // 8 bytes per step, the tail byte by byte
+        uint64_t hash = 14695981039346656037ULL;
+        size_t n_words = size / sizeof(uint64_t);
+        for (size_t j = 0; j < n_words; j++)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + j * sizeof(uint64_t), sizeof(uint64_t));
+            hash ^= word;
+            hash *= 1099511628211ULL;
+        }
+        hashes[i] = fnv1a(hash, data + n_words * sizeof(uint64_t), size - n_words * sizeof(uint64_t));
+    });
+
+    uint64_t size = file.GetSize();
+    uint64_t hash = fnv1a(14695981039346656037ULL, &size, sizeof(size));
+    return fnv1a(hash, hashes.data(), hashes.size() * sizeof(uint64_t));
+}
+
+
+std::string MeshCache::GetFilename(const std::string& filename, float scale)
+{
+    std::string directory = OpenGL::ShaderProgram::GetBinaryCacheDirectory();
+    if (directory.empty())
+        return "";
+
+    // the same file through different paths shares its cache file
+    char resolved[PATH_MAX];
+    std::string source = realpath(filename.c_str(), resolved) ? std::string(resolved) : filename;
+
+    uint64_t hash = fnv1a(14695981039346656037ULL, source.data(), source.size());
+    hash = fnv1a(hash, &scale, sizeof(scale));
+    hash = fnv1a(hash, &CACHE_VERSION, sizeof(CACHE_VERSION));
+
+    std::stringstream ss;
+    ss << directory << "/meshes/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".mesh";
+    return ss.str();
+}
+
+
+int MeshCache::Write(const std::string& cache_filename, const MeshData& mesh, float scale,
+                     uint64_t source_size, int64_t source_mtime, uint64_t source_hash)
+{
+    TraceSpan trace("MeshCache::Write", "io");
+
+    CacheHeader header = {};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.vertex_size = sizeof(OpenGL::Vertex);
+    header.scale = scale;
+    header.flags = (mesh.has_normals ? HAS_NORMALS : 0) | (mesh.has_uvs ? HAS_UVS : 0) | (mesh.has_colors ? HAS_COLORS : 0);
+    header.n_vertices = mesh.vertices.size();
+    header.n_faces = mesh.indices.size() / 3;
+    compute_bounds(mesh.vertices.data(), mesh.vertices.size(), header.bounds_min, header.bounds_max);
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.source_hash = source_hash;
+    std::string mtl_filename = resolve_filename(mesh.mtl_filename);
+
+    std::vector<std::pair<CacheSection, const void*>> sections;
+    sections.push_back({{VERTICES, 0, 0, mesh.vertices.size() * sizeof(OpenGL::Vertex)}, mesh.vertices.data()});
+    sections.push_back({{INDICES, 0, 0, mesh.indices.size() * sizeof(unsigned int)}, mesh.indices.data()});
+    if (!mesh.material_ids.empty())
+        sections.push_back({{MATERIAL_IDS, 0, 0, mesh.material_ids.size() * sizeof(unsigned int)}, mesh.material_ids.data()});
+    if (!mtl_filename.empty())
+        sections.push_back({{MTL_FILENAME, 0, 0, mtl_filename.size()}, mtl_filename.data()});
+    header.n_sections = sections.size();
+
+    size_t offset = sizeof(CacheHeader) + sections.size() * sizeof(CacheSection);
+    for (auto& section : sections)
+    {
+        section.first.offset = align(offset);
+        offset = section.first.offset + section.first.size;
+    }
+
+    path directory = path(cache_filename).parent_path();
+    if (!directory.exists())
+        create_directories(directory);
+
+    // several processes may write the same mesh, readers never see a partial file
+    std::string tmp_filename = cache_filename + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tmp_filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cout << "WARNING: unable to write mesh cache to " << directory.str() << std::endl;
+            return -1;
+        }
+
+        file.write((const char*)&header, sizeof(CacheHeader));
+        for (const auto& section : sections)
+            file.write((const char*)&section.first, sizeof(CacheSection));
+
+        const char padding[SECTION_ALIGNMENT] = {};
+        size_t position = sizeof(CacheHeader) + sections.size() * sizeof(CacheSection);
+        for (const auto& section : sections)
+        {
+            file.write(padding, section.first.offset - position);
+            file.write((const char*)section.second, section.first.size);
+            position = section.first.offset + section.first.size;
+        }
+
+        if (!file.good())
+        {
+            std::cout << "WARNING: unable to write mesh cache to " << directory.str() << std::endl;
+            file.close();
+            std::remove(tmp_filename.c_str());
+            return -1;
+        }
+    }
+    std::rename(tmp_filename.c_str(), cache_filename.c_str());
+    return 1;
+}
+
+
+int MeshCache::Read(const std::string& cache_filename, const std::string& filename, MeshView& mesh, float scale)
+{
+    if (access(cache_filename.c_str(), R_OK) != 0)
+        return 0;
+
+    TraceSpan trace("MeshCache::Read", "io");
+
+    // copy on write, tensors may modify the vertices in place
+    auto file = std::make_shared<MappedFile>();
+    if (file->Open(cache_filename, true) < 0)
+        return 0;
+
+    const char* data = file->GetData();
+    size_t size = file->GetSize();
+    if (size < sizeof(CacheHeader))
+        return 0;
+
+    CacheHeader header;
+    std::memcpy(&header, data, sizeof(CacheHeader));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+        header.vertex_size != sizeof(OpenGL::Vertex) || header.scale != scale ||
+        size < sizeof(CacheHeader) + header.n_sections * sizeof(CacheSection))
+        return 0;
+
+    uint64_t source_size;
+    int64_t source_mtime;
+    if (stat_source(filename, source_size, source_mtime) < 0 || source_size != header.source_size)
+        return 0;
+
+    // a touched or copied file is still valid with the same content
+    if (source_mtime != header.source_mtime)
+    {
+        MappedFile source;
+        if (source.Open(filename) < 0 || HashFile(source) != header.source_hash)
+            return 0;
+    }
+
+    MeshView view;
+    const CacheSection* sections = (const CacheSection*)(data + sizeof(CacheHeader));
+    for (uint32_t i = 0; i < header.n_sections; i++)
+    {
+        const CacheSection& section = sections[i];
+        if (section.offset > size || section.size > size - section.offset)
+            return 0;
+
+        char* section_data = file->GetData() + section.offset;
+        switch (section.type)
+        {
+        case VERTICES:
+            if (section.size != header.n_vertices * sizeof(OpenGL::Vertex))
+                return 0;
+            view.vertices = (const OpenGL::Vertex*)section_data;
+            break;
+        case INDICES:
+            if (section.size != header.n_faces * 3 * sizeof(unsigned int))
+                return 0;
+            view.indices = (const unsigned int*)section_data;
+            break;
+        case MATERIAL_IDS:
+            if (section.size != header.n_faces * sizeof(unsigned int))
+                return 0;
+            view.material_ids = (const unsigned int*)section_data;
+            break;
+        case MTL_FILENAME:
+            view.mtl_filename.assign(section_data, section.size);
+            break;
+        default:
+            // sections of newer writers are skipped
+            break;
+        }
+    }
+
+    if (!view.vertices || !view.indices)
+        return 0;
+
+    view.n_vertices = header.n_vertices;
+    view.n_faces = header.n_faces;
+    std::memcpy(view.bounds_min, header.bounds_min, sizeof(view.bounds_min));
+    std::memcpy(view.bounds_max, header.bounds_max, sizeof(view.bounds_max));
+    view.has_normals = header.flags & HAS_NORMALS;
+    view.has_uvs = header.flags & HAS_UVS;
+    view.has_colors = header.flags & HAS_COLORS;
+    view.owner = file;
+    mesh = view;
+    return 1;
+}
+
+
+int MeshCache::Load(const std::string& filename, MeshView& mesh, float scale, bool use_cache)
+{
+    TraceSpan trace("MeshCache::Load", "io");
+
+    std::string cache_filename = use_cache ? GetFilename(filename, scale) : "";
+    if (!cache_filename.empty() && Read(cache_filename, filename, mesh, scale) > 0)
+        return 1;
+
+    // the source is stamped before it is parsed and stat'ed again after, a file
+    // replaced in between is parsed but not cached with the stamp of the other one
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    uint64_t source_hash = 0;
+    ino_t source_inode = 0;
+    if (!cache_filename.empty())
+    {
+        MappedFile source;
+        if (stat_source(filename, source_size, source_mtime, &source_inode) < 0 ||
+            source.Open(filename) < 0 || source.GetSize() != source_size)
+            cache_filename.clear();
+        else
+            source_hash = HashFile(source);
+    }
+
+    auto data = std::make_shared<MeshData>();
+    if (MeshLoader::Load(filename, *data, scale) < 0)
+        return -1;
+
+    if (!cache_filename.empty())
+    {
+        uint64_t size;
+        int64_t mtime;
+        ino_t inode;
+        if (stat_source(filename, size, mtime, &inode) < 0 || size != source_size || mtime != source_mtime ||
+            inode != source_inode)
+            cache_filename.clear();
+    }
+
+    // stored in draw order, so the faces are not reordered again on upload
+    if (!data->material_ids.empty())
+        OpenGL::GroupFacesByMaterial(data->indices.data(), data->material_ids.data(), data->indices.size() / 3);
+
+    // the parsed arrays are freed in favor of the pages shared with other processes
+    if (!cache_filename.empty() && Write(cache_filename, *data, scale, source_size, source_mtime, source_hash) > 0 &&
+        Read(cache_filename, filename, mesh, scale) > 0)
+        return 1;
+
+    MeshView view;
+    view.vertices = data->vertices.data();
+    view.n_vertices = data->vertices.size();
+    view.indices = data->indices.data();
+    view.n_faces = data->indices.size() / 3;
+    view.material_ids = data->material_ids.empty() ? nullptr : data->material_ids.data();
+    compute_bounds(view.vertices, view.n_vertices, view.bounds_min, view.bounds_max);
+    view.mtl_filename = data->mtl_filename;
+    view.has_normals = data->has_normals;
+    view.has_uvs = data->has_uvs;
+    view.has_colors = data->has_colors;
+    view.owner = data;
+    mesh = view;
+    return 1;
+}
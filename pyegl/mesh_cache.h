@@ -0,0 +1,68 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+
+#include "mesh_loader.h"
+
+
+// Arrays of a loaded mesh, either in a memory mapped cache file or in a parsed
+// MeshData. They stay valid as long as a copy of the owner is alive.
+struct MeshView
+{
+    const OpenGL::Vertex* vertices = nullptr;
+    size_t n_vertices = 0;
+    const unsigned int* indices = nullptr;      // 3 per face, grouped by material
+    size_t n_faces = 0;
+    const unsigned int* material_ids = nullptr; // per face, nullptr if the file has no materials
+    float bounds_min[3] = {0.0f, 0.0f, 0.0f};
+    float bounds_max[3] = {0.0f, 0.0f, 0.0f};
+    std::string mtl_filename;
+    bool has_normals = false;
+    bool has_uvs = false;
+    bool has_colors = false;
+    std::shared_ptr<void> owner;
+};
+
+
+// Binary container of a loaded mesh, written after the first load of a file
+// into the meshes directory of the shader binary cache. Its sections hold the
+// deduplicated vertices, the index buffer and the material ids in the layout
+// of the renderer, so later loads memory map the file and upload it without
+// parsing. Processes loading the same file share its pages in the page cache.
+//
+// A cache file is used while the size of the source is the same and either its
+// modification time or the hash of its content matches.
+class MeshCache
+{
+public:
+    enum Section
+    {
+        VERTICES = 1,
+        INDICES = 2,
+        MATERIAL_IDS = 3,
+        MTL_FILENAME = 4,
+    };
+
+    // Loads a mesh file through the cache, a missing or stale cache file is
+    // written again. Without a cache directory or use_cache the file is parsed.
+    static int Load(const std::string& filename, MeshView& mesh, float scale=1.0f, bool use_cache=true);
+
+    // cache file of a mesh file at a scale, empty without a cache directory
+    static std::string GetFilename(const std::string& filename, float scale);
+
+    // size, modification time (ns) and hash of the source as it was parsed
+    static int Write(const std::string& cache_filename, const MeshData& mesh, float scale,
+                     uint64_t source_size, int64_t source_mtime, uint64_t source_hash);
+
+    // 0 if the cache file is missing or does not match the source
+    static int Read(const std::string& cache_filename, const std::string& filename, MeshView& mesh, float scale);
+
+    // hash of the content of a file, computed in parallel
+    static uint64_t HashFile(const MappedFile& file);
+};
+
+#endif
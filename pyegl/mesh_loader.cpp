@@ -0,0 +1,1618 @@
+#include "mesh_loader.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <charconv>
+#include <sstream>
+#include <cstring>
+#include <mutex>
+#include <map>
+#include <limits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deps/path.h"
+
+
+// MappedFile
+
+int MappedFile::Open(const std::string& filename, bool writable)
+{
+    Close();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "ERROR: unable to open file " << filename << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        std::cout << "ERROR: unable to read file " << filename << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size > 0)
+    {
+        void* mapped = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            std::cout << "ERROR: mapping file " << filename << " failed" << std::endl;
+            close(fd);
+            return -1;
+        }
+        data = mapped;
+        size = st.st_size;
+        madvise(data, size, MADV_WILLNEED);
+    }
+    close(fd);
+    return 1;
+}
+
+
+void MappedFile::Close()
+{
+    if (data)
+        munmap(data, size);
+    data = nullptr;
+    size = 0;
+}
+
+
+// MeshLoader
+
+ThreadPool& MeshLoader::Pool()
+{
+    static std::mutex mutex;
+    static ThreadPool* pool = nullptr;
+    static pid_t pid = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pool || pid != getpid())
+    {
+        // the threads of the parent do not exist in a forked child, leak its pool
+        pool = new ThreadPool();
+        pid = getpid();
+    }
+    return *pool;
+}
+
+
+namespace
+{
+
+// the file is split at line ends into chunks of about this size
+const size_t CHUNK_SIZE = 4 << 20;
+
+// corners and vertices are processed in blocks of this size
+const size_t BLOCK_SIZE = 1 << 16;
+
+// partitions of the vertex positions for the deduplication of corners that
+// reference a position with different texture coordinates or normals
+const size_t N_PARTITIONS = 64;
+
+struct ObjCorner
+{
+    int v, vt, vn; // 0-based, -1 if not given
+};
+
+struct ObjCornerHash
+{
+    size_t operator()(const ObjCorner& c) const
+    {
+        size_t hash = std::hash<int>()(c.v);
+        OpenGL::hash_combine(hash, c.vt);
+        OpenGL::hash_combine(hash, c.vn);
+        return hash;
+    }
+};
+
+struct ObjCornerEqual
+{
+    bool operator()(const ObjCorner& a, const ObjCorner& b) const
+    {
+        return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+    }
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    // counted in the first pass
+    size_t n_positions = 0, n_texcoords = 0, n_normals = 0, n_triangles = 0;
+    bool has_colors = false;
+
+    // first entries of the chunk in the arrays of the whole file
+    size_t position_offset = 0, texcoord_offset = 0, normal_offset = 0, triangle_offset = 0;
+
+    // (first triangle, name) of every usemtl
+    std::vector<std::pair<size_t, std::string>> materials;
+    std::string mtllib;
+    std::string error;
+};
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+inline const char* line_end(const char* p, const char* end)
+{
+    const char* e = (const char*)memchr(p, '\n', end - p);
+    return e ? e : end;
+}
+
+// keyword at p followed by white space
+inline bool is_keyword(const char* p, const char* end, const char* keyword, size_t length)
+{
+    return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && is_space(p[length]);
+}
+
+inline size_t count_tokens(const char* p, const char* end)
+{
+    size_t n = 0;
+    while (true)
+    {
+        p = skip_spaces(p, end);
+        if (p >= end || *p == '#')
+            return n;
+        n++;
+        while (p < end && !is_space(*p))
+            p++;
+    }
+}
+
+// nullptr if there is no number
+inline const char* parse_float(const char* p, const char* end, float& value)
+{
+    p = skip_spaces(p, end);
+    if (p < end && *p == '+')
+        p++;
+    auto result = std::from_chars(p, end, value);
+    return result.ec == std::errc() ? result.ptr : nullptr;
+}
+
+inline std::string trimmed(const char* p, const char* end)
+{
+    p = skip_spaces(p, end);
+    while (end > p && is_space(end[-1]))
+        end--;
+    return std::string(p, end);
+}
+
+// 1-based or negative (relative to count) index into a 0-based one, -1 if invalid
+inline int resolve_index(long index, size_t count, size_t total)
+{
+    long resolved = index > 0 ? index - 1 : (long)count + index;
+    return (index != 0 && resolved >= 0 && (size_t)resolved < total) ? (int)resolved : -1;
+}
+
+void count_obj_chunk(ObjChunk& chunk)
+{
+    for (const char* p = chunk.begin; p < chunk.end; )
+    {
+        const char* e = line_end(p, chunk.end);
+        const char* s = skip_spaces(p, e);
+        if (e - s > 1 && s[0] == 'v')
+        {
+            if (is_space(s[1]))
+            {
+                chunk.n_positions++;
+                if (!chunk.has_colors && count_tokens(s + 2, e) >= 6)
+                    chunk.has_colors = true;
+            }
+            else if (is_keyword(s, e, "vt", 2))
+            {
+                chunk.n_texcoords++;
+            }
+            else if (is_keyword(s, e, "vn", 2))
+            {
+                chunk.n_normals++;
+            }
+        }
+        else if (e - s > 1 && s[0] == 'f' && is_space(s[1]))
+        {
+            size_t n = count_tokens(s + 2, e);
+            if (n >= 3)
+                chunk.n_triangles += n - 2;
+        }
+        p = e + 1;
+    }
+}
+
+struct ObjArrays
+{
+    float* positions; // 3 per position
+    float* colors;    // 3 per position, nullptr without vertex colors
+    float* texcoords; // 2 per texcoord
+    float* normals;   // 3 per normal
+    ObjCorner* corners;
+    size_t n_positions, n_texcoords, n_normals;
+};
+
+// v[/vt][/vn] at p, returns the end of the token or nullptr
+const char* parse_corner(const char* p, const char* end, size_t positions, size_t texcoords, size_t normals,
+                         const ObjArrays& arrays, ObjCorner& corner)
+{
+    long index;
+    auto result = std::from_chars(p, end, index);
+    if (result.ec != std::errc())
+        return nullptr;
+    corner.v = resolve_index(index, positions, arrays.n_positions);
+    corner.vt = -1;
+    corner.vn = -1;
+    if (corner.v < 0)
+        return nullptr;
+
+    p = result.ptr;
+    if (p < end && *p == '/')
+    {
+        p++;
+        if (p < end && *p != '/')
+        {
+            result = std::from_chars(p, end, index);
+            if (result.ec != std::errc() || (corner.vt = resolve_index(index, texcoords, arrays.n_texcoords)) < 0)
+                return nullptr;
+            p = result.ptr;
+        }
+        if (p < end && *p == '/')
+        {
+            p++;
+            result = std::from_chars(p, end, index);
+            if (result.ec != std::errc() || (corner.vn = resolve_index(index, normals, arrays.n_normals)) < 0)
+                return nullptr;
+            p = result.ptr;
+        }
+    }
+    return (p == end || is_space(*p)) ? p : nullptr;
+}
+
+void parse_obj_chunk(ObjChunk& chunk, const ObjArrays& arrays)
+{
+    size_t iv = chunk.position_offset, ivt = chunk.texcoord_offset, ivn = chunk.normal_offset, it = chunk.triangle_offset;
+    for (const char* p = chunk.begin; p < chunk.end; )
+    {
+        const char* e = line_end(p, chunk.end);
+        const char* s = skip_spaces(p, e);
+        bool ok = true;
+
+        if (e - s > 1 && s[0] == 'v' && is_space(s[1]))
+        {
+            float* position = arrays.positions + 3 * iv;
+            const char* q = s + 2;
+            for (int i = 0; i < 3 && ok; i++)
+                ok = (q = parse_float(q, e, position[i])) != nullptr;
+            if (ok && arrays.colors)
+            {
+                float* color = arrays.colors + 3 * iv;
+                for (int i = 0; i < 3; i++)
+                {
+                    if (!q || !(q = parse_float(q, e, color[i])))
+                        color[i] = 1.0f;
+                }
+            }
+            iv++;
+        }
+        else if (is_keyword(s, e, "vt", 2))
+        {
+            float* texcoord = arrays.texcoords + 2 * ivt;
+            const char* q = parse_float(s + 3, e, texcoord[0]);
+            ok = q != nullptr;
+            if (ok && !parse_float(q, e, texcoord[1]))
+                texcoord[1] = 0.0f;
+            ivt++;
+        }
+        else if (is_keyword(s, e, "vn", 2))
+        {
+            float* normal = arrays.normals + 3 * ivn;
+            const char* q = s + 3;
+            for (int i = 0; i < 3 && ok; i++)
+                ok = (q = parse_float(q, e, normal[i])) != nullptr;
+            ivn++;
+        }
+        else if (e - s > 1 && s[0] == 'f' && is_space(s[1]))
+        {
+            // fan around the first corner
+            ObjCorner first, previous, corner;
+            size_t n = 0;
+            const char* q = s + 2;
+            while (ok)
+            {
+                q = skip_spaces(q, e);
+                if (q >= e || *q == '#')
+                    break;
+                ok = (q = parse_corner(q, e, iv, ivt, ivn, arrays, corner)) != nullptr;
+                if (!ok)
+                    break;
+                if (n >= 2)
+                {
+                    ObjCorner* triangle = arrays.corners + 3 * it++;
+                    triangle[0] = first;
+                    triangle[1] = previous;
+                    triangle[2] = corner;
+                }
+                if (n == 0)
+                    first = corner;
+                previous = corner;
+                n++;
+            }
+        }
+        else if (is_keyword(s, e, "usemtl", 6))
+        {
+            chunk.materials.emplace_back(it, trimmed(s + 7, e));
+        }
+        else if (is_keyword(s, e, "mtllib", 6) && chunk.mtllib.empty())
+        {
+            chunk.mtllib = trimmed(s + 7, e);
+        }
+
+        if (!ok && chunk.error.empty())
+            chunk.error = trimmed(p, e);
+        p = e + 1;
+    }
+}
+
+}
+
+
+int MeshLoader::Load(const std::string& filename, MeshData& mesh, float scale)
+{
+    std::string extension = path(filename).extension();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == "obj")
+        return LoadObj(filename, mesh, scale);
+    if (extension == "off")
+        return LoadOff(filename, mesh, scale);
+    if (extension == "ply")
+        return LoadPly(filename, mesh, scale);
+    if (extension == "glb")
+        return LoadGlb(filename, mesh, scale);
+
+    std::cout << "ERROR: unsupported mesh format of " << filename << std::endl;
+    return -1;
+}
+
+
+int MeshLoader::LoadObj(const std::string& filename, MeshData& mesh, float scale)
+{
+    TraceSpan trace("MeshLoader::LoadObj", "io");
+
+    MappedFile file;
+    if (file.Open(filename) < 0)
+        return -1;
+    const char* data = file.GetData();
+    const char* data_end = data + file.GetSize();
+
+    // chunks start after a line end
+    std::vector<ObjChunk> chunks;
+    for (const char* p = data; p < data_end; )
+    {
+        const char* e = std::min(p + CHUNK_SIZE, data_end);
+        e = e < data_end ? line_end(e, data_end) + 1 : data_end;
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = std::min(e, data_end);
+        p = chunks.back().end;
+    }
+
+    ParallelFor(chunks.size(), [&](size_t i) { count_obj_chunk(chunks[i]); });
+
+    size_t n_positions = 0, n_texcoords = 0, n_normals = 0, n_triangles = 0;
+    bool has_colors = false;
+    for (auto& chunk : chunks)
+    {
+        chunk.position_offset = n_positions;
+        chunk.texcoord_offset = n_texcoords;
+        chunk.normal_offset = n_normals;
+        chunk.triangle_offset = n_triangles;
+        n_positions += chunk.n_positions;
+        n_texcoords += chunk.n_texcoords;
+        n_normals += chunk.n_normals;
+        n_triangles += chunk.n_triangles;
+        has_colors = has_colors || chunk.has_colors;
+    }
+
+    if (n_positions == 0 || n_triangles == 0)
+    {
+        std::cout << "ERROR: " << filename << " has no vertices or faces" << std::endl;
+        return -1;
+    }
+    if (n_positions > (size_t)std::numeric_limits<int>::max() || 3 * n_triangles > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+        return -1;
+    }
+
+    std::vector<float> positions(3 * n_positions), colors(has_colors ? 3 * n_positions : 0);
+    std::vector<float> texcoords(2 * n_texcoords), normals(3 * n_normals);
+    std::vector<ObjCorner> corners(3 * n_triangles);
+    ObjArrays arrays = {positions.data(), has_colors ? colors.data() : nullptr, texcoords.data(), normals.data(), corners.data(),
+                        n_positions, n_texcoords, n_normals};
+
+    ParallelFor(chunks.size(), [&](size_t i) { parse_obj_chunk(chunks[i], arrays); });
+
+    for (const auto& chunk : chunks)
+    {
+        if (!chunk.error.empty())
+        {
+            std::cout << "ERROR: malformed line in " << filename << ": " << chunk.error << std::endl;
+            return -1;
+        }
+    }
+    file.Close();
+
+    // A position that is always used with the same texture coordinate and
+    // normal is one vertex, so the vertices keep the order of the file. This
+    // is checked with one slot per position, (vt + 1, vn + 1) packed.
+    const uint64_t UNSET = ~uint64_t(0);
+    auto pack = [](const ObjCorner& c) { return ((uint64_t)(uint32_t)(c.vt + 1) << 32) | (uint32_t)(c.vn + 1); };
+    size_t n_corners = corners.size();
+    size_t n_corner_blocks = (n_corners + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> attributes(new std::atomic<uint64_t>[n_positions]);
+    ParallelFor((n_positions + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+    {
+        size_t end = std::min(n_positions, (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < end; i++)
+            attributes[i].store(n_texcoords == 0 && n_normals == 0 ? 0 : UNSET, std::memory_order_relaxed);
+    });
+
+    std::atomic<bool> shared_positions(false);
+    if (n_texcoords > 0 || n_normals > 0)
+    {
+        ParallelFor(n_corner_blocks, [&](size_t block)
+        {
+            size_t end = std::min(n_corners, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end && !shared_positions.load(std::memory_order_relaxed); i++)
+            {
+                uint64_t key = pack(corners[i]);
+                uint64_t expected = UNSET;
+                if (!attributes[corners[i].v].compare_exchange_strong(expected, key, std::memory_order_relaxed) && expected != key)
+                    shared_positions = true;
+            }
+        });
+    }
+
+    // (position, texcoord, normal) of every vertex
+    std::vector<ObjCorner> unique;
+    mesh.indices.resize(n_corners);
+    if (!shared_positions)
+    {
+        unique.resize(n_positions);
+        ParallelFor((n_positions + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+        {
+            size_t end = std::min(n_positions, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+            {
+                uint64_t key = attributes[i].load(std::memory_order_relaxed);
+                if (key == UNSET)
+                    key = 0; // not referenced by a face
+                unique[i] = {(int)i, (int)(key >> 32) - 1, (int)(key & 0xffffffff) - 1};
+            }
+        });
+        ParallelFor(n_corner_blocks, [&](size_t block)
+        {
+            size_t end = std::min(n_corners, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+                mesh.indices[i] = corners[i].v;
+        });
+    }
+    else
+    {
+        // Corners are bucketed by ranges of positions and every bucket is
+        // deduplicated on its own. Within a bucket the vertices are in the
+        // order of their first corner.
+        auto partition = [&](const ObjCorner& c) { return (size_t)c.v * N_PARTITIONS / n_positions; };
+        std::vector<size_t> counts(n_corner_blocks * N_PARTITIONS, 0);
+        ParallelFor(n_corner_blocks, [&](size_t block)
+        {
+            size_t end = std::min(n_corners, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+                counts[block * N_PARTITIONS + partition(corners[i])]++;
+        });
+
+        // counts become the first slot of every (block, partition) in order
+        std::vector<size_t> partition_begin(N_PARTITIONS + 1, 0);
+        size_t offset = 0;
+        for (size_t p = 0; p < N_PARTITIONS; p++)
+        {
+            partition_begin[p] = offset;
+            for (size_t block = 0; block < n_corner_blocks; block++)
+            {
+                size_t count = counts[block * N_PARTITIONS + p];
+                counts[block * N_PARTITIONS + p] = offset;
+                offset += count;
+            }
+        }
+        partition_begin[N_PARTITIONS] = offset;
+
+        std::vector<unsigned int> order(n_corners);
+        ParallelFor(n_corner_blocks, [&](size_t block)
+        {
+            size_t end = std::min(n_corners, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+                order[counts[block * N_PARTITIONS + partition(corners[i])]++] = i;
+        });
+
+        std::vector<std::vector<ObjCorner>> partition_unique(N_PARTITIONS);
+        ParallelFor(N_PARTITIONS, [&](size_t p)
+        {
+            std::unordered_map<ObjCorner, unsigned int, ObjCornerHash, ObjCornerEqual> ids;
+            ids.reserve(partition_begin[p + 1] - partition_begin[p]);
+            for (size_t j = partition_begin[p]; j < partition_begin[p + 1]; j++)
+            {
+                const ObjCorner& corner = corners[order[j]];
+                auto inserted = ids.emplace(corner, (unsigned int)partition_unique[p].size());
+                if (inserted.second)
+                    partition_unique[p].push_back(corner);
+                mesh.indices[order[j]] = inserted.first->second;
+            }
+        });
+
+        std::vector<size_t> vertex_begin(N_PARTITIONS + 1, 0);
+        for (size_t p = 0; p < N_PARTITIONS; p++)
+            vertex_begin[p + 1] = vertex_begin[p] + partition_unique[p].size();
+        unique.resize(vertex_begin[N_PARTITIONS]);
+
+        ParallelFor(N_PARTITIONS, [&](size_t p)
+        {
+            std::copy(partition_unique[p].begin(), partition_unique[p].end(), unique.begin() + vertex_begin[p]);
+            for (size_t j = partition_begin[p]; j < partition_begin[p + 1]; j++)
+                mesh.indices[order[j]] += vertex_begin[p];
+        });
+    }
+
+    mesh.vertices.resize(unique.size());
+    ParallelFor((unique.size() + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+    {
+        size_t end = std::min(unique.size(), (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < end; i++)
+        {
+            const ObjCorner& c = unique[i];
+            OpenGL::Vertex& v = mesh.vertices[i];
+            v.x = positions[3 * c.v + 0] * scale;
+            v.y = positions[3 * c.v + 1] * scale;
+            v.z = positions[3 * c.v + 2] * scale;
+            v.r = has_colors ? colors[3 * c.v + 0] : 1.0f;
+            v.g = has_colors ? colors[3 * c.v + 1] : 1.0f;
+            v.b = has_colors ? colors[3 * c.v + 2] : 1.0f;
+            v.a = 1.0f;
+            if (c.vt >= 0)
+            {
+                v.u = texcoords[2 * c.vt + 0];
+                v.v = texcoords[2 * c.vt + 1];
+            }
+            if (c.vn >= 0)
+            {
+                v.nx = normals[3 * c.vn + 0];
+                v.ny = normals[3 * c.vn + 1];
+                v.nz = normals[3 * c.vn + 2];
+            }
+            v.mask = 1.0f;
+        }
+    });
+
+    mesh.has_colors = has_colors;
+    mesh.has_uvs = n_texcoords > 0;
+    mesh.has_normals = n_normals > 0;
+
+    // material ids in the order of the mtllib, otherwise in the order of their first use
+    mesh.material_ids.clear();
+    mesh.mtl_filename.clear();
+    std::map<std::string, unsigned int> material_lookup;
+    for (const auto& chunk : chunks)
+    {
+        if (!chunk.mtllib.empty())
+        {
+            mesh.mtl_filename = (path(filename).parent_path() / chunk.mtllib).str();
+            std::vector<OpenGL::Material> materials;
+            if (OpenGL::LoadMtlFile(mesh.mtl_filename, materials) > 0)
+            {
+                for (size_t i = 0; i < materials.size(); i++)
+                    material_lookup.emplace(materials[i].name, i);
+            }
+            break;
+        }
+    }
+
+    // a usemtl applies up to the next one, which can be in a later chunk
+    std::vector<std::pair<size_t, std::string>> usemtl;
+    for (const auto& chunk : chunks)
+        usemtl.insert(usemtl.end(), chunk.materials.begin(), chunk.materials.end());
+
+    if (!usemtl.empty())
+    {
+        bool from_mtllib = !material_lookup.empty();
+        mesh.material_ids.assign(n_triangles, 0);
+        for (size_t i = 0; i < usemtl.size(); i++)
+        {
+            auto search = material_lookup.find(usemtl[i].second);
+            unsigned int id = 0;
+            if (search != material_lookup.end())
+                id = search->second;
+            else if (!from_mtllib)
+                id = material_lookup.emplace(usemtl[i].second, material_lookup.size()).first->second;
+
+            size_t end = i + 1 < usemtl.size() ? usemtl[i + 1].first : n_triangles;
+            std::fill(mesh.material_ids.begin() + usemtl[i].first, mesh.material_ids.begin() + end, id);
+        }
+    }
+
+    return 1;
+}
+
+
+namespace
+{
+
+// OFF
+
+struct OffFormat
+{
+    bool texcoords = false;
+    bool colors = false;
+    bool normals = false;
+    bool binary = false;
+};
+
+// [ST][C][N]OFF
+bool parse_off_keyword(const std::string& keyword, OffFormat& format)
+{
+    size_t i = 0;
+    if (keyword.compare(i, 2, "ST") == 0)
+    {
+        format.texcoords = true;
+        i += 2;
+    }
+    if (keyword.compare(i, 1, "C") == 0)
+    {
+        format.colors = true;
+        i += 1;
+    }
+    if (keyword.compare(i, 1, "N") == 0)
+    {
+        format.normals = true;
+        i += 1;
+    }
+    return keyword.compare(i, std::string::npos, "OFF") == 0;
+}
+
+// lines with content, comments and empty lines are skipped
+inline bool is_record(const char* p, const char* e)
+{
+    p = skip_spaces(p, e);
+    return p < e && *p != '#';
+}
+
+struct OffChunk
+{
+    const char* begin;
+    const char* end;
+    size_t n_lines = 0, line_offset = 0;
+    size_t n_triangles = 0, triangle_offset = 0;
+    std::string error;
+};
+
+// integer color components are in [0, 255], others in [0, 1]
+inline const char* parse_color(const char* p, const char* end, float& value)
+{
+    const char* s = skip_spaces(p, end);
+    const char* e = parse_float(s, end, value);
+    if (e && std::find_if(s, e, [](char c) { return c == '.' || c == 'e' || c == 'E'; }) == e)
+        value /= 255.0f;
+    return e;
+}
+
+bool parse_off_vertex(const char* p, const char* e, const OffFormat& format, float scale, OpenGL::Vertex& v)
+{
+    v = OpenGL::Vertex();
+    v.b = 1.0f;
+    float values[3];
+    for (int k = 0; k < 3 && p; k++)
+        p = parse_float(p, e, values[k]);
+    if (!p)
+        return false;
+    v.x = values[0] * scale;
+    v.y = values[1] * scale;
+    v.z = values[2] * scale;
+
+    if (format.normals)
+    {
+        p = parse_float(p, e, v.nx);
+        p = p ? parse_float(p, e, v.ny) : nullptr;
+        p = p ? parse_float(p, e, v.nz) : nullptr;
+        if (!p)
+            return false;
+    }
+
+    if (format.colors)
+    {
+        // r g b [a], the alpha is only there if more values follow than the texture coordinates
+        size_t n_colors = count_tokens(p, e) - (format.texcoords ? 2 : 0);
+        if (n_colors < 3 || n_colors > 4)
+            return false;
+        p = parse_color(p, e, v.r);
+        p = p ? parse_color(p, e, v.g) : nullptr;
+        p = p ? parse_color(p, e, v.b) : nullptr;
+        if (p && n_colors == 4)
+            p = parse_color(p, e, v.a);
+        if (!p)
+            return false;
+    }
+
+    if (format.texcoords)
+    {
+        p = parse_float(p, e, v.u);
+        p = p ? parse_float(p, e, v.v) : nullptr;
+        if (!p)
+            return false;
+    }
+    return true;
+}
+
+// n i0 i1 ... as a triangle fan, trailing face colors are ignored
+bool parse_off_face(const char* p, const char* e, size_t n_vertices, unsigned int* indices)
+{
+    long n, first = 0, previous = 0;
+    p = skip_spaces(p, e);
+    auto result = std::from_chars(p, e, n);
+    if (result.ec != std::errc() || n < 3)
+        return false;
+    p = result.ptr;
+
+    for (long i = 0; i < n; i++)
+    {
+        long index;
+        p = skip_spaces(p, e);
+        result = std::from_chars(p, e, index);
+        if (result.ec != std::errc() || index < 0 || (size_t)index >= n_vertices)
+            return false;
+        p = result.ptr;
+
+        if (i == 0)
+        {
+            first = index;
+        }
+        else if (i >= 2)
+        {
+            indices[0] = first;
+            indices[1] = previous;
+            indices[2] = index;
+            indices += 3;
+        }
+        previous = index;
+    }
+    return true;
+}
+
+// number of triangles of a face line, 0 if it is malformed
+inline size_t count_off_triangles(const char* p, const char* e)
+{
+    long n;
+    p = skip_spaces(p, e);
+    auto result = std::from_chars(p, e, n);
+    return result.ec == std::errc() && n >= 3 ? n - 2 : 0;
+}
+
+inline uint32_t read_big_endian(const char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+inline float read_big_endian_float(const char* p)
+{
+    uint32_t bits = read_big_endian(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}
+
+
+int MeshLoader::LoadOff(const std::string& filename, MeshData& mesh, float scale)
+{
+    TraceSpan trace("MeshLoader::LoadOff", "io");
+
+    MappedFile file;
+    if (file.Open(filename) < 0)
+        return -1;
+    const char* p = file.GetData();
+    const char* data_end = p + file.GetSize();
+
+    // keyword line, optionally followed by the counts or BINARY
+    while (p < data_end && !is_record(p, line_end(p, data_end)))
+        p = line_end(p, data_end) + 1;
+    if (p >= data_end)
+    {
+        std::cout << "ERROR: " << filename << " is empty" << std::endl;
+        return -1;
+    }
+
+    const char* e = line_end(p, data_end);
+    const char* s = skip_spaces(p, e);
+    const char* keyword_end = s;
+    while (keyword_end < e && !is_space(*keyword_end) && *keyword_end != '#')
+        keyword_end++;
+
+    OffFormat format;
+    std::string keyword(s, keyword_end);
+    if (!parse_off_keyword(keyword, format))
+    {
+        std::cout << "ERROR: unsupported mesh format: " << keyword << std::endl;
+        return -1;
+    }
+
+    const char* rest = skip_spaces(keyword_end, e);
+    if ((size_t)(e - rest) >= 6 && memcmp(rest, "BINARY", 6) == 0)
+    {
+        format.binary = true;
+        p = std::min(e + 1, data_end);
+    }
+    else if (!is_record(rest, e))
+    {
+        // counts on the next line
+        p = std::min(e + 1, data_end);
+        while (p < data_end && !is_record(p, line_end(p, data_end)))
+            p = line_end(p, data_end) + 1;
+        rest = p;
+        e = line_end(p, data_end);
+        p = std::min(e + 1, data_end);
+    }
+    else
+    {
+        p = std::min(e + 1, data_end);
+    }
+
+    size_t n_vertices = 0, n_faces = 0;
+    if (format.binary)
+    {
+        if (data_end - p < 12)
+        {
+            std::cout << "ERROR: " << filename << " has no binary header" << std::endl;
+            return -1;
+        }
+        n_vertices = read_big_endian(p);
+        n_faces = read_big_endian(p + 4);
+        p += 12;
+    }
+    else
+    {
+        long counts[2];
+        for (int k = 0; k < 2; k++)
+        {
+            rest = skip_spaces(rest, e);
+            auto result = std::from_chars(rest, e, counts[k]);
+            if (result.ec != std::errc() || counts[k] < 0)
+            {
+                std::cout << "ERROR: " << filename << " has no vertex and face counts" << std::endl;
+                return -1;
+            }
+            rest = result.ptr;
+        }
+        n_vertices = counts[0];
+        n_faces = counts[1];
+    }
+
+    if (n_vertices == 0 || n_faces == 0)
+    {
+        std::cout << "ERROR: " << filename << " has no vertices or faces" << std::endl;
+        return -1;
+    }
+    if (n_vertices > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+        return -1;
+    }
+
+    mesh.material_ids.clear();
+    mesh.mtl_filename.clear();
+    mesh.has_normals = format.normals;
+    mesh.has_uvs = format.texcoords;
+    mesh.has_colors = format.colors;
+
+    if (format.binary)
+    {
+        // big endian float32 x y z [nx ny nz] [r g b a] [u v] per vertex
+        size_t n_components = 3 + (format.normals ? 3 : 0) + (format.colors ? 4 : 0) + (format.texcoords ? 2 : 0);
+        size_t stride = 4 * n_components;
+        if ((size_t)(data_end - p) / stride < n_vertices)
+        {
+            std::cout << "ERROR: " << filename << " is truncated" << std::endl;
+            return -1;
+        }
+
+        const char* vertex_data = p;
+        mesh.vertices.resize(n_vertices);
+        ParallelFor((n_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+        {
+            size_t end = std::min(n_vertices, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+            {
+                const char* q = vertex_data + i * stride;
+                OpenGL::Vertex& v = mesh.vertices[i];
+                v = OpenGL::Vertex();
+                v.b = 1.0f;
+                v.x = read_big_endian_float(q) * scale;
+                v.y = read_big_endian_float(q + 4) * scale;
+                v.z = read_big_endian_float(q + 8) * scale;
+                q += 12;
+                if (format.normals)
+                {
+                    v.nx = read_big_endian_float(q);
+                    v.ny = read_big_endian_float(q + 4);
+                    v.nz = read_big_endian_float(q + 8);
+                    q += 12;
+                }
+                if (format.colors)
+                {
+                    v.r = read_big_endian_float(q);
+                    v.g = read_big_endian_float(q + 4);
+                    v.b = read_big_endian_float(q + 8);
+                    v.a = read_big_endian_float(q + 12);
+                    q += 16;
+                }
+                if (format.texcoords)
+                {
+                    v.u = read_big_endian_float(q);
+                    v.v = read_big_endian_float(q + 4);
+                }
+            }
+        });
+        p += n_vertices * stride;
+
+        // int32 n, n indices, int32 n_colors, n_colors floats per face
+        std::vector<size_t> face_offsets(n_faces);
+        size_t n_triangles = 0, n_read = 0;
+        for (const char* q = p; n_read < n_faces; n_read++)
+        {
+            if (data_end - q < 4)
+                break;
+            uint32_t n = read_big_endian(q);
+            if (n < 3 || (size_t)(data_end - q) / 4 < (size_t)n + 2)
+                break;
+            size_t n_colors = read_big_endian(q + 4 * ((size_t)n + 1));
+            if ((size_t)(data_end - q) / 4 < (size_t)n + 2 + n_colors)
+                break;
+            face_offsets[n_read] = q - p;
+            n_triangles += n - 2;
+            q += 4 * ((size_t)n + 2 + n_colors);
+        }
+        if (n_read < n_faces)
+        {
+            std::cout << "ERROR: " << filename << " has malformed or truncated faces" << std::endl;
+            return -1;
+        }
+        if (3 * n_triangles > (size_t)std::numeric_limits<unsigned int>::max())
+        {
+            std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+            return -1;
+        }
+
+        // triangle fans, the first triangle of a face follows from the ones before
+        std::vector<size_t> triangle_offsets(n_faces);
+        for (size_t i = 0, offset = 0; i < n_faces; i++)
+        {
+            triangle_offsets[i] = offset;
+            offset += read_big_endian(p + face_offsets[i]) - 2;
+        }
+
+        mesh.indices.resize(3 * n_triangles);
+        std::atomic<bool> valid(true);
+        ParallelFor((n_faces + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+        {
+            size_t end = std::min(n_faces, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end; i++)
+            {
+                const char* f = p + face_offsets[i];
+                uint32_t n = read_big_endian(f);
+                unsigned int* indices = mesh.indices.data() + 3 * triangle_offsets[i];
+                uint32_t first = read_big_endian(f + 4);
+                for (uint32_t j = 2; j < n; j++)
+                {
+                    indices[0] = first;
+                    indices[1] = read_big_endian(f + 4 * j);
+                    indices[2] = read_big_endian(f + 4 * (j + 1));
+                    if (indices[0] >= n_vertices || indices[1] >= n_vertices || indices[2] >= n_vertices)
+                        valid = false;
+                    indices += 3;
+                }
+            }
+        });
+        if (!valid)
+        {
+            std::cout << "ERROR: " << filename << " has faces with invalid vertex indices" << std::endl;
+            return -1;
+        }
+        return 1;
+    }
+
+    // chunks start after a line end, record lines are numbered across chunks
+    std::vector<OffChunk> chunks;
+    while (p < data_end)
+    {
+        const char* chunk_end = std::min(p + CHUNK_SIZE, data_end);
+        chunk_end = chunk_end < data_end ? line_end(chunk_end, data_end) + 1 : data_end;
+        chunks.emplace_back();
+        chunks.back().begin = p;
+        chunks.back().end = std::min(chunk_end, data_end);
+        p = chunks.back().end;
+    }
+
+    ParallelFor(chunks.size(), [&](size_t i)
+    {
+        OffChunk& chunk = chunks[i];
+        for (const char* q = chunk.begin; q < chunk.end; q = line_end(q, chunk.end) + 1)
+            chunk.n_lines += is_record(q, line_end(q, chunk.end));
+    });
+
+    size_t n_lines = 0;
+    for (auto& chunk : chunks)
+    {
+        chunk.line_offset = n_lines;
+        n_lines += chunk.n_lines;
+    }
+    if (n_lines < n_vertices + n_faces)
+    {
+        std::cout << "ERROR: " << filename << " has fewer lines than its " << n_vertices << " vertices and " << n_faces << " faces" << std::endl;
+        return -1;
+    }
+
+    // triangles per chunk, only chunks with face lines are read
+    size_t n_records = n_vertices + n_faces;
+    ParallelFor(chunks.size(), [&](size_t i)
+    {
+        OffChunk& chunk = chunks[i];
+        if (chunk.line_offset + chunk.n_lines <= n_vertices || chunk.line_offset >= n_records)
+            return;
+        size_t line = chunk.line_offset;
+        for (const char* q = chunk.begin; q < chunk.end && line < n_records; q = line_end(q, chunk.end) + 1)
+        {
+            const char* qe = line_end(q, chunk.end);
+            if (!is_record(q, qe))
+                continue;
+            if (line >= n_vertices)
+                chunk.n_triangles += count_off_triangles(q, qe);
+            line++;
+        }
+    });
+
+    size_t n_triangles = 0;
+    for (auto& chunk : chunks)
+    {
+        chunk.triangle_offset = n_triangles;
+        n_triangles += chunk.n_triangles;
+    }
+    if (3 * n_triangles > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+        return -1;
+    }
+
+    mesh.vertices.resize(n_vertices);
+    mesh.indices.resize(3 * n_triangles);
+    ParallelFor(chunks.size(), [&](size_t i)
+    {
+        OffChunk& chunk = chunks[i];
+        size_t line = chunk.line_offset;
+        size_t triangle = chunk.triangle_offset;
+        for (const char* q = chunk.begin; q < chunk.end && line < n_records; q = line_end(q, chunk.end) + 1)
+        {
+            const char* qe = line_end(q, chunk.end);
+            if (!is_record(q, qe))
+                continue;
+
+            bool ok;
+            if (line < n_vertices)
+            {
+                ok = parse_off_vertex(q, qe, format, scale, mesh.vertices[line]);
+            }
+            else
+            {
+                size_t n = count_off_triangles(q, qe);
+                ok = n > 0 && parse_off_face(q, qe, n_vertices, mesh.indices.data() + 3 * triangle);
+                triangle += n;
+            }
+
+            if (!ok && chunk.error.empty())
+                chunk.error = trimmed(q, qe);
+            line++;
+        }
+    });
+
+    for (const auto& chunk : chunks)
+    {
+        if (!chunk.error.empty())
+        {
+            std::cout << "ERROR: malformed line in " << filename << ": " << chunk.error << std::endl;
+            return -1;
+        }
+    }
+    return 1;
+}
+
+
+namespace
+{
+
+// PLY
+
+enum PlyType
+{
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64,
+};
+
+struct PlyProperty
+{
+    std::string name;
+    PlyType type = PLY_FLOAT32;
+    bool is_list = false;
+    PlyType count_type = PLY_UINT8; // of lists
+    size_t offset = 0;  // in the element, for elements without lists
+};
+
+struct PlyElement
+{
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t stride = 0; // 0 if the element has lists
+};
+
+bool parse_ply_type(const std::string& name, PlyType& type)
+{
+    static const std::map<std::string, PlyType> lookup = {
+        {"char", PLY_INT8}, {"int8", PLY_INT8},
+        {"uchar", PLY_UINT8}, {"uint8", PLY_UINT8},
+        {"short", PLY_INT16}, {"int16", PLY_INT16},
+        {"ushort", PLY_UINT16}, {"uint16", PLY_UINT16},
+        {"int", PLY_INT32}, {"int32", PLY_INT32},
+        {"uint", PLY_UINT32}, {"uint32", PLY_UINT32},
+        {"float", PLY_FLOAT32}, {"float32", PLY_FLOAT32},
+        {"double", PLY_FLOAT64}, {"float64", PLY_FLOAT64},
+    };
+    auto search = lookup.find(name);
+    if (search == lookup.end())
+        return false;
+    type = search->second;
+    return true;
+}
+
+inline size_t ply_type_size(PlyType type)
+{
+    static const size_t sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[type];
+}
+
+// little endian value, the host has the same byte order
+template<typename T>
+inline T read_ply(const char* p, PlyType type)
+{
+    switch (type)
+    {
+    case PLY_INT8: { int8_t v; memcpy(&v, p, 1); return (T)v; }
+    case PLY_UINT8: { uint8_t v; memcpy(&v, p, 1); return (T)v; }
+    case PLY_INT16: { int16_t v; memcpy(&v, p, 2); return (T)v; }
+    case PLY_UINT16: { uint16_t v; memcpy(&v, p, 2); return (T)v; }
+    case PLY_INT32: { int32_t v; memcpy(&v, p, 4); return (T)v; }
+    case PLY_UINT32: { uint32_t v; memcpy(&v, p, 4); return (T)v; }
+    case PLY_FLOAT32: { float v; memcpy(&v, p, 4); return (T)v; }
+    case PLY_FLOAT64: { double v; memcpy(&v, p, 8); return (T)v; }
+    }
+    return T();
+}
+
+// integer colors are scaled to [0, 1] by their range
+inline float read_ply_color(const char* p, PlyType type)
+{
+    float value = read_ply<float>(p, type);
+    if (type == PLY_UINT8)
+        return value / 255.0f;
+    if (type == PLY_UINT16)
+        return value / 65535.0f;
+    return value;
+}
+
+// size of one element with lists at p, 0 if it does not fit before end
+size_t ply_element_size(const PlyElement& element, const char* p, const char* end)
+{
+    size_t size = 0;
+    for (const auto& property : element.properties)
+    {
+        size_t count_size = property.is_list ? ply_type_size(property.count_type) : 0;
+        if ((size_t)(end - p) < size + count_size)
+            return 0;
+        size_t n = property.is_list ? read_ply<size_t>(p + size, property.count_type) : 1;
+        size += count_size + n * ply_type_size(property.type);
+    }
+    return (size_t)(end - p) < size ? 0 : size;
+}
+
+int parse_ply_header(const char*& p, const char* end, std::vector<PlyElement>& elements, std::string& error)
+{
+    const char* e = line_end(p, end);
+    if (trimmed(p, e) != "ply")
+    {
+        error = "not a PLY file";
+        return -1;
+    }
+
+    for (p = e + 1; p < end; p = e + 1)
+    {
+        e = line_end(p, end);
+        std::istringstream line(trimmed(p, e));
+        std::string keyword;
+        line >> keyword;
+
+        if (keyword == "format")
+        {
+            std::string format;
+            line >> format;
+            if (format != "binary_little_endian")
+            {
+                error = "only binary_little_endian PLY files are supported, not " + format;
+                return -1;
+            }
+        }
+        else if (keyword == "element")
+        {
+            elements.emplace_back();
+            line >> elements.back().name >> elements.back().count;
+        }
+        else if (keyword == "property")
+        {
+            if (elements.empty())
+            {
+                error = "property before the first element";
+                return -1;
+            }
+
+            PlyProperty property;
+            std::string type;
+            line >> type;
+            if (type == "list")
+            {
+                std::string count_type;
+                line >> count_type >> type;
+                property.is_list = true;
+                if (!parse_ply_type(count_type, property.count_type))
+                {
+                    error = "unknown property type " + count_type;
+                    return -1;
+                }
+            }
+            if (!parse_ply_type(type, property.type))
+            {
+                error = "unknown property type " + type;
+                return -1;
+            }
+            line >> property.name;
+            elements.back().properties.push_back(property);
+        }
+        else if (keyword == "end_header")
+        {
+            p = std::min(e + 1, end);
+            break;
+        }
+        else if (keyword != "comment" && keyword != "obj_info" && !keyword.empty())
+        {
+            error = "unknown header line " + trimmed(p, e);
+            return -1;
+        }
+    }
+
+    for (auto& element : elements)
+    {
+        size_t offset = 0;
+        bool has_lists = false;
+        for (auto& property : element.properties)
+        {
+            property.offset = offset;
+            offset += ply_type_size(property.type);
+            has_lists = has_lists || property.is_list;
+        }
+        element.stride = has_lists ? 0 : offset;
+    }
+    return 1;
+}
+
+}
+
+
+int MeshLoader::LoadPly(const std::string& filename, MeshData& mesh, float scale)
+{
+    TraceSpan trace("MeshLoader::LoadPly", "io");
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    std::cout << "ERROR: PLY files are only read on little endian hosts" << std::endl;
+    return -1;
+#endif
+
+    MappedFile file;
+    if (file.Open(filename) < 0)
+        return -1;
+    const char* p = file.GetData();
+    const char* data_end = p + file.GetSize();
+
+    std::vector<PlyElement> elements;
+    std::string error;
+    if (parse_ply_header(p, data_end, elements, error) < 0)
+    {
+        std::cout << "ERROR: " << filename << ": " << error << std::endl;
+        return -1;
+    }
+
+    // blocks of the elements, ones with lists are walked element by element
+    const char* vertex_data = nullptr;
+    const char* face_data = nullptr;
+    const PlyElement* vertex_element = nullptr;
+    const PlyElement* face_element = nullptr;
+    for (const auto& element : elements)
+    {
+        if (element.name == "vertex")
+        {
+            vertex_data = p;
+            vertex_element = &element;
+        }
+        else if (element.name == "face")
+        {
+            face_data = p;
+            face_element = &element;
+        }
+
+        if (element.stride > 0)
+        {
+            if ((size_t)(data_end - p) / element.stride < element.count)
+            {
+                p = nullptr;
+                break;
+            }
+            p += element.stride * element.count;
+        }
+        else if (&element == face_element)
+        {
+            // faces are the last block that is needed
+            break;
+        }
+        else
+        {
+            for (size_t i = 0; i < element.count && p; i++)
+            {
+                size_t size = ply_element_size(element, p, data_end);
+                p = size > 0 ? p + size : nullptr;
+            }
+            if (!p)
+                break;
+        }
+    }
+
+    if (!p || !vertex_element || !face_element || vertex_element->count == 0 || face_element->count == 0)
+    {
+        std::cout << "ERROR: " << filename << " has no vertices or faces or is truncated" << std::endl;
+        return -1;
+    }
+    if (vertex_element->stride == 0)
+    {
+        std::cout << "ERROR: " << filename << " has list properties of vertices" << std::endl;
+        return -1;
+    }
+
+    const PlyProperty* index_property = nullptr;
+    for (const auto& property : face_element->properties)
+    {
+        if (property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+            index_property = &property;
+    }
+    if (!index_property || index_property->type == PLY_FLOAT32 || index_property->type == PLY_FLOAT64)
+    {
+        std::cout << "ERROR: " << filename << " has no integer vertex_indices of faces" << std::endl;
+        return -1;
+    }
+
+    // index lists start at the offset of the property only if no list comes before it
+    size_t index_offset = 0;
+    bool offset_fixed = true;
+    for (const auto& property : face_element->properties)
+    {
+        if (&property == index_property)
+            break;
+        offset_fixed = offset_fixed && !property.is_list;
+        index_offset += ply_type_size(property.type);
+    }
+    if (!offset_fixed)
+    {
+        std::cout << "ERROR: " << filename << " has lists before the vertex indices of faces" << std::endl;
+        return -1;
+    }
+
+    size_t n_vertices = vertex_element->count;
+    size_t n_faces = face_element->count;
+    if (n_vertices > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has too many vertices or faces" << std::endl;
+        return -1;
+    }
+
+    // vertex attributes in the order of OpenGL::Vertex, missing ones are nullptr
+    const char* names[][4] = {
+        {"x"}, {"y"}, {"z"},
+        {"nx"}, {"ny"}, {"nz"},
+        {"red", "r"}, {"green", "g"}, {"blue", "b"}, {"alpha", "a"},
+        {"s", "u", "texture_u", "texture_s"}, {"t", "v", "texture_v", "texture_t"},
+    };
+    const int N_ATTRIBUTES = 12;
+    const PlyProperty* attributes[N_ATTRIBUTES] = {};
+    for (int k = 0; k < N_ATTRIBUTES; k++)
+    {
+        for (const auto& property : vertex_element->properties)
+        {
+            for (const char* name : names[k])
+            {
+                if (name && property.name == name)
+                    attributes[k] = &property;
+            }
+        }
+    }
+    if (!attributes[0] || !attributes[1] || !attributes[2])
+    {
+        std::cout << "ERROR: " << filename << " has no x, y and z of vertices" << std::endl;
+        return -1;
+    }
+
+    mesh.material_ids.clear();
+    mesh.mtl_filename.clear();
+    mesh.has_normals = attributes[3] && attributes[4] && attributes[5];
+    mesh.has_colors = attributes[6] && attributes[7] && attributes[8];
+    mesh.has_uvs = attributes[10] && attributes[11];
+
+    // the vertex block is converted in place of the mapping, in parallel
+    mesh.vertices.resize(n_vertices);
+    size_t stride = vertex_element->stride;
+    ParallelFor((n_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+    {
+        size_t end = std::min(n_vertices, (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < end; i++)
+        {
+            const char* q = vertex_data + i * stride;
+            OpenGL::Vertex& v = mesh.vertices[i];
+            v = OpenGL::Vertex();
+            v.b = 1.0f;
+            v.x = read_ply<float>(q + attributes[0]->offset, attributes[0]->type) * scale;
+            v.y = read_ply<float>(q + attributes[1]->offset, attributes[1]->type) * scale;
+            v.z = read_ply<float>(q + attributes[2]->offset, attributes[2]->type) * scale;
+            if (mesh.has_normals)
+            {
+                v.nx = read_ply<float>(q + attributes[3]->offset, attributes[3]->type);
+                v.ny = read_ply<float>(q + attributes[4]->offset, attributes[4]->type);
+                v.nz = read_ply<float>(q + attributes[5]->offset, attributes[5]->type);
+            }
+            if (mesh.has_colors)
+            {
+                v.r = read_ply_color(q + attributes[6]->offset, attributes[6]->type);
+                v.g = read_ply_color(q + attributes[7]->offset, attributes[7]->type);
+                v.b = read_ply_color(q + attributes[8]->offset, attributes[8]->type);
+                if (attributes[9])
+                    v.a = read_ply_color(q + attributes[9]->offset, attributes[9]->type);
+            }
+            if (mesh.has_uvs)
+            {
+                v.u = read_ply<float>(q + attributes[10]->offset, attributes[10]->type);
+                v.v = read_ply<float>(q + attributes[11]->offset, attributes[11]->type);
+            }
+        }
+    });
+
+    // Faces of only triangles with the index list as their single property
+    // have a fixed size and are copied in parallel. Others are walked face by
+    // face to find where each one starts.
+    size_t count_size = ply_type_size(index_property->count_type);
+    size_t index_size = ply_type_size(index_property->type);
+    size_t triangle_stride = count_size + 3 * index_size;
+    bool fixed = face_element->properties.size() == 1 && (size_t)(data_end - face_data) / triangle_stride >= n_faces;
+    if (fixed)
+    {
+        std::atomic<bool> triangles(true);
+        ParallelFor((n_faces + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+        {
+            size_t end = std::min(n_faces, (block + 1) * BLOCK_SIZE);
+            for (size_t i = block * BLOCK_SIZE; i < end && triangles; i++)
+            {
+                if (read_ply<size_t>(face_data + i * triangle_stride, index_property->count_type) != 3)
+                    triangles = false;
+            }
+        });
+        fixed = triangles;
+    }
+
+    std::vector<size_t> face_offsets;
+    std::vector<size_t> triangle_offsets;
+    size_t n_triangles = n_faces;
+    if (!fixed)
+    {
+        face_offsets.resize(n_faces);
+        triangle_offsets.resize(n_faces);
+        n_triangles = 0;
+        const char* q = face_data;
+        for (size_t i = 0; i < n_faces; i++)
+        {
+            size_t size = ply_element_size(*face_element, q, data_end);
+            if (size == 0)
+            {
+                std::cout << "ERROR: " << filename << " is truncated" << std::endl;
+                return -1;
+            }
+            size_t n = read_ply<size_t>(q + index_offset, index_property->count_type);
+            face_offsets[i] = q - face_data;
+            triangle_offsets[i] = n_triangles;
+            n_triangles += n >= 3 ? n - 2 : 0;
+            q += size;
+        }
+    }
+    if (n_triangles == 0 || 3 * n_triangles > (size_t)std::numeric_limits<unsigned int>::max())
+    {
+        std::cout << "ERROR: " << filename << " has no or too many faces" << std::endl;
+        return -1;
+    }
+
+    mesh.indices.resize(3 * n_triangles);
+    std::atomic<bool> valid(true);
+    PlyType type = index_property->type;
+    ParallelFor((n_faces + BLOCK_SIZE - 1) / BLOCK_SIZE, [&](size_t block)
+    {
+        size_t end = std::min(n_faces, (block + 1) * BLOCK_SIZE);
+        for (size_t i = block * BLOCK_SIZE; i < end; i++)
+        {
+            const char* f = face_data + (fixed ? i * triangle_stride : face_offsets[i]) + index_offset;
+            size_t n = fixed ? 3 : read_ply<size_t>(f, index_property->count_type);
+            const char* list = f + count_size;
+            unsigned int* indices = mesh.indices.data() + 3 * (fixed ? i : triangle_offsets[i]);
+
+            // triangle fan
+            long first = read_ply<long>(list, type);
+            for (size_t j = 2; j < n; j++)
+            {
+                long i1 = read_ply<long>(list + (j - 1) * index_size, type);
+                long i2 = read_ply<long>(list + j * index_size, type);
+                if (first < 0 || i1 < 0 || i2 < 0 || (size_t)first >= n_vertices || (size_t)i1 >= n_vertices || (size_t)i2 >= n_vertices)
+                    valid = false;
+                indices[0] = first;
+                indices[1] = i1;
+                indices[2] = i2;
+                indices += 3;
+            }
+        }
+    });
+    if (!valid)
+    {
+        std::cout << "ERROR: " << filename << " has faces with invalid vertex indices" << std::endl;
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,136 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <algorithm>
+
+#include "opengl_helper.h"
+#include "thread_pool.h"
+
+
+// Triangle mesh in the vertex layout of the renderer, every vertex is a
+// unique combination of position, texture coordinate and normal of the file.
+struct MeshData
+{
+    std::vector<OpenGL::Vertex> vertices;
+    std::vector<unsigned int> indices;      // 3 per face
+    std::vector<unsigned int> material_ids; // per face, empty if the file has no materials
+    std::string mtl_filename;               // library the material ids refer to, empty if there is none
+    bool has_normals = false;
+    bool has_uvs = false;
+    bool has_colors = false;
+};
+
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // a writable mapping is copy on write, changes stay in the process
+    int Open(const std::string& filename, bool writable=false);
+
+    void Close();
+
+    const char* GetData() const
+    {
+        return (const char*)data;
+    }
+
+    char* GetData()
+    {
+        return (char*)data;
+    }
+
+    size_t GetSize() const
+    {
+        return size;
+    }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+};
+
+
+// Mesh file readers. Files are memory mapped and parsed in chunks on a
+// thread pool shared by all loaders of the process.
+class MeshLoader
+{
+public:
+    // reader chosen by the file extension
+    static int Load(const std::string& filename, MeshData& mesh, float scale=1.0f);
+
+    // Wavefront OBJ with triangles or polygons (triangulated as fans),
+    // negative indices and vertex colors (v x y z r g b). Material ids follow
+    // the order of the materials in the mtllib, faces before the first usemtl
+    // and unknown materials get id 0.
+    static int LoadObj(const std::string& filename, MeshData& mesh, float scale=1.0f);
+
+    // ASCII [ST][C][N]OFF with polygons (triangulated as fans) and big endian
+    // OFF BINARY. Integer colors are in [0, 255], float colors in [0, 1].
+    static int LoadOff(const std::string& filename, MeshData& mesh, float scale=1.0f);
+
+    // Binary little endian PLY, the vertex block is converted in parallel and
+    // faces that are all triangles are copied without walking the lists
+    static int LoadPly(const std::string& filename, MeshData& mesh, float scale=1.0f);
+
+    // Binary glTF 2.0 with the meshes of the default scene in world space.
+    // Accessors are read in place from the buffer views of the mapped file,
+    // material ids are the materials of the primitives and mtl_filename is
+    // the GLB file itself (see LoadGlbMaterials).
+    static int LoadGlb(const std::string& filename, MeshData& mesh, float scale=1.0f);
+
+    // base colors of the materials of a GLB file, embedded images are
+    // registered as OpenGL::EmbeddedImage and decoded from the mapping
+    static int LoadGlbMaterials(const std::string& filename, std::vector<OpenGL::Material>& materials);
+
+    // runs f(i) for i in [0, n) on the pool, blocks until all are done
+    template<typename F>
+    static void ParallelFor(size_t n, F f);
+
+private:
+    // created again in forked children
+    static ThreadPool& Pool();
+};
+
+
+template<typename F>
+void MeshLoader::ParallelFor(size_t n, F f)
+{
+    if (n <= 1)
+    {
+        if (n == 1)
+            f(0);
+        return;
+    }
+
+    // workers take the next index, so uneven chunks are balanced
+    ThreadPool& pool = Pool();
+    std::atomic<size_t> next(0);
+    size_t n_workers = std::min(n, pool.GetNumberOfThreads());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        futures.push_back(pool.Submit([&]()
+        {
+            for (size_t j = next++; j < n; j = next++)
+                f(j);
+        }));
+    }
+    for (auto& future : futures)
+        future.get();
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "opengl_helper.h"
+#include "mesh_loader.h"
+#include "profiler.h"
 
 #ifndef NO_FREEIMAGE
 #include "deps/FreeImageHelper.h"
@@ -7,7 +9,16 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "deps/tiny_obj_loader.h"
 #include <unordered_map>
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <iomanip>
+#include <cstdio>
+#include <unistd.h>
+
+#include "deps/path.h"
+#include "shaders/embedded_shaders.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "deps/stb_image.h"
@@ -73,7 +84,12 @@ EGLDisplay EGL::GetEGLDisplayFromNative(NativeDisplayType native_display)
     return eglDisplay;
 }
 
-int EGL::Init(unsigned int width, unsigned int height)
+// several contexts (e.g. the workers of a render pool) may share one display,
+// which must only be terminated when the last of them is gone
+static std::mutex egl_display_mutex;
+static std::map<EGLDisplay, int> egl_display_references;
+
+int EGL::Init(unsigned int width, unsigned int height, int device_id)
 {        
     pbufferWidth = (int)width;
     pbufferHeight = (int)height;
@@ -87,8 +103,11 @@ int EGL::Init(unsigned int width, unsigned int height)
     // https://gist.github.com/andyneff/36293b1aeb509fd1c6313afabac777ee
     // 1. Initialize EGL
     {
-        std::cout << "EGL_DEVICE_ID environment variable is set to: " << std::getenv("EGL_DEVICE_ID") << std::endl;
-        EGLint device_id = std::atoi(std::getenv("EGL_DEVICE_ID"));
+        if (device_id < 0 && std::getenv("EGL_DEVICE_ID") != nullptr)
+        {
+            std::cout << "EGL_DEVICE_ID environment variable is set to: " << std::getenv("EGL_DEVICE_ID") << std::endl;
+            device_id = std::atoi(std::getenv("EGL_DEVICE_ID"));
+        }
 
         PFNEGLQUERYDEVICESEXTPROC eglQueryDevicesEXT = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
         checkEglError("Failed to get EGLEXT: eglQueryDevicesEXT");
@@ -107,19 +126,20 @@ int EGL::Init(unsigned int width, unsigned int height)
             checkEglError("Error getting number of devices: eglQueryDevicesEXT");
             std::cerr << numberDevices << " EGL devices found." << std::endl;
 
-            if (numberDevices > 0)
-            {
-                eglDevs = new EGLDeviceEXT[numberDevices];
-                checkEglReturn(eglQueryDevicesEXT(numberDevices, eglDevs, &numberDevices), "Failed to get devices. Bad parameter suspected");
-                checkEglError("Error getting number of devices: eglQueryDevicesEXT");
-
-                egl_display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[device_id], 0);
-                checkEglError("Error getting Platform Display: eglGetPlatformDisplayEXT");
-            }
-            else
+            // a wrong id would silently render every worker on the default device
+            if (device_id >= numberDevices)
             {
-                egl_display = GetEGLDisplayFromNative();
+                std::cout << "ERROR: EGL device " << device_id << " does not exist, " << numberDevices << " devices found" << std::endl;
+                return 0;
             }
+
+            eglDevs = new EGLDeviceEXT[numberDevices];
+            checkEglReturn(eglQueryDevicesEXT(numberDevices, eglDevs, &numberDevices), "Failed to get devices. Bad parameter suspected");
+            checkEglError("Error getting number of devices: eglQueryDevicesEXT");
+
+            egl_display = eglGetPlatformDisplayEXT(EGL_PLATFORM_DEVICE_EXT, eglDevs[device_id], 0);
+            checkEglError("Error getting Platform Display: eglGetPlatformDisplayEXT");
+            delete[] eglDevs;
         }
         else
         {
@@ -151,14 +171,22 @@ int EGL::Init(unsigned int width, unsigned int height)
             std::cerr << "Unknown error: " << error << std::endl;
             break;
         }
+        egl_display = EGL_NO_DISPLAY;
         return 0;
     }
     std::cout << "EGL version: " << egl_major_ver << "." << egl_minor_ver << std::endl;
 
+    // from here on every error has to release the reference again
+    {
+        std::lock_guard<std::mutex> lock(egl_display_mutex);
+        egl_display_references[egl_display]++;
+    }
+
     char const * client_apis = eglQueryString(egl_display, EGL_CLIENT_APIS);
     if(!client_apis)
     {
         std::cerr << "Failed to eglQueryString(egl_display, EGL_CLIENT_APIS)" << std::endl;
+        Release();
         return 0;
     }
     std::cout << "Supported client rendering APIs: " << client_apis << std::endl;
@@ -175,18 +203,30 @@ int EGL::Init(unsigned int width, unsigned int height)
         EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
         EGL_NONE
     }; 
-    eglChooseConfig(egl_display, configAttribs, &eglCfg, 1, &numConfigs);
+    if (!eglChooseConfig(egl_display, configAttribs, &eglCfg, 1, &numConfigs) || numConfigs < 1)
+    {
+        std::cout << "ERROR: no EGL config with a pbuffer and OpenGL" << std::endl;
+        Release();
+        return 0;
+    }
 
     // 3. Bind the API
     if(!eglBindAPI(EGL_OPENGL_API))
     {
         std::cout << "ERROR: unable to bind opengl API" << std::endl;
+        Release();
         return 0;
     }
 
 
     // 4. Create a surface
     egl_surface = eglCreatePbufferSurface(egl_display, eglCfg, pbufferAttribs);
+    if (egl_surface == EGL_NO_SURFACE)
+    {
+        eglPrintError("eglCreatePbufferSurface");
+        Release();
+        return 0;
+    }
 
     // 5. Create a context and make it current
     GLint gl_req_major_ver = 4;
@@ -230,11 +270,17 @@ int EGL::Init(unsigned int width, unsigned int height)
             std::cerr << "Unknown error: " << error << std::endl;
             break;
         }
+        Release();
         return 0;
     }
 
     // 6. connect the context to the surface
-    if(!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) eglPrintErrorAndExit("eglMakeCurrent");
+    if(!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context))
+    {
+        eglPrintError("eglMakeCurrent");
+        Release();
+        return 0;
+    }
 
 
     printf("OpenGL version: %s\n", glGetString(GL_VERSION));
@@ -246,12 +292,47 @@ int EGL::Init(unsigned int width, unsigned int height)
         std::cout << "glewInit failed: " << glewGetErrorString(err) << std::endl;            
         std::cout << "Are you sure that you are using GLEW>2.1?" << std::endl;
         std::cout << "Build GLEW2.1 with 'make SYSTEM=linux-egl'" << std::endl;
+        Release();
         return 0;
     } 
 
     return 1;
 }
 
+void EGL::Terminate()
+{
+    // Terminate EGL when finished
+    std::cout << "Terminate EGL" << std::endl;
+    Release();
+}
+
+void EGL::Release()
+{
+    if (egl_display == EGL_NO_DISPLAY)
+        return;
+
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_context != EGL_NO_CONTEXT)
+        eglDestroyContext(egl_display, egl_context);
+    if (egl_surface != EGL_NO_SURFACE)
+        eglDestroySurface(egl_display, egl_surface);
+    egl_context = EGL_NO_CONTEXT;
+    egl_surface = EGL_NO_SURFACE;
+
+    std::lock_guard<std::mutex> lock(egl_display_mutex);
+    if (--egl_display_references[egl_display] <= 0)
+    {
+        egl_display_references.erase(egl_display);
+        eglTerminate(egl_display);
+    }
+    egl_display = EGL_NO_DISPLAY;
+}
+
+void EGL::ForgetDisplays()
+{
+    egl_display_references.clear();
+}
+
 void EGL::SaveScreenshotPPM(const std::string& filename)
 {
     // https://gitlab.kitware.com/third-party/nvpipe/blob/f95cd926b8794bc3ecd50baa97e20f8d56d47c0c/doc/egl-example/egl-example.cpp
@@ -296,7 +377,10 @@ void Texture::Init(const char* filename)
         std::cout << " " << "Width: " << width << std::endl;
         std::cout << " " << "Height: " << height << std::endl;
         std::cout << " " << "# Channels: " << n_channels << std::endl;
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        static const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, formats[n_channels - 1], width, height, 0, formats[n_channels - 1], GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
         glGenerateMipmap(GL_TEXTURE_2D);
     }
     else
@@ -306,15 +390,462 @@ void Texture::Init(const char* filename)
 
     stbi_image_free(data);
 
+    width = 0;
+    height = 0;
+    levels = 1;
+    immutable = false;
     state = InternalState::INITIALIZED;
 }
 
+int Texture::Init(unsigned int _width, unsigned int _height, GLenum _internal_format, unsigned int _levels)
+{
+    width = _width;
+    height = _height;
+    internal_format = _internal_format;
+    levels = _levels > 0 ? _levels : 1;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internal_format, width, height);
+    if (glGetError() != GL_NO_ERROR)
+    {
+        std::cout << "ERROR: allocating texture storage " << width << "x" << height << " failed" << std::endl;
+        glDeleteTextures(1, &texture);
+        return -1;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+    immutable = true;
+    state = InternalState::INITIALIZED;
+    return 1;
+}
+
+// bytes per texel of the uncompressed formats that textures are allocated with
+static size_t BytesPerTexel(GLenum internal_format)
+{
+    switch (internal_format)
+    {
+        case GL_R8: return 1;
+        case GL_RG8: return 2;
+        case GL_RGB8: case GL_SRGB8: return 3;
+        case GL_RGBA8: case GL_SRGB8_ALPHA8: return 4;
+        case GL_R32F: return 4;
+        case GL_RG32F: return 8;
+        case GL_RGB32F: return 12;
+        case GL_RGBA32F: return 16;
+        default: return 4;
+    }
+}
+
+size_t Texture::GetMemoryUsage() const
+{
+    if (!IsInitialized())
+        return 0;
+
+    size_t bytes = 0;
+    for (unsigned int level = 0; level < levels; level++)
+        bytes += (size_t)std::max(width >> level, 1u) * std::max(height >> level, 1u) * BytesPerTexel(internal_format);
+    return bytes;
+}
+
+int Texture::Update(const void* data, bool data_on_cuda, unsigned int x, unsigned int y, unsigned int _width, unsigned int _height,
+                    GLenum format, GLenum type, unsigned int bytes_per_pixel, bool generate_mipmaps)
+{
+    if (!IsInitialized() || !immutable)
+    {
+        std::cout << "ERROR: texture has no storage to update" << std::endl;
+        return -1;
+    }
+
+    if (x + _width > width || y + _height > height)
+    {
+        std::cout << "ERROR: texture update " << _width << "x" << _height << " at (" << x << ", " << y << ") exceeds the texture " << width << "x" << height << std::endl;
+        return -1;
+    }
+
+    #ifdef NO_CUDA
+    if (data_on_cuda)
+    {
+        std::cout << "ERROR: built without CUDA, texture data has to be in host memory" << std::endl;
+        return -1;
+    }
+    #endif
+
+    size_t size = (size_t)_width * _height * bytes_per_pixel;
+    if (size > pbo_size)
+    {
+        #ifndef NO_CUDA
+        if (pbo_resource)
+        {
+            checkCudaErrors(cudaGraphicsUnregisterResource(pbo_resource));
+            pbo_resource = nullptr;
+        }
+        #endif
+        if (pbo == 0)
+        {
+            glGenBuffers(1, &pbo);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        pbo_size = size;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+
+    #ifndef NO_CUDA
+    if (data_on_cuda)
+    {
+        // device tensors are copied into the buffer without leaving the GPU
+        if (!pbo_resource)
+        {
+            checkCudaErrors(cudaGraphicsGLRegisterBuffer(&pbo_resource, pbo, cudaGraphicsRegisterFlagsWriteDiscard));
+        }
+        void* pbo_ptr;
+        size_t mapped_size;
+        checkCudaErrors(cudaGraphicsMapResources(1, &pbo_resource));
+        checkCudaErrors(cudaGraphicsResourceGetMappedPointer(&pbo_ptr, &mapped_size, pbo_resource));
+        checkCudaErrors(cudaMemcpy(pbo_ptr, data, size, cudaMemcpyDeviceToDevice));
+        checkCudaErrors(cudaGraphicsUnmapResources(1, &pbo_resource));
+    }
+    else
+    #endif
+    {
+        // orphan the previous contents, so the upload does not wait for the last one
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo_size, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, size, data);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, _width, _height, format, type, nullptr);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        std::cout << "ERROR: uploading texture failed" << std::endl;
+        return -1;
+    }
+
+    if (generate_mipmaps && levels > 1)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    return 1;
+}
+
+int Texture::UploadLevel(unsigned int level, unsigned int level_width, unsigned int level_height,
+                         GLenum format, GLenum type, const void* data, size_t size)
+{
+    if (!IsInitialized() || !immutable || level >= levels)
+    {
+        std::cout << "ERROR: texture has no storage for level " << level << std::endl;
+        return -1;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (type == 0)
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, level_width, level_height, format, size, data);
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, level_width, level_height, format, type, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        std::cout << "ERROR: uploading texture level " << level << " failed" << std::endl;
+        return -1;
+    }
+    return 1;
+}
+
+void Texture::ReleaseUploadBuffer()
+{
+    #ifndef NO_CUDA
+    if (pbo_resource)
+    {
+        cudaGraphicsUnregisterResource(pbo_resource);
+        pbo_resource = nullptr;
+    }
+    #endif
+    if (pbo != 0)
+    {
+        glDeleteBuffers(1, &pbo);
+        pbo = 0;
+        pbo_size = 0;
+    }
+}
+
+void Texture::Terminate()
+{
+    ReleaseUploadBuffer();
+
+    if (state == InternalState::INITIALIZED)
+    {
+        state = InternalState::UNINITIALIZED;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glDeleteTextures(1, &texture);
+    }
+    immutable = false;
+    origin_top = false;
+}
+
+// Materials
+
+int LoadMtlFile(const std::string& filename, std::vector<Material>& materials)
+{
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: unable to open material file: " << filename << std::endl;
+        return -1;
+    }
+
+    std::map<std::string, int> material_map;
+    std::vector<tinyobj::material_t> mtl_materials;
+    std::string warn, err;
+    tinyobj::LoadMtl(&material_map, &mtl_materials, &file, &warn, &err);
+    if (!err.empty())
+    {
+        std::cout << "ERROR: reading material file " << filename << " failed: " << err << std::endl;
+        return -1;
+    }
+
+    path directory = path(filename).parent_path();
+    materials.clear();
+    for (const auto& m : mtl_materials)
+    {
+        Material material;
+        material.name = m.name;
+        material.diffuse = OpenGL::vec4(m.diffuse[0], m.diffuse[1], m.diffuse[2], 1.0f);
+        if (!m.diffuse_texname.empty())
+        {
+            material.diffuse_texture = (directory / m.diffuse_texname).str();
+        }
+        materials.push_back(material);
+    }
+
+    return 1;
+}
+
+// the registry does not keep the images alive, see AddEmbeddedImage
+struct RegisteredImage
+{
+    const unsigned char* data;
+    size_t size;
+    long stamp;
+    long generation;
+    std::weak_ptr<const void> owner;
+};
+
+static std::mutex embedded_images_mutex;
+static std::map<std::string, RegisteredImage> embedded_images;
+static long embedded_images_generation = 0;
+
+EmbeddedImage AddEmbeddedImage(const std::string& name, const EmbeddedImage& image)
+{
+    std::lock_guard<std::mutex> lock(embedded_images_mutex);
+
+    // images of released materials are dropped with their owners
+    for (auto it = embedded_images.begin(); it != embedded_images.end();)
+        it = it->second.owner.expired() ? embedded_images.erase(it) : std::next(it);
+
+    // e.g. the same file loaded by every context of a pool
+    auto search = embedded_images.find(name);
+    if (search != embedded_images.end() && search->second.stamp == image.stamp)
+    {
+        std::shared_ptr<const void> owner = search->second.owner.lock();
+        if (owner)
+            return {search->second.data, search->second.size, search->second.stamp, search->second.generation, owner};
+    }
+
+    EmbeddedImage registered = image;
+    registered.generation = ++embedded_images_generation;
+    embedded_images[name] = {registered.data, registered.size, registered.stamp, registered.generation, registered.owner};
+    return registered;
+}
+
+bool FindEmbeddedImage(const std::string& name, EmbeddedImage& image)
+{
+    std::lock_guard<std::mutex> lock(embedded_images_mutex);
+    auto search = embedded_images.find(name);
+    if (search == embedded_images.end())
+        return false;
+
+    std::shared_ptr<const void> owner = search->second.owner.lock();
+    if (!owner)
+    {
+        embedded_images.erase(search);
+        return false;
+    }
+    image = {search->second.data, search->second.size, search->second.stamp, search->second.generation, owner};
+    return true;
+}
+
+void GroupFacesByMaterial(unsigned int* indices, unsigned int* material_ids, unsigned int n_faces)
+{
+    // counting sort, material ids are small and dense
+    unsigned int n_materials = 0;
+    for (unsigned int i = 0; i < n_faces; i++)
+        n_materials = std::max(n_materials, material_ids[i] + 1);
+
+    std::vector<unsigned int> offsets(n_materials + 1, 0);
+    for (unsigned int i = 0; i < n_faces; i++)
+        offsets[material_ids[i] + 1]++;
+    for (unsigned int m = 0; m < n_materials; m++)
+        offsets[m + 1] += offsets[m];
+
+    std::vector<unsigned int> grouped_indices(3 * n_faces);
+    std::vector<unsigned int> grouped_ids(n_faces);
+    for (unsigned int i = 0; i < n_faces; i++)
+    {
+        unsigned int j = offsets[material_ids[i]]++;
+        std::copy(indices + 3 * i, indices + 3 * i + 3, grouped_indices.begin() + 3 * j);
+        grouped_ids[j] = material_ids[i];
+    }
+
+    std::copy(grouped_indices.begin(), grouped_indices.end(), indices);
+    std::copy(grouped_ids.begin(), grouped_ids.end(), material_ids);
+}
+
+int MaterialArray::Init(const std::vector<Material>& materials)
+{
+    Terminate();
+
+    struct Image
+    {
+        unsigned char* data = nullptr;
+        int width = 0, height = 0;
+    };
+    std::vector<Image> images(materials.size());
+
+    // embedded textures stay registered while the materials are in use
+    for (const auto& material : materials)
+    {
+        if (material.texture_owner)
+            texture_owners.push_back(material.texture_owner);
+    }
+
+    // all layers are decoded as RGBA, regardless of the channels in the file
+    stbi_set_flip_vertically_on_load(true);
+    int max_width = 0, max_height = 0, n_layers = 0;
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        if (materials[i].diffuse_texture.empty())
+            continue;
+
+        int n_channels;
+        EmbeddedImage embedded;
+        if (FindEmbeddedImage(materials[i].diffuse_texture, embedded))
+            images[i].data = stbi_load_from_memory(embedded.data, (int)embedded.size, &images[i].width, &images[i].height, &n_channels, 4);
+        else
+            images[i].data = stbi_load(materials[i].diffuse_texture.c_str(), &images[i].width, &images[i].height, &n_channels, 4);
+        if (!images[i].data)
+        {
+            std::cout << "WARNING: failed to load texture of material " << materials[i].name << " from " << materials[i].diffuse_texture << std::endl;
+            continue;
+        }
+        max_width = std::max(max_width, images[i].width);
+        max_height = std::max(max_height, images[i].height);
+        n_layers++;
+    }
+
+    std::vector<Parameters> parameters(materials.size());
+    if (n_layers > 0)
+    {
+        GLsizei levels = 1;
+        while ((std::max(max_width, max_height) >> levels) > 0)
+            levels++;
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, max_width, max_height, n_layers);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    }
+
+    int layer = 0;
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        parameters[i].diffuse = materials[i].diffuse;
+        parameters[i].texture_transform = OpenGL::vec4(1.0f, 1.0f, -1.0f, 0.0f);
+        if (!images[i].data)
+            continue;
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, images[i].width, images[i].height, 1, GL_RGBA, GL_UNSIGNED_BYTE, images[i].data);
+        parameters[i].texture_transform = OpenGL::vec4((float)images[i].width / max_width, (float)images[i].height / max_height, (float)layer, 0.0f);
+        stbi_image_free(images[i].data);
+        layer++;
+    }
+
+    if (n_layers > 0)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        std::cout << " " << "Material textures: " << n_layers << " layers of " << max_width << "x" << max_height << std::endl;
+    }
+
+    glGenBuffers(1, &ssbo);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Parameters)*std::max<size_t>(parameters.size(), 1), parameters.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    n_materials = materials.size();
+    bytes = sizeof(Parameters)*std::max<size_t>(parameters.size(), 1);
+    if (n_layers > 0)
+        bytes += (size_t)max_width * max_height * n_layers * 4 * 4 / 3;
+
+    if (glGetError() != GL_NO_ERROR)
+    {
+        std::cout << "ERROR: creating material array failed" << std::endl;
+        Terminate();
+        return -1;
+    }
+
+    return 1;
+}
+
+void MaterialArray::Terminate()
+{
+    if (texture != 0)
+    {
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+    if (ssbo != 0)
+    {
+        glDeleteBuffers(1, &ssbo);
+        ssbo = 0;
+    }
+    n_materials = 0;
+    bytes = 0;
+    texture_owners.clear();
+}
+
+void MaterialArray::Use()
+{
+    glActiveTexture(GL_TEXTURE0 + MATERIAL_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, ssbo);
+}
+
 // RenderTarget
 
-int RenderTarget::Init(unsigned int _width, unsigned int _height)
+int RenderTarget::Init(unsigned int _width, unsigned int _height, unsigned int _outputs)
 {
     width = _width;
     height = _height;
+    outputs = _outputs;
+
+    // internal format and format of color, position, normal, uv, bary and vids
+    static const GLenum internal_formats[NUM_GRAPHICS_RESOURCES] = {GL_RGBA32F, GL_RGB32F, GL_RGB32F, GL_RG32F, GL_RGBA32F, GL_RGBA32F};
+    static const GLenum formats[NUM_GRAPHICS_RESOURCES] = {GL_RGBA, GL_RGB, GL_RGB, GL_RG, GL_RGBA, GL_RGBA};
 
     /////////////////////////
     ///// Framebuffers //////
@@ -322,48 +853,26 @@ int RenderTarget::Init(unsigned int _width, unsigned int _height)
     //http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-14-render-to-texture/
     glGenFramebuffers(1, &fbo);
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    
-    // color texture to render to   
-    glGenTextures(1, &color_texture);
-    glBindTexture(GL_TEXTURE_2D, color_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // position texture to render to   
-    glGenTextures(1, &position_texture);
-    glBindTexture(GL_TEXTURE_2D, position_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // normal texture
-    glGenTextures(1, &normal_texture);
-    glBindTexture(GL_TEXTURE_2D, normal_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // uv texture
-    glGenTextures(1, &uv_texture);
-    glBindTexture(GL_TEXTURE_2D, uv_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, width, height, 0, GL_RG, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // bary texture
-    glGenTextures(1, &bary_texture);
-    glBindTexture(GL_TEXTURE_2D, bary_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    // vids texture
-    glGenTextures(1, &vids_texture);
-    glBindTexture(GL_TEXTURE_2D, vids_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // textures to render to, draw buffers of maps that are not requested
+    // are set to GL_NONE so that the fragment shader output is dropped
+    GLenum DrawBuffers[NUM_GRAPHICS_RESOURCES];
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (!HasOutput(i))
+        {
+            DrawBuffers[i] = GL_NONE;
+            continue;
+        }
+
+        glGenTextures(1, &textures[i]);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_formats[i], width, height, 0, formats[i], GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textures[i], 0);
+        DrawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
 
     // The depth buffer  
     glGenRenderbuffers(1, &depth_buffer);
@@ -371,19 +880,8 @@ int RenderTarget::Init(unsigned int _width, unsigned int _height)
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
 
-    // Set "color_texture" as our colour attachement #0
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, position_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, normal_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, uv_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, bary_texture, 0);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT5, vids_texture, 0);
-
     // Set the list of draw buffers.
-    GLenum DrawBuffers[6] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
-                             GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
-                             GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5};
-    glDrawBuffers(6, DrawBuffers);
+    glDrawBuffers(NUM_GRAPHICS_RESOURCES, DrawBuffers);
 
     // Always check that our framebuffer is ok
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -392,25 +890,53 @@ int RenderTarget::Init(unsigned int _width, unsigned int _height)
         return -1;
     }
 
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[0], color_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[1], position_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[2], normal_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[3], uv_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[4], bary_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
-    checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[5], vids_texture, GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (!HasOutput(i))
+            continue;
 
-    cudaMalloc((void**)&(buffer[0]), width*height*4*sizeof(float));
-    cudaMalloc((void**)&(buffer[1]), width*height*4*sizeof(float));
-    cudaMalloc((void**)&(buffer[2]), width*height*4*sizeof(float));
-    cudaMalloc((void**)&(buffer[3]), width*height*2*sizeof(float));
-    cudaMalloc((void**)&(buffer[4]), width*height*4*sizeof(float));
-    cudaMalloc((void**)&(buffer[5]), width*height*4*sizeof(float));
+        #ifndef NO_CUDA
+        checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[i], textures[i], GL_TEXTURE_2D, cudaGraphicsRegisterFlagsNone));
+        #endif
+    }
 
     return 1;
 }
 
-void RenderTarget::CopyRenderedTexturesToCUDA(bool copy_to_host)
+void RenderTarget::CopyRenderedTexturesToCUDA(bool copy_to_host, float* const* destinations)
 {
+    TraceSpan trace("RenderTarget::CopyRenderedTexturesToCUDA");
+    // the buffers of the target are only needed by callers without destinations
+    if (!destinations)
+    {
+        for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+        {
+            if (!HasOutput(i) || buffer[i])
+                continue;
+
+            #ifndef NO_CUDA
+            checkCudaErrors(cudaMalloc((void**)&(buffer[i]), width*height*GetNumberOfChannels(i)*sizeof(float)));
+            #else
+            buffer[i] = new float[width*height*GetNumberOfChannels(i)];
+            #endif
+        }
+        destinations = buffer;
+    }
+
+    #ifdef NO_CUDA
+    // the buffers are in host memory already
+    (void)copy_to_host;
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (!HasOutput(i))
+            continue;
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GetNumberOfChannels(i) == 2 ? GL_RG : GL_RGBA, GL_FLOAT, destinations[i]);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    #else
     cudaMemcpyKind copy_mode;
     
     if (copy_to_host) {
@@ -418,37 +944,33 @@ void RenderTarget::CopyRenderedTexturesToCUDA(bool copy_to_host)
     } else {
         copy_mode = cudaMemcpyDeviceToDevice;
     }
-     
-    checkCudaErrors(cudaGraphicsMapResources(NUM_GRAPHICS_RESOURCES, graphics_resource));
+
+    cudaGraphicsResource_t mapped_resources[NUM_GRAPHICS_RESOURCES];
+    int n_mapped = 0;
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (HasOutput(i))
+            mapped_resources[n_mapped++] = graphics_resource[i];
+    }
+
+    checkCudaErrors(cudaGraphicsMapResources(n_mapped, mapped_resources));
     cudaArray* cuda_array;
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[0], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[0], width*sizeof(float)*4, cuda_array, 0, 0, width*sizeof(float)*4, height, copy_mode));
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[1], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[1], width*sizeof(float)*4, cuda_array, 0, 0, width*sizeof(float)*4, height, copy_mode));
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[2], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[2], width*sizeof(float)*4, cuda_array, 0, 0, width*sizeof(float)*4, height, copy_mode));
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[3], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[3], width*sizeof(float)*2, cuda_array, 0, 0, width*sizeof(float)*2, height, copy_mode));
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[4], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[4], width*sizeof(float)*4, cuda_array, 0, 0, width*sizeof(float)*4, height, copy_mode));
-    checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[5], 0, 0));
-    checkCudaErrors(cudaMemcpy2DFromArray(buffer[5], width*sizeof(float)*4, cuda_array, 0, 0, width*sizeof(float)*4, height, copy_mode));
-    checkCudaErrors(cudaGraphicsUnmapResources(NUM_GRAPHICS_RESOURCES, graphics_resource));
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (!HasOutput(i))
+            continue;
+
+        size_t pitch = width*sizeof(float)*GetNumberOfChannels(i);
+        checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[i], 0, 0));
+        checkCudaErrors(cudaMemcpy2DFromArray(destinations[i], pitch, cuda_array, 0, 0, pitch, height, copy_mode));
+    }
+    checkCudaErrors(cudaGraphicsUnmapResources(n_mapped, mapped_resources));
+    #endif
 }
 
 void RenderTarget::WriteDataToFile(const std::string& filename, float* data, unsigned int tex_id)
 {
-    size_t format_nchannels = 4;
-    switch (tex_id)
-    {
-        case 0:  break;
-        case 1:  break;
-        case 2:  break;
-        case 3:  format_nchannels = 2; break;
-        case 4:  break;
-        case 5:  break;
-        default: break;
-    }
+    size_t format_nchannels = GetNumberOfChannels(tex_id);
 
     FreeImage image(width, height, format_nchannels);
     std::memcpy(image.data, data, width*height*format_nchannels*sizeof(float));
@@ -460,19 +982,15 @@ void RenderTarget::WriteDataToFile(const std::string& filename, float* data, uns
 
 void RenderTarget::WriteToFile(const std::string& filename, unsigned int tex_id, bool yFlip)
 {
-    GLuint texture_id = color_texture;
-    size_t format_nchannels = 4;
-    switch (tex_id)
+    if (tex_id >= NUM_GRAPHICS_RESOURCES || !HasOutput(tex_id))
     {
-        case 0:  texture_id = color_texture; break;
-        case 1:  texture_id = position_texture; break;
-        case 2:  texture_id = normal_texture; break;
-        case 3:  texture_id = uv_texture; format_nchannels = 2; break;
-        case 4:  texture_id = bary_texture; break;
-        case 5:  texture_id = vids_texture; break;
-        default: texture_id = color_texture; break;
+        std::cout << "WARNING: map " << tex_id << " is not rendered, unable to write image file:" << filename << std::endl;
+        return;
     }
 
+    GLuint texture_id = textures[tex_id];
+    size_t format_nchannels = GetNumberOfChannels(tex_id);
+
     glBindTexture(GL_TEXTURE_2D, texture_id);
     //https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/glGetTexImage.xhtml
     #ifndef NO_FREEIMAGE
@@ -505,44 +1023,278 @@ void RenderTarget::WriteToFile(const std::string& filename, unsigned int tex_id,
     #endif
 }
 
-void RenderTarget::Terminate()
+void RenderTarget::Terminate()
+{
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (!HasOutput(i))
+            continue;
+
+        #ifndef NO_CUDA
+        cudaGraphicsUnregisterResource(graphics_resource[i]);
+        cudaFree(buffer[i]);
+        #else
+        delete[] buffer[i];
+        #endif
+        glDeleteTextures(1, &textures[i]);
+        graphics_resource[i] = nullptr;
+        buffer[i] = nullptr;
+        textures[i] = 0;
+    }
+    outputs = 0;
+
+    glDeleteRenderbuffers(1, &depth_buffer);
+    glDeleteFramebuffers(1, &fbo);
+    depth_buffer = 0;
+    fbo = 0;
+}
+
+
+size_t RenderTarget::GetMemoryUsage() const
+{
+    // texel sizes of the internal formats in Init
+    static const size_t texel_bytes[NUM_GRAPHICS_RESOURCES] = {16, 12, 12, 8, 16, 16};
+    if (fbo == 0)
+        return 0;
+
+    size_t bytes = (size_t)width * height * 4; // depth
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (HasOutput(i))
+            bytes += (size_t)width * height * texel_bytes[i];
+    }
+    return bytes;
+}
+
+
+size_t RenderTarget::GetStagingMemoryUsage() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    {
+        if (buffer[i])
+            bytes += (size_t)width * height * GetNumberOfChannels(i) * sizeof(float);
+    }
+    return bytes;
+}
+
+
+void RenderTarget::Use()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height); 
+}
+
+void RenderTarget::Clear()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glClearColor(-1.0f, -1.0f, -1.0f, 1.0f);
+    glClearDepth(1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+}
+
+void RenderTarget::ClearBack()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glClearColor(-1.0f, -1.0f, -1.0f, 1.0f);
+    glClearDepth(0.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GREATER);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+}
+
+// FeatureTarget
+
+int FeatureTarget::Init(unsigned int _width, unsigned int _height, unsigned int _n_attachments)
+{
+    width = _width;
+    height = _height;
+    n_attachments = std::min(_n_attachments, MAX_ATTACHMENTS);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    // outputs of features.fs beyond the attachments are dropped
+    GLenum DrawBuffers[MAX_ATTACHMENTS];
+    for (unsigned int i = 0; i < MAX_ATTACHMENTS; i++)
+    {
+        if (i >= n_attachments)
+        {
+            DrawBuffers[i] = GL_NONE;
+            continue;
+        }
+
+        glGenTextures(1, &textures[i]);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, textures[i], 0);
+        DrawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+
+    glGenRenderbuffers(1, &depth_buffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+
+    glDrawBuffers(MAX_ATTACHMENTS, DrawBuffers);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cout << "ERROR::FRAMEBUFFER:: Feature framebuffer is not complete!" << std::endl;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < n_attachments; i++)
+    {
+        #ifndef NO_CUDA
+        checkCudaErrors(cudaGraphicsGLRegisterImage(&graphics_resource[i], textures[i], GL_TEXTURE_2D, cudaGraphicsRegisterFlagsReadOnly));
+        checkCudaErrors(cudaMalloc((void**)&(buffer[i]), width*height*4*sizeof(float)));
+        #else
+        buffer[i] = new float[width*height*4];
+        #endif
+    }
+
+    return 1;
+}
+
+void FeatureTarget::Terminate()
+{
+    for (unsigned int i = 0; i < MAX_ATTACHMENTS; i++)
+    {
+        #ifndef NO_CUDA
+        if (graphics_resource[i])
+            cudaGraphicsUnregisterResource(graphics_resource[i]);
+        if (buffer[i])
+            cudaFree(buffer[i]);
+        #else
+        delete[] buffer[i];
+        #endif
+        if (textures[i])
+            glDeleteTextures(1, &textures[i]);
+        graphics_resource[i] = nullptr;
+        buffer[i] = nullptr;
+        textures[i] = 0;
+    }
+    n_attachments = 0;
+
+    glDeleteRenderbuffers(1, &depth_buffer);
+    glDeleteFramebuffers(1, &fbo);
+    depth_buffer = 0;
+    fbo = 0;
+}
+
+size_t FeatureTarget::GetMemoryUsage() const
+{
+    if (!IsInitialized())
+        return 0;
+    // RGBA32F attachments and the depth buffer
+    return (size_t)width * height * (4 * sizeof(float) * n_attachments + 4);
+}
+
+size_t FeatureTarget::GetStagingMemoryUsage() const
+{
+    return (size_t)width * height * 4 * sizeof(float) * n_attachments;
+}
+
+void FeatureTarget::Clear(bool back)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClearDepth(back ? 0.0 : 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(back ? GL_GREATER : GL_LESS);
+    glEnable(GL_CULL_FACE);
+    glCullFace(back ? GL_FRONT : GL_BACK);
+}
+
+void FeatureTarget::CopyRenderedTexturesToCUDA()
 {
-    for (int i = 0; i < NUM_GRAPHICS_RESOURCES; i++)
+    TraceSpan trace("FeatureTarget::CopyRenderedTexturesToCUDA");
+    #ifdef NO_CUDA
+    for (unsigned int i = 0; i < n_attachments; i++)
     {
-        cudaGraphicsUnregisterResource(graphics_resource[i]);
-        cudaFree(buffer[i]);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, buffer[i]);
+    }
+    #else
+    checkCudaErrors(cudaGraphicsMapResources(n_attachments, graphics_resource));
+    cudaArray* cuda_array;
+    size_t pitch = width*4*sizeof(float);
+    for (unsigned int i = 0; i < n_attachments; i++)
+    {
+        checkCudaErrors(cudaGraphicsSubResourceGetMappedArray(&cuda_array, graphics_resource[i], 0, 0));
+        checkCudaErrors(cudaMemcpy2DFromArray(buffer[i], pitch, cuda_array, 0, 0, pitch, height, cudaMemcpyDeviceToDevice));
     }
+    checkCudaErrors(cudaGraphicsUnmapResources(n_attachments, graphics_resource));
+    #endif
 }
 
+// FeatureBuffer
 
-void RenderTarget::Use()
+void FeatureBuffer::Update(const float* data, size_t _n_values, bool data_on_cuda)
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glViewport(0, 0, width, height); 
+    if (ssbo == 0 || n_values != _n_values)
+    {
+        Terminate();
+        n_values = _n_values;
+        glGenBuffers(1, &ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float)*std::max(n_values, size_t(1)), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        #ifndef NO_CUDA
+        checkCudaErrors(cudaGraphicsGLRegisterBuffer(&graphics_resource, ssbo, cudaGraphicsRegisterFlagsWriteDiscard));
+        #endif
+    }
+
+    if (n_values == 0)
+        return;
+
+    #ifdef NO_CUDA
+    if (data_on_cuda)
+    {
+        std::cout << "ERROR: built without CUDA, features have to be in host memory" << std::endl;
+        return;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(float)*n_values, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    #else
+    checkCudaErrors(cudaGraphicsMapResources(1, &graphics_resource));
+    float* ssboPtr;
+    size_t size;
+    checkCudaErrors(cudaGraphicsResourceGetMappedPointer((void**)&ssboPtr, &size, graphics_resource));
+    checkCudaErrors(cudaMemcpy((void*)ssboPtr, (const void*)data, sizeof(float)*n_values, data_on_cuda ? cudaMemcpyDeviceToDevice : cudaMemcpyHostToDevice));
+    checkCudaErrors(cudaGraphicsUnmapResources(1, &graphics_resource));
+    #endif
 }
 
-void RenderTarget::Clear()
+void FeatureBuffer::Terminate()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glClearColor(-1.0f, -1.0f, -1.0f, 1.0f);
-    glClearDepth(1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    if (ssbo != 0)
+    {
+        #ifndef NO_CUDA
+        checkCudaErrors(cudaGraphicsUnregisterResource(graphics_resource));
+        #endif
+        glDeleteBuffers(1, &ssbo);
+        graphics_resource = nullptr;
+        ssbo = 0;
+    }
+    n_values = 0;
 }
 
-void RenderTarget::ClearBack()
+void FeatureBuffer::Use()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glClearColor(-1.0f, -1.0f, -1.0f, 1.0f);
-    glClearDepth(0.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_GREATER);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FEATURE_BINDING, ssbo);
 }
 
 // Shader
@@ -555,6 +1307,17 @@ int Shader::LoadShader(const char  *shader_source, GLenum type)
     if (type == GL_COMPUTE_SHADER) std::cout << "- load compute shader" << std::endl;
     
 
+    if (!Compile(shader_source, type))
+    {
+        return 0;
+    }
+
+    // print compilation log
+    return print_shader_info_log();
+}
+
+int Shader::Compile(const char* shader_source, GLenum type)
+{
     // create shader
     shader = glCreateShader( type );
     if(shader == 0)
@@ -572,11 +1335,15 @@ int Shader::LoadShader(const char  *shader_source, GLenum type)
     glCompileShader(shader);
     CheckError();
 
-    // print compilation log
+    return 1;
+}
+
+int Shader::CheckCompileStatus()
+{
     return print_shader_info_log();
 }
 
-int Shader::LoadShaderFromFile(const std::string& filename, GLenum type, const std::vector<std::string>& defines)
+int Shader::ReadShaderFile(const std::string& filename, const std::vector<std::string>& defines, std::string& shader_src)
 {
     std::ifstream shader_file(filename);
 
@@ -586,17 +1353,81 @@ int Shader::LoadShaderFromFile(const std::string& filename, GLenum type, const s
         return 0;
     }
 
-    std::string shader_src((std::istreambuf_iterator<char>(shader_file)), std::istreambuf_iterator<char>());
+    shader_src.assign((std::istreambuf_iterator<char>(shader_file)), std::istreambuf_iterator<char>());
     shader_file.close();
 
+    InjectDefines(defines, shader_src);
+
+    //std::cout << shader_src << std::endl;
+
+    return 1;
+}
+
+void Shader::InjectDefines(const std::vector<std::string>& defines, std::string& shader_src)
+{
     std::size_t second_line = shader_src.find(std::string("\n")) + 1;
 
     for (const auto& define : defines)
     {
         shader_src.insert(second_line, std::string("#define ").append(define).append("\n"));
     }
+}
 
-    //std::cout << shader_src << std::endl;
+static std::string default_shader_source_directory()
+{
+    const char* directory = std::getenv("PYEGL_SHADER_DIR");
+    return directory ? directory : "";
+}
+
+std::string Shader::source_directory = default_shader_source_directory();
+
+static std::mutex source_directory_mutex;
+
+void Shader::SetSourceDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(source_directory_mutex);
+    source_directory = directory;
+}
+
+std::string Shader::GetSourceDirectory()
+{
+    std::lock_guard<std::mutex> lock(source_directory_mutex);
+    return source_directory;
+}
+
+int Shader::ReadShaderSource(const std::string& name, const std::vector<std::string>& defines, std::string& shader_src)
+{
+    std::string directory = GetSourceDirectory();
+    if (!directory.empty())
+    {
+        std::string filename = directory + "/" + name;
+        if (path(filename).exists())
+        {
+            return ReadShaderFile(filename, defines, shader_src);
+        }
+    }
+
+    for (const auto& embedded : EmbeddedShaders::sources)
+    {
+        if (name == embedded.name)
+        {
+            shader_src = embedded.source;
+            InjectDefines(defines, shader_src);
+            return 1;
+        }
+    }
+
+    std::cout << "ERROR: unknown shader " << name << std::endl;
+    return 0;
+}
+
+int Shader::LoadShaderFromFile(const std::string& filename, GLenum type, const std::vector<std::string>& defines)
+{
+    std::string shader_src;
+    if (!ReadShaderFile(filename, defines, shader_src))
+    {
+        return 0;
+    }
 
     return LoadShader(shader_src.c_str(), type);
 }
@@ -668,6 +1499,7 @@ int ShaderProgram::Init(Shader& vertexShader, Shader& geometryShader, Shader& fr
 {
     std::cout << "- create shader program" << std::endl;
     shaderProgram = glCreateProgram();      // create program object
+    glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glAttachShader(shaderProgram, vertexShader.GetID());
     if(glGetError() != GL_NO_ERROR)
     {
@@ -748,23 +1580,132 @@ int ShaderProgram::Init(const std::string& filename_vertexShader, const std::str
 
 int ShaderProgram::Init(const std::string& filename_vertexShader, const std::string& filename_geometryShader, const std::string& filename_fragmentShader, const std::vector<std::string>& defines)
 {
-    Shader vertexShader, geometryShader, fragmentShader;
-    if(!vertexShader.LoadShaderFromFile(filename_vertexShader, GL_VERTEX_SHADER, defines))
+    std::string vertex_src, geometry_src, fragment_src;
+    if(!Shader::ReadShaderFile(filename_vertexShader, defines, vertex_src) ||
+       !Shader::ReadShaderFile(filename_geometryShader, defines, geometry_src) ||
+       !Shader::ReadShaderFile(filename_fragmentShader, defines, fragment_src))
     {
-        std::cout << "ERROR: loading vertex shader failed" << std::endl;
+        std::cout << "ERROR: reading shader files failed" << std::endl;
         return -1;
     }
-    if(!geometryShader.LoadShaderFromFile(filename_geometryShader, GL_GEOMETRY_SHADER, defines))
+
+    if (Begin(vertex_src, geometry_src, fragment_src) < 0)
     {
-        std::cout << "ERROR: loading geometry shader failed" << std::endl;
         return -1;
     }
-    if(!fragmentShader.LoadShaderFromFile(filename_fragmentShader, GL_FRAGMENT_SHADER, defines))
+    return Finish();
+}
+
+int ShaderProgram::Begin(const std::string& vertex_src, const std::string& geometry_src, const std::string& fragment_src)
+{
+    TraceSpan trace("ShaderProgram::Begin", "shader");
+    pending_key = BinaryCacheKey({vertex_src, geometry_src, fragment_src});
+    if (LoadBinary(pending_key) > 0)
     {
-        std::cout << "ERROR: loading fragment shader failed" << std::endl;
+        return 1;
+    }
+
+    pending_shaders.assign(3, Shader());
+    if(!pending_shaders[0].Compile(vertex_src.c_str(), GL_VERTEX_SHADER) ||
+       !pending_shaders[1].Compile(geometry_src.c_str(), GL_GEOMETRY_SHADER) ||
+       !pending_shaders[2].Compile(fragment_src.c_str(), GL_FRAGMENT_SHADER))
+    {
+        std::cout << "ERROR: creating shaders failed" << std::endl;
+        for (auto& shader : pending_shaders)
+            shader.Terminate();
+        pending_shaders.clear();
+        return -1;
+    }
+
+    // linking is issued right away as well, the driver waits for the shaders
+    std::cout << "- create shader program" << std::endl;
+    shaderProgram = glCreateProgram();
+    glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    for (auto& shader : pending_shaders)
+        glAttachShader(shaderProgram, shader.GetID());
+    glLinkProgram(shaderProgram);
+    if(glGetError() != GL_NO_ERROR)
+    {
+        std::cout << "ERROR: linking shader program failed!" << std::endl;
+        return -1;
+    }
+
+    pending = true;
+    return 1;
+}
+
+int ShaderProgram::Finish()
+{
+    TraceSpan trace("ShaderProgram::Finish", "shader");
+    if (!pending)
+    {
+        return shaderProgram != 0 ? 1 : -1;
+    }
+    pending = false;
+
+    int status = 1;
+    for (auto& shader : pending_shaders)
+    {
+        if (!shader.CheckCompileStatus())
+            status = -1;
+        shader.Terminate();
+    }
+    pending_shaders.clear();
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linked);
+    if (status < 0 || linked != GL_TRUE)
+    {
+        std::cout << "ERROR: linking shader program failed!" << std::endl;
         return -1;
     }
-    return Init(vertexShader, geometryShader, fragmentShader);
+
+    StoreBinary(pending_key);
+    return 1;
+}
+
+// GL_COMPLETION_STATUS_KHR, the same value in GL_ARB_parallel_shader_compile
+#define PYEGL_COMPLETION_STATUS 0x91B1
+
+bool ShaderProgram::parallel_compile = false;
+
+bool ShaderProgram::IsReady()
+{
+    if (!pending)
+        return true;
+
+    // without the extension the status queries would block
+    if (!parallel_compile)
+        return false;
+
+    GLint done = GL_FALSE;
+    glGetProgramiv(shaderProgram, PYEGL_COMPLETION_STATUS, &done);
+    return done == GL_TRUE;
+}
+
+bool ShaderProgram::EnableParallelCompile()
+{
+    typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
+    MaxShaderCompilerThreadsProc maxShaderCompilerThreads = nullptr;
+
+    GLint n_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &n_extensions);
+    for (GLint i = 0; i < n_extensions && !maxShaderCompilerThreads; i++)
+    {
+        std::string extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (extension == "GL_KHR_parallel_shader_compile")
+            maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc) eglGetProcAddress("glMaxShaderCompilerThreadsKHR");
+        else if (extension == "GL_ARB_parallel_shader_compile")
+            maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc) eglGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+
+    if (!maxShaderCompilerThreads)
+        return false;
+
+    // let the driver pick the number of threads
+    maxShaderCompilerThreads(0xFFFFFFFF);
+    parallel_compile = true;
+    return true;
 }
 
 int ShaderProgram::Init(const std::string& filename_computeShader, const std::vector<std::string>& defines)
@@ -778,6 +1719,136 @@ int ShaderProgram::Init(const std::string& filename_computeShader, const std::ve
     return Init(computeShader);
 }
 
+static std::string default_binary_cache_directory()
+{
+    if (const char* dir = std::getenv("PYEGL_CACHE_DIR"))
+        return dir;
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"))
+        return std::string(dir) + "/pyegl";
+    if (const char* dir = std::getenv("HOME"))
+        return std::string(dir) + "/.cache/pyegl";
+    return "";
+}
+
+std::string ShaderProgram::binary_cache_directory = default_binary_cache_directory();
+
+static std::mutex binary_cache_directory_mutex;
+
+void ShaderProgram::SetBinaryCacheDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(binary_cache_directory_mutex);
+    binary_cache_directory = directory;
+}
+
+std::string ShaderProgram::GetBinaryCacheDirectory()
+{
+    std::lock_guard<std::mutex> lock(binary_cache_directory_mutex);
+    return binary_cache_directory;
+}
+
+std::string ShaderProgram::BinaryCacheKey(const std::vector<std::string>& sources)
+{
+    // FNV-1a over the sources (defines are already injected) and the driver strings
+    uint64_t hash = 14695981039346656037ULL;
+    auto combine = [&hash](const char* data, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        // separator, so that ("ab", "c") and ("a", "bc") differ
+        hash ^= 0xff;
+        hash *= 1099511628211ULL;
+    };
+
+    for (const auto& source : sources)
+        combine(source.data(), source.size());
+
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        const char* value = (const char*)glGetString(name);
+        if (value)
+            combine(value, std::strlen(value));
+    }
+
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}
+
+int ShaderProgram::LoadBinary(const std::string& key)
+{
+    std::string cache_directory = GetBinaryCacheDirectory();
+    if (cache_directory.empty())
+        return 0;
+
+    std::ifstream file(cache_directory + "/" + key + ".bin", std::ios::binary);
+    if (!file.is_open())
+        return 0;
+
+    GLenum format;
+    file.read((char*)&format, sizeof(GLenum));
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!file.good() && !file.eof())
+        return 0;
+
+    shaderProgram = glCreateProgram();
+    glProgramBinary(shaderProgram, format, binary.data(), (GLsizei)binary.size());
+
+    // the driver may reject binaries, e.g. after an update
+    GLint success = GL_FALSE;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (success != GL_TRUE)
+    {
+        glDeleteProgram(shaderProgram);
+        shaderProgram = 0;
+        return 0;
+    }
+
+    std::cout << "- load shader program binary " << key << std::endl;
+    glUseProgram(shaderProgram);
+    return 1;
+}
+
+void ShaderProgram::StoreBinary(const std::string& key)
+{
+    std::string cache_directory = GetBinaryCacheDirectory();
+    if (cache_directory.empty())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    GLenum format;
+    std::vector<char> binary(length);
+    glGetProgramBinary(shaderProgram, length, nullptr, &format, binary.data());
+    if (glGetError() != GL_NO_ERROR)
+        return;
+
+    path directory(cache_directory);
+    if (!directory.exists())
+        create_directories(directory);
+
+    // several processes may store the same program, write to a private file
+    // and rename it so that readers never see a partial binary
+    std::string filename = cache_directory + "/" + key + ".bin";
+    std::string tmp_filename = filename + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tmp_filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            std::cout << "WARNING: unable to write shader program binary to " << cache_directory << std::endl;
+            return;
+        }
+        file.write((const char*)&format, sizeof(GLenum));
+        file.write(binary.data(), binary.size());
+    }
+    std::rename(tmp_filename.c_str(), filename.c_str());
+}
+
 // Transformation
 
 void Transformation::SetPerspectiveProjection(float fovX, float fovY, float cX, float cY, float near, float far)
@@ -834,151 +1905,65 @@ void Transformation::SetIdentityProjection()
 
 int Mesh::LoadObjFile(const std::string& filename, float scale)
 {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
+    MeshData data;
+    if (MeshLoader::LoadObj(filename, data, scale) < 0)
+        return -1;
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str())) {
-        throw std::runtime_error(warn + err);
+    unsigned int n_faces = data.indices.size() / 3;
+    if (!data.material_ids.empty())
+    {
+        GroupFacesByMaterial(data.indices.data(), data.material_ids.data(), n_faces);
     }
 
-    std::vector<Vertex> vertices;
-    vertices.reserve(10000);
-    std::vector<unsigned int> indices;
-    indices.reserve(10000);
-
-    std::unordered_map<Vertex, uint32_t, VertexHash> uniqueVertices{};
-
-    for (const auto& shape : shapes) {
-        for (const auto &index : shape.mesh.indices) {
-            Vertex v{};
-            v.x = attrib.vertices[3 * index.vertex_index + 0] * scale;
-            v.y = attrib.vertices[3 * index.vertex_index + 1] * scale;
-            v.z = attrib.vertices[3 * index.vertex_index + 2] * scale;
-            v.mask = 1.0f;
-
-            if (!attrib.colors.empty()) {
-                v.r = attrib.colors[3 * index.vertex_index + 0];
-                v.g = attrib.colors[3 * index.vertex_index + 1];
-                v.b = attrib.colors[3 * index.vertex_index + 2];
-                v.a = 1.0;
-            }
-
-            if (!attrib.normals.empty()) {
-                v.nx = attrib.normals[3 * index.vertex_index + 0];
-                v.ny = attrib.normals[3 * index.vertex_index + 1];
-                v.nz = attrib.normals[3 * index.vertex_index + 2];
-            }
-
-            if (!attrib.texcoords.empty()) {
-                v.u = attrib.texcoords[2 * index.texcoord_index + 0];
-                v.v = attrib.texcoords[2 * index.texcoord_index + 1];
-            }
-
-            //std::cout << "vertex: " << v.x << " " << v.y << " " << v.z << std::endl;
+    Init(data.vertices.data(), data.vertices.size(), data.indices.data(), n_faces);
 
-            if (uniqueVertices.count(v) == 0) {
-                uniqueVertices[v] = static_cast<uint32_t>(vertices.size());
-                vertices.push_back(v);
-            }
-
-            indices.push_back(uniqueVertices[v]);
-            //std::cout << "index: " << indices[indices.size() - 1] << std::endl;
-        }
+    if (!data.material_ids.empty())
+    {
+        SetMaterialIds(data.material_ids.data());
     }
 
-    Init(vertices.data(), vertices.size(), indices.data(), indices.size() / 3);
-
     return 0;
 }
 
 int Mesh::LoadOffFile(const std::string& filename, float scale)
 {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-
-    std::ifstream file(filename);
-    if(!file.is_open())
-    {
-        std::cout << "Error: unable to open mesh file: " << filename << std::endl;
+    MeshData data;
+    if (MeshLoader::LoadOff(filename, data, scale) < 0)
         return -1;
-    }
 
-    
-    std::string line;
-    std::getline(file, line);
+    Init(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size() / 3);
+    return 0;
+}
 
-    std::string format;
-    {
-        std::stringstream line_ss;
-        line_ss << line;
-        line_ss >> format;
-    }
+int Mesh::LoadPlyFile(const std::string& filename, float scale)
+{
+    MeshData data;
+    if (MeshLoader::LoadPly(filename, data, scale) < 0)
+        return -1;
 
-    if(format != "STCOFF" && format != "COFF" && format != "STOFF")
-    {
-        std::cout << "Error: unsupported mesh format: " << format << std::endl;
+    Init(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size() / 3);
+    return 0;
+}
+
+int Mesh::LoadGlbFile(const std::string& filename, float scale)
+{
+    MeshData data;
+    if (MeshLoader::LoadGlb(filename, data, scale) < 0)
         return -1;
-    }
 
-    unsigned int n_vertices, n_faces, dump;
+    unsigned int n_faces = data.indices.size() / 3;
+    if (!data.material_ids.empty())
     {
-        std::stringstream line_ss;
-        std::getline(file, line);
-        line_ss << line;
-        line_ss >> n_vertices >> n_faces >> dump;
+        GroupFacesByMaterial(data.indices.data(), data.material_ids.data(), n_faces);
     }
-    //std::cout << "format: " << format << std::endl;
-    //std::cout << "n_vertices: " << n_vertices << std::endl;
-    //std::cout << "n_faces: " << n_faces << std::endl;
-
-    for(unsigned int i=0; i<n_vertices; ++i)
-    {
-        std::string line;
-        std::getline(file, line);
-        std::stringstream line_ss;
-        line_ss << line;
 
-        Vertex v;
-        //-57239 42965.7 80410.1 183 135 107 255 0.287456 0.613019
-        line_ss >> v.x >> v.y >> v.z;
-        if(format == "STCOFF" || format == "COFF") line_ss >> v.r >> v.g >> v.b >> v.a;
-        if(format == "STCOFF" || format == "STOFF") line_ss >> v.u >> v.v;
-        v.x *= scale;
-        v.y *= scale;
-        v.z *= scale;
-        v.r /= 255.0f;
-        v.g /= 255.0f;
-        v.b /= 255.0f;
-        v.a /= 255.0f;
-        v.nx = 0.0f;
-        v.ny = 0.0f;
-        v.nz = 1.0f;
-        v.mask = 1.0f;
+    Init(data.vertices.data(), data.vertices.size(), data.indices.data(), n_faces);
 
-        vertices.push_back(v);
-    }
-
-    for (unsigned int i=0; i<n_faces; ++i)
+    if (!data.material_ids.empty())
     {
-        std::string line;
-        std::getline(file, line);
-        std::stringstream line_ss;
-        line_ss << line;
-
-        unsigned int dump, i0,i1,i2;
-        // 3 40923 40897 40924
-        line_ss >> dump >> i0 >> i1 >> i2;
-        indices.push_back(i0);
-        indices.push_back(i1);
-        indices.push_back(i2);
+        SetMaterialIds(data.material_ids.data());
     }
 
-
-    file.close();
-    Init(vertices.data(), vertices.size(), indices.data(), indices.size() / 3);
-
     return 0;
 }
 
@@ -987,20 +1972,37 @@ void Mesh::Terminate()
     if (initialized)
     {
         //code=4(cudaErrorCudartUnloading) when executed in destructor
+        #ifndef NO_CUDA
         checkCudaErrors(cudaGraphicsUnregisterResource(VertexVBORes));
+        #endif
         const GLuint buffers[2] = {VertexVBOID, IndexVBOID};
         glDeleteBuffers(2, buffers);
         glDeleteVertexArrays(1, &vao);
+        if (MaterialIdSSBO != 0)
+        {
+            glDeleteBuffers(1, &MaterialIdSSBO);
+            MaterialIdSSBO = 0;
+        }
         initialized = false;
     }
 }
 
 void Mesh::Init(OpenGL::Vertex* vertex_data, unsigned int n_vertices, unsigned int* indices, unsigned int n_faces, bool vertex_data_on_cuda)
 {
+    TraceSpan trace("Mesh::Init");
     std::cout << "Initialize mesh (" << n_vertices << " | " << n_faces << ")" << std::endl;
 
     glGenBuffers(1, &VertexVBOID);
     glBindBuffer(GL_ARRAY_BUFFER, VertexVBOID);
+    #ifdef NO_CUDA
+    if (vertex_data_on_cuda)
+    {
+        std::cout << "ERROR: built without CUDA, vertex data has to be in host memory" << std::endl;
+        vertex_data = nullptr;
+        vertex_data_on_cuda = false;
+    }
+    glBufferData(GL_ARRAY_BUFFER, sizeof(OpenGL::Vertex)*n_vertices, vertex_data, GL_DYNAMIC_DRAW);
+    #else
     glBufferData(GL_ARRAY_BUFFER, sizeof(OpenGL::Vertex)*n_vertices, nullptr, GL_DYNAMIC_COPY);
     checkCudaErrors(cudaGraphicsGLRegisterBuffer(&VertexVBORes, VertexVBOID, cudaGraphicsRegisterFlagsNone));
 
@@ -1017,6 +2019,7 @@ void Mesh::Init(OpenGL::Vertex* vertex_data, unsigned int n_vertices, unsigned i
 
     checkCudaErrors(cudaGraphicsUnmapResources(1, &VertexVBORes));
     //checkCudaErrors(cudaStreamSynchronize(0));
+    #endif
 
     glGenBuffers(1, &IndexVBOID);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IndexVBOID);
@@ -1034,6 +2037,18 @@ void Mesh::Init(OpenGL::Vertex* vertex_data, unsigned int n_vertices, unsigned i
 
 void Mesh::Update(OpenGL::Vertex* vertex_data, unsigned int n_vertices, bool vertex_data_on_cuda)
 {
+    TraceSpan trace("Mesh::Update");
+    #ifdef NO_CUDA
+    if (vertex_data_on_cuda)
+    {
+        std::cout << "ERROR: built without CUDA, vertex data has to be in host memory" << std::endl;
+        return;
+    }
+    // orphan the previous contents, so the upload does not wait for the last draw
+    glBindBuffer(GL_ARRAY_BUFFER, VertexVBOID);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(OpenGL::Vertex)*this->n_vertices, nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(OpenGL::Vertex)*std::min(n_vertices, this->n_vertices), vertex_data);
+    #else
     checkCudaErrors(cudaGraphicsMapResources(1, &VertexVBORes));
     float* vboPtr;
     size_t size;
@@ -1047,6 +2062,18 @@ void Mesh::Update(OpenGL::Vertex* vertex_data, unsigned int n_vertices, bool ver
 
     checkCudaErrors(cudaGraphicsUnmapResources(1, &VertexVBORes));
     //checkCudaErrors(cudaStreamSynchronize(0));
+    #endif
+}
+
+void Mesh::SetMaterialIds(const unsigned int* material_ids)
+{
+    if (MaterialIdSSBO == 0)
+    {
+        glGenBuffers(1, &MaterialIdSSBO);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, MaterialIdSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(unsigned int)*n_faces, material_ids, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 int Mesh::Render(GLint position_loc, GLint normal_loc, GLint color_loc, GLint uv_loc, GLint mask_loc)
@@ -1104,6 +2131,11 @@ int Mesh::Render(GLint position_loc, GLint normal_loc, GLint color_loc, GLint uv
     }
 
 
+    if (MaterialIdSSBO != 0)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_ID_BINDING, MaterialIdSSBO);
+    }
+
     // index buffer
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IndexVBOID);
     OpenGL::CheckError();
@@ -11,6 +11,7 @@
 #include <sstream>
 #include <streambuf>
 #include <vector>
+#include <memory>
 #include <exception>
 
 #include "eigen/Eigen/Eigen"
@@ -25,8 +26,14 @@
 ////////////////////////////////
 ///////       CUDA      ////////
 ////////////////////////////////
+#ifndef NO_CUDA
 #include <cuda_gl_interop.h>
 #include "cuda_helper.h"
+#else
+// without CUDA (e.g. the benchmark on Mesa) rendered maps are read back into
+// host memory and data marked as on CUDA is rejected
+typedef void* cudaGraphicsResource_t;
+#endif
 
 ////////////////////////////////
 //////////   MACROS  ///////////
@@ -111,14 +118,15 @@ public:
 
     EGLDisplay GetEGLDisplayFromNative(NativeDisplayType native_display=EGL_DEFAULT_DISPLAY);
 
-    int Init(unsigned int width=512, unsigned int height=512);
+    // device_id selects the EGL device, a negative id falls back to the
+    // EGL_DEVICE_ID environment variable and then to the default display,
+    // an id without a device is an error
+    int Init(unsigned int width=512, unsigned int height=512, int device_id=-1);
 
-    void Terminate()
-    {
-        // Terminate EGL when finished
-        std::cout << "Terminate EGL" << std::endl;
-        eglTerminate(egl_display);
-    }
+    void Terminate();
+
+    // the displays of a parent process are unusable in a forked child
+    static void ForgetDisplays();
 
     void Clear()
     {
@@ -146,10 +154,13 @@ public:
     }
 
 private:
+    // destroys what Init created and terminates the display with its last reference
+    void Release();
+
     // EGL
-    EGLDisplay  egl_display;
-    EGLContext  egl_context;
-    EGLSurface  egl_surface;
+    EGLDisplay  egl_display = EGL_NO_DISPLAY;
+    EGLContext  egl_context = EGL_NO_CONTEXT;
+    EGLSurface  egl_surface = EGL_NO_SURFACE;
 
     // window settings
     int pbufferWidth;
@@ -168,41 +179,124 @@ public:
 
     void Init(const char* filename);
 
-    void Terminate()
+    // immutable storage (glTexStorage2D) for textures that are updated from
+    // memory, levels > 1 allocates mip levels
+    int Init(unsigned int width, unsigned int height, GLenum internal_format, unsigned int levels);
+
+    // Uploads a width x height sub-rectangle at (x, y) through a pixel unpack
+    // buffer, data is either host or CUDA device memory. Rows are in GL order,
+    // the first one is at v = 0.
+    int Update(const void* data, bool data_on_cuda, unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+               GLenum format, GLenum type, unsigned int bytes_per_pixel, bool generate_mipmaps);
+
+    void Terminate();
+
+    // frees the pixel unpack buffer, for textures that are not updated again
+    void ReleaseUploadBuffer();
+
+    // uploads a whole mip level from host memory, format is the compressed
+    // internal format (glCompressedTexSubImage2D) if type is 0
+    int UploadLevel(unsigned int level, unsigned int level_width, unsigned int level_height,
+                    GLenum format, GLenum type, const void* data, size_t size);
+
+    // images stored top row first (DDS, KTX2) are flipped in the shader
+    void SetOriginTop(bool _origin_top)
     {
-        if (state == InternalState::INITIALIZED)
-        {
-            state = InternalState::UNINITIALIZED;
-            glBindTexture(GL_TEXTURE_2D, texture);
-            glDeleteTextures(1, &texture);
-        }
+        origin_top = _origin_top;
+    }
+
+    bool IsOriginTop() const
+    {
+        return origin_top;
+    }
+
+    // channel swizzle (GL_TEXTURE_SWIZZLE_RGBA), e.g. to sample grey images as rgb
+    void SetSwizzle(const GLint swizzle[4])
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    bool IsInitialized() const
+    {
+        return state == InternalState::INITIALIZED;
+    }
+
+    bool HasStorage(unsigned int _width, unsigned int _height, GLenum _internal_format) const
+    {
+        return IsInitialized() && immutable && width == _width && height == _height && internal_format == _internal_format;
+    }
+
+    unsigned int GetWidth() const
+    {
+        return width;
     }
 
-    void SetUniformLocations(GLint _texture_loc)
+    unsigned int GetHeight() const
     {
-        texture_loc = _texture_loc;
+        return height;
     }
 
+    unsigned int GetLevels() const
+    {
+        return levels;
+    }
+
+    // bytes of the storage of all mip levels, 0 for textures loaded with Init(filename)
+    size_t GetMemoryUsage() const;
+
+    // bytes of the pixel unpack buffer
+    size_t GetStagingMemoryUsage() const
+    {
+        return pbo_size;
+    }
+
+    // the sampler is bound to texture unit 0 in the shader (layout(binding = 0)),
+    // so the texture does not depend on the active shader program
     void Use()
     {
         if (state == InternalState::INITIALIZED)
         {
+            glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, texture);
-            glUniform1i(texture_loc, 0);
         }
     }
 
 private:
     unsigned int texture;
-    GLint texture_loc;
     InternalState state = InternalState::UNINITIALIZED;
+
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int levels = 1;
+    GLenum internal_format = GL_RGB8;
+    bool immutable = false;
+    bool origin_top = false;
+
+    // pixel unpack buffer, grown to the largest update
+    GLuint pbo = 0;
+    size_t pbo_size = 0;
+    cudaGraphicsResource_t pbo_resource = nullptr;
 };
 
 
 class RenderTarget
 {
 public:
-    int Init(unsigned int _width, unsigned int _height);
+    // the maps written by basic.fs, one bit per color attachment
+    enum Output
+    {
+        COLOR    = 1 << 0,
+        POSITION = 1 << 1,
+        NORMAL   = 1 << 2,
+        UV       = 1 << 3,
+        BARY     = 1 << 4,
+        VIDS     = 1 << 5,
+        ALL      = (1 << 6) - 1
+    };
+
+    // only the attachments selected in outputs are allocated
+    int Init(unsigned int _width, unsigned int _height, unsigned int _outputs=Output::ALL);
 
     void Terminate();
 
@@ -212,7 +306,10 @@ public:
 
     void ClearBack();
 
-    void CopyRenderedTexturesToCUDA(bool copy_to_host=false);
+    // Copies the rendered maps into destinations, one pointer per map. Without
+    // destinations they go to the buffers of the target (GetBuffers), which
+    // are allocated on first use.
+    void CopyRenderedTexturesToCUDA(bool copy_to_host=false, float* const* destinations=nullptr);
 
     void WriteDataToFile(const std::string& filename, float* data, unsigned int tex_id=0);
 
@@ -223,32 +320,120 @@ public:
         return NUM_GRAPHICS_RESOURCES;
     }
 
+    static int GetNumberOfChannels(unsigned int tex_id)
+    {
+        return tex_id == 3 ? 2 : 4;
+    }
+
+    // entries of outputs that are not rendered are nullptr, CUDA device
+    // memory (host memory when built with NO_CUDA), nullptr until the first
+    // CopyRenderedTexturesToCUDA into the buffers of the target
     float** GetBuffers()
     {
         return buffer;
     }
 
+    unsigned int GetWidth() const
+    {
+        return width;
+    }
+
+    unsigned int GetHeight() const
+    {
+        return height;
+    }
+
+    unsigned int GetOutputs() const
+    {
+        return outputs;
+    }
+
+    bool HasOutput(unsigned int tex_id) const
+    {
+        return outputs & (1 << tex_id);
+    }
+
+    // bytes of the attachments and the depth buffer
+    size_t GetMemoryUsage() const;
+
+    // bytes of the buffers the maps are copied into
+    size_t GetStagingMemoryUsage() const;
+
 private:
     unsigned int width, height;
+    unsigned int outputs = 0;
 
     // color frame buffer object
     GLuint fbo = 0;
 
-    // textures
-    GLuint color_texture;
-    GLuint position_texture;
-    GLuint normal_texture;
-    GLuint uv_texture;
-    GLuint bary_texture;
-    GLuint vids_texture;
-
     // cuda graphics resources
     static const int NUM_GRAPHICS_RESOURCES = 6;
-    cudaGraphicsResource_t graphics_resource[NUM_GRAPHICS_RESOURCES];
-    float* buffer[NUM_GRAPHICS_RESOURCES];
+
+    // color, position, normal, uv, bary and vids textures
+    GLuint textures[NUM_GRAPHICS_RESOURCES] = {};
+    cudaGraphicsResource_t graphics_resource[NUM_GRAPHICS_RESOURCES] = {};
+    float* buffer[NUM_GRAPHICS_RESOURCES] = {};
 
     // depth buffer
-    GLuint depth_buffer;
+    GLuint depth_buffer = 0;
+};
+
+
+// Render target of features.fs: up to MAX_ATTACHMENTS RGBA32F textures that
+// hold 4 feature channels each, the background is cleared to 0.
+class FeatureTarget
+{
+public:
+    static const unsigned int MAX_ATTACHMENTS = 8;
+    static const unsigned int CHANNELS_PER_PASS = 4 * MAX_ATTACHMENTS;
+
+    int Init(unsigned int _width, unsigned int _height, unsigned int _n_attachments);
+
+    void Terminate();
+
+    void Clear(bool back=false);
+
+    void CopyRenderedTexturesToCUDA();
+
+    // (height, width, 4) per attachment
+    float** GetBuffers()
+    {
+        return buffer;
+    }
+
+    bool IsInitialized() const
+    {
+        return fbo != 0;
+    }
+
+    unsigned int GetWidth() const
+    {
+        return width;
+    }
+
+    unsigned int GetHeight() const
+    {
+        return height;
+    }
+
+    unsigned int GetNumberOfAttachments() const
+    {
+        return n_attachments;
+    }
+
+    size_t GetMemoryUsage() const;
+
+    size_t GetStagingMemoryUsage() const;
+
+private:
+    unsigned int width = 0, height = 0;
+    unsigned int n_attachments = 0;
+
+    GLuint fbo = 0;
+    GLuint depth_buffer = 0;
+    GLuint textures[MAX_ATTACHMENTS] = {};
+    cudaGraphicsResource_t graphics_resource[MAX_ATTACHMENTS] = {};
+    float* buffer[MAX_ATTACHMENTS] = {};
 };
 
 
@@ -330,17 +515,47 @@ public:
 
     int LoadShaderFromFile(const std::string& filename, GLenum type, const std::vector<std::string>& defines);
 
+    // issues the compilation without waiting for it, CheckCompileStatus() blocks until it is done
+    int Compile(const char* shader_source, GLenum type);
+
+    int CheckCompileStatus();
+
+    // reads a shader file and injects the defines after the #version line
+    static int ReadShaderFile(const std::string& filename, const std::vector<std::string>& defines, std::string& shader_src);
+
+    // source of a shader by name (e.g. "basic.vs") with injected defines, taken
+    // from the override directory if it contains the file, otherwise from the
+    // sources embedded at build time
+    static int ReadShaderSource(const std::string& name, const std::vector<std::string>& defines, std::string& shader_src);
+
+    static void InjectDefines(const std::vector<std::string>& defines, std::string& shader_src);
+
+    // empty uses the embedded sources only, defaults to $PYEGL_SHADER_DIR,
+    // guarded like the binary cache directory
+    static void SetSourceDirectory(const std::string& directory);
+
+    static std::string GetSourceDirectory();
+
     GLuint GetID()
     {
         return shader;
     }
 
+    // shaders can be deleted as soon as the program is linked
+    void Terminate()
+    {
+        glDeleteShader(shader);
+        shader = 0;
+    }
+
 
 private:
     int print_shader_info_log();
 
+    static std::string source_directory;
+
     // shader
-    GLuint  shader;
+    GLuint  shader = 0;
 };
 
 class ShaderProgram
@@ -358,6 +573,45 @@ public:
 
     int Init(const std::string& filename_computeShader, const std::vector<std::string>& defines);
 
+    // Starts compiling and linking a program from sources (or loads it from the
+    // binary cache) without waiting for the driver. Finish() has to be called
+    // before the program is used, in between the driver compiles in the
+    // background if it supports GL_KHR_parallel_shader_compile.
+    int Begin(const std::string& vertex_src, const std::string& geometry_src, const std::string& fragment_src);
+
+    // waits for the compilation started by Begin(), checks it and stores the binary
+    int Finish();
+
+    // true if Finish() would not block
+    bool IsReady();
+
+    bool IsPending() const
+    {
+        return pending;
+    }
+
+    // lets the driver compile on its own threads if GL_KHR/ARB_parallel_shader_compile
+    // is available, has to be called with a current context
+    static bool EnableParallelCompile();
+
+    // Linked programs are stored with glGetProgramBinary in this directory,
+    // keyed by a hash of the shader sources and the driver. Processes sharing
+    // the directory skip GLSL compilation on warm starts, empty disables it.
+    // set from Python while render threads read it, so it is guarded and
+    // returned as a copy
+    static void SetBinaryCacheDirectory(const std::string& directory);
+
+    static std::string GetBinaryCacheDirectory();
+
+    void Terminate()
+    {
+        if (shaderProgram != 0)
+        {
+            glDeleteProgram(shaderProgram);
+            shaderProgram = 0;
+        }
+    }
+
     void Use()
     {
         glUseProgram(shaderProgram);
@@ -399,9 +653,244 @@ public:
     }
 
 private:
-    GLuint shaderProgram;
+    int LoadBinary(const std::string& key);
+
+    void StoreBinary(const std::string& key);
+
+    static std::string BinaryCacheKey(const std::vector<std::string>& sources);
+
+    static std::string binary_cache_directory;
+
+    static bool parallel_compile;
+
+    GLuint shaderProgram = 0;
+
+    // state between Begin() and Finish()
+    bool pending = false;
+    std::string pending_key;
+    std::vector<Shader> pending_shaders;
+};
+
+
+// binding points of the uniform blocks declared in the shaders
+enum UniformBlockBinding
+{
+    CAMERA_BINDING = 0,
+    LIGHTING_BINDING = 1,
+    SHADING_BINDING = 2,
+    FEATURE_PASS_BINDING = 3,
+};
+
+// Uniform buffer object holding a std140 block, the whole block is written
+// with a single buffer update no matter how many parameters it contains
+template<typename T>
+class UniformBuffer
+{
+public:
+    T data;
+
+    void Init(GLuint _binding)
+    {
+        binding = _binding;
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    }
+
+    void Terminate()
+    {
+        if (ubo != 0)
+        {
+            glDeleteBuffers(1, &ubo);
+            ubo = 0;
+        }
+    }
+
+    void Upload()
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+    }
+
+    void Bind()
+    {
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    }
+
+private:
+    GLuint ubo = 0;
+    GLuint binding = 0;
+};
+
+// std140 layout of the Camera block in basic.vs (row major matrices)
+struct CameraBlock
+{
+    OpenGL::mat4 projection;
+    OpenGL::mat4 modelview;
+    OpenGL::vec4 mesh_normalization; // center of gravity, scale
+};
+
+// std140 layout of the Lighting block in basic.fs, w components are unused
+struct LightingBlock
+{
+    OpenGL::vec4 ambient_light = OpenGL::vec4(0.5f, 0.5f, 0.5f, 0.0f);
+    OpenGL::vec4 brightness = OpenGL::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    OpenGL::vec4 light_direction = OpenGL::vec4(0.0f, 1.0f, 1.0f, 0.0f);
+
+    // sets a parameter by its name in the shader config, returns false for unknown names
+    bool Set(const std::string& name, const std::vector<float>& value)
+    {
+        OpenGL::vec4* parameter = nullptr;
+        if (name == "ambient_light") parameter = &ambient_light;
+        else if (name == "brightness") parameter = &brightness;
+        else if (name == "light_direction") parameter = &light_direction;
+        else return false;
+
+        for (size_t i = 0; i < 3 && i < value.size(); i++)
+            parameter->data[i] = value[i];
+        return true;
+    }
+};
+
+// std140 layout of the Shading block in basic.gs/basic.fs
+struct ShadingBlock
+{
+    enum Flags
+    {
+        CONSTANT = 1,
+        DIFFUSE = 2,
+        TEXTURE = 4,
+        PER_FACE_NORMAL = 8,
+        MATERIAL = 16, // set by the renderer for meshes with material ids
+        TEXTURE_ORIGIN_TOP = 32 // set by the renderer for textures stored top row first
+    };
+
+    unsigned int flags = PER_FACE_NORMAL;
+    unsigned int padding[3];
+};
+
+// std140 layout of the FeaturePass block in features.fs
+struct FeaturePassBlock
+{
+    unsigned int n_features = 0;
+    unsigned int first_feature = 0; // channel written to attachment 0
+    unsigned int padding[2];
+};
+
+// binding points of the shader storage blocks declared in the shaders
+enum StorageBlockBinding
+{
+    MATERIAL_BINDING = 0,
+    MATERIAL_ID_BINDING = 1,
+    FEATURE_BINDING = 2,
+};
+
+// texture unit of the material texture array, unit 0 holds the attached texture
+const GLuint MATERIAL_TEXTURE_UNIT = 1;
+
+struct Material
+{
+    std::string name;
+    OpenGL::vec4 diffuse = OpenGL::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    std::string diffuse_texture; // empty for untextured materials
+    std::shared_ptr<const void> texture_owner; // keeps an embedded diffuse_texture registered
+};
+
+// reads the materials of a .mtl file, texture paths are made relative to its directory
+int LoadMtlFile(const std::string& filename, std::vector<Material>& materials);
+
+// Encoded image that is not a file, e.g. embedded in a GLB file. The owner
+// keeps the data alive, e.g. the mapping of the file it is embedded in.
+struct EmbeddedImage
+{
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    long stamp = 0;      // version of the source, e.g. the modification time of the file
+    long generation = 0; // changes when the name is registered with another stamp
+    std::shared_ptr<const void> owner;
+};
+
+// Registers an image under a name that textures and materials then use like a
+// file name. The images are shared by all contexts of the process, but only
+// registered while a copy of the returned owner is alive, e.g. in the materials
+// that use them. A name registered again with the same stamp keeps the image
+// that is already registered and its generation.
+EmbeddedImage AddEmbeddedImage(const std::string& name, const EmbeddedImage& image);
+
+// false if no image is registered under the name
+bool FindEmbeddedImage(const std::string& name, EmbeddedImage& image);
+
+// Stable reorder of the faces by material id, so faces of a material are
+// contiguous and the texture array is accessed coherently in one draw call.
+void GroupFacesByMaterial(unsigned int* indices, unsigned int* material_ids, unsigned int n_faces);
+
+// All materials of an asset: their diffuse textures are layers of one
+// GL_TEXTURE_2D_ARRAY (allocated at the largest texture size, smaller ones
+// are scaled in uv) and their parameters are in a std430 storage buffer
+// indexed by the per-face material id of the mesh.
+class MaterialArray
+{
+public:
+    int Init(const std::vector<Material>& materials);
+
+    void Terminate();
+
+    void Use();
+
+    bool IsInitialized() const
+    {
+        return ssbo != 0;
+    }
+
+    size_t GetNumberOfMaterials() const
+    {
+        return n_materials;
+    }
+
+    // bytes of the texture array and the parameters
+    size_t GetMemoryUsage() const
+    {
+        return bytes;
+    }
+
+private:
+    // std430 layout of MaterialParameters in basic.fs
+    struct Parameters
+    {
+        OpenGL::vec4 diffuse;
+        OpenGL::vec4 texture_transform; // uv scale, layer (-1 for none), unused
+    };
+
+    GLuint texture = 0;
+    GLuint ssbo = 0;
+    size_t n_materials = 0;
+    size_t bytes = 0;
+    std::vector<std::shared_ptr<const void>> texture_owners;
 };
 
+// Per-vertex features (n_vertices, n_features) in a std430 storage buffer for
+// features.fs, written from CPU or CUDA memory without a round trip.
+class FeatureBuffer
+{
+public:
+    // reallocates the buffer if the number of values changed
+    void Update(const float* data, size_t n_values, bool data_on_cuda);
+
+    void Terminate();
+
+    void Use();
+
+    size_t GetMemoryUsage() const
+    {
+        return ssbo != 0 ? sizeof(float)*std::max(n_values, size_t(1)) : 0;
+    }
+
+private:
+    GLuint ssbo = 0;
+    cudaGraphicsResource_t graphics_resource = nullptr;
+    size_t n_values = 0;
+};
 
 // shader transformations cpu -> gpu example
 struct Transformation
@@ -410,15 +899,12 @@ struct Transformation
     OpenGL::mat4 modelview;
     OpenGL::vec4 mesh_normalization;
   
-    // uniform location
-    GLint projection_loc;
-    GLint modelview_loc;
-    GLint mesh_normalization_loc;
+    // uniform buffer of the camera block
+    UniformBuffer<CameraBlock> camera;
   
     Transformation()
     {
         Reset();
-        projection_loc = modelview_loc = mesh_normalization_loc = -1;
     }
   
     void Reset()
@@ -428,18 +914,23 @@ struct Transformation
         mesh_normalization = OpenGL::vec4(0.0f, 0.0f, 0.0f, 1.0f);
     }
   
-    void SetUniformLocations(GLint _projection_loc, GLint _modelview_loc, GLint _mesh_normalization_loc)
+    void Init()
     {
-        projection_loc = _projection_loc;
-        modelview_loc = _modelview_loc;
-        mesh_normalization_loc = _mesh_normalization_loc;
+        camera.Init(CAMERA_BINDING);
+    }
+  
+    void Terminate()
+    {
+        camera.Terminate();
     }
   
     void Use()
     {
-        glUniformMatrix4fv(projection_loc, 1, true, projection.data);
-        glUniformMatrix4fv(modelview_loc, 1, true, modelview.data);
-        glUniform4fv(mesh_normalization_loc, 1, mesh_normalization.data);
+        camera.data.projection = projection;
+        camera.data.modelview = modelview;
+        camera.data.mesh_normalization = mesh_normalization;
+        camera.Upload();
+        camera.Bind();
     }
   
     void SetModelView(OpenGL::mat4& m)
@@ -545,6 +1036,10 @@ public:
 
     int LoadOffFile(const std::string& filename, float scale=1.0f);
 
+    int LoadPlyFile(const std::string& filename, float scale=1.0f);
+
+    int LoadGlbFile(const std::string& filename, float scale=1.0f);
+
     void Terminate();
 
     void Init(OpenGL::Vertex* vertex_data, unsigned int n_vertices, unsigned int* indices, unsigned int n_faces, bool vertex_data_on_cuda=false);
@@ -553,6 +1048,14 @@ public:
 
     int Render(GLint position_loc, GLint normal_loc, GLint color_loc, GLint uv_loc, GLint mask_loc);
 
+    // per-face material ids in the order of the index buffer, see GroupFacesByMaterial
+    void SetMaterialIds(const unsigned int* material_ids);
+
+    bool HasMaterials() const
+    {
+        return MaterialIdSSBO != 0;
+    }
+
     GLuint GetVertexBufferID()
     {
         return VertexVBOID;
@@ -588,9 +1091,18 @@ public:
         return vertex_data_on_cuda;
     }
 
+    // bytes of the vertex, index and material id buffers
+    size_t GetMemoryUsage() const
+    {
+        if (!initialized)
+            return 0;
+        return sizeof(OpenGL::Vertex)*n_vertices + sizeof(unsigned int)*(MaterialIdSSBO != 0 ? 4 : 3)*n_faces;
+    }
+
 private:
     GLuint vao;
     GLuint VertexVBOID, IndexVBOID;
+    GLuint MaterialIdSSBO = 0;
 
     cudaGraphicsResource_t VertexVBORes;
 
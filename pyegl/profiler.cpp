@@ -0,0 +1,374 @@
+#include "profiler.h"
+
+#include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <map>
+#include <unistd.h>
+#include <pthread.h>
+
+
+static bool default_enabled()
+{
+    const char* value = std::getenv("PYEGL_STATS");
+    return value && std::strcmp(value, "") != 0 && std::strcmp(value, "0") != 0;
+}
+
+std::atomic<bool> Profiler::enabled{default_enabled()};
+Profiler::Histogram Profiler::histograms[Profiler::NUM_STAGES][Profiler::NUM_CLOCKS];
+
+
+// the bucket of ns, 1/4 octaves from 1 us
+static int bucket_index(uint64_t ns)
+{
+    if (ns < 1000)
+        return 0;
+    int index = (int)(Profiler::BUCKETS_PER_OCTAVE * std::log2(ns / 1000.0)) + 1;
+    return index < Profiler::NUM_BUCKETS ? index : Profiler::NUM_BUCKETS - 1;
+}
+
+// upper bound of a bucket in ms
+static double bucket_bound(int index)
+{
+    return 1e-3 * std::exp2(double(index) / Profiler::BUCKETS_PER_OCTAVE);
+}
+
+
+void Profiler::SetEnabled(bool _enabled)
+{
+    enabled.store(_enabled, std::memory_order_relaxed);
+}
+
+
+void Profiler::Record(Stage stage, Clock clock, uint64_t ns)
+{
+    Histogram& histogram = histograms[stage][clock];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.total_ns.fetch_add(ns, std::memory_order_relaxed);
+    histogram.buckets[bucket_index(ns)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t current = histogram.min_ns.load(std::memory_order_relaxed);
+    while (ns < current && !histogram.min_ns.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {}
+    current = histogram.max_ns.load(std::memory_order_relaxed);
+    while (ns > current && !histogram.max_ns.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {}
+}
+
+
+std::vector<Profiler::Summary> Profiler::GetStats()
+{
+    static const char* clock_names[NUM_CLOCKS] = {"cpu", "gpu"};
+
+    std::vector<Summary> stats;
+    for (int s = 0; s < NUM_STAGES; s++)
+    {
+        for (int c = 0; c < NUM_CLOCKS; c++)
+        {
+            Histogram& histogram = histograms[s][c];
+            uint64_t counts[NUM_BUCKETS];
+            uint64_t count = 0;
+            for (int i = 0; i < NUM_BUCKETS; i++)
+            {
+                counts[i] = histogram.buckets[i].load(std::memory_order_relaxed);
+                count += counts[i];
+            }
+            if (count == 0)
+                continue;
+
+            Summary summary;
+            summary.stage = GetStageName((Stage)s);
+            summary.clock = clock_names[c];
+            summary.count = count;
+            summary.total_ms = histogram.total_ns.load(std::memory_order_relaxed) * 1e-6;
+            summary.min_ms = histogram.min_ns.load(std::memory_order_relaxed) * 1e-6;
+            summary.max_ms = histogram.max_ns.load(std::memory_order_relaxed) * 1e-6;
+            summary.mean_ms = summary.total_ms / count;
+
+            // percentiles are the upper bound of their bucket, clamped to the observed range
+            double* percentiles[3] = {&summary.p50_ms, &summary.p90_ms, &summary.p99_ms};
+            const double ranks[3] = {0.5, 0.9, 0.99};
+            int p = 0;
+            uint64_t seen = 0;
+            for (int i = 0; i < NUM_BUCKETS; i++)
+            {
+                if (counts[i] == 0)
+                    continue;
+                seen += counts[i];
+                summary.histogram.push_back({bucket_bound(i), counts[i]});
+                while (p < 3 && seen >= std::ceil(ranks[p] * count))
+                {
+                    *percentiles[p] = std::min(std::max(bucket_bound(i), summary.min_ms), summary.max_ms);
+                    p++;
+                }
+            }
+            stats.push_back(summary);
+        }
+    }
+    return stats;
+}
+
+
+void Profiler::Reset()
+{
+    for (auto& stage : histograms)
+    {
+        for (auto& histogram : stage)
+        {
+            histogram.count.store(0, std::memory_order_relaxed);
+            histogram.total_ns.store(0, std::memory_order_relaxed);
+            histogram.min_ns.store(UINT64_MAX, std::memory_order_relaxed);
+            histogram.max_ns.store(0, std::memory_order_relaxed);
+            for (auto& bucket : histogram.buckets)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+
+const char* Profiler::GetStageName(Stage stage)
+{
+    static const char* names[NUM_STAGES] = {"upload", "draw", "readback", "wrap"};
+    return names[stage];
+}
+
+
+// Tracer
+
+std::atomic<bool> Tracer::enabled{false};
+std::atomic<Tracer::Buffer*> Tracer::buffer{nullptr};
+
+// names of the tracks, only touched once per thread or context
+static std::mutex track_mutex;
+static std::map<uint32_t, std::string> track_names;
+static uint32_t n_thread_tracks = 0;
+static uint32_t n_gpu_tracks = 0;
+static const uint32_t GPU_TRACK_OFFSET = 1u << 30;
+
+// buffers of earlier Start calls, a thread may still be writing to them
+static std::vector<std::unique_ptr<Tracer::Buffer>> retired_buffers;
+
+
+void Tracer::Start(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(track_mutex);
+    enabled.store(false, std::memory_order_relaxed);
+    retired_buffers.emplace_back(new Buffer(std::max(capacity, size_t(1))));
+    buffer.store(retired_buffers.back().get(), std::memory_order_release);
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+
+void Tracer::Stop()
+{
+    enabled.store(false, std::memory_order_relaxed);
+}
+
+
+void Tracer::Record(const char* name, const char* category, uint32_t track, uint64_t start_ns, uint64_t duration_ns)
+{
+    Buffer* current = buffer.load(std::memory_order_acquire);
+    if (!current)
+        return;
+
+    uint64_t index = current->head.fetch_add(1, std::memory_order_relaxed);
+    Event& event = current->events[index % current->capacity];
+    event.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.category.store(category, std::memory_order_relaxed);
+    event.track.store(track, std::memory_order_relaxed);
+    event.start_ns.store(start_ns, std::memory_order_relaxed);
+    event.duration_ns.store(duration_ns, std::memory_order_relaxed);
+    event.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+
+uint32_t Tracer::GetThreadTrack()
+{
+    thread_local uint32_t track = 0;
+    if (track == 0)
+    {
+        char name[16] = {};
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+
+        std::lock_guard<std::mutex> lock(track_mutex);
+        track = ++n_thread_tracks;
+        track_names[track] = std::string(name) + " (" + std::to_string(track) + ")";
+    }
+    return track;
+}
+
+
+uint32_t Tracer::NewGpuTrack()
+{
+    std::lock_guard<std::mutex> lock(track_mutex);
+    uint32_t track = GPU_TRACK_OFFSET + n_gpu_tracks++;
+    track_names[track] = "GPU (context " + std::to_string(track - GPU_TRACK_OFFSET) + ")";
+    return track;
+}
+
+
+int Tracer::Dump(const std::string& filename)
+{
+    Buffer* current = buffer.load(std::memory_order_acquire);
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        std::cout << "ERROR: unable to write trace file " << filename << std::endl;
+        return -1;
+    }
+
+    // steady clock to microseconds since the epoch
+    double offset_us = std::chrono::duration<double, std::micro>(std::chrono::system_clock::now().time_since_epoch()).count() - Now() * 1e-3;
+    long pid = getpid();
+
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    file << std::fixed;
+    file.precision(3);
+    {
+        std::lock_guard<std::mutex> lock(track_mutex);
+        bool first = true;
+        for (const auto& track : track_names)
+        {
+            file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << track.first
+                 << ", \"args\": {\"name\": \"" << track.second << "\"}}";
+            first = false;
+        }
+    }
+
+    size_t n_events = 0;
+    if (current)
+    {
+        uint64_t head = current->head.load(std::memory_order_acquire);
+        uint64_t begin = head > current->capacity ? head - current->capacity : 0;
+        for (uint64_t index = begin; index < head; index++)
+        {
+            // slots that are being written or were overwritten in the meantime are skipped
+            Event& event = current->events[index % current->capacity];
+            if (event.sequence.load(std::memory_order_acquire) != 2 * index + 2)
+                continue;
+            const char* name = event.name.load(std::memory_order_relaxed);
+            const char* category = event.category.load(std::memory_order_relaxed);
+            uint32_t track = event.track.load(std::memory_order_relaxed);
+            uint64_t start_ns = event.start_ns.load(std::memory_order_relaxed);
+            uint64_t duration_ns = event.duration_ns.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (event.sequence.load(std::memory_order_relaxed) != 2 * index + 2)
+                continue;
+
+            file << ",\n{\"name\": \"" << name << "\", \"cat\": \"" << category << "\", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << track
+                 << ", \"ts\": " << offset_us + start_ns * 1e-3 << ", \"dur\": " << duration_ns * 1e-3 << "}";
+            n_events++;
+        }
+    }
+    file << std::endl << "]}" << std::endl;
+
+    std::cout << "Trace with " << n_events << " spans written to " << filename << std::endl;
+    return 1;
+}
+
+
+// GpuTimer
+
+void GpuTimer::Begin(Profiler::Stage stage)
+{
+    if (active >= 0)
+        return;
+
+    int free_query = -1;
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        if (!queries[i].pending)
+        {
+            free_query = (int)i;
+            break;
+        }
+    }
+    if (free_query < 0)
+    {
+        if (queries.size() >= MAX_QUERIES)
+            return;
+        queries.emplace_back();
+        glGenQueries(1, &queries.back().id);
+        free_query = (int)queries.size() - 1;
+    }
+
+    Query& query = queries[free_query];
+    query.stage = stage;
+    query.stats = Profiler::IsEnabled();
+    query.traced = Tracer::IsEnabled();
+    if (query.traced)
+    {
+        if (query.timestamp_id == 0)
+            glGenQueries(1, &query.timestamp_id);
+        glQueryCounter(query.timestamp_id, GL_TIMESTAMP);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query.id);
+    active = free_query;
+}
+
+void GpuTimer::End()
+{
+    if (active < 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    queries[active].pending = true;
+    active = -1;
+}
+
+void GpuTimer::Poll()
+{
+    // offset of the GPU clock to the steady clock, measured once per poll
+    bool calibrated = false;
+    int64_t offset_ns = 0;
+
+    for (auto& query : queries)
+    {
+        if (!query.pending)
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &ns);
+        query.pending = false;
+        if (query.stats)
+            Profiler::Record(query.stage, Profiler::GPU, ns);
+
+        if (query.traced)
+        {
+            if (!calibrated)
+            {
+                GLint64 gpu_now = 0;
+                glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+                offset_ns = (int64_t)Tracer::Now() - gpu_now;
+                calibrated = true;
+            }
+            if (track == 0)
+                track = Tracer::NewGpuTrack();
+
+            GLuint64 start = 0;
+            glGetQueryObjectui64v(query.timestamp_id, GL_QUERY_RESULT, &start);
+            Tracer::Record(Profiler::GetStageName(query.stage), "gpu", track, (uint64_t)((int64_t)start + offset_ns), ns);
+        }
+    }
+}
+
+void GpuTimer::Terminate()
+{
+    for (auto& query : queries)
+    {
+        glDeleteQueries(1, &query.id);
+        if (query.timestamp_id != 0)
+            glDeleteQueries(1, &query.timestamp_id);
+    }
+    queries.clear();
+    active = -1;
+}
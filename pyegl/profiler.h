@@ -0,0 +1,261 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+#include <GL/glew.h>
+
+
+// Runtime-toggled timing of the render stages. CPU spans (steady clock) and
+// GPU spans (GL_TIME_ELAPSED queries) are aggregated per stage into
+// log-scale histograms shared by all renderers of the process. While
+// disabled, a span costs a single relaxed atomic load.
+class Profiler
+{
+public:
+    enum Stage
+    {
+        UPLOAD,   // mesh data into the vertex buffer
+        DRAW,     // draw calls
+        READBACK, // render target into the buffers of the maps
+        WRAP,     // output tensors of the maps
+        NUM_STAGES
+    };
+
+    enum Clock
+    {
+        CPU,
+        GPU,
+        NUM_CLOCKS
+    };
+
+    // buckets of 1/4 octave starting at 1 us, the last one collects everything above
+    static const int BUCKETS_PER_OCTAVE = 4;
+    static const int NUM_BUCKETS = 28 * BUCKETS_PER_OCTAVE;
+
+    struct Summary
+    {
+        std::string stage;
+        std::string clock;
+        uint64_t count = 0;
+        double total_ms = 0.0, min_ms = 0.0, max_ms = 0.0;
+        double mean_ms = 0.0, p50_ms = 0.0, p90_ms = 0.0, p99_ms = 0.0;
+        // (upper bound in ms, count) of the non-empty buckets
+        std::vector<std::pair<double, uint64_t>> histogram;
+    };
+
+    // the default is read from the PYEGL_STATS environment variable
+    static void SetEnabled(bool enabled);
+
+    static bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static void Record(Stage stage, Clock clock, uint64_t ns);
+
+    // stages and clocks without samples are left out
+    static std::vector<Summary> GetStats();
+
+    static void Reset();
+
+    static const char* GetStageName(Stage stage);
+
+private:
+    struct Histogram
+    {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> total_ns{0};
+        std::atomic<uint64_t> min_ns{UINT64_MAX};
+        std::atomic<uint64_t> max_ns{0};
+        std::atomic<uint64_t> buckets[NUM_BUCKETS] = {};
+    };
+
+    static std::atomic<bool> enabled;
+    static Histogram histograms[NUM_STAGES][NUM_CLOCKS];
+};
+
+
+// Opt-in recorder of named spans for chrome://tracing and Perfetto. Spans of
+// all threads go into a lock-free ring buffer, the oldest ones are
+// overwritten once it is full. Timestamps are microseconds since the Unix
+// epoch like in the traces of the PyTorch profiler, GPU spans are on a track
+// per GL context.
+class Tracer
+{
+public:
+    // clears the buffer and starts recording
+    static void Start(size_t capacity=1 << 16);
+
+    static void Stop();
+
+    static bool IsEnabled()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // writes the recorded spans as Chrome trace JSON, works while recording
+    static int Dump(const std::string& filename);
+
+    // start_ns on the steady clock (Now)
+    static void Record(const char* name, const char* category, uint32_t track, uint64_t start_ns, uint64_t duration_ns);
+
+    static uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // track of the calling thread, named after it
+    static uint32_t GetThreadTrack();
+
+    static uint32_t NewGpuTrack();
+
+    // seqlock slot: sequence is odd while a span is written, 2 * (index + 1) once it is complete
+    struct Event
+    {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<const char*> name{nullptr};
+        std::atomic<const char*> category{nullptr};
+        std::atomic<uint32_t> track{0};
+        std::atomic<uint64_t> start_ns{0};
+        std::atomic<uint64_t> duration_ns{0};
+    };
+
+    struct Buffer
+    {
+        explicit Buffer(size_t _capacity): capacity(_capacity), events(new Event[_capacity])
+        {
+        }
+
+        size_t capacity;
+        std::unique_ptr<Event[]> events;
+        std::atomic<uint64_t> head{0};
+    };
+
+private:
+    static std::atomic<bool> enabled;
+    static std::atomic<Buffer*> buffer;
+};
+
+
+// records the scope as a trace span when the tracer is enabled
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* _name, const char* _category="pyegl"): name(_name), category(_category), active(Tracer::IsEnabled())
+    {
+        if (active)
+            start = Tracer::Now();
+    }
+
+    ~TraceSpan()
+    {
+        if (active)
+            Tracer::Record(name, category, Tracer::GetThreadTrack(), start, Tracer::Now() - start);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    const char* category;
+    bool active;
+    uint64_t start = 0;
+};
+
+
+// times the scope on the CPU when the profiler is enabled
+class CpuSpan
+{
+public:
+    explicit CpuSpan(Profiler::Stage _stage): stage(_stage), active(Profiler::IsEnabled())
+    {
+        if (active)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~CpuSpan()
+    {
+        if (active)
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            Profiler::Record(stage, Profiler::CPU, (uint64_t)ns);
+        }
+    }
+
+    CpuSpan(const CpuSpan&) = delete;
+    CpuSpan& operator=(const CpuSpan&) = delete;
+
+private:
+    Profiler::Stage stage;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+
+// GL_TIME_ELAPSED queries of one GL context. Results are collected without
+// stalling by Poll() on later frames, when no query object is free a span is
+// dropped. Spans of one context must not overlap. While tracing, a
+// GL_TIMESTAMP query places the span on the GPU track of the context.
+class GpuTimer
+{
+public:
+    static const size_t MAX_QUERIES = 64;
+
+    void Begin(Profiler::Stage stage);
+
+    void End();
+
+    // records the spans whose results are available
+    void Poll();
+
+    void Terminate();
+
+private:
+    struct Query
+    {
+        GLuint id = 0;
+        GLuint timestamp_id = 0;
+        Profiler::Stage stage = Profiler::DRAW;
+        bool pending = false;
+        bool stats = false;
+        bool traced = false;
+    };
+
+    std::vector<Query> queries;
+    int active = -1;
+    uint32_t track = 0;
+};
+
+
+// times the scope on the GPU when the profiler or the tracer is enabled
+class GpuSpan
+{
+public:
+    GpuSpan(GpuTimer& _timer, Profiler::Stage stage): timer(_timer), active(Profiler::IsEnabled() || Tracer::IsEnabled())
+    {
+        if (active)
+            timer.Begin(stage);
+    }
+
+    ~GpuSpan()
+    {
+        if (active)
+            timer.End();
+    }
+
+    GpuSpan(const GpuSpan&) = delete;
+    GpuSpan& operator=(const GpuSpan&) = delete;
+
+private:
+    GpuTimer& timer;
+    bool active;
+};
+
+#endif
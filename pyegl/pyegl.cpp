@@ -1,507 +1,738 @@
 #include <torch/extension.h>
 #include <vector>
-#include <map>
-#include <cassert>
-#include <iostream>
-#include <iomanip>
-#include <sstream>
-#include <fstream>
 #include <string>
+#include <iostream>
+#include <future>
 #include <chrono>
+#include <map>
+#include <mutex>
 
+#include "renderer.h"
+#include "render_pool.h"
+#include "interpolate.h"
+#include "mesh_cache.h"
 
-#include "opengl_helper.h"
-#include "deps/path.h"
-#include "deps/json.h"
-#include "deps/any.h"
 
+// all GL work of the default context happens on a dedicated render thread,
+// so the calls below release the GIL while they wait for it. Contexts are
+// only created on first use in each process, which keeps pyegl usable in
+// forked DataLoader workers.
+static LazyRenderPool renderThread;
+static LazyRenderPool renderPool;
 
-//#define DEBUG
-#define CLOCK_START(start) auto start = std::chrono::system_clock::now()
-#define CLOCK_END(start, msg) std::cout << msg << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start).count() << "ms" << std::endl
 
+// Handle to a frame that is rendered asynchronously on the render thread
+class RenderFuture
+{
+public:
+    RenderFuture(std::future<std::vector<torch::Tensor>>&& _future): future(_future.share())
+    {
+    }
+
+    bool Done() const
+    {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
 
-#ifndef DEBUG
-#undef CLOCK_START
-#define CLOCK_START(start) {}
-#undef CLOCK_END
-#define CLOCK_END(start, msg) {}
-#endif
+    void Wait() const
+    {
+        future.wait();
+    }
 
+    std::vector<torch::Tensor> Result() const
+    {
+        return future.get();
+    }
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
-#include <dlfcn.h>
+private:
+    std::shared_future<std::vector<torch::Tensor>> future;
+};
 
 
-const char* so_path_lookup() 
+static RenderPool* get_render_thread()
 {
-    Dl_info dl_info;
-    dladdr((void*)so_path_lookup, &dl_info);
-    return dl_info.dli_fname;
+    RenderPool* pool = renderThread.Get();
+    if (!pool)
+    {
+        std::cout << "ERROR: you need to initialize pyegl" << std::endl;
+    }
+    return pool;
 }
 
 
-enum InternalState 
+void pyegl_load_shader(std::vector<std::string> defines)
 {
-    UNINITIALIZED,
-    INITIALIZED
-};
+    renderThread.SetDefines(defines);
+}
 
 
-static InternalState internal_state = InternalState::UNINITIALIZED;
-static OpenGL::EGL eglContext;
-static OpenGL::RenderTarget renderTarget;
-static OpenGL::ShaderProgram shaderProgram;
-static OpenGL::Texture texture;
-static std::vector<OpenGL::Mesh> meshes;
-static std::map<long, int> meshes_cache;
-static int g_active_mesh_index = -1;
-static size_t CACHE_SIZE = 20;
-static GLint position_loc, normal_loc, color_loc, uv_loc, mask_loc;
-static OpenGL::Transformation transformation;
-static std::vector<OpenGL::mat4> g_rigids;
-static unsigned int g_frame_count = 0;
-static unsigned int g_width = 512;
-static unsigned int g_height = 512;
-
-enum UniformType
-{
-    Vector3f,
-};
+void pyegl_init_with_defines(unsigned int width, unsigned int height, std::vector<std::string> defines)
+{
+    renderThread.Configure(1, width, height, defines);
+}
 
-static std::map<std::string, UniformType> uniform_types_lookup;
-static std::map<std::string, nonstd::any> g_uniforms = {
-    {"ambient_light", Eigen::Vector3f(0.5f, 0.5f, 0.5f)},
-    {"brightness", Eigen::Vector3f(0.0f, 0.0f, 0.0f)},
-    {"light_direction", Eigen::Vector3f(0.0f, 1.0f, 1.0f)}
-};
 
-enum ProjectionType
+void pyegl_init(unsigned int width, unsigned int height)
 {
-    PERSPECTIVE,
-    WEAK_PERSPECTIVE,
-    PINHOLE,
-    PINHOLE_ZERO_OPTICAL_CENTER,
-    IDENTITY,
-};
+    pyegl_init_with_defines(width, height, {});
+}
+
+
+void pyegl_warm_up()
+{
+    get_render_thread();
+}
 
-static ProjectionType g_projection_type = ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER;
+
+void pyegl_terminate()
+{
+    renderThread.Terminate();
+}
 
 
-void pyegl_load_shader(std::vector<std::string> defines)
+void pyegl_attach_texture(std::string filename)
+{
+    renderThread.SetTexture(filename);
+}
+
+
+void pyegl_load_config(std::string filename)
+{
+    renderThread.SetConfig(filename);
+}
+
+
+void pyegl_prefetch_textures(std::vector<std::string> filenames)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return;
+    pool->Submit([=](Renderer& r) { r.PrefetchTextures(filenames); });
+}
+
+
+void pyegl_set_texture_budget(size_t bytes)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return;
+    pool->Submit([=](Renderer& r) { r.SetTextureBudget(bytes); }).get();
+}
+
+
+void pyegl_load_materials(std::string filename)
+{
+    renderThread.SetMaterials(filename);
+}
+
+
+static std::map<std::string, size_t> memory_usage_dict(const MemoryUsage& usage)
 {
-    std::cout << "Defines:";
-    for (const auto& define : defines)
+    return {{"meshes", usage.meshes}, {"render_targets", usage.render_targets}, {"textures", usage.textures},
+            {"staging", usage.staging}, {"total", usage.Total()}, {"budget", Renderer::GetMemoryBudget()}};
+}
+
+
+std::map<std::string, size_t> pyegl_get_memory_usage()
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return {};
+    return memory_usage_dict(pool->Submit([](Renderer& r) { return r.GetMemoryUsage(); }).get());
+}
+
+
+// applies to every context, they evict on their next frame
+void pyegl_set_memory_budget(size_t bytes)
+{
+    Renderer::SetMemoryBudget(bytes);
+}
+
+
+// tensors are uploaded right away, unlike textures from files they are not
+// recorded to be uploaded again into the context of a forked process
+int pyegl_attach_texture_tensor(torch::Tensor texture, unsigned int x, unsigned int y, bool mipmaps)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return -1;
+    return pool->Submit([&](Renderer& r)
     {
-        std::cout << " " << define;
-        
-        if (define == "PERSPECTIVE")
-        {
-            g_projection_type = ProjectionType::PERSPECTIVE;
-        }
-        else if (define == "WEAK_PERSPECTIVE")
-        {
-            g_projection_type = ProjectionType::WEAK_PERSPECTIVE;
-        }
-        else if (define == "PINHOLE")
-        {
-            g_projection_type = ProjectionType::PINHOLE;
-        }
-        else if (define == "PINHOLE_ZERO_OPTICAL_CENTER")
-        {
-            g_projection_type = ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER;
-        }
-        else if (define == "IDENTITY")
-        {
-            g_projection_type = ProjectionType::IDENTITY;
-        }
-    }
-    std::cout << std::endl;
+        return r.AttachTextureTensor(texture, x, y, mipmaps);
+    }).get();
+}
+
+
+void pyegl_set_cache_dir(std::string directory)
+{
+    OpenGL::ShaderProgram::SetBinaryCacheDirectory(directory);
+}
+
+
+void pyegl_set_shader_dir(std::string directory)
+{
+    OpenGL::Shader::SetSourceDirectory(directory);
+}
+
 
-    path so_path(so_path_lookup());
-    if(!shaderProgram.Init((so_path.parent_path() / "shaders/basic.vs").str(),
-                           (so_path.parent_path() / "shaders/basic.gs").str(), 
-                           (so_path.parent_path() / "shaders/basic.fs").str(),
-                           defines))
+// applies to contexts that are created afterwards, call it before the first render
+void pyegl_set_backend(std::string name)
+{
+    RenderBackend backend;
+    if (!Renderer::ParseBackend(name, backend))
     {
-        std::cout << "ERROR: initializing shader program failed" << std::endl;
+        std::cout << "ERROR: unknown backend " << name << ", use auto, gl or software" << std::endl;
         return;
     }
-  
-    std::cout << "Setting uniforms:" << std::endl;
-    shaderProgram.Use();
+    Renderer::SetBackend(backend);
+}
 
-    for (const auto& el : g_uniforms)
-    {
-        switch (uniform_types_lookup[el.first])
-        {
-            case UniformType::Vector3f:
-                std::cout << el.first << ": " << nonstd::any_cast<Eigen::Vector3f>(el.second) << std::endl;
-                shaderProgram.SetUniform3fv(el.first, nonstd::any_cast<Eigen::Vector3f>(el.second));
-                break;
-            default:
-                std::cout << "ERROR: not supported uniform parameter" << std::endl;
-                break;
-        }
-    }
 
-    transformation.SetUniformLocations(shaderProgram.GetUniformLocation("projection"), shaderProgram.GetUniformLocation("modelview"), shaderProgram.GetUniformLocation("mesh_normalization") );
-  
-    std::cout << " " << "Attribute locations" << std::endl;
-    shaderProgram.Use();
-    position_loc = shaderProgram.GetAttribLocation("in_position");
-    normal_loc = shaderProgram.GetAttribLocation("in_normal");
-    color_loc = shaderProgram.GetAttribLocation("in_color");
-    uv_loc = shaderProgram.GetAttribLocation("in_uv");
-    mask_loc = shaderProgram.GetAttribLocation("in_mask");
+std::string pyegl_get_backend()
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return "";
+    return pool->Submit([](Renderer& r)
+    {
+        return std::string(r.GetBackend() == BACKEND_SOFTWARE ? "software" : "gl");
+    }).get();
 }
 
 
-void pyegl_init_with_defines(unsigned int width, unsigned int height, std::vector<std::string> defines)
+void pyegl_enable_stats(bool enabled)
 {
-    g_width = width;
-    g_height = height;
-  
-    std::cout << "Init EGL context" << std::endl;
-    eglContext.Init(width, height);
-  
-    pyegl_load_shader(defines);
-    
-    std::cout << "Create rendertarget" << std::endl;
-    renderTarget.Init(eglContext.GetWidth(), eglContext.GetHeight());
-  
-    internal_state = InternalState::INITIALIZED;
+    Profiler::SetEnabled(enabled);
 }
 
 
-void pyegl_init(unsigned int width, unsigned int height)
+void pyegl_reset_stats()
 {
-    pyegl_init_with_defines(width, height, {});
+    Profiler::Reset();
 }
 
 
-void pyegl_terminate()
+void pyegl_start_trace(size_t capacity)
 {
-    internal_state = InternalState::UNINITIALIZED;
-    //mesh.Terminate();
-    for (auto& mesh : meshes)
-        mesh.Terminate();
-    texture.Terminate();
-    renderTarget.Terminate();
-    eglContext.Terminate();
+    Tracer::Start(capacity);
 }
 
 
-void pyegl_attach_texture(std::string filename)
+void pyegl_stop_trace()
 {
-    std::cout << "Attach texture" << std::endl;
-    texture.Init(filename.c_str());
-    shaderProgram.Use();
-    texture.SetUniformLocations(shaderProgram.GetUniformLocation("color_texture"));
+    Tracer::Stop();
 }
 
 
-void pyegl_load_config(std::string filename)
+int pyegl_dump_trace(const std::string& filename)
 {
-    shaderProgram.Use();
-
-    std::cout << "Load config" << std::endl;
+    return Tracer::Dump(filename);
+}
 
-    std::ifstream file(filename);
 
-    if (file.fail())
+// {stage: {clock: {count, total_ms, mean_ms, min_ms, max_ms, p50_ms, p90_ms, p99_ms, histogram}}},
+// GPU times of the last frames are only collected by the next forward
+py::dict pyegl_get_stats()
+{
+    py::dict stats;
+    for (const auto& summary : Profiler::GetStats())
     {
-        std::cout << "ERROR: file does not exist " << filename << std::endl;
-        return;
+        py::dict entry;
+        entry["count"] = summary.count;
+        entry["total_ms"] = summary.total_ms;
+        entry["mean_ms"] = summary.mean_ms;
+        entry["min_ms"] = summary.min_ms;
+        entry["max_ms"] = summary.max_ms;
+        entry["p50_ms"] = summary.p50_ms;
+        entry["p90_ms"] = summary.p90_ms;
+        entry["p99_ms"] = summary.p99_ms;
+        entry["histogram"] = summary.histogram;
+
+        py::str stage(summary.stage);
+        if (!stats.contains(stage))
+            stats[stage] = py::dict();
+        stats[stage].cast<py::dict>()[py::str(summary.clock)] = entry;
     }
+    return stats;
+}
 
-    nlohmann::json config;
-    file >> config;
 
-    for (auto& el : config.items())
+// maps a list of names to the output bits of the render target, empty selects all maps
+static unsigned int parse_outputs(const std::vector<std::string>& names)
+{
+    static const std::map<std::string, unsigned int> lookup = {
+        {"color", OpenGL::RenderTarget::COLOR},
+        {"position", OpenGL::RenderTarget::POSITION},
+        {"normal", OpenGL::RenderTarget::NORMAL},
+        {"uv", OpenGL::RenderTarget::UV},
+        {"bary", OpenGL::RenderTarget::BARY},
+        {"vids", OpenGL::RenderTarget::VIDS}
+    };
+
+    if (names.empty())
+        return OpenGL::RenderTarget::ALL;
+
+    unsigned int outputs = 0;
+    for (const auto& name : names)
     {
-        try
-        {
-            switch (uniform_types_lookup.at(el.key()))
-            {
-                case UniformType::Vector3f:
-                {
-                    std::vector<float> data = config.at(el.key()).get<std::vector<float>>();
-                    auto uniform = nonstd::any(Eigen::Vector3f(data.data()));
-                    g_uniforms[el.key()].swap(uniform);
-                    shaderProgram.SetUniform3fv(el.key(), nonstd::any_cast<Eigen::Vector3f>(g_uniforms[el.key()]));
-                }
-                    break;
-                default:
-                    std::cout << "ERROR: not supported uniform parameter" << std::endl;
-                    break;
-            }
-        }
-        catch (std::out_of_range& e)
-        {
-            std::cout << "ERROR: wrong parameter in shader config " << e.what() << std::endl;
-        }
+        auto search = lookup.find(name);
+        if (search != lookup.end())
+            outputs |= search->second;
+        else
+            std::cout << "WARNING: unknown output map " << name << std::endl;
     }
+    return outputs;
 }
 
 
-void render(std::vector<float>& intrinsics)
+// maps shading defines (e.g. DIFFUSE_SHADING, TEXTURE_SHADING, PER_VERTEX_NORMAL)
+// to shading flags, an empty list keeps the ones of the loaded shader
+static int parse_shading(const std::vector<std::string>& names)
 {
-    float fx, fy, cx, cy, near, far;
-  
-    if (intrinsics.size() >= 6)
+    if (names.empty())
+        return -1;
+
+    unsigned int flags = OpenGL::ShadingBlock::PER_FACE_NORMAL;
+    for (const auto& name : names)
     {
-        fx = intrinsics[0];
-        fy = intrinsics[1];
-        cx = intrinsics[2];
-        cy = intrinsics[3];
-        near = intrinsics[4];
-        far = intrinsics[5];
+        if (!Renderer::ParseShading(name, flags))
+            std::cout << "WARNING: unknown shading mode " << name << std::endl;
     }
-    else
+    return flags;
+}
+
+
+// maps a projection define to its type, an empty name keeps the one of the loaded shader
+static int parse_projection(const std::string& name)
+{
+    ProjectionType projection;
+    if (name.empty())
+        return -1;
+    if (!Renderer::ParseProjection(name, projection))
     {
-        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
-        return;
+        std::cout << "WARNING: unknown projection " << name << std::endl;
+        return -1;
     }
+    return projection;
+}
 
-    // reset viewport, clear
-    eglContext.Clear();
-    
-    renderTarget.Use();
 
-    if (intrinsics.size() == 7)
+std::vector<torch::Tensor> pyegl_forward(std::vector<float> intrinsics, std::vector<float> pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                         unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                         c10::optional<torch::Tensor> materials)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return {};
+    return pool->Submit([&](Renderer& r)
     {
-        //std::cout << "WARNING: hacky solution to render backfaces" << std::endl;
-        renderTarget.ClearBack();
-    }
-    else
+        return r.Forward(intrinsics, pose, vertices, n_vertices, indices, n_faces, width, height, parse_outputs(outputs),
+                         parse_shading(shading), parse_projection(projection), materials.value_or(torch::Tensor()));
+    }).get();
+}
+
+
+torch::Tensor pyegl_forward_features(std::vector<float> intrinsics, std::vector<float> pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                    torch::Tensor features, unsigned int width, unsigned int height, std::string projection)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return torch::Tensor();
+    return pool->Submit([&](Renderer& r)
     {
-        renderTarget.Clear();
-    }    
-
-    // TODO: decide if that's necessary
-    // glDepthRangef(near, far);
-  
-    // set shader program
-    shaderProgram.Use();
-  
-    // set uniforms
-    transformation.SetModelView(g_rigids[0]);
-
-    switch (g_projection_type)
+        return r.ForwardFeatures(intrinsics, pose, vertices, n_vertices, indices, n_faces, features, width, height, parse_projection(projection));
+    }).get();
+}
+
+
+RenderFuture pyegl_forward_async(std::vector<float> intrinsics, std::vector<float> pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                 unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                 c10::optional<torch::Tensor> materials)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool)
     {
-        case ProjectionType::PERSPECTIVE:
-            transformation.SetPerspectiveProjection(fx, fy, cx, cy, near, far);
-            break;
-        case ProjectionType::WEAK_PERSPECTIVE:
-            transformation.SetWeakPerspectiveProjection(fx, fy, cx, cy);
-            break;
-        case ProjectionType::PINHOLE:
-            transformation.SetPinholeProjection(fx, fy, cx, cy, near, far, g_width, g_height);
-            break;
-        case ProjectionType::IDENTITY:
-            transformation.SetIdentityProjection();
-            break;
-        case ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER:
-        default:
-            transformation.SetPinholeZeroOpticalCenterProjection(fx, fy, cx, cy, near, far, g_width, g_height);
-            break;
+        std::promise<std::vector<torch::Tensor>> empty;
+        empty.set_value({});
+        return RenderFuture(empty.get_future());
     }
-  
-    //#ifdef DEBUG
-    //std::cout << "Projection matrix:" << std::endl;
-    //std::cout << " " << transformation.projection.m00 << " " << transformation.projection.m01 << " " << transformation.projection.m02 << " " << transformation.projection.m03 << std::endl;
-    //std::cout << " " << transformation.projection.m10 << " " << transformation.projection.m11 << " " << transformation.projection.m12 << " " << transformation.projection.m13 << std::endl;
-    //std::cout << " " << transformation.projection.m20 << " " << transformation.projection.m21 << " " << transformation.projection.m22 << " " << transformation.projection.m23 << std::endl;
-    //std::cout << " " << transformation.projection.m30 << " " << transformation.projection.m31 << " " << transformation.projection.m32 << " " << transformation.projection.m33 << std::endl;
-    //#endif
-  
-    auto& mesh = meshes[g_active_mesh_index];
-    transformation.SetMeshNormalization(mesh.GetCoG(), mesh.GetExtend());
-  
-    #ifdef DEBUG
-    std::cout << "Mesh normalization:" << std::endl;
-    auto cog = mesh.GetCoG();
-    std::cout << " " << cog(0) << " " << cog(1) << " " << cog(2) << std::endl;
-    std::cout << " " << mesh.GetExtend() << std::endl;
-    #endif
-  
-    transformation.Use();
-    texture.Use();
-  
-    // render mesh
-    CLOCK_START(time_render);
-    mesh.Render(position_loc, normal_loc, color_loc, uv_loc, mask_loc);
-    CLOCK_END(time_render, "Rendering: ");
-  
-    CLOCK_START(time_opengl_cuda_transfer);
-    renderTarget.CopyRenderedTexturesToCUDA();
-    CLOCK_END(time_opengl_cuda_transfer, "Copying OpenGL to CUDA: ");
-  
-    #ifdef DEBUG
-    renderTarget.CopyRenderedTexturesToCUDA(true);
-    //renderTarget.WriteDataToFile("results/cuda_color_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[0], 0);
-    //renderTarget.WriteDataToFile("results/cuda_position_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[1], 1);
-    //renderTarget.WriteDataToFile("results/cuda_normal_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[2], 2);
-    //renderTarget.WriteDataToFile("results/cuda_uv_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[3], 3);
-    //renderTarget.WriteDataToFile("results/cuda_bary_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[4], 4);
-    //renderTarget.WriteDataToFile("results/cuda_vids_" + std::to_string(g_frame_count) + ".png", renderTarget.GetBuffers()[5], 5);
-  
-    // write rendertarget to file
-    renderTarget.WriteToFile("fbo_color_" + std::to_string(g_frame_count) + ".png", 0);
-    renderTarget.WriteToFile("fbo_position_" + std::to_string(g_frame_count) + ".png", 1);
-    renderTarget.WriteToFile("fbo_normal_" + std::to_string(g_frame_count) + ".png", 2);
-    renderTarget.WriteToFile("fbo_uv_" + std::to_string(g_frame_count) + ".png", 3);
-    renderTarget.WriteToFile("fbo_bary_" + std::to_string(g_frame_count) + ".png", 4);
-    renderTarget.WriteToFile("fbo_vids_" + std::to_string(g_frame_count) + ".png", 5);
-  
-    // save screenshot
-    eglContext.SaveScreenshotPPM("rendering_" + std::to_string(g_frame_count) + ".ppm");
-    #endif
-  
-    g_frame_count++;
-  
-    // flush and swap buffers
-    eglContext.SwapBuffer();
-}
-
-std::vector<unsigned int> map_indices(const torch::Tensor& indices, unsigned int n_faces)
-{
-    std::vector<unsigned int> gl_indices;
-    gl_indices.reserve(n_faces*3);
-    for (unsigned int i = 0; i < n_faces*3; i++)
+
+    unsigned int output_bits = parse_outputs(outputs);
+    int shading_flags = parse_shading(shading);
+    int projection_type = parse_projection(projection);
+    torch::Tensor face_materials = materials.value_or(torch::Tensor());
+    return RenderFuture(pool->Submit([=](Renderer& r)
     {
-        gl_indices.emplace_back(static_cast<unsigned int>(((long*)indices.data_ptr())[i]));
-    }
-  
-    return gl_indices;
+        return r.Forward(intrinsics, pose, vertices, n_vertices, indices, n_faces, width, height, output_bits, shading_flags, projection_type, face_materials);
+    }));
+}
+
+
+// the trajectory stays in the context of the render thread until the next load or terminate
+int pyegl_load_trajectory(torch::Tensor poses)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return -1;
+    return pool->Submit([&](Renderer& r) { return r.LoadTrajectory(poses); }).get();
+}
+
+
+// files are recorded and loaded again into the context of a forked process
+void pyegl_load_trajectory_file(std::string filename)
+{
+    renderThread.SetTrajectory(filename);
+}
+
+
+size_t pyegl_get_trajectory_length()
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return 0;
+    return pool->Submit([](Renderer& r) { return r.GetTrajectoryLength(); }).get();
 }
 
-std::vector<torch::Tensor> pyegl_forward(std::vector<float> intrinsics, std::vector<float> pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces)
+
+std::vector<torch::Tensor> pyegl_forward_frame(std::vector<float> intrinsics, long frame, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                               unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                               c10::optional<torch::Tensor> materials)
 {
-    if (internal_state != InternalState::INITIALIZED)
+    RenderPool* pool = get_render_thread();
+    if (!pool) return {};
+    return pool->Submit([&](Renderer& r)
     {
-        std::cout << "ERROR: you need to initialize pyegl" << std::endl;
-        return {};
-    }
-  
-    if (vertices.scalar_type() != torch::kFloat32)
+        if (r.SetFrame(frame) < 0)
+            return std::vector<torch::Tensor>();
+        return r.Forward(intrinsics, {}, vertices, n_vertices, indices, n_faces, width, height, parse_outputs(outputs),
+                         parse_shading(shading), parse_projection(projection), materials.value_or(torch::Tensor()));
+    }).get();
+}
+
+
+// all frames are rendered in one task on the render thread, the maps are copies
+std::vector<std::vector<torch::Tensor>> pyegl_forward_frames(std::vector<float> intrinsics, std::vector<long> frames, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                                             unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                                             c10::optional<torch::Tensor> materials)
+{
+    RenderPool* pool = get_render_thread();
+    if (!pool) return {};
+    return pool->Submit([&](Renderer& r)
     {
-        std::cout << "ERROR: vertices has to be float32, but was: " << vertices.scalar_type() << std::endl;
-        return {};
-    }
-  
-    if (!vertices.is_cuda())
+        unsigned int output_bits = parse_outputs(outputs);
+        int shading_flags = parse_shading(shading);
+        int projection_type = parse_projection(projection);
+        torch::Tensor face_materials = materials.value_or(torch::Tensor());
+
+        std::vector<std::vector<torch::Tensor>> results;
+        results.reserve(frames.size());
+        for (long frame : frames)
+        {
+            if (r.SetFrame(frame) < 0)
+            {
+                results.emplace_back();
+                continue;
+            }
+            results.push_back(r.Forward(intrinsics, {}, vertices, n_vertices, indices, n_faces, width, height, output_bits, shading_flags, projection_type, face_materials));
+        }
+        return results;
+    }).get();
+}
+
+
+// Parses an OBJ, OFF or PLY file with the GIL released. The vertex tensor (V, 13) wraps
+// the parsed vertices without a copy on CPU, positions, normals, colors and uv
+// are views of it. With cache the mesh is stored in the cache directory after
+// the first load and memory mapped by later ones. With upload the mesh is added
+// to the cache of the default context, forwards with the returned faces reuse it. Returns an empty dict on errors.
+py::dict pyegl_load_mesh(std::string filename, float scale, bool upload, bool cache)
+{
+    MeshView view;
+    torch::Tensor vertices, faces, materials, bounds;
+    int result = 1;
     {
-        std::cout << "WARNING: vertices should be placed on CUDA, but was: " << vertices.device() << std::endl;
-        return {};
+        py::gil_scoped_release release;
+        result = MeshCache::Load(filename, view, scale, cache);
+        if (result >= 0)
+        {
+            long n_vertices = view.n_vertices;
+            long n_faces = view.n_faces;
+
+            // widened by torch in parallel, the view keeps the arrays alive meanwhile
+            faces = torch::from_blob((void*)view.indices, {n_faces, 3}, torch::kInt32).to(torch::kInt64);
+            if (view.material_ids)
+                materials = torch::from_blob((void*)view.material_ids, {n_faces}, torch::kInt32).to(torch::kInt64);
+
+            bounds = torch::empty({2, 3}, torch::kFloat32);
+            for (int k = 0; k < 3; k++)
+            {
+                bounds[0][k] = view.bounds_min[k];
+                bounds[1][k] = view.bounds_max[k];
+            }
+
+            // the vertex tensor keeps the parsed mesh or the mapped file alive
+            std::shared_ptr<void> owner = view.owner;
+            vertices = torch::from_blob((void*)view.vertices, {n_vertices, (long)(sizeof(OpenGL::Vertex) / sizeof(float))},
+                                        [owner](void*) {}, torch::kFloat32);
+
+            // the GL backend uploads from a temporary CUDA copy, the returned
+            // vertices stay the mapped ones on CPU
+            if (upload)
+            {
+                RenderPool* pool = get_render_thread();
+                result = pool ? pool->Submit([&](Renderer& r)
+                {
+                    torch::Tensor uploaded = r.GetBackend() == BACKEND_SOFTWARE ? vertices : vertices.cuda();
+                    return r.UploadMesh(uploaded, n_vertices, faces, n_faces, materials);
+                }).get() : -1;
+            }
+        }
     }
-  
-    if (indices.scalar_type() != torch::kInt64)
+
+    if (result < 0)
     {
-        std::cout << "ERROR: indices has to be int64, but was: " << indices.scalar_type() << std::endl;
-        return {};
+        return py::dict();
     }
-    
-    if (indices.device() != torch::kCPU)
+
+    py::dict mesh;
+    mesh["vertices"] = vertices;
+    mesh["positions"] = vertices.slice(1, 0, 3);
+    mesh["normals"] = vertices.slice(1, 3, 6);
+    mesh["colors"] = vertices.slice(1, 6, 10);
+    mesh["uv"] = vertices.slice(1, 10, 12);
+    mesh["faces"] = faces;
+    mesh["materials"] = materials.defined() ? py::cast(materials) : py::object(py::none());
+    mesh["bounds"] = bounds;
+    mesh["mtl"] = view.mtl_filename;
+    mesh["has_normals"] = view.has_normals;
+    mesh["has_uvs"] = view.has_uvs;
+    mesh["has_colors"] = view.has_colors;
+    return mesh;
+}
+
+
+void pyegl_init_pool(unsigned int n_workers, unsigned int width, unsigned int height, std::vector<std::string> defines, std::vector<int> devices)
+{
+    renderPool.Configure(n_workers, width, height, defines, devices);
+}
+
+
+void pyegl_terminate_pool()
+{
+    renderPool.Terminate();
+}
+
+
+void pyegl_pool_load_shader(std::vector<std::string> defines)
+{
+    renderPool.SetDefines(defines);
+}
+
+
+void pyegl_pool_attach_texture(std::string filename)
+{
+    renderPool.SetTexture(filename);
+}
+
+
+void pyegl_pool_load_config(std::string filename)
+{
+    renderPool.SetConfig(filename);
+}
+
+
+void pyegl_pool_prefetch_textures(std::vector<std::string> filenames)
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
     {
-        std::cout << "ERROR: faces has to be placed on CPU, but was: " << indices.device() << std::endl;
-        return {};
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return;
     }
-  
-    // Looking for a mesh in the cache or adding a new one
-    long ptr = (long)indices.data_ptr();
-    auto search = meshes_cache.find(ptr);
-    if (search != meshes_cache.end())
+
+    pool->Broadcast([&](Renderer& r) { r.PrefetchTextures(filenames); });
+}
+
+
+void pyegl_pool_load_materials(std::string filename)
+{
+    renderPool.SetMaterials(filename);
+}
+
+
+void pyegl_pool_attach_texture_tensor(torch::Tensor texture, unsigned int x, unsigned int y, bool mipmaps)
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
     {
-        //std::cout << "[INFO] Found cached mesh (indices ptr 0x" << std::hex << ptr << std::dec << " )" << std::endl;
-        g_active_mesh_index = search->second;
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return;
     }
-    else
-    {
-        if (meshes.size() > CACHE_SIZE)
-        {
-            meshes_cache.clear();
-            for (auto& m : meshes)
-                m.Terminate();
-            meshes.clear();
-        }
 
-        #ifdef DEBUG
-        std::cout << "[INFO] Adding new mesh in the cache (indices ptr 0x" << std::hex << ptr << std::dec << " )" << std::endl;
-        #endif
-        g_active_mesh_index = meshes.size();
-        meshes_cache[ptr] = g_active_mesh_index;
+    pool->Broadcast([&](Renderer& r) { r.AttachTextureTensor(texture, x, y, mipmaps); });
+}
 
-        #ifdef DEBUG
-        for (const auto & tuple : meshes_cache)
-            std::cout << "0x" << std::hex << tuple.first << std::dec << "->" << tuple.second << std::endl;
-        #endif
 
-        meshes.push_back(OpenGL::Mesh());
-    }
-    
-    auto& mesh = meshes[g_active_mesh_index];
-  
-    CLOCK_START(time_pytorch_opengl_transfer);
-    if (!mesh.IsInitialized())
+// summed over the contexts of the pool, the budget applies to each of them
+std::map<std::string, size_t> pyegl_pool_get_memory_usage()
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
     {
-        mesh.Init((OpenGL::Vertex*)vertices.data_ptr(), n_vertices, map_indices(indices, n_faces).data(), n_faces, vertices.is_cuda());
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return {};
     }
-    else if (mesh.GetNumberOfVertices() != n_vertices || mesh.GetNumberOfFaces() != n_faces || mesh.IsVertexDataOnCUDA() != vertices.is_cuda())
+
+    MemoryUsage total;
+    std::mutex mutex;
+    pool->Broadcast([&](Renderer& r)
     {
-        //https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/glDrawElements.xhtml
-        //type must be on of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT
-        std::cout << "ERROR: Different amount of vertices or faces in subsequent call: (" << n_vertices << "|" << n_faces << ")" << std::endl;
-        return {};
+        MemoryUsage usage = r.GetMemoryUsage();
+        std::lock_guard<std::mutex> lock(mutex);
+        total.meshes += usage.meshes;
+        total.render_targets += usage.render_targets;
+        total.textures += usage.textures;
+        total.staging += usage.staging;
+    });
+    return memory_usage_dict(total);
+}
+
+
+void pyegl_pool_load_trajectory(torch::Tensor poses)
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
+    {
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return;
     }
-    else
+
+    pool->Broadcast([&](Renderer& r) { r.LoadTrajectory(poses); });
+}
+
+
+void pyegl_pool_load_trajectory_file(std::string filename)
+{
+    renderPool.SetTrajectory(filename);
+}
+
+
+std::vector<std::vector<torch::Tensor>> pyegl_pool_forward_frames(std::vector<float> intrinsics, std::vector<long> frames, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                                                  unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                                                  c10::optional<torch::Tensor> materials)
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
     {
-        mesh.Update((OpenGL::Vertex*)vertices.data_ptr(), n_vertices, vertices.is_cuda());
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return {};
     }
-    CLOCK_END(time_pytorch_opengl_transfer, "Copying Pytorch to OpenGL: ");
-    
-    OpenGL::mat4 m{};
-    for (size_t i = 0; i < pose.size(); i++)
+
+    return pool->ForwardFrames(intrinsics, frames, vertices, n_vertices, indices, n_faces, width, height, parse_outputs(outputs),
+                               parse_shading(shading), parse_projection(projection), materials.value_or(torch::Tensor()));
+}
+
+
+std::vector<std::vector<torch::Tensor>> pyegl_forward_batch(std::vector<std::tuple<std::vector<float>, std::vector<float>, torch::Tensor, unsigned int, torch::Tensor, unsigned int>> requests,
+                                                             unsigned int width, unsigned int height, std::vector<std::string> outputs, std::vector<std::string> shading, std::string projection,
+                                                             c10::optional<torch::Tensor> materials)
+{
+    RenderPool* pool = renderPool.Get();
+    if (!pool)
     {
-        m.data[i] = pose[i];
+        std::cout << "ERROR: you need to initialize the render pool" << std::endl;
+        return {};
     }
-    Eigen::Matrix4f mEigen = m.ToEigen();
-    mEigen = mEigen.inverse().eval();
-    m.FromEigen(mEigen);
-    g_rigids.push_back(m);
-  
-    render(intrinsics);
-  
-    CLOCK_START(time_cuda_pytorch_transfer);
-    auto device = vertices.device();
-    auto color_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto color_map = torch::from_blob(renderTarget.GetBuffers()[0], {g_height, g_width, 4}, color_options);
-    auto position_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto position_map = torch::from_blob(renderTarget.GetBuffers()[1], {g_height, g_width, 4}, position_options);
-    auto normal_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto normal_map = torch::from_blob(renderTarget.GetBuffers()[2], {g_height, g_width, 4}, normal_options);
-    auto uv_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto uv_map = torch::from_blob(renderTarget.GetBuffers()[3], {g_height, g_width, 2}, uv_options);
-    auto bary_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto bary_map = torch::from_blob(renderTarget.GetBuffers()[4], {g_height, g_width, 4}, bary_options);
-    auto vids_options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
-    auto vids_map = torch::from_blob(renderTarget.GetBuffers()[5], {g_height, g_width, 4}, vids_options);
-    CLOCK_END(time_cuda_pytorch_transfer, "Copying CUDA to Pytorch: ");
-  
-    return {color_map, position_map, normal_map, uv_map, bary_map, vids_map};
+
+    return pool->ForwardBatch(requests, width, height, parse_outputs(outputs), parse_shading(shading), parse_projection(projection),
+                              materials.value_or(torch::Tensor()));
 }
 
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
-    m.def("init", &pyegl_init, "Set up EGL context");
-    m.def("init_with_defines", &pyegl_init_with_defines, "Set up EGL context with defines");
-    m.def("terminate", &pyegl_terminate, "Destroy EGL context");
-    m.def("attach_texture", &pyegl_attach_texture, "Load texture from file and attach to context");
-    m.def("load_config", &pyegl_load_config, "Load config for shaders");
-    m.def("load_shader", &pyegl_load_shader, "Reload shaders");
-    m.def("forward", &pyegl_forward, "Forward through pyegl");
+    py::class_<RenderFuture>(m, "RenderFuture")
+        .def("done", &RenderFuture::Done, "Check if the frame has been rendered")
+        .def("wait", &RenderFuture::Wait, "Block until the frame has been rendered", py::call_guard<py::gil_scoped_release>())
+        .def("result", &RenderFuture::Result, "Block until the frame has been rendered and return the maps", py::call_guard<py::gil_scoped_release>());
+
+    m.def("init", &pyegl_init, "Set up EGL context", py::call_guard<py::gil_scoped_release>());
+    m.def("init_with_defines", &pyegl_init_with_defines, "Set up EGL context with defines", py::call_guard<py::gil_scoped_release>());
+    m.def("terminate", &pyegl_terminate, "Destroy EGL context", py::call_guard<py::gil_scoped_release>());
+    m.def("attach_texture", &pyegl_attach_texture, "Load texture from file and attach to context", py::call_guard<py::gil_scoped_release>());
+    m.def("attach_texture_tensor", &pyegl_attach_texture_tensor, "Upload a (H, W, C) uint8/float32 CPU or CUDA tensor as texture, or a sub-rectangle of it at (x, y)",
+          py::arg("texture"), py::arg("x") = 0, py::arg("y") = 0, py::arg("mipmaps") = true,
+          py::call_guard<py::gil_scoped_release>());
+    m.def("load_config", &pyegl_load_config, "Load config for shaders", py::call_guard<py::gil_scoped_release>());
+    m.def("prefetch_textures", &pyegl_prefetch_textures, "Decode texture files in the background, so attaching them later does not block", py::call_guard<py::gil_scoped_release>());
+    m.def("set_texture_budget", &pyegl_set_texture_budget, "Set the GPU memory in bytes for cached textures, least recently used ones are released beyond it (0 for no limit)", py::call_guard<py::gil_scoped_release>());
+    m.def("load_materials", &pyegl_load_materials, "Load the materials of a .mtl or .glb file, forward renders them with per-face material ids", py::call_guard<py::gil_scoped_release>());
+    m.def("load_shader", &pyegl_load_shader, "Reload shaders", py::call_guard<py::gil_scoped_release>());
+    m.def("forward", &pyegl_forward, "Forward through pyegl, optionally at another resolution, with a subset of [color, position, normal, uv, bary, vids] (others are None) and another shading or projection",
+          py::arg("intrinsics"), py::arg("pose"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("forward_async", &pyegl_forward_async, "Enqueue a forward on the render thread and return a RenderFuture",
+          py::arg("intrinsics"), py::arg("pose"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("forward_features", &pyegl_forward_features, "Render per-vertex features (n_vertices, F) interpolated by the rasterizer, returns (H, W, F)",
+          py::arg("intrinsics"), py::arg("pose"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"), py::arg("features"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("projection") = std::string(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("load_trajectory", &pyegl_load_trajectory, "Load camera poses (T, 4, 4) float32 on CPU or CUDA, inverted once, for forward_frame(s)", py::call_guard<py::gil_scoped_release>());
+    m.def("load_trajectory_file", &pyegl_load_trajectory_file, "Memory map camera poses from a raw float32 (T, 4, 4) file, e.g. written with poses.astype('float32').tofile(filename)",
+          py::call_guard<py::gil_scoped_release>());
+    m.def("get_trajectory_length", &pyegl_get_trajectory_length, "Number of poses of the loaded trajectory", py::call_guard<py::gil_scoped_release>());
+    m.def("forward_frame", &pyegl_forward_frame, "Forward with the pose of a frame of the loaded trajectory",
+          py::arg("intrinsics"), py::arg("frame"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("forward_frames", &pyegl_forward_frames, "Forward a list or range of frames of the loaded trajectory, returns the maps per frame",
+          py::arg("intrinsics"), py::arg("frames"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("load_mesh", &pyegl_load_mesh, "Parse an OBJ, OFF, binary PLY or GLB file in parallel into vertices (V, 13), faces (F, 3) grouped by material, per-face materials and bounds, "
+          "optionally uploaded into the mesh cache. With cache a binary copy in the cache directory is memory mapped by later loads",
+          py::arg("filename"), py::arg("scale") = 1.0f, py::arg("upload") = false, py::arg("cache") = false);
+    m.def("load_obj", &pyegl_load_mesh, "Same as load_mesh",
+          py::arg("filename"), py::arg("scale") = 1.0f, py::arg("upload") = false, py::arg("cache") = false);
+    m.def("warm_up", &pyegl_warm_up, "Create the EGL context now instead of on first use", py::call_guard<py::gil_scoped_release>());
+    m.def("set_cache_dir", &pyegl_set_cache_dir, "Set the directory of the shader program binary cache, empty disables it");
+    m.def("set_shader_dir", &pyegl_set_shader_dir, "Take shader sources from this directory instead of the embedded ones, empty restores them");
+    m.def("enable_stats", &pyegl_enable_stats, "Turn the timing of upload, draw, readback and wrap (CPU and GPU) on or off, $PYEGL_STATS=1 turns it on at start");
+    m.def("get_stats", &pyegl_get_stats, "Latency statistics and histograms per stage and clock since the last reset_stats");
+    m.def("reset_stats", &pyegl_reset_stats, "Clear the collected timing statistics");
+    m.def("start_trace", &pyegl_start_trace, "Record the spans of all threads and GL contexts into a ring buffer of the given number of spans", py::arg("capacity") = 1 << 16);
+    m.def("stop_trace", &pyegl_stop_trace, "Stop recording spans, the recorded ones are kept for dump_trace");
+    m.def("dump_trace", &pyegl_dump_trace, "Write the recorded spans as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)", py::arg("filename"));
+    m.def("get_memory_usage", &pyegl_get_memory_usage, "GPU memory in bytes of the default context per subsystem (meshes, render_targets, textures, staging), the total and the budget",
+          py::call_guard<py::gil_scoped_release>());
+    m.def("set_memory_budget", &pyegl_set_memory_budget, "Limit the GPU memory of every context, least recently used meshes and texture files are released beyond it (0 for no limit, $PYEGL_MEMORY_BUDGET at start)");
+    m.def("set_backend", &pyegl_set_backend, "Render contexts created afterwards with auto, gl or software (the CPU rasterizer)");
+    m.def("get_backend", &pyegl_get_backend, "Backend of the default context, gl or software", py::call_guard<py::gil_scoped_release>());
+    m.def("interpolate", &interpolate, "Interpolate per-vertex attributes (V, F) at every pixel of the bary and vids maps, differentiable w.r.t. attributes and bary",
+          py::arg("attributes"), py::arg("bary"), py::arg("vids"));
+
+    m.def("init_pool", &pyegl_init_pool, "Set up a pool of EGL contexts, each on its own worker thread",
+          py::arg("n_workers"), py::arg("width"), py::arg("height"), py::arg("defines") = std::vector<std::string>(), py::arg("devices") = std::vector<int>(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("terminate_pool", &pyegl_terminate_pool, "Destroy all EGL contexts of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_load_shader", &pyegl_pool_load_shader, "Reload shaders in every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_attach_texture", &pyegl_pool_attach_texture, "Load texture from file and attach to every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_attach_texture_tensor", &pyegl_pool_attach_texture_tensor, "Upload a texture tensor into every context of the pool",
+          py::arg("texture"), py::arg("x") = 0, py::arg("y") = 0, py::arg("mipmaps") = true,
+          py::call_guard<py::gil_scoped_release>());
+    m.def("pool_prefetch_textures", &pyegl_pool_prefetch_textures, "Decode texture files in the background for every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_load_materials", &pyegl_pool_load_materials, "Load the materials of a .mtl or .glb file into every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_load_config", &pyegl_pool_load_config, "Load config for shaders in every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_get_memory_usage", &pyegl_pool_get_memory_usage, "GPU memory in bytes per subsystem summed over the contexts of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_load_trajectory", &pyegl_pool_load_trajectory, "Load camera poses (T, 4, 4) into every context of the pool", py::call_guard<py::gil_scoped_release>());
+    m.def("pool_load_trajectory_file", &pyegl_pool_load_trajectory_file, "Memory map camera poses from a raw float32 (T, 4, 4) file into every context of the pool",
+          py::call_guard<py::gil_scoped_release>());
+    m.def("pool_forward_frames", &pyegl_pool_forward_frames, "Forward a list or range of frames of the trajectory of the pool, results are returned in the order of frames",
+          py::arg("intrinsics"), py::arg("frames"), py::arg("vertices"), py::arg("n_vertices"), py::arg("faces"), py::arg("n_faces"),
+          py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
+    m.def("forward_batch", &pyegl_forward_batch, "Forward a list of (intrinsics, pose, vertices, n_vertices, faces, n_faces) requests through the pool with the same resolution, outputs, shading, projection and materials, "
+          "results are returned in submission order",
+          py::arg("requests"), py::arg("width") = 0, py::arg("height") = 0, py::arg("outputs") = std::vector<std::string>(),
+          py::arg("shading") = std::vector<std::string>(), py::arg("projection") = std::string(), py::arg("materials") = py::none(),
+          py::call_guard<py::gil_scoped_release>());
 }
@@ -0,0 +1,437 @@
+#include "render_pool.h"
+
+#include <iostream>
+#include <set>
+#include <pthread.h>
+#include <unistd.h>
+
+
+// pools are static objects in other translation units, so the registry is
+// created on first use and never destroyed
+static std::mutex& pools_mutex()
+{
+    static std::mutex* mutex = new std::mutex();
+    return *mutex;
+}
+static std::set<RenderPool*>& registered_pools()
+{
+    static std::set<RenderPool*>* pools = new std::set<RenderPool*>();
+    return *pools;
+}
+
+
+RenderPool::RenderPool()
+{
+    static std::once_flag fork_handlers;
+    std::call_once(fork_handlers, [] { pthread_atfork(&RenderPool::PrepareFork, &RenderPool::ParentAfterFork, &RenderPool::ChildAfterFork); });
+
+    std::lock_guard<std::mutex> lock(pools_mutex());
+    registered_pools().insert(this);
+}
+
+
+void RenderPool::UnregisterForkHandlers()
+{
+    std::lock_guard<std::mutex> lock(pools_mutex());
+    registered_pools().erase(this);
+}
+
+
+void RenderPool::PrepareFork()
+{
+    // hold all locks, so the child does not inherit a half modified queue
+    pools_mutex().lock();
+    for (auto pool : registered_pools())
+        pool->mutex.lock();
+}
+
+
+void RenderPool::ParentAfterFork()
+{
+    for (auto pool : registered_pools())
+        pool->mutex.unlock();
+    pools_mutex().unlock();
+}
+
+
+void RenderPool::ChildAfterFork()
+{
+    for (auto pool : registered_pools())
+    {
+        // the worker threads do not exist in the child and the contexts they
+        // own are unusable, leak them instead of joining or terminating
+        for (auto& worker : pool->workers)
+            worker.release();
+        pool->workers.clear();
+        pool->shared_tasks.clear();
+        pool->stopping = false;
+        pool->mutex.unlock();
+    }
+    pools_mutex().unlock();
+
+    OpenGL::EGL::ForgetDisplays();
+}
+
+
+int RenderPool::Init(unsigned int n_workers, unsigned int width, unsigned int height, const std::vector<std::string>& defines, const std::vector<int>& devices)
+{
+    if (IsInitialized())
+    {
+        std::cout << "WARNING: render pool is already initialized, terminating it first" << std::endl;
+        Terminate();
+    }
+
+    if (!devices.empty() && devices.size() != n_workers)
+    {
+        std::cout << "ERROR: expected one device per worker (" << n_workers << "), but got " << devices.size() << std::endl;
+        return -1;
+    }
+
+    // new threads start on CUDA device 0, so pass the current one on to the
+    // workers, the software backend and hosts without a device do not need one
+    int current_cuda_device = -1;
+    if (Renderer::GetRequestedBackend() != BACKEND_SOFTWARE)
+    {
+        cudaError_t error = cudaGetDevice(&current_cuda_device);
+        if (error != cudaSuccess)
+        {
+            current_cuda_device = -1;
+            if (Renderer::GetRequestedBackend() == BACKEND_GL || !Renderer::IsNoCudaDevice(error))
+            {
+                std::cout << "ERROR: no CUDA device for the GL backend: " << cudaGetErrorString(error) << std::endl;
+                cudaGetLastError();
+                return -1;
+            }
+        }
+    }
+
+    stopping = false;
+    for (unsigned int i = 0; i < n_workers; i++)
+    {
+        workers.emplace_back(new Worker());
+        workers.back()->thread = std::thread(&RenderPool::Run, this, std::ref(*workers.back()));
+    }
+
+    // contexts have to be created on the threads that are going to use them
+    std::vector<std::future<int>> statuses;
+    for (unsigned int i = 0; i < n_workers; i++)
+    {
+        // the EGL device index is assumed to match the CUDA device ordinal
+        int device_id = devices.empty() ? -1 : devices[i];
+        int cuda_device = devices.empty() || current_cuda_device < 0 ? current_cuda_device : devices[i];
+        auto task = std::make_shared<std::packaged_task<int(Renderer&)>>([=](Renderer& renderer)
+        {
+            if (cuda_device >= 0)
+            {
+                cudaError_t error = cudaSetDevice(cuda_device);
+                if (error != cudaSuccess)
+                {
+                    std::cout << "ERROR: setting CUDA device " << cuda_device << " failed: " << cudaGetErrorString(error) << std::endl;
+                    cudaGetLastError();
+                    return -1;
+                }
+            }
+            return renderer.Init(width, height, defines, device_id);
+        });
+        statuses.push_back(task->get_future());
+        Push([task](Renderer& renderer) { (*task)(renderer); }, i);
+    }
+
+    int status = 1;
+    for (auto& s : statuses)
+    {
+        if (s.get() < 0)
+            status = -1;
+    }
+
+    if (status < 0)
+    {
+        std::cout << "ERROR: initializing render pool failed" << std::endl;
+        Terminate();
+    }
+
+    return status;
+}
+
+
+void RenderPool::Terminate()
+{
+    if (!IsInitialized())
+        return;
+
+    Broadcast([](Renderer& renderer) { renderer.Terminate(); });
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+
+    for (auto& worker : workers)
+        worker->thread.join();
+    workers.clear();
+    shared_tasks.clear();
+}
+
+
+void RenderPool::Push(Task task, int worker_id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (worker_id < 0)
+            shared_tasks.push_back(std::move(task));
+        else
+            workers[worker_id]->tasks.push_back(std::move(task));
+    }
+    condition.notify_all();
+}
+
+
+void RenderPool::Broadcast(const Task& task)
+{
+    std::vector<std::future<void>> done;
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void(Renderer&)>>(task);
+        done.push_back(packaged->get_future());
+        Push([packaged](Renderer& renderer) { (*packaged)(renderer); }, i);
+    }
+
+    for (auto& d : done)
+        d.get();
+}
+
+
+std::vector<std::vector<torch::Tensor>> RenderPool::ForwardBatch(const std::vector<std::tuple<std::vector<float>, std::vector<float>, torch::Tensor, unsigned int, torch::Tensor, unsigned int>>& requests,
+                                                                 unsigned int width, unsigned int height, unsigned int outputs, int flags, int projection, torch::Tensor face_materials)
+{
+    std::vector<std::future<std::vector<torch::Tensor>>> futures;
+    futures.reserve(requests.size());
+
+    for (const auto& request : requests)
+    {
+        futures.push_back(Submit([=](Renderer& renderer)
+        {
+            return renderer.Forward(std::get<0>(request), std::get<1>(request), std::get<2>(request), std::get<3>(request), std::get<4>(request), std::get<5>(request),
+                                    width, height, outputs, flags, projection, face_materials);
+        }));
+    }
+
+    // results are returned in submission order
+    std::vector<std::vector<torch::Tensor>> results;
+    results.reserve(futures.size());
+    for (auto& future : futures)
+        results.push_back(future.get());
+
+    return results;
+}
+
+
+std::vector<std::vector<torch::Tensor>> RenderPool::ForwardFrames(const std::vector<float>& intrinsics, const std::vector<long>& frames, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                                                  unsigned int width, unsigned int height, unsigned int outputs, int flags, int projection, torch::Tensor face_materials)
+{
+    std::vector<std::future<std::vector<torch::Tensor>>> futures;
+    futures.reserve(frames.size());
+
+    for (long frame : frames)
+    {
+        futures.push_back(Submit([=](Renderer& renderer)
+        {
+            if (renderer.SetFrame(frame) < 0)
+                return std::vector<torch::Tensor>();
+            return renderer.Forward(intrinsics, {}, vertices, n_vertices, indices, n_faces, width, height, outputs, flags, projection, face_materials);
+        }));
+    }
+
+    std::vector<std::vector<torch::Tensor>> results;
+    results.reserve(futures.size());
+    for (auto& future : futures)
+        results.push_back(future.get());
+
+    return results;
+}
+
+
+void RenderPool::Run(Worker& worker)
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&] { return stopping || !worker.tasks.empty() || !shared_tasks.empty(); });
+
+            if (!worker.tasks.empty())
+            {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+            else if (!shared_tasks.empty())
+            {
+                task = std::move(shared_tasks.front());
+                shared_tasks.pop_front();
+            }
+            else
+            {
+                // stopping and nothing left to do
+                return;
+            }
+        }
+
+        task(worker.renderer);
+    }
+}
+
+
+static std::mutex& lazy_pools_mutex()
+{
+    static std::mutex* mutex = new std::mutex();
+    return *mutex;
+}
+static std::set<LazyRenderPool*>& registered_lazy_pools()
+{
+    static std::set<LazyRenderPool*>* pools = new std::set<LazyRenderPool*>();
+    return *pools;
+}
+
+
+LazyRenderPool::LazyRenderPool()
+{
+    static std::once_flag fork_handlers;
+    std::call_once(fork_handlers, [] { pthread_atfork(&LazyRenderPool::PrepareFork, &LazyRenderPool::ParentAfterFork, &LazyRenderPool::ChildAfterFork); });
+
+    std::lock_guard<std::mutex> lock(lazy_pools_mutex());
+    registered_lazy_pools().insert(this);
+}
+
+
+LazyRenderPool::~LazyRenderPool()
+{
+    std::lock_guard<std::mutex> lock(lazy_pools_mutex());
+    registered_lazy_pools().erase(this);
+}
+
+
+void LazyRenderPool::PrepareFork()
+{
+    // a fork during Get() or Set*() would leave the mutex of the child locked
+    lazy_pools_mutex().lock();
+    for (auto pool : registered_lazy_pools())
+        pool->mutex.lock();
+}
+
+
+void LazyRenderPool::ParentAfterFork()
+{
+    for (auto pool : registered_lazy_pools())
+        pool->mutex.unlock();
+    lazy_pools_mutex().unlock();
+}
+
+
+void LazyRenderPool::ChildAfterFork()
+{
+    // the forking thread holds the locks, it is the only thread of the child
+    for (auto pool : registered_lazy_pools())
+        pool->mutex.unlock();
+    lazy_pools_mutex().unlock();
+}
+
+
+void LazyRenderPool::Configure(unsigned int _n_workers, unsigned int _width, unsigned int _height, const std::vector<std::string>& _defines, const std::vector<int>& _devices)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    // a reconfigured pool is created again on its next use
+    pool.Terminate();
+    n_workers = _n_workers;
+    width = _width;
+    height = _height;
+    defines = _defines;
+    devices = _devices;
+    config.clear();
+    texture.clear();
+    materials.clear();
+    trajectory.clear();
+    configured = true;
+}
+
+
+void LazyRenderPool::Terminate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pid == getpid())
+        pool.Terminate();
+    configured = false;
+}
+
+
+void LazyRenderPool::SetDefines(const std::vector<std::string>& _defines)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    defines = _defines;
+    if (pool.IsInitialized() && pid == getpid())
+        pool.Broadcast([&](Renderer& r) { r.LoadShader(defines); });
+}
+
+
+void LazyRenderPool::SetConfig(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    config = filename;
+    if (pool.IsInitialized() && pid == getpid())
+        pool.Broadcast([&](Renderer& r) { r.LoadConfig(config); });
+}
+
+
+void LazyRenderPool::SetTexture(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    texture = filename;
+    if (pool.IsInitialized() && pid == getpid())
+        pool.Broadcast([&](Renderer& r) { r.AttachTexture(texture); });
+}
+
+
+void LazyRenderPool::SetMaterials(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    materials = filename;
+    if (pool.IsInitialized() && pid == getpid())
+        pool.Broadcast([&](Renderer& r) { r.LoadMaterials(materials); });
+}
+
+
+void LazyRenderPool::SetTrajectory(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    trajectory = filename;
+    if (pool.IsInitialized() && pid == getpid())
+        pool.Broadcast([&](Renderer& r) { r.LoadTrajectoryFile(trajectory); });
+}
+
+
+RenderPool* LazyRenderPool::Get()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!configured)
+        return nullptr;
+
+    if (pool.IsInitialized() && pid == getpid())
+        return &pool;
+
+    // first use in this process
+    if (pool.Init(n_workers, width, height, defines, devices) < 0)
+        return nullptr;
+
+    if (!config.empty())
+        pool.Broadcast([&](Renderer& r) { r.LoadConfig(config); });
+    if (!texture.empty())
+        pool.Broadcast([&](Renderer& r) { r.AttachTexture(texture); });
+    if (!materials.empty())
+        pool.Broadcast([&](Renderer& r) { r.LoadMaterials(materials); });
+    if (!trajectory.empty())
+        pool.Broadcast([&](Renderer& r) { r.LoadTrajectoryFile(trajectory); });
+
+    pid = getpid();
+    return &pool;
+}
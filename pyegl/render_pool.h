@@ -0,0 +1,170 @@
+#ifndef RENDER_POOL_H
+#define RENDER_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <future>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+
+#include "renderer.h"
+
+
+// A pool of renderers, each one owning its EGL context on a dedicated
+// worker thread. Forward requests are put into a shared queue and picked
+// up by whichever worker is idle, while Broadcast() runs a task on every
+// worker (e.g. to load a shader or a texture into all contexts).
+class RenderPool
+{
+public:
+    typedef std::function<void(Renderer&)> Task;
+
+    RenderPool();
+
+    ~RenderPool()
+    {
+        UnregisterForkHandlers();
+
+        // at interpreter exit only stop the idle workers, the GL/CUDA
+        // resources might already be gone at this point
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (auto& worker : workers)
+            worker->thread.join();
+    }
+
+    // devices holds the EGL device per worker, if empty all workers use the default one
+    int Init(unsigned int n_workers, unsigned int width, unsigned int height, const std::vector<std::string>& defines, const std::vector<int>& devices={});
+
+    void Terminate();
+
+    template<typename F>
+    auto Submit(F&& f) -> std::future<decltype(f(std::declval<Renderer&>()))>
+    {
+        typedef decltype(f(std::declval<Renderer&>())) R;
+        auto task = std::make_shared<std::packaged_task<R(Renderer&)>>(std::forward<F>(f));
+        auto future = task->get_future();
+        Push([task](Renderer& renderer) { (*task)(renderer); }, -1);
+        return future;
+    }
+
+    void Broadcast(const Task& task);
+
+    // the resolution, outputs, shading, projection and face materials apply
+    // to every request, see Renderer::Forward
+    std::vector<std::vector<torch::Tensor>> ForwardBatch(const std::vector<std::tuple<std::vector<float>, std::vector<float>, torch::Tensor, unsigned int, torch::Tensor, unsigned int>>& requests,
+                                                         unsigned int width=0, unsigned int height=0, unsigned int outputs=OpenGL::RenderTarget::ALL,
+                                                         int flags=-1, int projection=-1, torch::Tensor face_materials=torch::Tensor());
+
+    // renders frames of the trajectory loaded into every worker, in the order of frames
+    std::vector<std::vector<torch::Tensor>> ForwardFrames(const std::vector<float>& intrinsics, const std::vector<long>& frames, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                                          unsigned int width=0, unsigned int height=0, unsigned int outputs=OpenGL::RenderTarget::ALL,
+                                                          int flags=-1, int projection=-1, torch::Tensor face_materials=torch::Tensor());
+
+    size_t GetNumberOfWorkers() const
+    {
+        return workers.size();
+    }
+
+    bool IsInitialized() const
+    {
+        return !workers.empty();
+    }
+
+private:
+    void UnregisterForkHandlers();
+
+    // pthread_atfork handlers: the parent keeps its workers, the child only
+    // inherits the memory of the pool and has to drop it without touching GL
+    static void PrepareFork();
+
+    static void ParentAfterFork();
+
+    static void ChildAfterFork();
+
+    struct Worker
+    {
+        std::thread thread;
+        Renderer renderer;
+        std::deque<Task> tasks; // tasks addressed to this worker only
+    };
+
+    // worker_id < 0 pushes into the shared queue
+    void Push(Task task, int worker_id);
+
+    void Run(Worker& worker);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::deque<Task> shared_tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping = false;
+};
+
+
+// Records how a render pool has to be set up and creates its contexts on
+// first use in every process. pyegl can therefore be initialized before a
+// DataLoader forks its workers, each of them gets fresh contexts.
+class LazyRenderPool
+{
+public:
+    LazyRenderPool();
+
+    ~LazyRenderPool();
+
+    void Configure(unsigned int n_workers, unsigned int width, unsigned int height, const std::vector<std::string>& defines, const std::vector<int>& devices={});
+
+    void Terminate();
+
+    void SetDefines(const std::vector<std::string>& defines);
+
+    void SetConfig(const std::string& filename);
+
+    void SetTexture(const std::string& filename);
+
+    void SetMaterials(const std::string& filename);
+
+    void SetTrajectory(const std::string& filename);
+
+    // returns nullptr if the pool was never configured or creating the contexts failed
+    RenderPool* Get();
+
+    bool IsConfigured() const
+    {
+        return configured;
+    }
+
+private:
+    // pthread_atfork handlers, they are registered after the ones of
+    // RenderPool (the member pool is constructed first), so the mutex is
+    // locked before the pool mutexes, in the order Get() takes them
+    static void PrepareFork();
+
+    static void ParentAfterFork();
+
+    static void ChildAfterFork();
+
+    RenderPool pool;
+    std::mutex mutex;
+    pid_t pid = 0;
+    bool configured = false;
+
+    unsigned int n_workers = 1;
+    unsigned int width = 512;
+    unsigned int height = 512;
+    std::vector<std::string> defines;
+    std::vector<int> devices;
+    std::string config;
+    std::string texture;
+    std::string materials;
+    std::string trajectory;
+};
+
+#endif
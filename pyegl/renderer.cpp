@@ -0,0 +1,1245 @@
+#include "renderer.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+
+#include "deps/json.h"
+#include "deps/path.h"
+#include "interpolate.h"
+#include "profiler.h"
+#include "mesh_loader.h"
+
+
+//#define DEBUG
+
+
+static RenderBackend default_render_backend()
+{
+    RenderBackend backend = BACKEND_AUTO;
+    if (const char* name = std::getenv("PYEGL_BACKEND"))
+    {
+        if (!Renderer::ParseBackend(name, backend))
+            std::cout << "WARNING: unknown PYEGL_BACKEND " << name << std::endl;
+    }
+    return backend;
+}
+
+RenderBackend Renderer::requested_backend = default_render_backend();
+
+
+static size_t default_memory_budget()
+{
+    if (const char* bytes = std::getenv("PYEGL_MEMORY_BUDGET"))
+        return std::strtoull(bytes, nullptr, 10);
+    return 0;
+}
+
+std::atomic<size_t> Renderer::memory_budget{default_memory_budget()};
+
+
+bool Renderer::ParseBackend(const std::string& name, RenderBackend& backend)
+{
+    if (name == "auto") backend = BACKEND_AUTO;
+    else if (name == "gl") backend = BACKEND_GL;
+    else if (name == "software") backend = BACKEND_SOFTWARE;
+    else return false;
+    return true;
+}
+
+
+bool Renderer::IsNoCudaDevice(cudaError_t error)
+{
+    cudaGetLastError();
+    return error == cudaErrorNoDevice || error == cudaErrorInsufficientDriver;
+}
+
+
+int Renderer::Init(unsigned int _width, unsigned int _height, const std::vector<std::string>& defines, int device_id)
+{
+    width = _width;
+    height = _height;
+
+    backend = requested_backend == BACKEND_SOFTWARE ? BACKEND_SOFTWARE : BACKEND_GL;
+
+    // the maps are copied through CUDA, the buffers of the render target are
+    // allocated on the current device
+    if (backend == BACKEND_GL)
+    {
+        cudaError_t error = cudaGetDevice(&cuda_device);
+        if (error != cudaSuccess)
+        {
+            if (requested_backend == BACKEND_GL || !IsNoCudaDevice(error))
+            {
+                std::cout << "ERROR: no CUDA device for the GL backend: " << cudaGetErrorString(error) << std::endl;
+                cudaGetLastError();
+                return -1;
+            }
+            std::cout << "WARNING: no CUDA device, using the software rasterizer" << std::endl;
+            backend = BACKEND_SOFTWARE;
+        }
+    }
+
+    if (backend == BACKEND_GL)
+    {
+        std::cout << "Init EGL context" << std::endl;
+        bool egl_ready = false;
+        try
+        {
+            egl_ready = eglContext.Init(width, height, device_id);
+        }
+        catch (...)
+        {
+            if (requested_backend == BACKEND_GL)
+                throw;
+        }
+
+        if (!egl_ready)
+        {
+            if (requested_backend == BACKEND_GL)
+            {
+                std::cout << "ERROR: initializing EGL context failed" << std::endl;
+                return -1;
+            }
+            std::cout << "WARNING: initializing EGL context failed, using the software rasterizer" << std::endl;
+            backend = BACKEND_SOFTWARE;
+        }
+    }
+
+    if (backend == BACKEND_SOFTWARE)
+    {
+        // only the shading and projection defaults of the defines apply
+        LoadShader(defines);
+        state = InternalState::INITIALIZED;
+        return 1;
+    }
+
+    textureManager.SetClock(&use_clock);
+
+    if (OpenGL::ShaderProgram::EnableParallelCompile())
+    {
+        std::cout << " " << "Parallel shader compilation" << std::endl;
+    }
+
+    transformation.Init();
+    lighting.Init(OpenGL::LIGHTING_BINDING);
+    shading.Init(OpenGL::SHADING_BINDING);
+    featurePass.Init(OpenGL::FEATURE_PASS_BINDING);
+
+    // only starts the compilation, the program is finished on first use
+    LoadShader(defines);
+
+    std::cout << "Create rendertarget" << std::endl;
+    if (!GetRenderTarget(width, height, OpenGL::RenderTarget::ALL))
+    {
+        return -1;
+    }
+
+    state = InternalState::INITIALIZED;
+    return 1;
+}
+
+
+void Renderer::Terminate()
+{
+    state = InternalState::UNINITIALIZED;
+    trajectory.Clear();
+    view = OpenGL::mat4::Identity();
+    if (backend == BACKEND_SOFTWARE)
+        return;
+
+    for (auto& cached : meshes)
+        cached.second.mesh.Terminate();
+    meshes.clear();
+    active_mesh = nullptr;
+    texture.Terminate();
+    textureManager.Terminate();
+    attachedTexture = nullptr;
+    materials.Terminate();
+    TerminateRenderTargets();
+    featureTarget.Terminate();
+    gpuTimer.Terminate();
+    featureBuffer.Terminate();
+    featureProgram.Terminate();
+    featureProgram_ready = false;
+    featurePass.Terminate();
+    for (auto& el : shaderPrograms)
+        el.second.Terminate();
+    shaderPrograms.clear();
+    shaderProgram = nullptr;
+    shaderProgram_ready = false;
+    transformation.Terminate();
+    lighting.Terminate();
+    shading.Terminate();
+    eglContext.Terminate();
+}
+
+
+OpenGL::RenderTarget* Renderer::GetRenderTarget(unsigned int target_width, unsigned int target_height, unsigned int outputs)
+{
+    auto key = std::make_tuple(target_width, target_height, outputs);
+    auto search = renderTargets.find(key);
+    if (search != renderTargets.end())
+    {
+        search->second.last_used = ++use_clock;
+        return &search->second.target;
+    }
+
+    if (renderTargets.size() >= RENDER_TARGET_CACHE_SIZE)
+    {
+        TraceSpan trace("Renderer::EvictRenderTarget", "cache");
+        auto lru = renderTargets.begin();
+        for (auto it = renderTargets.begin(); it != renderTargets.end(); ++it)
+        {
+            if (it->second.last_used < lru->second.last_used)
+                lru = it;
+        }
+
+        #ifdef DEBUG
+        std::cout << "[INFO] Release render target " << std::get<0>(lru->first) << "x" << std::get<1>(lru->first) << std::endl;
+        #endif
+        lru->second.target.Terminate();
+        renderTargets.erase(lru);
+    }
+
+    auto& cached = renderTargets[key];
+    cached.last_used = ++use_clock;
+    if (cached.target.Init(target_width, target_height, outputs) < 0)
+    {
+        std::cout << "ERROR: creating render target " << target_width << "x" << target_height << " failed" << std::endl;
+        cached.target.Terminate();
+        renderTargets.erase(key);
+        return nullptr;
+    }
+
+    return &cached.target;
+}
+
+
+void Renderer::TerminateRenderTargets()
+{
+    for (auto& el : renderTargets)
+        el.second.target.Terminate();
+    renderTargets.clear();
+}
+
+
+MemoryUsage Renderer::GetMemoryUsage() const
+{
+    MemoryUsage usage;
+    if (backend == BACKEND_SOFTWARE)
+        return usage;
+
+    for (const auto& cached : meshes)
+        usage.meshes += cached.second.mesh.GetMemoryUsage();
+
+    for (const auto& el : renderTargets)
+    {
+        usage.render_targets += el.second.target.GetMemoryUsage();
+        usage.staging += el.second.target.GetStagingMemoryUsage();
+    }
+    usage.render_targets += featureTarget.GetMemoryUsage();
+    usage.staging += featureTarget.GetStagingMemoryUsage();
+
+    usage.textures = textureManager.GetMemoryUsage() + texture.GetMemoryUsage() + materials.GetMemoryUsage();
+    usage.staging += texture.GetStagingMemoryUsage() + featureBuffer.GetMemoryUsage();
+    return usage;
+}
+
+
+void Renderer::EnforceMemoryBudget()
+{
+    size_t budget = memory_budget;
+    if (budget == 0 || backend == BACKEND_SOFTWARE)
+        return;
+
+    size_t total = GetMemoryUsage().Total();
+    if (total <= budget)
+        return;
+
+    TraceSpan trace("Renderer::EnforceMemoryBudget", "cache");
+    while (total > budget)
+    {
+        // least recently used mesh except the one of the current frame
+        auto lru = meshes.end();
+        for (auto it = meshes.begin(); it != meshes.end(); ++it)
+        {
+            if (&it->second.mesh == active_mesh)
+                continue;
+            if (lru == meshes.end() || it->second.last_used < lru->second.last_used)
+                lru = it;
+        }
+
+        unsigned long texture_use = textureManager.GetLeastRecentUse();
+        if (lru != meshes.end() && (texture_use == 0 || lru->second.last_used < texture_use))
+        {
+            total -= lru->second.mesh.GetMemoryUsage();
+            lru->second.mesh.Terminate();
+            meshes.erase(lru);
+        }
+        else if (texture_use != 0)
+        {
+            size_t before = textureManager.GetMemoryUsage();
+            textureManager.EvictLeastRecentlyUsed();
+            total -= before - textureManager.GetMemoryUsage();
+        }
+        else
+        {
+            std::cout << "WARNING: " << total << " bytes in use, the memory budget of " << budget << " bytes is too small for the current frame" << std::endl;
+            return;
+        }
+    }
+}
+
+
+bool Renderer::ParseProjection(const std::string& name, ProjectionType& projection)
+{
+    static const std::map<std::string, ProjectionType> lookup = {
+        {"PERSPECTIVE", ProjectionType::PERSPECTIVE},
+        {"WEAK_PERSPECTIVE", ProjectionType::WEAK_PERSPECTIVE},
+        {"PINHOLE", ProjectionType::PINHOLE},
+        {"PINHOLE_ZERO_OPTICAL_CENTER", ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER},
+        {"IDENTITY", ProjectionType::IDENTITY}
+    };
+
+    auto search = lookup.find(name);
+    if (search == lookup.end())
+        return false;
+    projection = search->second;
+    return true;
+}
+
+
+bool Renderer::ParseShading(const std::string& name, unsigned int& flags)
+{
+    if (name == "CONSTANT_SHADING") flags |= OpenGL::ShadingBlock::CONSTANT;
+    else if (name == "DIFFUSE_SHADING") flags |= OpenGL::ShadingBlock::DIFFUSE;
+    else if (name == "TEXTURE_SHADING") flags |= OpenGL::ShadingBlock::TEXTURE;
+    else if (name == "PER_FACE_NORMAL") flags |= OpenGL::ShadingBlock::PER_FACE_NORMAL;
+    else if (name == "PER_VERTEX_NORMAL") flags &= ~OpenGL::ShadingBlock::PER_FACE_NORMAL;
+    else return false;
+    return true;
+}
+
+
+void Renderer::LoadShader(const std::vector<std::string>& defines)
+{
+    // shading and projection are selected at runtime, so they only change the
+    // defaults and all of their combinations share one program
+    std::vector<std::string> program_defines;
+    shading_flags = OpenGL::ShadingBlock::PER_FACE_NORMAL;
+
+    std::cout << "Defines:";
+    for (const auto& define : defines)
+    {
+        std::cout << " " << define;
+
+        if (!ParseProjection(define, projection_type) && !ParseShading(define, shading_flags))
+        {
+            program_defines.push_back(define);
+        }
+    }
+    std::cout << std::endl;
+
+    if (backend == BACKEND_SOFTWARE)
+        return;
+
+    auto search = shaderPrograms.find(program_defines);
+    if (search != shaderPrograms.end())
+    {
+        shaderProgram = &search->second;
+        shaderProgram_ready = false;
+        return;
+    }
+
+    std::string vertex_src, geometry_src, fragment_src;
+    if(!OpenGL::Shader::ReadShaderSource("basic.vs", program_defines, vertex_src) ||
+       !OpenGL::Shader::ReadShaderSource("basic.gs", program_defines, geometry_src) ||
+       !OpenGL::Shader::ReadShaderSource("basic.fs", program_defines, fragment_src))
+    {
+        std::cout << "ERROR: reading shader sources failed" << std::endl;
+        shaderProgram = nullptr;
+        return;
+    }
+
+    // the program binary cache on disk may still skip the compilation
+    OpenGL::ShaderProgram program;
+    if (program.Begin(vertex_src, geometry_src, fragment_src) < 0)
+    {
+        std::cout << "ERROR: initializing shader program failed" << std::endl;
+        program.Terminate();
+        shaderProgram = nullptr;
+        return;
+    }
+    shaderProgram = &(shaderPrograms[program_defines] = program);
+    shaderProgram_ready = false;
+}
+
+
+int Renderer::UseShader()
+{
+    if (!shaderProgram)
+    {
+        std::cout << "ERROR: no shader program loaded" << std::endl;
+        return -1;
+    }
+
+    if (!shaderProgram_ready)
+    {
+        if (shaderProgram->Finish() < 0)
+        {
+            std::cout << "ERROR: initializing shader program failed" << std::endl;
+            for (auto it = shaderPrograms.begin(); it != shaderPrograms.end(); ++it)
+            {
+                if (&it->second == shaderProgram)
+                {
+                    it->second.Terminate();
+                    shaderPrograms.erase(it);
+                    break;
+                }
+            }
+            shaderProgram = nullptr;
+            return -1;
+        }
+        shaderProgram_ready = true;
+
+        std::cout << " " << "Attribute locations" << std::endl;
+        position_loc = shaderProgram->GetAttribLocation("in_position");
+        normal_loc = shaderProgram->GetAttribLocation("in_normal");
+        color_loc = shaderProgram->GetAttribLocation("in_color");
+        uv_loc = shaderProgram->GetAttribLocation("in_uv");
+        mask_loc = shaderProgram->GetAttribLocation("in_mask");
+    }
+
+    shaderProgram->Use();
+    return 1;
+}
+
+
+void Renderer::AttachTexture(const std::string& filename)
+{
+    std::cout << "Attach texture" << std::endl;
+    if (backend == BACKEND_SOFTWARE)
+    {
+        std::cout << "WARNING: the software rasterizer does not sample textures" << std::endl;
+        return;
+    }
+    attachedTexture = textureManager.Get(filename);
+}
+
+
+void Renderer::PrefetchTextures(const std::vector<std::string>& filenames)
+{
+    if (backend == BACKEND_SOFTWARE)
+        return;
+    textureManager.Prefetch(filenames);
+}
+
+
+void Renderer::SetTextureBudget(size_t bytes)
+{
+    if (backend == BACKEND_SOFTWARE)
+        return;
+    textureManager.SetBudget(bytes);
+}
+
+
+int Renderer::AttachTextureTensor(torch::Tensor data, unsigned int x, unsigned int y, bool mipmaps)
+{
+    if (backend == BACKEND_SOFTWARE)
+    {
+        std::cout << "WARNING: the software rasterizer does not sample textures" << std::endl;
+        return -1;
+    }
+
+    if (data.dim() != 3 || data.size(2) < 1 || data.size(2) > 4)
+    {
+        std::cout << "ERROR: texture has to be (H, W, C) with 1 to 4 channels" << std::endl;
+        return -1;
+    }
+
+    static const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    static const GLenum internal_formats_uint8[4] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    static const GLenum internal_formats_float[4] = {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F};
+
+    unsigned int n_channels = data.size(2);
+    GLenum format = formats[n_channels - 1];
+    GLenum type, internal_format;
+    if (data.scalar_type() == torch::kUInt8)
+    {
+        type = GL_UNSIGNED_BYTE;
+        internal_format = internal_formats_uint8[n_channels - 1];
+    }
+    else if (data.scalar_type() == torch::kFloat32)
+    {
+        type = GL_FLOAT;
+        internal_format = internal_formats_float[n_channels - 1];
+    }
+    else
+    {
+        std::cout << "ERROR: texture has to be uint8 or float32, but was: " << data.scalar_type() << std::endl;
+        return -1;
+    }
+
+    data = data.contiguous();
+    unsigned int data_height = data.size(0);
+    unsigned int data_width = data.size(1);
+
+    if (x == 0 && y == 0 && !texture.HasStorage(data_width, data_height, internal_format))
+    {
+        unsigned int levels = 1;
+        if (mipmaps)
+        {
+            while ((std::max(data_width, data_height) >> levels) > 0)
+                levels++;
+        }
+
+        texture.Terminate();
+        if (texture.Init(data_width, data_height, internal_format, levels) < 0)
+        {
+            return -1;
+        }
+    }
+
+    attachedTexture = &texture;
+    return texture.Update(data.data_ptr(), data.is_cuda(), x, y, data_width, data_height,
+                          format, type, n_channels * data.element_size(), mipmaps);
+}
+
+
+int Renderer::LoadMaterials(const std::string& filename)
+{
+    std::cout << "Load materials" << std::endl;
+    if (backend == BACKEND_SOFTWARE)
+    {
+        std::cout << "WARNING: the software rasterizer does not sample materials" << std::endl;
+        return -1;
+    }
+
+    // GLB files hold their own materials, see MeshLoader::LoadGlb
+    std::vector<OpenGL::Material> mtl_materials;
+    std::string extension = path(filename).extension();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    int result = extension == "glb" ? MeshLoader::LoadGlbMaterials(filename, mtl_materials) : OpenGL::LoadMtlFile(filename, mtl_materials);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    return materials.Init(mtl_materials);
+}
+
+
+void Renderer::LoadConfig(const std::string& filename)
+{
+    std::cout << "Load config" << std::endl;
+
+    std::ifstream file(filename);
+
+    if (file.fail())
+    {
+        std::cout << "ERROR: file does not exist " << filename << std::endl;
+        return;
+    }
+
+    nlohmann::json config;
+    file >> config;
+
+    for (auto& el : config.items())
+    {
+        try
+        {
+            std::vector<float> data = el.value().get<std::vector<float>>();
+            if (data.size() < 3 || !lighting.data.Set(el.key(), data))
+            {
+                std::cout << "ERROR: wrong parameter in shader config " << el.key() << std::endl;
+            }
+        }
+        catch (nlohmann::json::exception& e)
+        {
+            std::cout << "ERROR: wrong parameter in shader config " << el.key() << " " << e.what() << std::endl;
+        }
+    }
+
+    // a single buffer write for all lighting parameters
+    if (backend != BACKEND_SOFTWARE)
+        lighting.Upload();
+}
+
+
+int Renderer::SetCamera(const std::vector<float>& intrinsics, unsigned int width, unsigned int height, ProjectionType projection)
+{
+    float fx, fy, cx, cy, near, far;
+
+    if (intrinsics.size() >= 6)
+    {
+        fx = intrinsics[0];
+        fy = intrinsics[1];
+        cx = intrinsics[2];
+        cy = intrinsics[3];
+        near = intrinsics[4];
+        far = intrinsics[5];
+    }
+    else
+    {
+        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
+        return -1;
+    }
+
+    // set uniforms
+    transformation.SetModelView(view);
+
+    switch (projection)
+    {
+        case ProjectionType::PERSPECTIVE:
+            transformation.SetPerspectiveProjection(fx, fy, cx, cy, near, far);
+            break;
+        case ProjectionType::WEAK_PERSPECTIVE:
+            transformation.SetWeakPerspectiveProjection(fx, fy, cx, cy);
+            break;
+        case ProjectionType::PINHOLE:
+            transformation.SetPinholeProjection(fx, fy, cx, cy, near, far, width, height);
+            break;
+        case ProjectionType::IDENTITY:
+            transformation.SetIdentityProjection();
+            break;
+        case ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER:
+        default:
+            transformation.SetPinholeZeroOpticalCenterProjection(fx, fy, cx, cy, near, far, width, height);
+            break;
+    }
+
+    //#ifdef DEBUG
+    //std::cout << "Projection matrix:" << std::endl;
+    //std::cout << " " << transformation.projection.m00 << " " << transformation.projection.m01 << " " << transformation.projection.m02 << " " << transformation.projection.m03 << std::endl;
+    //std::cout << " " << transformation.projection.m10 << " " << transformation.projection.m11 << " " << transformation.projection.m12 << " " << transformation.projection.m13 << std::endl;
+    //std::cout << " " << transformation.projection.m20 << " " << transformation.projection.m21 << " " << transformation.projection.m22 << " " << transformation.projection.m23 << std::endl;
+    //std::cout << " " << transformation.projection.m30 << " " << transformation.projection.m31 << " " << transformation.projection.m32 << " " << transformation.projection.m33 << std::endl;
+    //#endif
+
+    return 1;
+}
+
+
+int Renderer::Render(const std::vector<float>& intrinsics, OpenGL::RenderTarget& renderTarget, unsigned int flags, ProjectionType projection,
+                     float* const* destinations)
+{
+    if (intrinsics.size() < 6)
+    {
+        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
+        return -1;
+    }
+
+    // reset viewport, clear
+    eglContext.Clear();
+
+    renderTarget.Use();
+
+    if (intrinsics.size() == 7)
+    {
+        //std::cout << "WARNING: hacky solution to render backfaces" << std::endl;
+        renderTarget.ClearBack();
+    }
+    else
+    {
+        renderTarget.Clear();
+    }
+
+    // TODO: decide if that's necessary
+    // glDepthRangef(near, far);
+
+    // set shader program
+    if (UseShader() < 0)
+    {
+        return -1;
+    }
+
+    // set uniforms
+    SetCamera(intrinsics, renderTarget.GetWidth(), renderTarget.GetHeight(), projection);
+
+    auto& mesh = *active_mesh;
+    transformation.SetMeshNormalization(mesh.GetCoG(), mesh.GetExtend());
+
+    #ifdef DEBUG
+    std::cout << "Mesh normalization:" << std::endl;
+    auto cog = mesh.GetCoG();
+    std::cout << " " << cog(0) << " " << cog(1) << " " << cog(2) << std::endl;
+    std::cout << " " << mesh.GetExtend() << std::endl;
+    #endif
+
+    transformation.Use();
+    lighting.Bind();
+    flags &= ~OpenGL::ShadingBlock::TEXTURE_ORIGIN_TOP;
+    if (attachedTexture)
+    {
+        attachedTexture->Use();
+        if (attachedTexture->IsOriginTop())
+            flags |= OpenGL::ShadingBlock::TEXTURE_ORIGIN_TOP;
+    }
+
+    if (mesh.HasMaterials() && materials.IsInitialized())
+    {
+        flags |= OpenGL::ShadingBlock::MATERIAL;
+        materials.Use();
+    }
+    else
+    {
+        flags &= ~OpenGL::ShadingBlock::MATERIAL;
+    }
+
+    if (shading.data.flags != flags)
+    {
+        shading.data.flags = flags;
+        shading.Upload();
+    }
+    shading.Bind();
+
+    // render mesh
+    {
+        CpuSpan span(Profiler::DRAW);
+        GpuSpan gpu_span(gpuTimer, Profiler::DRAW);
+        mesh.Render(position_loc, normal_loc, color_loc, uv_loc, mask_loc);
+    }
+
+    {
+        CpuSpan span(Profiler::READBACK);
+        GpuSpan gpu_span(gpuTimer, Profiler::READBACK);
+        renderTarget.CopyRenderedTexturesToCUDA(false, destinations);
+    }
+
+    #ifdef DEBUG
+    renderTarget.CopyRenderedTexturesToCUDA(true);
+    //renderTarget.WriteDataToFile("results/cuda_color_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[0], 0);
+    //renderTarget.WriteDataToFile("results/cuda_position_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[1], 1);
+    //renderTarget.WriteDataToFile("results/cuda_normal_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[2], 2);
+    //renderTarget.WriteDataToFile("results/cuda_uv_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[3], 3);
+    //renderTarget.WriteDataToFile("results/cuda_bary_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[4], 4);
+    //renderTarget.WriteDataToFile("results/cuda_vids_" + std::to_string(frame_count) + ".png", renderTarget.GetBuffers()[5], 5);
+
+    // write rendertarget to file
+    renderTarget.WriteToFile("fbo_color_" + std::to_string(frame_count) + ".png", 0);
+    renderTarget.WriteToFile("fbo_position_" + std::to_string(frame_count) + ".png", 1);
+    renderTarget.WriteToFile("fbo_normal_" + std::to_string(frame_count) + ".png", 2);
+    renderTarget.WriteToFile("fbo_uv_" + std::to_string(frame_count) + ".png", 3);
+    renderTarget.WriteToFile("fbo_bary_" + std::to_string(frame_count) + ".png", 4);
+    renderTarget.WriteToFile("fbo_vids_" + std::to_string(frame_count) + ".png", 5);
+
+    // save screenshot
+    eglContext.SaveScreenshotPPM("rendering_" + std::to_string(frame_count) + ".ppm");
+    #endif
+
+    frame_count++;
+
+    // flush and swap buffers
+    eglContext.SwapBuffer();
+    return 1;
+}
+
+
+static std::vector<unsigned int> map_indices(const torch::Tensor& indices, unsigned int n_faces)
+{
+    std::vector<unsigned int> gl_indices;
+    gl_indices.reserve(n_faces*3);
+    for (unsigned int i = 0; i < n_faces*3; i++)
+    {
+        gl_indices.emplace_back(static_cast<unsigned int>(((long*)indices.data_ptr())[i]));
+    }
+
+    return gl_indices;
+}
+
+
+int Renderer::PrepareMesh(const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces, torch::Tensor face_materials)
+{
+    if (vertices.scalar_type() != torch::kFloat32)
+    {
+        std::cout << "ERROR: vertices has to be float32, but was: " << vertices.scalar_type() << std::endl;
+        return -1;
+    }
+
+    if (!vertices.is_cuda())
+    {
+        std::cout << "WARNING: vertices should be placed on CUDA, but was: " << vertices.device() << std::endl;
+        return -1;
+    }
+
+    if (indices.scalar_type() != torch::kInt64)
+    {
+        std::cout << "ERROR: indices has to be int64, but was: " << indices.scalar_type() << std::endl;
+        return -1;
+    }
+
+    if (indices.device() != torch::kCPU)
+    {
+        std::cout << "ERROR: faces has to be placed on CPU, but was: " << indices.device() << std::endl;
+        return -1;
+    }
+
+    if (face_materials.defined())
+    {
+        if (face_materials.device() != torch::kCPU || face_materials.numel() != n_faces ||
+            (face_materials.scalar_type() != torch::kInt64 && face_materials.scalar_type() != torch::kInt32))
+        {
+            std::cout << "ERROR: materials has to be an int32/int64 CPU tensor with one id per face" << std::endl;
+            return -1;
+        }
+    }
+
+    if (SetPose(pose) < 0)
+    {
+        return -1;
+    }
+
+    // Looking for a mesh in the cache or adding a new one
+    long ptr = (long)indices.data_ptr();
+    auto search = meshes.find(ptr);
+    if (search == meshes.end())
+    {
+        if (meshes.size() > CACHE_SIZE)
+        {
+            auto lru = meshes.begin();
+            for (auto it = meshes.begin(); it != meshes.end(); ++it)
+            {
+                if (it->second.last_used < lru->second.last_used)
+                    lru = it;
+            }
+            TraceSpan trace("Renderer::EvictMesh", "cache");
+            lru->second.mesh.Terminate();
+            meshes.erase(lru);
+        }
+
+        #ifdef DEBUG
+        std::cout << "[INFO] Adding new mesh in the cache (indices ptr 0x" << std::hex << ptr << std::dec << " )" << std::endl;
+        #endif
+        search = meshes.emplace(ptr, CachedMesh()).first;
+    }
+    search->second.last_used = ++use_clock;
+    active_mesh = &search->second.mesh;
+
+    // frees memory before the new mesh is allocated
+    EnforceMemoryBudget();
+
+    auto& mesh = *active_mesh;
+
+    CpuSpan span(Profiler::UPLOAD);
+    GpuSpan gpu_span(gpuTimer, Profiler::UPLOAD);
+    if (!mesh.IsInitialized())
+    {
+        auto gl_indices = map_indices(indices, n_faces);
+        if (face_materials.defined())
+        {
+            // faces are grouped by material, only the vertex ids are returned per pixel
+            auto material_ids = face_materials.to(torch::kInt64).contiguous();
+            std::vector<unsigned int> gl_material_ids(n_faces);
+            for (unsigned int i = 0; i < n_faces; i++)
+            {
+                // unknown ids fall back to the first material
+                long id = material_ids.data_ptr<long>()[i];
+                gl_material_ids[i] = (id < 0 || (materials.IsInitialized() && (size_t)id >= materials.GetNumberOfMaterials())) ? 0 : id;
+            }
+            OpenGL::GroupFacesByMaterial(gl_indices.data(), gl_material_ids.data(), n_faces);
+            mesh.Init((OpenGL::Vertex*)vertices.data_ptr(), n_vertices, gl_indices.data(), n_faces, vertices.is_cuda());
+            mesh.SetMaterialIds(gl_material_ids.data());
+        }
+        else
+        {
+            mesh.Init((OpenGL::Vertex*)vertices.data_ptr(), n_vertices, gl_indices.data(), n_faces, vertices.is_cuda());
+        }
+    }
+    else if (mesh.GetNumberOfVertices() != n_vertices || mesh.GetNumberOfFaces() != n_faces || mesh.IsVertexDataOnCUDA() != vertices.is_cuda())
+    {
+        //https://www.khronos.org/registry/OpenGL-Refpages/gl4/html/glDrawElements.xhtml
+        //type must be on of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT
+        std::cout << "ERROR: Different amount of vertices or faces in subsequent call: (" << n_vertices << "|" << n_faces << ")" << std::endl;
+        return -1;
+    }
+    else
+    {
+        mesh.Update((OpenGL::Vertex*)vertices.data_ptr(), n_vertices, vertices.is_cuda());
+    }
+
+    return 1;
+}
+
+
+int Renderer::UploadMesh(torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces, torch::Tensor face_materials)
+{
+    if (state != InternalState::INITIALIZED)
+    {
+        std::cout << "ERROR: you need to initialize pyegl" << std::endl;
+        return -1;
+    }
+
+    if (backend == BACKEND_SOFTWARE)
+    {
+        return 1;
+    }
+
+    return PrepareMesh({}, vertices, n_vertices, indices, n_faces, face_materials);
+}
+
+
+int Renderer::SetPose(const std::vector<float>& pose)
+{
+    if (pose.empty())
+    {
+        return 1;
+    }
+
+    if (pose.size() != 16)
+    {
+        std::cout << "ERROR: pose has to be a 4x4 matrix with 16 values, but has " << pose.size() << std::endl;
+        return -1;
+    }
+
+    Trajectory::Invert(pose.data(), 1, &view);
+    return 1;
+}
+
+
+int Renderer::LoadTrajectory(torch::Tensor poses)
+{
+    if (poses.scalar_type() != torch::kFloat32 || poses.dim() < 2 || poses.numel() % 16 != 0 || poses.size(-1) * poses.size(-2) != 16)
+    {
+        std::cout << "ERROR: trajectory has to be a float32 (T, 4, 4) tensor" << std::endl;
+        return -1;
+    }
+
+    poses = poses.to(torch::kCPU).contiguous();
+    return trajectory.Load(poses.data_ptr<float>(), poses.numel() / 16);
+}
+
+
+int Renderer::LoadTrajectoryFile(const std::string& filename)
+{
+    return trajectory.LoadFile(filename);
+}
+
+
+int Renderer::SetFrame(long frame)
+{
+    const OpenGL::mat4* frame_view = frame >= 0 ? trajectory.GetView(frame) : nullptr;
+    if (!frame_view)
+    {
+        std::cout << "ERROR: frame " << frame << " is not in the trajectory of " << trajectory.GetLength() << " poses" << std::endl;
+        return -1;
+    }
+
+    view = *frame_view;
+    return 1;
+}
+
+
+std::vector<torch::Tensor> Renderer::Forward(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                             unsigned int target_width, unsigned int target_height, unsigned int outputs, int flags, int projection, torch::Tensor face_materials)
+{
+    TraceSpan trace("Renderer::Forward", "render");
+    if (state != InternalState::INITIALIZED)
+    {
+        std::cout << "ERROR: you need to initialize pyegl" << std::endl;
+        return {};
+    }
+
+    if (target_width == 0 || target_height == 0)
+    {
+        target_width = width;
+        target_height = height;
+    }
+
+    if ((outputs & OpenGL::RenderTarget::ALL) == 0)
+    {
+        std::cout << "ERROR: no output map selected" << std::endl;
+        return {};
+    }
+
+    if (backend == BACKEND_SOFTWARE)
+    {
+        return ForwardSoftware(intrinsics, pose, vertices, n_vertices, indices, n_faces, target_width, target_height, outputs & OpenGL::RenderTarget::ALL,
+                               flags < 0 ? shading_flags : (unsigned int)flags, projection);
+    }
+
+    // upload textures whose prefetch finished in the meantime
+    textureManager.Poll();
+    gpuTimer.Poll();
+
+    OpenGL::RenderTarget* renderTarget = GetRenderTarget(target_width, target_height, outputs & OpenGL::RenderTarget::ALL);
+    if (!renderTarget)
+    {
+        return {};
+    }
+
+    if (PrepareMesh(pose, vertices, n_vertices, indices, n_faces, face_materials) < 0)
+    {
+        return {};
+    }
+
+    // checked before the maps are allocated, Render fails on them otherwise
+    if (intrinsics.size() < 6)
+    {
+        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
+        return {};
+    }
+    if (UseShader() < 0)
+    {
+        return {};
+    }
+
+    // color, position, normal, uv, bary and vids map, the attachments are
+    // copied straight into tensors owned by the caller
+    std::vector<torch::Tensor> maps(renderTarget->GetNumOfGraphicsResources());
+    std::vector<float*> destinations(maps.size(), nullptr);
+    {
+        CpuSpan span(Profiler::WRAP);
+        auto device = torch::Device(torch::kCUDA, cuda_device);
+        auto options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
+        for (int i = 0; i < renderTarget->GetNumOfGraphicsResources(); i++)
+        {
+            if (renderTarget->HasOutput(i))
+            {
+                long n_channels = OpenGL::RenderTarget::GetNumberOfChannels(i);
+                maps[i] = torch::empty({(long)target_height, (long)target_width, n_channels}, options);
+                destinations[i] = maps[i].data_ptr<float>();
+            }
+        }
+    }
+
+    if (Render(intrinsics, *renderTarget,
+               flags < 0 ? shading_flags : (unsigned int)flags,
+               projection < 0 ? projection_type : (ProjectionType)projection,
+               destinations.data()) < 0)
+    {
+        return {};
+    }
+
+    return maps;
+}
+
+
+int Renderer::UseFeatureShader()
+{
+    if (!featureProgram_ready)
+    {
+        std::string vertex_src, geometry_src, fragment_src;
+        if(!OpenGL::Shader::ReadShaderSource("basic.vs", {}, vertex_src) ||
+           !OpenGL::Shader::ReadShaderSource("basic.gs", {}, geometry_src) ||
+           !OpenGL::Shader::ReadShaderSource("features.fs", {}, fragment_src))
+        {
+            std::cout << "ERROR: reading feature shader sources failed" << std::endl;
+            return -1;
+        }
+
+        if (featureProgram.Begin(vertex_src, geometry_src, fragment_src) < 0 || featureProgram.Finish() < 0)
+        {
+            std::cout << "ERROR: initializing feature shader program failed" << std::endl;
+            featureProgram.Terminate();
+            return -1;
+        }
+        featureProgram_ready = true;
+
+        // the other attributes do not contribute to the features
+        feature_position_loc = featureProgram.GetAttribLocation("in_position");
+        feature_mask_loc = featureProgram.GetAttribLocation("in_mask");
+    }
+
+    featureProgram.Use();
+    return 1;
+}
+
+
+torch::Tensor Renderer::ForwardFeatures(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                        torch::Tensor features, unsigned int target_width, unsigned int target_height, int projection)
+{
+    TraceSpan trace("Renderer::ForwardFeatures", "render");
+    if (state != InternalState::INITIALIZED)
+    {
+        std::cout << "ERROR: you need to initialize pyegl" << std::endl;
+        return torch::Tensor();
+    }
+
+    if (features.dim() != 2 || features.size(0) != n_vertices || features.size(1) < 1 || features.scalar_type() != torch::kFloat32)
+    {
+        std::cout << "ERROR: features have to be a float32 (n_vertices, F) tensor" << std::endl;
+        return torch::Tensor();
+    }
+
+    if (intrinsics.size() < 6)
+    {
+        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
+        return torch::Tensor();
+    }
+
+    if (target_width == 0 || target_height == 0)
+    {
+        target_width = width;
+        target_height = height;
+    }
+
+    if (backend == BACKEND_SOFTWARE)
+    {
+        // no storage buffers, the features are interpolated with the rasterized bary and vids maps
+        auto maps = ForwardSoftware(intrinsics, pose, vertices, n_vertices, indices, n_faces, target_width, target_height,
+                                    OpenGL::RenderTarget::BARY | OpenGL::RenderTarget::VIDS, shading_flags, projection);
+        if (maps.empty())
+            return torch::Tensor();
+        return interpolate(features.to(maps[4].device()), maps[4], maps[5]);
+    }
+
+    gpuTimer.Poll();
+    if (PrepareMesh(pose, vertices, n_vertices, indices, n_faces, torch::Tensor()) < 0)
+    {
+        return torch::Tensor();
+    }
+
+    // one pass renders CHANNELS_PER_PASS channels, the attachments are kept for the next call
+    unsigned int n_features = features.size(1);
+    unsigned int n_attachments = std::min((n_features + 3) / 4, OpenGL::FeatureTarget::MAX_ATTACHMENTS);
+    if (!featureTarget.IsInitialized() || featureTarget.GetWidth() != target_width || featureTarget.GetHeight() != target_height ||
+        featureTarget.GetNumberOfAttachments() != n_attachments)
+    {
+        featureTarget.Terminate();
+        if (featureTarget.Init(target_width, target_height, n_attachments) < 0)
+        {
+            std::cout << "ERROR: creating feature target " << target_width << "x" << target_height << " failed" << std::endl;
+            featureTarget.Terminate();
+            return torch::Tensor();
+        }
+    }
+
+    if (UseFeatureShader() < 0)
+    {
+        return torch::Tensor();
+    }
+
+    SetCamera(intrinsics, target_width, target_height, projection < 0 ? projection_type : (ProjectionType)projection);
+    auto& mesh = *active_mesh;
+    transformation.SetMeshNormalization(mesh.GetCoG(), mesh.GetExtend());
+    transformation.Use();
+
+    features = features.contiguous();
+    featureBuffer.Update(features.data_ptr<float>(), features.numel(), features.is_cuda());
+    featureBuffer.Use();
+
+    // basic.gs reads material ids only for the material flag
+    unsigned int flags = shading.data.flags & ~OpenGL::ShadingBlock::MATERIAL;
+    if (shading.data.flags != flags)
+    {
+        shading.data.flags = flags;
+        shading.Upload();
+    }
+    shading.Bind();
+
+    auto device = torch::Device(torch::kCUDA, cuda_device);
+    auto options = torch::TensorOptions().dtype(torch::kFloat32).layout(torch::kStrided).device(device);
+    auto output = torch::empty({(long)target_height, (long)target_width, (long)n_features}, options);
+
+    for (unsigned int first = 0; first < n_features; first += OpenGL::FeatureTarget::CHANNELS_PER_PASS)
+    {
+        featurePass.data.n_features = n_features;
+        featurePass.data.first_feature = first;
+        featurePass.Upload();
+        featurePass.Bind();
+
+        featureTarget.Clear(intrinsics.size() == 7);
+        {
+            CpuSpan span(Profiler::DRAW);
+            GpuSpan gpu_span(gpuTimer, Profiler::DRAW);
+            mesh.Render(feature_position_loc, -1, -1, -1, feature_mask_loc);
+        }
+        {
+            CpuSpan span(Profiler::READBACK);
+            GpuSpan gpu_span(gpuTimer, Profiler::READBACK);
+            featureTarget.CopyRenderedTexturesToCUDA();
+        }
+
+        // RGBA attachments to consecutive channels of (H, W, F)
+        for (unsigned int i = 0; i < n_attachments && first + 4 * i < n_features; i++)
+        {
+            long channel = first + 4 * i;
+            long n_channels = std::min(4L, (long)n_features - channel);
+            auto attachment = torch::from_blob(featureTarget.GetBuffers()[i], {(long)target_height, (long)target_width, 4}, options);
+            output.narrow(2, channel, n_channels).copy_(attachment.narrow(2, 0, n_channels));
+        }
+    }
+
+    frame_count++;
+    return output;
+}
+
+
+std::vector<torch::Tensor> Renderer::ForwardSoftware(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                                     unsigned int target_width, unsigned int target_height, unsigned int outputs, unsigned int flags, int projection)
+{
+    if (vertices.scalar_type() != torch::kFloat32 || vertices.numel() < (long)n_vertices * (long)(sizeof(OpenGL::Vertex) / sizeof(float)))
+    {
+        std::cout << "ERROR: vertices has to be float32 with " << sizeof(OpenGL::Vertex) / sizeof(float) << " values per vertex" << std::endl;
+        return {};
+    }
+
+    if (indices.scalar_type() != torch::kInt64 || indices.device() != torch::kCPU || indices.numel() < (long)n_faces * 3)
+    {
+        std::cout << "ERROR: faces has to be an int64 CPU tensor with 3 indices per face" << std::endl;
+        return {};
+    }
+
+    if (intrinsics.size() < 6)
+    {
+        std::cout << "ERROR: intrinsics have less then 6 components" << std::endl;
+        return {};
+    }
+
+    if (flags & (OpenGL::ShadingBlock::TEXTURE | OpenGL::ShadingBlock::MATERIAL))
+    {
+        static bool warned = false;
+        if (!warned)
+            std::cout << "WARNING: the software rasterizer does not sample textures, the vertex color is used" << std::endl;
+        warned = true;
+    }
+
+    torch::Tensor vertex_data;
+    std::vector<unsigned int> gl_indices;
+    {
+        CpuSpan span(Profiler::UPLOAD);
+        vertex_data = vertices.to(torch::kCPU).contiguous();
+        gl_indices = map_indices(indices.contiguous(), n_faces);
+    }
+
+    if (SetPose(pose) < 0)
+    {
+        return {};
+    }
+    SetCamera(intrinsics, target_width, target_height, projection < 0 ? projection_type : (ProjectionType)projection);
+
+    // color, position, normal, uv, bary and vids map, returned on the device of the vertices
+    auto options = torch::TensorOptions().dtype(torch::kFloat32);
+    std::vector<torch::Tensor> maps(6);
+    float* buffers[6] = {};
+    for (int i = 0; i < 6; i++)
+    {
+        if (outputs & (1 << i))
+        {
+            maps[i] = torch::empty({(long)target_height, (long)target_width, (long)OpenGL::RenderTarget::GetNumberOfChannels(i)}, options);
+            buffers[i] = maps[i].data_ptr<float>();
+        }
+    }
+
+    {
+        CpuSpan span(Profiler::DRAW);
+        rasterizer.Render((const OpenGL::Vertex*)vertex_data.data_ptr(), n_vertices, gl_indices.data(), n_faces,
+                          transformation.projection, transformation.modelview, target_width, target_height,
+                          flags, lighting.data, intrinsics.size() == 7, buffers);
+    }
+
+    CpuSpan span(Profiler::WRAP);
+    for (auto& map : maps)
+    {
+        if (map.defined())
+            map = map.to(vertices.device());
+    }
+
+    frame_count++;
+    return maps;
+}
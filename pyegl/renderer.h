@@ -0,0 +1,286 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <torch/extension.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <tuple>
+#include <atomic>
+
+#include "opengl_helper.h"
+#include "texture_manager.h"
+#include "software_rasterizer.h"
+#include "profiler.h"
+#include "trajectory.h"
+
+
+enum ProjectionType
+{
+    PERSPECTIVE,
+    WEAK_PERSPECTIVE,
+    PINHOLE,
+    PINHOLE_ZERO_OPTICAL_CENTER,
+    IDENTITY,
+};
+
+
+// AUTO renders with EGL/GL and falls back to the software rasterizer when no
+// EGL context can be created
+enum RenderBackend
+{
+    BACKEND_AUTO,
+    BACKEND_GL,
+    BACKEND_SOFTWARE,
+};
+
+
+// GPU memory of one context in bytes
+struct MemoryUsage
+{
+    size_t meshes = 0;         // vertex, index and material id buffers of the mesh cache
+    size_t render_targets = 0; // attachments and depth buffers
+    size_t textures = 0;       // texture files, the attached tensor and the materials
+    size_t staging = 0;        // readback buffers of the maps, upload and feature buffers
+
+    size_t Total() const
+    {
+        return meshes + render_targets + textures + staging;
+    }
+};
+
+
+// All the state that is bound to one EGL/GL context: the context itself,
+// shaders, render target, attached texture and the mesh cache.
+// A renderer has to be initialized, used and terminated on the same thread.
+class Renderer
+{
+public:
+    enum InternalState
+    {
+        UNINITIALIZED,
+        INITIALIZED
+    };
+
+    int Init(unsigned int width, unsigned int height, const std::vector<std::string>& defines, int device_id=-1);
+
+    void Terminate();
+
+    void LoadShader(const std::vector<std::string>& defines);
+
+    void LoadConfig(const std::string& filename);
+
+    // textures from files are cached, attaching one again does not decode it
+    void AttachTexture(const std::string& filename);
+
+    // decodes the texture files in the background, so attaching them later does not block
+    void PrefetchTextures(const std::vector<std::string>& filenames);
+
+    void SetTextureBudget(size_t bytes);
+
+    // Uploads a (H, W, C) uint8 or float32 tensor from CPU or CUDA memory. At
+    // offset (0, 0) a tensor of another size, type or number of channels
+    // reallocates the texture, otherwise it replaces the sub-rectangle at (x, y).
+    // Row 0 of the tensor is at v = 0.
+    int AttachTextureTensor(torch::Tensor data, unsigned int x=0, unsigned int y=0, bool mipmaps=true);
+
+    // loads the materials of a .mtl file into a texture array, meshes with
+    // per-face material ids are then rendered with them in a single draw call
+    int LoadMaterials(const std::string& filename);
+
+    // width/height of 0 render at the resolution given to Init, maps that
+    // are not selected in outputs are returned as undefined tensors. The maps
+    // are allocated by torch and owned by the caller, later forwards and the
+    // eviction of the render target do not touch them.
+    // Negative flags (OpenGL::ShadingBlock) or projection use the ones of the
+    // last LoadShader, switching them does not recompile anything.
+    // face_materials (n_faces, int32/int64 on CPU) selects a material of
+    // LoadMaterials per face, it is read when the mesh enters the cache.
+    // An empty pose renders with the view of the last SetFrame.
+    std::vector<torch::Tensor> Forward(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                       unsigned int width=0, unsigned int height=0, unsigned int outputs=OpenGL::RenderTarget::ALL,
+                                       int flags=-1, int projection=-1, torch::Tensor face_materials=torch::Tensor());
+
+    // Renders per-vertex features (n_vertices, F) float32 on CPU or CUDA,
+    // interpolated with the barycentrics of the rasterizer, and returns
+    // (H, W, F) on CUDA with 0 in the background. More than
+    // FeatureTarget::CHANNELS_PER_PASS channels take several passes.
+    torch::Tensor ForwardFeatures(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                  torch::Tensor features, unsigned int width=0, unsigned int height=0, int projection=-1);
+
+    // Adds a mesh to the cache without rendering it, later forwards with the
+    // same indices tensor reuse it. Nothing is cached by the software backend.
+    int UploadMesh(torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces, torch::Tensor face_materials=torch::Tensor());
+
+    // Camera poses (T, 4, 4) float32 on CPU or CUDA, inverted once. SetFrame
+    // selects the view of a frame, a forward with an empty pose renders with it.
+    int LoadTrajectory(torch::Tensor poses);
+
+    // memory maps a raw float32 (T, 4, 4) file, see Trajectory::LoadFile
+    int LoadTrajectoryFile(const std::string& filename);
+
+    int SetFrame(long frame);
+
+    size_t GetTrajectoryLength() const
+    {
+        return trajectory.GetLength();
+    }
+
+    // map a define name to a projection type or shading flag, false for other names
+    static bool ParseProjection(const std::string& name, ProjectionType& projection);
+
+    static bool ParseShading(const std::string& name, unsigned int& flags);
+
+    // "auto", "gl" or "software", false for other names
+    static bool ParseBackend(const std::string& name, RenderBackend& backend);
+
+    // backend of renderers initialized afterwards, the default is read from
+    // the PYEGL_BACKEND environment variable
+    static void SetBackend(RenderBackend backend)
+    {
+        requested_backend = backend;
+    }
+
+    static RenderBackend GetRequestedBackend()
+    {
+        return requested_backend;
+    }
+
+    // true if a CUDA error means that the host has no device or driver, in
+    // auto mode the software rasterizer is used then, the error is cleared
+    static bool IsNoCudaDevice(cudaError_t error);
+
+    // Budget for the GPU memory of every context, 0 for no limit. Beyond it the
+    // least recently used meshes and texture files are released, the ones of
+    // the current frame are kept. The default is read from the
+    // PYEGL_MEMORY_BUDGET environment variable.
+    static void SetMemoryBudget(size_t bytes)
+    {
+        memory_budget = bytes;
+    }
+
+    static size_t GetMemoryBudget()
+    {
+        return memory_budget;
+    }
+
+    MemoryUsage GetMemoryUsage() const;
+
+    // evicts until the context fits the budget, called on every frame
+    void EnforceMemoryBudget();
+
+    // GL or SOFTWARE once initialized
+    RenderBackend GetBackend() const
+    {
+        return backend;
+    }
+
+    bool IsInitialized() const
+    {
+        return state == InternalState::INITIALIZED;
+    }
+
+    unsigned int GetWidth() const
+    {
+        return width;
+    }
+
+    unsigned int GetHeight() const
+    {
+        return height;
+    }
+
+private:
+    // finishes a pending compilation and queries the attribute locations
+    // when the program changed, then binds it
+    int UseShader();
+
+    // compiles the feature program on first use, then binds it
+    int UseFeatureShader();
+
+    // checks the tensors and uploads the mesh into the cache, sets the pose
+    int PrepareMesh(const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces, torch::Tensor face_materials);
+
+    // sets the view to the inverse of the (row major) pose, an empty pose keeps the current view
+    int SetPose(const std::vector<float>& pose);
+
+    // sets the projection and modelview of the camera block, without uploading it
+    int SetCamera(const std::vector<float>& intrinsics, unsigned int width, unsigned int height, ProjectionType projection);
+
+    // destinations (one per map of the target) receive the maps instead of the buffers of the target
+    int Render(const std::vector<float>& intrinsics, OpenGL::RenderTarget& renderTarget, unsigned int flags, ProjectionType projection,
+                float* const* destinations=nullptr);
+
+    // Forward on the CPU, the maps are moved to the device of the vertices
+    std::vector<torch::Tensor> ForwardSoftware(const std::vector<float>& intrinsics, const std::vector<float>& pose, torch::Tensor vertices, unsigned int n_vertices, torch::Tensor indices, unsigned int n_faces,
+                                               unsigned int width, unsigned int height, unsigned int outputs, unsigned int flags, int projection);
+
+    // returns a cached render target or allocates a new one, evicting the
+    // least recently used target when the cache is full
+    OpenGL::RenderTarget* GetRenderTarget(unsigned int width, unsigned int height, unsigned int outputs);
+
+    void TerminateRenderTargets();
+
+    InternalState state = InternalState::UNINITIALIZED;
+    static RenderBackend requested_backend;
+    static std::atomic<size_t> memory_budget;
+    RenderBackend backend = BACKEND_GL;
+    SoftwareRasterizer rasterizer;
+    OpenGL::EGL eglContext;
+    // linked programs per define set, switching back to a set that was used
+    // before neither compiles nor links
+    std::map<std::vector<std::string>, OpenGL::ShaderProgram> shaderPrograms;
+    OpenGL::ShaderProgram* shaderProgram = nullptr;
+    bool shaderProgram_ready = false;
+    OpenGL::Texture texture; // uploaded from tensors
+    TextureManager textureManager;
+    OpenGL::Texture* attachedTexture = nullptr;
+    OpenGL::MaterialArray materials;
+    OpenGL::Transformation transformation;
+    GpuTimer gpuTimer;
+    GLint position_loc, normal_loc, color_loc, uv_loc, mask_loc;
+
+    // feature rendering (basic.vs, basic.gs and features.fs)
+    OpenGL::ShaderProgram featureProgram;
+    bool featureProgram_ready = false;
+    GLint feature_position_loc, feature_mask_loc;
+    OpenGL::FeatureBuffer featureBuffer;
+    OpenGL::FeatureTarget featureTarget;
+    OpenGL::UniformBuffer<OpenGL::FeaturePassBlock> featurePass;
+
+    // last uses of the cached meshes, render targets and textures
+    unsigned long use_clock = 0;
+
+    // mesh cache keyed by the data pointer of the index tensor
+    struct CachedMesh
+    {
+        OpenGL::Mesh mesh;
+        unsigned long last_used;
+    };
+    std::map<long, CachedMesh> meshes;
+    OpenGL::Mesh* active_mesh = nullptr;
+    static const size_t CACHE_SIZE = 20;
+
+    // render targets keyed by (width, height, outputs)
+    struct CachedRenderTarget
+    {
+        OpenGL::RenderTarget target;
+        unsigned long last_used;
+    };
+    std::map<std::tuple<unsigned int, unsigned int, unsigned int>, CachedRenderTarget> renderTargets;
+    static const size_t RENDER_TARGET_CACHE_SIZE = 8;
+
+    OpenGL::mat4 view = OpenGL::mat4::Identity();
+    Trajectory trajectory;
+    unsigned int frame_count = 0;
+    unsigned int width = 512;
+    unsigned int height = 512;
+    int cuda_device = 0;
+
+    ProjectionType projection_type = ProjectionType::PINHOLE_ZERO_OPTICAL_CENTER;
+    unsigned int shading_flags = OpenGL::ShadingBlock::PER_FACE_NORMAL;
+    OpenGL::UniformBuffer<OpenGL::LightingBlock> lighting;
+    OpenGL::UniformBuffer<OpenGL::ShadingBlock> shading;
+};
+
+#endif
@@ -10,16 +10,44 @@ in FragmentData
     float mask;
     vec3 baryCoord;
     flat uvec3 vertexIds;
+    flat uint material;
 } fragData;
 
 // uniforms
-#ifdef TEXTURE_SHADING
-uniform sampler2D color_texture;
-#endif
+layout(binding = 0) uniform sampler2D color_texture;
+layout(binding = 1) uniform sampler2DArray material_textures;
 
-uniform vec3 ambient_light;
-uniform vec3 brightness;
-uniform vec3 light_direction;
+// parameters of each material (see OpenGL::MaterialArray)
+struct MaterialParameters
+{
+    vec4 diffuse;
+    vec4 texture_transform; // uv scale, layer (-1 for none)
+};
+
+layout(std430, binding = 0) readonly buffer Materials
+{
+    MaterialParameters materials[];
+};
+
+// shading flags, selected per frame (see OpenGL::ShadingBlock)
+layout(std140, binding = 2) uniform Shading
+{
+    uint shading_flags;
+};
+
+const uint CONSTANT_SHADING = 1u;
+const uint DIFFUSE_SHADING = 2u;
+const uint TEXTURE_SHADING = 4u;
+const uint MATERIAL = 16u;
+const uint TEXTURE_ORIGIN_TOP = 32u;
+
+// lighting parameters (see OpenGL::LightingBlock)
+layout(std140, binding = 1) uniform Lighting
+{
+    vec4 ambient_light;
+    vec4 brightness;
+    vec4 light_direction;
+};
 
 // output buffers
 layout(location = 0) out vec4 frag_color;
@@ -35,27 +63,55 @@ void  main()
     if (fragData.mask < 0.5) discard;
     frag_color = vec4(0.0, 0.0, 0.0, 1.0);
     
-    vec3 base_color = clamp(fragData.color.rgb + brightness, 0.0, 1.0);
+    vec3 base_color = clamp(fragData.color.rgb + brightness.rgb, 0.0, 1.0);
 
-    #ifdef TEXTURE_SHADING
-    base_color = clamp(texture2D(color_texture, fragData.uv).rgb + brightness, 0.0, 1.0);
-    #endif
+    if ((shading_flags & MATERIAL) != 0u)
+    {
+        // the diffuse texture (map_Kd) replaces the diffuse color (Kd), ids of
+        // meshes uploaded before a smaller set of materials fall back to the first
+        uint id = fragData.material < uint(materials.length()) ? fragData.material : 0u;
+        MaterialParameters m = materials[id];
+        vec3 diffuse = m.diffuse.rgb;
+        if (m.texture_transform.z >= 0.0)
+        {
+            // tiled uvs repeat inside the sub-rectangle of the layer, half a texel
+            // away from its border, the gradients of the unwrapped uvs keep the
+            // mip level continuous across the seams
+            vec2 scale = m.texture_transform.xy;
+            vec2 half_texel = 0.5 / vec2(textureSize(material_textures, 0).xy);
+            vec2 uv = clamp(fract(fragData.uv) * scale, half_texel, max(scale - half_texel, half_texel));
+            diffuse = textureGrad(material_textures, vec3(uv, m.texture_transform.z), dFdx(fragData.uv * scale), dFdy(fragData.uv * scale)).rgb;
+        }
+        base_color = clamp(diffuse + brightness.rgb, 0.0, 1.0);
+    }
+    else if ((shading_flags & TEXTURE_SHADING) != 0u)
+    {
+        vec2 uv = fragData.uv;
+        if ((shading_flags & TEXTURE_ORIGIN_TOP) != 0u)
+        {
+            uv.y = 1.0 - uv.y;
+        }
+        base_color = clamp(texture(color_texture, uv).rgb + brightness.rgb, 0.0, 1.0);
+    }
 
     vec3 n = fragData.normal.xyz;
 
-    #ifdef CONSTANT_SHADING
-    frag_color += vec4(base_color * ambient_light, 0.0);
-    #endif
+    if ((shading_flags & CONSTANT_SHADING) != 0u)
+    {
+        frag_color += vec4(base_color * ambient_light.rgb, 0.0);
+    }
 
-    #ifdef DIFFUSE_SHADING
-    vec3 light = normalize(light_direction);
-    float diffuse = max(dot(n, light), 0.0);
-    frag_color += vec4(base_color * diffuse, 0.0);
-    #endif
+    if ((shading_flags & DIFFUSE_SHADING) != 0u)
+    {
+        vec3 light = normalize(light_direction.xyz);
+        float diffuse = max(dot(n, light), 0.0);
+        frag_color += vec4(base_color * diffuse, 0.0);
+    }
 
-    #if !defined(CONSTANT_SHADING) && !defined(DIFFUSE_SHADING)
-    frag_color = vec4(base_color, 1.0);
-    #endif
+    if ((shading_flags & (CONSTANT_SHADING | DIFFUSE_SHADING)) == 0u)
+    {
+        frag_color = vec4(base_color, 1.0);
+    }
 
     frag_color = clamp(frag_color, 0.0, 1.0);
     frag_position = vec4(fragData.position.xyz, 1.0);
@@ -1,10 +1,23 @@
 #version 430
 
-#define PER_FACE_NORMAL
-
 layout (triangles) in;
 layout (triangle_strip, max_vertices = 3) out;
 
+// shading flags, selected per frame (see OpenGL::ShadingBlock)
+layout(std140, binding = 2) uniform Shading
+{
+    uint shading_flags;
+};
+
+const uint PER_FACE_NORMAL = 8u;
+const uint MATERIAL = 16u;
+
+// material of each face (see OpenGL::Mesh::SetMaterialIds)
+layout(std430, binding = 1) readonly buffer MaterialIds
+{
+    uint material_ids[];
+};
+
 // input from vertex shader
 in VertexData
 {
@@ -27,6 +40,7 @@ out FragmentData
     float mask;
     vec3 baryCoord;
     flat uvec3 vertexIds;
+    flat uint material;
 } fragData;
 
 void main()
@@ -38,26 +52,23 @@ void main()
     bary[1] = vec3(0.0, 1.0, 0.0);
     bary[2] = vec3(0.0, 0.0, 1.0);
 
-#ifdef PER_FACE_NORMAL
+    bool per_face_normal = (shading_flags & PER_FACE_NORMAL) != 0u;
+    uint material = (shading_flags & MATERIAL) != 0u ? material_ids[gl_PrimitiveIDIn] : 0u;
     vec3 normal;
     normal = cross(inData[1].position - inData[0].position, inData[2].position - inData[0].position);
     normal = normalize(normal);
-#endif
 
     int i;
     for (i = 0; i < gl_in.length(); i++)
     {      
       fragData.position  = inData[i].position;
-#ifdef PER_FACE_NORMAL
-      fragData.normal    = normal;
-#else
-      fragData.normal    = inData[i].normal;
-#endif
+      fragData.normal    = per_face_normal ? normal : inData[i].normal;
       fragData.color     = inData[i].color;
       fragData.uv        = inData[i].uv;
       fragData.mask      = inData[i].mask;
       fragData.baryCoord = bary[i];
       fragData.vertexIds = vertexIds;
+      fragData.material  = material;
       gl_Position = gl_in[i].gl_Position;
       EmitVertex();
     }
@@ -1,9 +1,12 @@
 #version 430
 
-// input uniforms
-uniform mat4 modelview;
-uniform mat4 projection;
-uniform vec4 mesh_normalization; // center of gravity, scale
+// input uniforms, written once per frame (see OpenGL::CameraBlock)
+layout(std140, row_major, binding = 0) uniform Camera
+{
+    mat4 projection;
+    mat4 modelview;
+    vec4 mesh_normalization; // center of gravity, scale
+};
 
 
 // input mesh data
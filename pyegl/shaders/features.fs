@@ -0,0 +1,62 @@
+#version 430
+
+// input from geometry shader (basic.gs)
+in FragmentData
+{
+    vec3 position;
+    vec3 normal;
+    vec4 color;
+    vec2 uv;
+    float mask;
+    vec3 baryCoord;
+    flat uvec3 vertexIds;
+    flat uint material;
+} fragData;
+
+// per-vertex features, n_features values per vertex (see OpenGL::FeatureBuffer)
+layout(std430, binding = 2) readonly buffer Features
+{
+    float features[];
+};
+
+// channels of this pass (see OpenGL::FeaturePassBlock)
+layout(std140, binding = 3) uniform FeaturePass
+{
+    uint n_features;
+    uint first_feature;
+};
+
+// 4 channels per attachment (see OpenGL::FeatureTarget)
+layout(location = 0) out vec4 frag_features[8];
+
+
+float interpolate(uint f)
+{
+    if (f >= n_features)
+        return 0.0;
+
+    uvec3 offsets = fragData.vertexIds * n_features + f;
+    vec3 values = vec3(features[offsets.x], features[offsets.y], features[offsets.z]);
+    return dot(fragData.baryCoord, values);
+}
+
+vec4 attachment(uint i)
+{
+    uint f = first_feature + 4u * i;
+    return vec4(interpolate(f), interpolate(f + 1u), interpolate(f + 2u), interpolate(f + 3u));
+}
+
+
+void main()
+{
+    if (fragData.mask < 0.5) discard;
+
+    frag_features[0] = attachment(0u);
+    frag_features[1] = attachment(1u);
+    frag_features[2] = attachment(2u);
+    frag_features[3] = attachment(3u);
+    frag_features[4] = attachment(4u);
+    frag_features[5] = attachment(5u);
+    frag_features[6] = attachment(6u);
+    frag_features[7] = attachment(7u);
+}
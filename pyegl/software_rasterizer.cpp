@@ -0,0 +1,504 @@
+#include "software_rasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <mutex>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PYEGL_X86
+#endif
+
+
+// Coverage, depth and barycentrics of up to 8 pixels of a row, starting at the
+// pixel center (x, y). Returns a bit per pixel that passes the fill rule, the
+// [0, 1] depth range and the depth test against depth.
+static unsigned int cover_span(const float (*edges)[3], const bool* top_left, const float* plane, float x, float y, int n,
+                               const float* depth, bool greater, float (*bary)[8], float* z)
+{
+    unsigned int mask = 0;
+    for (int i = 0; i < n; i++)
+    {
+        float px = x + (float)i;
+        bool inside = true;
+        for (int k = 0; k < 3; k++)
+        {
+            float e = edges[k][0] * px + (edges[k][1] * y + edges[k][2]);
+            bary[k][i] = e;
+            inside = inside && (e > 0.0f || (e == 0.0f && top_left[k]));
+        }
+        z[i] = plane[0] * px + (plane[1] * y + plane[2]);
+        inside = inside && z[i] >= 0.0f && z[i] <= 1.0f && (greater ? z[i] > depth[i] : z[i] < depth[i]);
+        if (inside)
+            mask |= 1u << i;
+    }
+    return mask;
+}
+
+#ifdef PYEGL_X86
+// same as cover_span with 8 pixels per instruction, mul and add are kept
+// separate so both paths round alike
+__attribute__((target("avx2")))
+static unsigned int cover_span_avx2(const float (*edges)[3], const bool* top_left, const float* plane, float x, float y, int n,
+                                    const float* depth, bool greater, float (*bary)[8], float* z)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lanes);
+
+    __m256 px = _mm256_add_ps(_mm256_set1_ps(x), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+    __m256 py = _mm256_set1_ps(y);
+    __m256 inside = _mm256_castsi256_ps(valid);
+
+    for (int k = 0; k < 3; k++)
+    {
+        __m256 row = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edges[k][1]), py), _mm256_set1_ps(edges[k][2]));
+        __m256 e = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edges[k][0]), px), row);
+        _mm256_storeu_ps(bary[k], e);
+        inside = _mm256_and_ps(inside, top_left[k] ? _mm256_cmp_ps(e, zero, _CMP_GE_OQ) : _mm256_cmp_ps(e, zero, _CMP_GT_OQ));
+    }
+
+    __m256 row = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane[1]), py), _mm256_set1_ps(plane[2]));
+    __m256 depths = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane[0]), px), row);
+    _mm256_storeu_ps(z, depths);
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(depths, zero, _CMP_GE_OQ));
+    inside = _mm256_and_ps(inside, _mm256_cmp_ps(depths, _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+
+    __m256 stored = _mm256_maskload_ps(depth, valid);
+    if (greater)
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(depths, stored, _CMP_GT_OQ));
+    else
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(depths, stored, _CMP_LT_OQ));
+
+    return (unsigned int)_mm256_movemask_ps(inside);
+}
+#endif
+
+typedef unsigned int (*CoverSpanFunction)(const float (*)[3], const bool*, const float*, float, float, int, const float*, bool, float (*)[8], float*);
+
+static CoverSpanFunction select_cover_span()
+{
+    #ifdef PYEGL_X86
+    if (__builtin_cpu_supports("avx2"))
+        return cover_span_avx2;
+    #endif
+    return cover_span;
+}
+
+
+ThreadPool& SoftwareRasterizer::SharedPool()
+{
+    static std::mutex mutex;
+    static ThreadPool* pool = nullptr;
+    static pid_t pid = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pool || pid != getpid())
+    {
+        // the threads of the parent do not exist in a forked child, leak its pool
+        pool = new ThreadPool();
+        pid = getpid();
+    }
+    return *pool;
+}
+
+
+template<typename F>
+void SoftwareRasterizer::ParallelFor(size_t n, F f)
+{
+    if (n <= 1)
+    {
+        if (n == 1)
+            f(0);
+        return;
+    }
+
+    // workers take the next index, so uneven jobs are balanced
+    std::atomic<size_t> next(0);
+    size_t n_workers = std::min(n, pool->GetNumberOfThreads());
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < n_workers; i++)
+    {
+        futures.push_back(pool->Submit([&]()
+        {
+            for (size_t j = next++; j < n; j = next++)
+                f(j);
+        }));
+    }
+    for (auto& future : futures)
+        future.get();
+}
+
+
+void SoftwareRasterizer::Render(const OpenGL::Vertex* _vertices, unsigned int _n_vertices, const unsigned int* _indices, unsigned int n_faces,
+                                const OpenGL::mat4& projection, const OpenGL::mat4& modelview, unsigned int _width, unsigned int _height,
+                                unsigned int _flags, const OpenGL::LightingBlock& _lighting, bool _back_faces, float* const* _maps)
+{
+    vertices = _vertices;
+    n_vertices = _n_vertices;
+    indices = _indices;
+    width = _width;
+    height = _height;
+    flags = _flags;
+    lighting = _lighting;
+    back_faces = _back_faces;
+    maps = _maps;
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    // looked up on every render, a forked child gets a pool of its own
+    pool = &SharedPool();
+
+    // basic.vs: projection * modelview * position
+    float mvp[16];
+    for (int r = 0; r < 4; r++)
+        for (int c = 0; c < 4; c++)
+        {
+            mvp[4*r + c] = 0.0f;
+            for (int k = 0; k < 4; k++)
+                mvp[4*r + c] += projection.data[4*r + k] * modelview.data[4*k + c];
+        }
+
+    const size_t vertex_block = 1 << 16;
+    clip_positions.resize(4 * (size_t)n_vertices);
+    ParallelFor((n_vertices + vertex_block - 1) / vertex_block, [&](size_t block)
+    {
+        size_t end = std::min((size_t)n_vertices, (block + 1) * vertex_block);
+        for (size_t i = block * vertex_block; i < end; i++)
+        {
+            const OpenGL::Vertex& v = vertices[i];
+            float* clip = &clip_positions[4*i];
+            for (int r = 0; r < 4; r++)
+                clip[r] = mvp[4*r] * v.x + mvp[4*r + 1] * v.y + mvp[4*r + 2] * v.z + mvp[4*r + 3];
+        }
+    });
+
+    // contiguous ranges of faces, so the bins of a tile stay in draw order
+    size_t n_setups = std::max<size_t>(1, std::min<size_t>(n_faces / 4096, 4 * pool->GetNumberOfThreads()));
+    setups.resize(n_setups);
+    ParallelFor(n_setups, [&](size_t i)
+    {
+        SetupFaces((unsigned int)(n_faces * i / n_setups), (unsigned int)(n_faces * (i + 1) / n_setups), setups[i]);
+    });
+
+    ParallelFor((size_t)tiles_x * tiles_y, [&](size_t tile)
+    {
+        thread_local std::vector<float> depth;
+        thread_local std::vector<Fragment> fragments;
+        RasterizeTile((int)tile, depth, fragments);
+        ShadeTile((int)tile, fragments);
+    });
+}
+
+
+void SoftwareRasterizer::SetupFaces(unsigned int begin, unsigned int end, Setup& setup)
+{
+    setup.triangles.clear();
+    setup.bins.resize((size_t)tiles_x * tiles_y);
+    for (auto& bin : setup.bins)
+        bin.clear();
+
+    static const float corners[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+
+    for (unsigned int f = begin; f < end; f++)
+    {
+        const unsigned int* face = indices + 3 * (size_t)f;
+        if (face[0] >= n_vertices || face[1] >= n_vertices || face[2] >= n_vertices)
+            continue;
+
+        float clip[3][4];
+        float near_distance[3];
+        int n_inside = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            std::copy_n(&clip_positions[4 * (size_t)face[k]], 4, clip[k]);
+            near_distance[k] = clip[k][2] + clip[k][3];
+            n_inside += near_distance[k] >= 0.0f;
+        }
+
+        if (n_inside == 3)
+        {
+            AddTriangle(clip, corners, f, setup);
+            continue;
+        }
+        if (n_inside == 0)
+            continue;
+
+        // clip at the near plane (z >= -w), the remaining polygon has 3 or 4 corners
+        float polygon[4][4], polygon_bary[4][3];
+        int n = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            int j = (k + 1) % 3;
+            if (near_distance[k] >= 0.0f)
+            {
+                std::copy_n(clip[k], 4, polygon[n]);
+                std::copy_n(corners[k], 3, polygon_bary[n]);
+                n++;
+            }
+            if ((near_distance[k] >= 0.0f) != (near_distance[j] >= 0.0f))
+            {
+                float t = near_distance[k] / (near_distance[k] - near_distance[j]);
+                for (int c = 0; c < 4; c++)
+                    polygon[n][c] = clip[k][c] + t * (clip[j][c] - clip[k][c]);
+                for (int c = 0; c < 3; c++)
+                    polygon_bary[n][c] = corners[k][c] + t * (corners[j][c] - corners[k][c]);
+                n++;
+            }
+        }
+
+        for (int i = 1; i + 1 < n; i++)
+        {
+            float fan[3][4], fan_bary[3][3];
+            const int corner[3] = {0, i, i + 1};
+            for (int k = 0; k < 3; k++)
+            {
+                std::copy_n(polygon[corner[k]], 4, fan[k]);
+                std::copy_n(polygon_bary[corner[k]], 3, fan_bary[k]);
+            }
+            AddTriangle(fan, fan_bary, f, setup);
+        }
+    }
+}
+
+
+void SoftwareRasterizer::AddTriangle(const float clip[3][4], const float bary[3][3], unsigned int face, Setup& setup)
+{
+    float x[3], y[3], z[3], inv_w[3];
+    for (int k = 0; k < 3; k++)
+    {
+        inv_w[k] = 1.0f / clip[k][3];
+        x[k] = (clip[k][0] * inv_w[k] * 0.5f + 0.5f) * width;
+        y[k] = (clip[k][1] * inv_w[k] * 0.5f + 0.5f) * height;
+        z[k] = clip[k][2] * inv_w[k] * 0.5f + 0.5f;
+    }
+
+    // counterclockwise faces are front faces (glFrontFace(GL_CCW)), culled like glCullFace
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area != 0.0f) || !std::isfinite(area))
+        return;
+    bool front = area > 0.0f;
+    if (front == back_faces)
+        return;
+
+    Triangle t;
+    t.face = face;
+    const int order[3] = {0, front ? 1 : 2, front ? 2 : 1};
+    area = std::abs(area);
+
+    float X[3], Y[3];
+    for (int k = 0; k < 3; k++)
+    {
+        X[k] = x[order[k]];
+        Y[k] = y[order[k]];
+        t.inv_w[k] = inv_w[order[k]];
+        std::copy_n(bary[order[k]], 3, t.bary[k]);
+    }
+
+    // the barycentric of corner k is the edge function of the opposite edge
+    for (int k = 0; k < 3; k++)
+    {
+        int a = (k + 1) % 3;
+        int b = (k + 2) % 3;
+        float A = Y[a] - Y[b];
+        float B = X[b] - X[a];
+        t.top_left[k] = A > 0.0f || (A == 0.0f && B < 0.0f);
+        t.edges[k][0] = A / area;
+        t.edges[k][1] = B / area;
+        t.edges[k][2] = -(A * X[a] + B * Y[a]) / area;
+    }
+
+    for (int i = 0; i < 3; i++)
+        t.depth[i] = z[order[0]] * t.edges[0][i] + z[order[1]] * t.edges[1][i] + z[order[2]] * t.edges[2][i];
+
+    float min_x = std::min({X[0], X[1], X[2]}), max_x = std::max({X[0], X[1], X[2]});
+    float min_y = std::min({Y[0], Y[1], Y[2]}), max_y = std::max({Y[0], Y[1], Y[2]});
+    // rejected and clamped in float, the bounds of far off-screen vertices do not fit into an int
+    if (!(min_x < (float)width && min_y < (float)height && max_x >= 0.0f && max_y >= 0.0f))
+        return;
+    t.x0 = (int)std::max(0.0f, std::floor(min_x));
+    t.y0 = (int)std::max(0.0f, std::floor(min_y));
+    t.x1 = (int)std::min((float)width - 1.0f, std::ceil(max_x));
+    t.y1 = (int)std::min((float)height - 1.0f, std::ceil(max_y));
+    if (t.x0 > t.x1 || t.y0 > t.y1)
+        return;
+
+    unsigned int index = setup.triangles.size();
+    setup.triangles.push_back(t);
+    for (int ty = t.y0 / TILE_SIZE; ty <= t.y1 / TILE_SIZE; ty++)
+        for (int tx = t.x0 / TILE_SIZE; tx <= t.x1 / TILE_SIZE; tx++)
+            setup.bins[ty * tiles_x + tx].push_back(index);
+}
+
+
+void SoftwareRasterizer::RasterizeTile(int tile, std::vector<float>& depth, std::vector<Fragment>& fragments)
+{
+    static const CoverSpanFunction cover = select_cover_span();
+
+    int bx0 = (tile % tiles_x) * TILE_SIZE;
+    int by0 = (tile / tiles_x) * TILE_SIZE;
+    int bx1 = std::min<int>(width, bx0 + TILE_SIZE) - 1;
+    int by1 = std::min<int>(height, by0 + TILE_SIZE) - 1;
+
+    // cleared like RenderTarget::Clear and ClearBack
+    depth.assign(TILE_SIZE * TILE_SIZE, back_faces ? 0.0f : 1.0f);
+    fragments.assign(TILE_SIZE * TILE_SIZE, Fragment{nullptr, {0.0f, 0.0f, 0.0f}});
+
+    float bary[3][8], z[8];
+    for (const auto& setup : setups)
+    {
+        for (unsigned int index : setup.bins[tile])
+        {
+            const Triangle& t = setup.triangles[index];
+            int x0 = std::max(t.x0, bx0), x1 = std::min(t.x1, bx1);
+            int y0 = std::max(t.y0, by0), y1 = std::min(t.y1, by1);
+
+            for (int py = y0; py <= y1; py++)
+            {
+                float* depth_row = &depth[(py - by0) * TILE_SIZE];
+                Fragment* fragment_row = &fragments[(py - by0) * TILE_SIZE];
+                for (int px = x0; px <= x1; px += 8)
+                {
+                    int n = std::min(8, x1 - px + 1);
+                    unsigned int mask = cover(t.edges, t.top_left, t.depth, px + 0.5f, py + 0.5f, n, depth_row + (px - bx0), back_faces, bary, z);
+                    while (mask)
+                    {
+                        int i = __builtin_ctz(mask);
+                        mask &= mask - 1;
+
+                        // perspective-correct barycentrics of the face
+                        float q[3], sum = 0.0f;
+                        for (int k = 0; k < 3; k++)
+                        {
+                            q[k] = bary[k][i] * t.inv_w[k];
+                            sum += q[k];
+                        }
+                        float b[3];
+                        for (int j = 0; j < 3; j++)
+                            b[j] = (q[0] * t.bary[0][j] + q[1] * t.bary[1][j] + q[2] * t.bary[2][j]) / sum;
+
+                        // discarded by basic.fs before the depth write
+                        const unsigned int* face = indices + 3 * (size_t)t.face;
+                        float mask_value = b[0] * vertices[face[0]].mask + b[1] * vertices[face[1]].mask + b[2] * vertices[face[2]].mask;
+                        if (mask_value < 0.5f)
+                            continue;
+
+                        depth_row[px - bx0 + i] = z[i];
+                        fragment_row[px - bx0 + i] = Fragment{&t, {b[0], b[1], b[2]}};
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void SoftwareRasterizer::ShadeTile(int tile, const std::vector<Fragment>& fragments)
+{
+    int bx0 = (tile % tiles_x) * TILE_SIZE;
+    int by0 = (tile / tiles_x) * TILE_SIZE;
+    int bx1 = std::min<int>(width, bx0 + TILE_SIZE) - 1;
+    int by1 = std::min<int>(height, by0 + TILE_SIZE) - 1;
+
+    bool per_face_normal = (flags & OpenGL::ShadingBlock::PER_FACE_NORMAL) != 0;
+    float light[3] = {lighting.light_direction.x, lighting.light_direction.y, lighting.light_direction.z};
+    float light_norm = std::sqrt(light[0] * light[0] + light[1] * light[1] + light[2] * light[2]);
+    for (int c = 0; c < 3 && light_norm > 0.0f; c++)
+        light[c] /= light_norm;
+
+    for (int py = by0; py <= by1; py++)
+    {
+        for (int px = bx0; px <= bx1; px++)
+        {
+            const Fragment& fragment = fragments[(py - by0) * TILE_SIZE + (px - bx0)];
+            size_t pixel = (size_t)py * width + px;
+
+            if (!fragment.triangle)
+            {
+                // glClearColor(-1, -1, -1, 1)
+                for (int i = 0; i < 6; i++)
+                {
+                    if (!maps[i])
+                        continue;
+                    int n_channels = OpenGL::RenderTarget::GetNumberOfChannels(i);
+                    float* out = maps[i] + pixel * n_channels;
+                    for (int c = 0; c < n_channels; c++)
+                        out[c] = c == 3 ? 1.0f : -1.0f;
+                }
+                continue;
+            }
+
+            const unsigned int* face = indices + 3 * (size_t)fragment.triangle->face;
+            const OpenGL::Vertex* v[3] = {&vertices[face[0]], &vertices[face[1]], &vertices[face[2]]};
+            const float* b = fragment.bary;
+
+            float position[3] = {b[0] * v[0]->x + b[1] * v[1]->x + b[2] * v[2]->x,
+                                 b[0] * v[0]->y + b[1] * v[1]->y + b[2] * v[2]->y,
+                                 b[0] * v[0]->z + b[1] * v[1]->z + b[2] * v[2]->z};
+            float normal[3];
+            if (per_face_normal)
+            {
+                // basic.gs: normalize(cross(p1 - p0, p2 - p0))
+                float e1[3] = {v[1]->x - v[0]->x, v[1]->y - v[0]->y, v[1]->z - v[0]->z};
+                float e2[3] = {v[2]->x - v[0]->x, v[2]->y - v[0]->y, v[2]->z - v[0]->z};
+                normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+                normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+                normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+                float norm = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                for (int c = 0; c < 3 && norm > 0.0f; c++)
+                    normal[c] /= norm;
+            }
+            else
+            {
+                normal[0] = b[0] * v[0]->nx + b[1] * v[1]->nx + b[2] * v[2]->nx;
+                normal[1] = b[0] * v[0]->ny + b[1] * v[1]->ny + b[2] * v[2]->ny;
+                normal[2] = b[0] * v[0]->nz + b[1] * v[1]->nz + b[2] * v[2]->nz;
+            }
+
+            // basic.fs without texture and material lookups
+            float base[3] = {b[0] * v[0]->r + b[1] * v[1]->r + b[2] * v[2]->r,
+                             b[0] * v[0]->g + b[1] * v[1]->g + b[2] * v[2]->g,
+                             b[0] * v[0]->b + b[1] * v[1]->b + b[2] * v[2]->b};
+            for (int c = 0; c < 3; c++)
+                base[c] = std::min(std::max(base[c] + lighting.brightness.data[c], 0.0f), 1.0f);
+
+            float color[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+            if (flags & OpenGL::ShadingBlock::CONSTANT)
+            {
+                for (int c = 0; c < 3; c++)
+                    color[c] += base[c] * lighting.ambient_light.data[c];
+            }
+            if (flags & OpenGL::ShadingBlock::DIFFUSE)
+            {
+                float diffuse = std::max(normal[0] * light[0] + normal[1] * light[1] + normal[2] * light[2], 0.0f);
+                for (int c = 0; c < 3; c++)
+                    color[c] += base[c] * diffuse;
+            }
+            if (!(flags & (OpenGL::ShadingBlock::CONSTANT | OpenGL::ShadingBlock::DIFFUSE)))
+            {
+                std::copy_n(base, 3, color);
+            }
+            for (int c = 0; c < 4; c++)
+                color[c] = std::min(std::max(color[c], 0.0f), 1.0f);
+
+            const float values[6][4] = {
+                {color[0], color[1], color[2], color[3]},
+                {position[0], position[1], position[2], 1.0f},
+                {normal[0], normal[1], normal[2], 1.0f},
+                {b[0] * v[0]->u + b[1] * v[1]->u + b[2] * v[2]->u, b[0] * v[0]->v + b[1] * v[1]->v + b[2] * v[2]->v, 0.0f, 0.0f},
+                {b[0], b[1], b[2], 1.0f},
+                {(float)face[0], (float)face[1], (float)face[2], 1.0f}
+            };
+            for (int i = 0; i < 6; i++)
+            {
+                if (!maps[i])
+                    continue;
+                int n_channels = OpenGL::RenderTarget::GetNumberOfChannels(i);
+                std::copy_n(values[i], n_channels, maps[i] + pixel * n_channels);
+            }
+        }
+    }
+}
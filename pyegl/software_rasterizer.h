@@ -0,0 +1,88 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <vector>
+#include <memory>
+
+#include "opengl_helper.h"
+#include "thread_pool.h"
+
+
+// CPU implementation of basic.vs, basic.gs and basic.fs for machines without
+// a usable GL driver. Triangles are clipped at the near plane, binned into
+// screen tiles and the tiles are rasterized in parallel (edge functions with
+// AVX2 where the CPU has it) with the top-left fill rule, a depth test and
+// perspective-correct barycentrics. Every pixel is shaded once after its
+// tile is done. Textures and materials are not sampled, their shading modes
+// use the vertex color.
+class SoftwareRasterizer
+{
+public:
+    static const int TILE_SIZE = 64;
+
+    // maps[i] receives the map of RenderTarget attachment i, (height, width,
+    // RenderTarget::GetNumberOfChannels(i)) floats with row 0 at the bottom and
+    // the background cleared to -1, nullptr skips it. Matrices are row major
+    // like the Camera block, back_faces renders like RenderTarget::ClearBack.
+    void Render(const OpenGL::Vertex* vertices, unsigned int n_vertices, const unsigned int* indices, unsigned int n_faces,
+                const OpenGL::mat4& projection, const OpenGL::mat4& modelview, unsigned int width, unsigned int height,
+                unsigned int flags, const OpenGL::LightingBlock& lighting, bool back_faces, float* const* maps);
+
+private:
+    // a clipped triangle in window coordinates, corners in counterclockwise order
+    struct Triangle
+    {
+        unsigned int face;
+        float edges[3][3];  // A, B, C of the barycentric of corner k, A * x + B * y + C
+        bool top_left[3];
+        float depth[3];     // plane of the window depth
+        float inv_w[3];
+        float bary[3][3];   // barycentrics of the corners in the face
+        int x0, y0, x1, y1; // pixel bounds, inclusive
+    };
+
+    struct Fragment
+    {
+        const Triangle* triangle;
+        float bary[3]; // perspective-correct, in the face
+    };
+
+    struct Setup
+    {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<unsigned int>> bins; // triangles per tile, in face order
+    };
+
+    void SetupFaces(unsigned int begin, unsigned int end, Setup& setup);
+
+    void AddTriangle(const float clip[3][4], const float bary[3][3], unsigned int face, Setup& setup);
+
+    void RasterizeTile(int tile, std::vector<float>& depth, std::vector<Fragment>& fragments);
+
+    void ShadeTile(int tile, const std::vector<Fragment>& fragments);
+
+    // runs f(i) for i in [0, n) on the thread pool, blocks until all are done
+    template<typename F>
+    void ParallelFor(size_t n, F f);
+
+    // one pool for the rasterizers of all contexts, they would oversubscribe
+    // the cores with a pool each
+    static ThreadPool& SharedPool();
+
+    ThreadPool* pool = nullptr;
+    std::vector<Setup> setups;
+    std::vector<float> clip_positions;
+
+    // state of the current Render call
+    const OpenGL::Vertex* vertices = nullptr;
+    unsigned int n_vertices = 0;
+    const unsigned int* indices = nullptr;
+    unsigned int width = 0, height = 0;
+    int tiles_x = 0, tiles_y = 0;
+    unsigned int flags = 0;
+    OpenGL::LightingBlock lighting;
+    bool back_faces = false;
+    float* const* maps = nullptr;
+};
+
+#endif
@@ -0,0 +1,627 @@
+#include "texture_manager.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <chrono>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "deps/stb_image.h"
+
+
+ThreadPool& TextureManager::DecodePool()
+{
+    static std::mutex mutex;
+    static ThreadPool* pool = nullptr;
+    static pid_t pid = 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pool || pid != getpid())
+    {
+        // the threads of the parent do not exist in a forked child, leak its pool
+        pool = new ThreadPool(std::max(1u, std::thread::hardware_concurrency() / 2));
+        pid = getpid();
+    }
+    return *pool;
+}
+
+
+long TextureManager::ModificationTime(const std::string& filename)
+{
+    // embedded images change with their registration
+    OpenGL::EmbeddedImage embedded;
+    if (OpenGL::FindEmbeddedImage(filename, embedded))
+        return embedded.generation;
+
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return -1;
+    return (long)info.st_mtim.tv_sec * 1000000000L + info.st_mtim.tv_nsec;
+}
+
+
+template<typename T>
+static T read_le(const std::vector<unsigned char>& data, size_t offset)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++)
+        value |= (T)data[offset + i] << (8 * i);
+    return value;
+}
+
+
+// bytes of a mip level, block compressed formats are stored in 4x4 blocks
+static size_t level_size(int width, int height, size_t block_bytes, size_t pixel_bytes)
+{
+    if (block_bytes > 0)
+        return (size_t)std::max(1, (width + 3) / 4) * std::max(1, (height + 3) / 4) * block_bytes;
+    return (size_t)width * height * pixel_bytes;
+}
+
+
+// sRGB variants are mapped to their linear formats, textures from png/jpg are not decoded either
+struct CompressedFormat
+{
+    GLenum internal_format;
+    size_t block_bytes;
+};
+
+static bool compressed_format_from_fourcc(const char fourcc[4], CompressedFormat& format)
+{
+    if (std::strncmp(fourcc, "DXT1", 4) == 0) format = {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8};
+    else if (std::strncmp(fourcc, "DXT5", 4) == 0) format = {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16};
+    else return false;
+    return true;
+}
+
+static bool compressed_format_from_dxgi(unsigned int dxgi_format, CompressedFormat& format)
+{
+    switch (dxgi_format)
+    {
+        case 71: case 72: format = {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8}; return true;  // BC1
+        case 77: case 78: format = {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16}; return true; // BC3
+        case 98: case 99: format = {GL_COMPRESSED_RGBA_BPTC_UNORM, 16}; return true;    // BC7
+        default: return false;
+    }
+}
+
+static bool compressed_format_from_vk(unsigned int vk_format, CompressedFormat& format)
+{
+    switch (vk_format)
+    {
+        case 131: case 132: format = {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8}; return true;  // BC1_RGB
+        case 133: case 134: format = {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8}; return true; // BC1_RGBA
+        case 137: case 138: format = {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16}; return true; // BC3
+        case 145: case 146: format = {GL_COMPRESSED_RGBA_BPTC_UNORM, 16}; return true;    // BC7
+        default: return false;
+    }
+}
+
+
+std::shared_ptr<TextureManager::Image> TextureManager::ReadDDS(const std::string& filename, std::vector<unsigned char>&& data)
+{
+    // magic, DDS_HEADER (124 bytes) and optionally DDS_HEADER_DXT10 (20 bytes)
+    if (data.size() < 128 || read_le<unsigned int>(data, 4) != 124)
+    {
+        std::cout << "ERROR: invalid DDS header in " << filename << std::endl;
+        return nullptr;
+    }
+
+    auto image = std::make_shared<Image>();
+    image->height = read_le<unsigned int>(data, 12);
+    image->width = read_le<unsigned int>(data, 16);
+    int n_levels = std::max(1u, read_le<unsigned int>(data, 28));
+    unsigned int pf_flags = read_le<unsigned int>(data, 80);
+    const char* fourcc = (const char*)&data[84];
+    unsigned int bit_count = read_le<unsigned int>(data, 88);
+    unsigned int red_mask = read_le<unsigned int>(data, 92);
+
+    const unsigned int DDPF_FOURCC = 0x4, DDPF_RGB = 0x40;
+    size_t offset = 128;
+    CompressedFormat compressed = {0, 0};
+    if ((pf_flags & DDPF_FOURCC) && std::strncmp(fourcc, "DX10", 4) == 0)
+    {
+        if (data.size() < 148)
+        {
+            std::cout << "ERROR: invalid DDS header in " << filename << std::endl;
+            return nullptr;
+        }
+        unsigned int dxgi_format = read_le<unsigned int>(data, 128);
+        offset = 148;
+        if (dxgi_format == 28 || dxgi_format == 29) // R8G8B8A8
+        {
+            image->internal_format = GL_RGBA8;
+            image->format = GL_RGBA;
+            image->type = GL_UNSIGNED_BYTE;
+        }
+        else if (!compressed_format_from_dxgi(dxgi_format, compressed))
+        {
+            std::cout << "ERROR: unsupported DXGI format " << dxgi_format << " in " << filename << std::endl;
+            return nullptr;
+        }
+    }
+    else if (pf_flags & DDPF_FOURCC)
+    {
+        if (!compressed_format_from_fourcc(fourcc, compressed))
+        {
+            std::cout << "ERROR: unsupported DDS format " << std::string(fourcc, 4) << " in " << filename << std::endl;
+            return nullptr;
+        }
+    }
+    else if ((pf_flags & DDPF_RGB) && bit_count == 32)
+    {
+        image->internal_format = GL_RGBA8;
+        image->format = red_mask == 0x000000ff ? GL_RGBA : GL_BGRA;
+        image->type = GL_UNSIGNED_BYTE;
+    }
+    else
+    {
+        std::cout << "ERROR: unsupported DDS pixel format in " << filename << std::endl;
+        return nullptr;
+    }
+
+    if (compressed.internal_format != 0)
+    {
+        image->internal_format = compressed.internal_format;
+        image->format = compressed.internal_format;
+        image->type = 0;
+    }
+
+    for (int i = 0; i < n_levels; i++)
+    {
+        int w = std::max(1, image->width >> i);
+        int h = std::max(1, image->height >> i);
+        size_t size = level_size(w, h, compressed.block_bytes, 4);
+        if (offset + size > data.size())
+        {
+            std::cout << "ERROR: DDS file is truncated " << filename << std::endl;
+            return nullptr;
+        }
+        image->levels.push_back({offset, size, w, h});
+        offset += size;
+    }
+
+    image->n_channels = 4;
+    image->origin_top = true;
+    image->pixels = std::move(data);
+    return image;
+}
+
+
+std::shared_ptr<TextureManager::Image> TextureManager::ReadKTX2(const std::string& filename, std::vector<unsigned char>&& data)
+{
+    // identifier (12 bytes), header (36 bytes), index (32 bytes), level index (24 bytes per level)
+    if (data.size() < 80)
+    {
+        std::cout << "ERROR: invalid KTX2 header in " << filename << std::endl;
+        return nullptr;
+    }
+
+    auto image = std::make_shared<Image>();
+    unsigned int vk_format = read_le<unsigned int>(data, 12);
+    image->width = read_le<unsigned int>(data, 20);
+    image->height = read_le<unsigned int>(data, 24);
+    unsigned int layer_count = read_le<unsigned int>(data, 32);
+    unsigned int face_count = read_le<unsigned int>(data, 36);
+    unsigned int n_levels = read_le<unsigned int>(data, 40);
+    unsigned int supercompression = read_le<unsigned int>(data, 44);
+    unsigned int kvd_offset = read_le<unsigned int>(data, 56);
+    unsigned int kvd_length = read_le<unsigned int>(data, 60);
+
+    if (supercompression != 0 || layer_count > 1 || face_count != 1)
+    {
+        std::cout << "ERROR: only 2D KTX2 files without supercompression are supported " << filename << std::endl;
+        return nullptr;
+    }
+
+    CompressedFormat compressed = {0, 0};
+    size_t pixel_bytes = 4;
+    if (vk_format == 37 || vk_format == 43) // R8G8B8A8
+    {
+        image->internal_format = GL_RGBA8;
+        image->format = GL_RGBA;
+        image->type = GL_UNSIGNED_BYTE;
+    }
+    else if (vk_format == 23 || vk_format == 29) // R8G8B8
+    {
+        image->internal_format = GL_RGB8;
+        image->format = GL_RGB;
+        image->type = GL_UNSIGNED_BYTE;
+        pixel_bytes = 3;
+    }
+    else if (compressed_format_from_vk(vk_format, compressed))
+    {
+        image->internal_format = compressed.internal_format;
+        image->format = compressed.internal_format;
+        image->type = 0;
+    }
+    else
+    {
+        std::cout << "ERROR: unsupported VkFormat " << vk_format << " in " << filename << std::endl;
+        return nullptr;
+    }
+
+    // levelCount 0 asks for generated mipmaps
+    bool generate_mipmaps = n_levels == 0;
+    n_levels = std::max(1u, n_levels);
+    if (data.size() < 80 + 24 * (size_t)n_levels)
+    {
+        std::cout << "ERROR: invalid KTX2 level index in " << filename << std::endl;
+        return nullptr;
+    }
+
+    for (unsigned int i = 0; i < n_levels; i++)
+    {
+        size_t offset = read_le<unsigned long long>(data, 80 + 24 * i);
+        size_t size = read_le<unsigned long long>(data, 80 + 24 * i + 8);
+        int w = std::max(1, image->width >> i);
+        int h = std::max(1, image->height >> i);
+        if (offset + size > data.size() || size < level_size(w, h, compressed.block_bytes, pixel_bytes))
+        {
+            std::cout << "ERROR: KTX2 file is truncated " << filename << std::endl;
+            return nullptr;
+        }
+        image->levels.push_back({offset, size, w, h});
+    }
+
+    // KTXorientation "rd" (the default) stores the top row first
+    image->origin_top = true;
+    for (size_t offset = kvd_offset; offset + 4 <= (size_t)kvd_offset + kvd_length && offset + 4 <= data.size();)
+    {
+        unsigned int length = read_le<unsigned int>(data, offset);
+        if (offset + 4 + length > data.size())
+            break;
+        std::string entry((const char*)&data[offset + 4], length);
+        size_t separator = entry.find('\0');
+        if (separator != std::string::npos && entry.substr(0, separator) == "KTXorientation")
+            image->origin_top = entry.compare(separator + 1, 2, "ru") != 0;
+        offset += 4 + ((length + 3) & ~3u);
+    }
+
+    // a single uncompressed level gets its mipmaps generated on upload,
+    // compressed ones cannot be generated by the driver
+    if (generate_mipmaps && image->type == 0)
+    {
+        std::cout << "WARNING: compressed KTX2 file without mip levels " << filename << std::endl;
+    }
+
+    image->n_channels = (int)pixel_bytes;
+    image->pixels = std::move(data);
+    return image;
+}
+
+
+static bool has_extension(const std::string& filename, const std::string& extension)
+{
+    if (filename.size() < extension.size())
+        return false;
+    std::string tail = filename.substr(filename.size() - extension.size());
+    std::transform(tail.begin(), tail.end(), tail.begin(), ::tolower);
+    return tail == extension;
+}
+
+
+std::shared_ptr<TextureManager::Image> TextureManager::DecodeFile(const std::string& filename)
+{
+    TraceSpan trace("TextureManager::DecodeFile", "texture");
+    if (has_extension(filename, ".dds") || has_extension(filename, ".ktx2"))
+    {
+        std::ifstream file(filename, std::ios::binary);
+        std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (has_extension(filename, ".dds"))
+            return ReadDDS(filename, std::move(data));
+        return ReadKTX2(filename, std::move(data));
+    }
+
+    auto image = std::make_shared<Image>();
+
+    // the flip setting is per thread, decoding threads do not affect each other
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* data;
+    OpenGL::EmbeddedImage embedded;
+    if (OpenGL::FindEmbeddedImage(filename, embedded))
+        data = stbi_load_from_memory(embedded.data, (int)embedded.size, &image->width, &image->height, &image->n_channels, 0);
+    else
+        data = stbi_load(filename.c_str(), &image->width, &image->height, &image->n_channels, 0);
+    if (!data)
+    {
+        std::cout << "ERROR: failed to load texture from " << filename << ": " << stbi_failure_reason() << std::endl;
+        return nullptr;
+    }
+
+    image->pixels.assign(data, data + (size_t)image->width * image->height * image->n_channels);
+    stbi_image_free(data);
+    return image;
+}
+
+
+TextureManager::Entry* TextureManager::Find(const std::string& filename, long mtime)
+{
+    auto search = entries.find(filename);
+    if (search == entries.end())
+        return nullptr;
+
+    Entry& entry = search->second;
+    if (entry.mtime == mtime)
+    {
+        // the file changed back, the replacement is stale
+        if (entry.replacement_mtime != 0)
+        {
+            entry.decoded = std::shared_future<std::shared_ptr<Image>>();
+            entry.replacement_mtime = 0;
+        }
+        return &entry;
+    }
+
+    // the replacement prefetched next to the pinned texture takes over
+    if (entry.replacement_mtime == mtime)
+    {
+        Release(entry);
+        entry.mtime = mtime;
+        entry.replacement_mtime = 0;
+        return &entry;
+    }
+
+    Release(entry);
+    entries.erase(search);
+    return nullptr;
+}
+
+
+TextureManager::Entry& TextureManager::Decode(const std::string& filename, long mtime)
+{
+    Entry& entry = entries[filename];
+    entry.mtime = mtime;
+    entry.last_used = ++*clock;
+    entry.decoded = DecodePool().Submit([filename]() { return DecodeFile(filename); }).share();
+    return entry;
+}
+
+
+int TextureManager::UploadLevels(Entry& entry, const Image& image)
+{
+    if (image.type == 0 && image.internal_format != GL_COMPRESSED_RGBA_BPTC_UNORM && !GLEW_EXT_texture_compression_s3tc)
+    {
+        std::cout << "ERROR: the driver does not support S3TC (BC1/BC3) textures" << std::endl;
+        return -1;
+    }
+
+    // stored levels are uploaded as they are, only a single uncompressed level gets mipmaps
+    bool generate_mipmaps = image.levels.size() == 1 && image.type != 0 && mipmaps;
+    unsigned int levels = image.levels.size();
+    if (generate_mipmaps)
+    {
+        while ((std::max(image.width, image.height) >> levels) > 0)
+            levels++;
+    }
+
+    if (entry.texture.Init(image.width, image.height, image.internal_format, levels) < 0)
+        return -1;
+    entry.texture.SetOriginTop(image.origin_top);
+
+    entry.bytes = 0;
+    for (size_t i = 0; i < image.levels.size(); i++)
+    {
+        const auto& level = image.levels[i];
+        if (entry.texture.UploadLevel(i, level.width, level.height, image.format, image.type, &image.pixels[level.offset], level.size) < 0)
+        {
+            entry.texture.Terminate();
+            return -1;
+        }
+        entry.bytes += level.size;
+    }
+
+    if (generate_mipmaps)
+    {
+        glGenerateMipmap(GL_TEXTURE_2D);
+        entry.bytes = entry.bytes * 4 / 3;
+    }
+
+    memory_usage += entry.bytes;
+    return 1;
+}
+
+
+int TextureManager::Upload(Entry& entry)
+{
+    TraceSpan trace("TextureManager::Upload", "texture");
+    std::shared_ptr<Image> image = entry.decoded.get();
+    entry.decoded = std::shared_future<std::shared_ptr<Image>>();
+    if (!image)
+        return -1;
+
+    if (!image->levels.empty())
+        return UploadLevels(entry, *image);
+
+    // formats by the number of channels in the file, grey values are swizzled to rgb
+    static const GLenum formats[4] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    static const GLenum internal_formats[4] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    static const GLint swizzles[4][4] = {{GL_RED, GL_RED, GL_RED, GL_ONE},
+                                         {GL_RED, GL_RED, GL_RED, GL_GREEN},
+                                         {GL_RED, GL_GREEN, GL_BLUE, GL_ONE},
+                                         {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA}};
+    int c = image->n_channels - 1;
+
+    unsigned int levels = 1;
+    if (mipmaps)
+    {
+        while ((std::max(image->width, image->height) >> levels) > 0)
+            levels++;
+    }
+
+    if (entry.texture.Init(image->width, image->height, internal_formats[c], levels) < 0)
+        return -1;
+    entry.texture.SetSwizzle(swizzles[c]);
+
+    // mip levels are generated once here, cached textures are used as they are
+    int status = entry.texture.Update(image->pixels.data(), false, 0, 0, image->width, image->height,
+                                      formats[c], GL_UNSIGNED_BYTE, image->n_channels, mipmaps);
+    entry.texture.ReleaseUploadBuffer();
+    if (status < 0)
+    {
+        entry.texture.Terminate();
+        return -1;
+    }
+
+    size_t level_bytes = (size_t)image->width * image->height * image->n_channels;
+    entry.bytes = levels > 1 ? level_bytes * 4 / 3 : level_bytes;
+    memory_usage += entry.bytes;
+    return 1;
+}
+
+
+void TextureManager::Release(Entry& entry)
+{
+    if (entry.texture.IsInitialized())
+    {
+        entry.texture.Terminate();
+        memory_usage -= entry.bytes;
+        entry.bytes = 0;
+    }
+}
+
+
+std::map<std::string, TextureManager::Entry>::const_iterator TextureManager::FindLeastRecentlyUsed() const
+{
+    auto lru = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->first == pinned || !it->second.texture.IsInitialized())
+            continue;
+        if (lru == entries.end() || it->second.last_used < lru->second.last_used)
+            lru = it;
+    }
+    return lru;
+}
+
+
+unsigned long TextureManager::GetLeastRecentUse() const
+{
+    auto lru = FindLeastRecentlyUsed();
+    return lru != entries.end() ? lru->second.last_used : 0;
+}
+
+
+bool TextureManager::EvictLeastRecentlyUsed()
+{
+    auto lru = FindLeastRecentlyUsed();
+    if (lru == entries.end())
+        return false;
+
+    auto it = entries.find(lru->first);
+    Release(it->second);
+    entries.erase(it);
+    return true;
+}
+
+
+void TextureManager::Evict()
+{
+    TraceSpan trace("TextureManager::Evict", "cache");
+    while (budget > 0 && memory_usage > budget)
+    {
+        // only the pinned texture is left
+        if (!EvictLeastRecentlyUsed())
+            return;
+    }
+}
+
+
+OpenGL::Texture* TextureManager::Get(const std::string& filename)
+{
+    long mtime = ModificationTime(filename);
+    if (mtime < 0)
+    {
+        std::cout << "ERROR: texture file does not exist " << filename << std::endl;
+        return nullptr;
+    }
+
+    Entry* entry = Find(filename, mtime);
+    if (!entry)
+        entry = &Decode(filename, mtime);
+    entry->last_used = ++*clock;
+
+    if (!entry->texture.IsInitialized())
+    {
+        // waits for the decoding if it was not prefetched early enough
+        if (Upload(*entry) < 0)
+        {
+            entries.erase(filename);
+            return nullptr;
+        }
+    }
+
+    pinned = filename;
+    Evict();
+    return &entry->texture;
+}
+
+
+void TextureManager::Prefetch(const std::vector<std::string>& filenames)
+{
+    for (const auto& filename : filenames)
+    {
+        long mtime = ModificationTime(filename);
+        if (mtime < 0)
+        {
+            std::cout << "WARNING: texture file does not exist " << filename << std::endl;
+            continue;
+        }
+
+        // the renderer keeps a pointer to the pinned texture, so its entry
+        // is not dropped here even if the file changed
+        auto search = entries.find(filename);
+        if (filename == pinned && search != entries.end() && search->second.mtime != mtime)
+        {
+            Entry& entry = search->second;
+            if (entry.replacement_mtime != mtime)
+            {
+                entry.replacement_mtime = mtime;
+                entry.decoded = DecodePool().Submit([filename]() { return DecodeFile(filename); }).share();
+            }
+            continue;
+        }
+
+        if (!Find(filename, mtime))
+            Decode(filename, mtime);
+    }
+}
+
+
+void TextureManager::Poll()
+{
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        Entry& entry = it->second;
+        // replacements are uploaded by the next Get() of their file
+        if (entry.decoded.valid() && entry.replacement_mtime == 0 && entry.decoded.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            if (Upload(entry) < 0)
+            {
+                it = entries.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+    Evict();
+}
+
+
+void TextureManager::Terminate()
+{
+    for (auto& el : entries)
+    {
+        // pending decodes hold no GL resources, just wait for them to finish
+        if (el.second.decoded.valid())
+            el.second.decoded.wait();
+        Release(el.second);
+    }
+    entries.clear();
+    pinned.clear();
+    memory_usage = 0;
+}
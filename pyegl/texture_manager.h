@@ -0,0 +1,141 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <memory>
+#include <future>
+
+#include "opengl_helper.h"
+#include "thread_pool.h"
+
+
+// Textures loaded from image files, cached per GL context by path and
+// modification time. Images are decoded on a shared thread pool, so
+// Prefetch() can decode the textures of the next batch while the current
+// one renders. Uploaded textures are released in least recently used order
+// once their memory exceeds the budget. Names of images registered with
+// OpenGL::AddEmbeddedImage are decoded from memory instead of a file.
+class TextureManager
+{
+public:
+    // Decoded pixels. Images from stb have a single level with rows in GL
+    // order (first row at v = 0), DDS and KTX2 files keep their mip levels,
+    // block compression and top row first order.
+    struct Image
+    {
+        struct Level
+        {
+            size_t offset;
+            size_t size;
+            int width;
+            int height;
+        };
+
+        std::vector<unsigned char> pixels;
+        int width = 0;
+        int height = 0;
+        int n_channels = 0;
+
+        std::vector<Level> levels; // empty for a single level, mipmaps are generated
+        GLenum internal_format = 0;
+        GLenum format = 0; // compressed format if type is 0
+        GLenum type = 0;
+        bool origin_top = false;
+    };
+
+    // returns the texture of an image file, decoding and uploading it if it is
+    // not cached; the returned texture stays cached until the next Get()
+    OpenGL::Texture* Get(const std::string& filename);
+
+    // Starts decoding files that are not cached yet, does not block. A new
+    // version of the file of the pinned texture is decoded next to it, the
+    // pinned texture stays valid until the next Get() of the file swaps it.
+    void Prefetch(const std::vector<std::string>& filenames);
+
+    // uploads prefetched images that are decoded by now, does not block
+    void Poll();
+
+    void Terminate();
+
+    // budget for the GPU memory of all uploaded textures, 0 disables eviction
+    void SetBudget(size_t bytes)
+    {
+        budget = bytes;
+        Evict();
+    }
+
+    size_t GetMemoryUsage() const
+    {
+        return memory_usage;
+    }
+
+    // counter of the last uses, shared with the other caches of the context so
+    // that their least recently used entries can be compared
+    void SetClock(unsigned long* _clock)
+    {
+        clock = _clock;
+    }
+
+    // last use of the texture that EvictLeastRecentlyUsed() would release, 0 if there is none
+    unsigned long GetLeastRecentUse() const;
+
+    // releases the least recently used texture except the pinned one, false if there is none
+    bool EvictLeastRecentlyUsed();
+
+    void SetMipmaps(bool _mipmaps)
+    {
+        mipmaps = _mipmaps;
+    }
+
+private:
+    struct Entry
+    {
+        long mtime = 0;
+        std::shared_future<std::shared_ptr<Image>> decoded;
+        long replacement_mtime = 0; // decoded holds a new version of the file, the texture is still in use
+        OpenGL::Texture texture;
+        size_t bytes = 0;
+        unsigned long last_used = 0;
+    };
+
+    // returns the entry of a file, dropping it if the file changed since it was cached
+    Entry* Find(const std::string& filename, long mtime);
+
+    Entry& Decode(const std::string& filename, long mtime);
+
+    int Upload(Entry& entry);
+
+    void Release(Entry& entry);
+
+    void Evict();
+
+    std::map<std::string, Entry>::const_iterator FindLeastRecentlyUsed() const;
+
+    static long ModificationTime(const std::string& filename);
+
+    static std::shared_ptr<Image> DecodeFile(const std::string& filename);
+
+    // containers with (block compressed) mip levels, uploaded without decoding
+    static std::shared_ptr<Image> ReadDDS(const std::string& filename, std::vector<unsigned char>&& data);
+
+    static std::shared_ptr<Image> ReadKTX2(const std::string& filename, std::vector<unsigned char>&& data);
+
+    int UploadLevels(Entry& entry, const Image& image);
+
+    // shared by all managers of a process, created again in forked children
+    static ThreadPool& DecodePool();
+
+    std::map<std::string, Entry> entries;
+    std::string pinned; // the texture handed out by the last Get()
+    unsigned long own_clock = 0;
+    unsigned long* clock = &own_clock;
+    size_t memory_usage = 0;
+    size_t budget = DEFAULT_BUDGET;
+    bool mipmaps = true;
+
+    static const size_t DEFAULT_BUDGET = size_t(1) << 30;
+};
+
+#endif
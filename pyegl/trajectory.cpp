@@ -0,0 +1,102 @@
+#include "trajectory.h"
+
+#include <iostream>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// rotation is orthonormal and the last row is (0, 0, 0, 1)
+static bool is_rigid(const float* m)
+{
+    const float eps = 1e-4f;
+    if (std::fabs(m[12]) > eps || std::fabs(m[13]) > eps || std::fabs(m[14]) > eps || std::fabs(m[15] - 1.0f) > eps)
+        return false;
+
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            float dot = m[i*4 + 0] * m[j*4 + 0] + m[i*4 + 1] * m[j*4 + 1] + m[i*4 + 2] * m[j*4 + 2];
+            if (std::fabs(dot - (i == j ? 1.0f : 0.0f)) > eps)
+                return false;
+        }
+    }
+    return true;
+}
+
+
+void Trajectory::Invert(const float* poses, size_t n_poses, OpenGL::mat4* views)
+{
+    for (size_t k = 0; k < n_poses; k++)
+    {
+        const float* m = poses + 16 * k;
+        OpenGL::mat4& view = views[k];
+
+        if (!is_rigid(m))
+        {
+            for (int i = 0; i < 16; i++)
+                view.data[i] = m[i];
+            Eigen::Matrix4f mEigen = view.ToEigen();
+            mEigen = mEigen.inverse().eval();
+            view.FromEigen(mEigen);
+            continue;
+        }
+
+        // [R | t]^-1 = [R^T | -R^T t]
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                view.data[i*4 + j] = m[j*4 + i];
+            view.data[i*4 + 3] = -(m[0*4 + i] * m[3] + m[1*4 + i] * m[7] + m[2*4 + i] * m[11]);
+        }
+        view.data[12] = 0.0f;
+        view.data[13] = 0.0f;
+        view.data[14] = 0.0f;
+        view.data[15] = 1.0f;
+    }
+}
+
+
+int Trajectory::Load(const float* poses, size_t n_poses)
+{
+    views.resize(n_poses);
+    Invert(poses, n_poses, views.data());
+    return 1;
+}
+
+
+int Trajectory::LoadFile(const std::string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "ERROR: trajectory file does not exist " << filename << std::endl;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % (16 * sizeof(float)) != 0)
+    {
+        std::cout << "ERROR: trajectory file " << filename << " has to hold float32 (T, 4, 4) poses" << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cout << "ERROR: mapping trajectory file " << filename << " failed" << std::endl;
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    int result = Load((const float*)data, st.st_size / (16 * sizeof(float)));
+    munmap(data, st.st_size);
+
+    std::cout << " " << "Loaded trajectory with " << views.size() << " poses from " << filename << std::endl;
+    return result;
+}
@@ -0,0 +1,47 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <vector>
+#include <string>
+
+#include "opengl_helper.h"
+
+
+// Camera poses of a whole sequence, inverted once into the view matrices of
+// the camera block so that frames are rendered by index. Poses are row major
+// 4x4 camera to world matrices, rigid ones are inverted by transposing the
+// rotation, others with a general inverse.
+class Trajectory
+{
+public:
+    // n_poses row major 4x4 matrices, replaces the loaded trajectory
+    int Load(const float* poses, size_t n_poses);
+
+    // Raw float32 (T, 4, 4) in native byte order without a header, e.g.
+    // written by numpy with poses.astype('float32').tofile(filename). The
+    // file is memory mapped and inverted in place, without parsing.
+    int LoadFile(const std::string& filename);
+
+    void Clear()
+    {
+        views.clear();
+    }
+
+    size_t GetLength() const
+    {
+        return views.size();
+    }
+
+    // view matrix of a frame, nullptr if it is out of range
+    const OpenGL::mat4* GetView(size_t frame) const
+    {
+        return frame < views.size() ? &views[frame] : nullptr;
+    }
+
+    static void Invert(const float* poses, size_t n_poses, OpenGL::mat4* views);
+
+private:
+    std::vector<OpenGL::mat4> views;
+};
+
+#endif
@@ -1,23 +1,114 @@
-from setuptools import setup
-from torch.utils.cpp_extension import BuildExtension, CUDAExtension
+from setuptools import setup, Command
+import os
 import os.path as osp
+import sys
+
+SHADERS = ['basic.vs', 'basic.gs', 'basic.fs', 'features.fs']
+
+
+def embed_shaders():
+    """Write the GLSL sources into pyegl/shaders/embedded_shaders.h as constexpr strings."""
+    shader_dir = osp.join(osp.dirname(osp.realpath(__file__)), 'pyegl', 'shaders')
+    lines = ['// generated by setup.py from pyegl/shaders, do not edit',
+             '#ifndef EMBEDDED_SHADERS_H',
+             '#define EMBEDDED_SHADERS_H',
+             '',
+             'namespace EmbeddedShaders',
+             '{',
+             'struct Source',
+             '{',
+             '    const char* name;',
+             '    const char* source;',
+             '};',
+             '',
+             'constexpr Source sources[] = {']
+    for name in SHADERS:
+        with open(osp.join(shader_dir, name)) as f:
+            source = f.read()
+        assert ')pyegl_glsl"' not in source
+        lines.append('    {"%s", R"pyegl_glsl(%s)pyegl_glsl"},' % (name, source))
+    lines += ['};',
+              '}',
+              '',
+              '#endif',
+              '']
+
+    header = '\n'.join(lines)
+    filename = osp.join(shader_dir, 'embedded_shaders.h')
+    # keep the timestamp if nothing changed, so the extension is not rebuilt
+    if osp.exists(filename):
+        with open(filename) as f:
+            if f.read() == header:
+                return
+    with open(filename, 'w') as f:
+        f.write(header)
+
+
+class BuildBenchmark(Command):
+    """Build the headless benchmark executable (pyegl/benchmark.cpp) into build/.
+    It only links against GL/EGL, so without --cuda it builds and runs without
+    torch and CUDA, e.g. on Mesa."""
+    description = 'build the pyegl_benchmark executable'
+    user_options = [('cuda', None, 'read the maps back into CUDA memory like the extension does')]
+    boolean_options = ['cuda']
+
+    def initialize_options(self):
+        self.cuda = False
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        from distutils.ccompiler import new_compiler
+        from distutils.sysconfig import customize_compiler
+
+        embed_shaders()
+        root = osp.dirname(osp.realpath(__file__))
+        sources = [osp.join('pyegl', 'benchmark.cpp'), osp.join('pyegl', 'opengl_helper.cpp'), osp.join('pyegl', 'software_rasterizer.cpp'), osp.join('pyegl', 'profiler.cpp'), osp.join('pyegl', 'mesh_loader.cpp'), osp.join('pyegl', 'glb_loader.cpp'), osp.join('pyegl', 'deps', 'FreeImageHelper.cpp')]
+        include_dirs = [osp.join(root, 'deps'), osp.join(root, 'deps/glew-2.1.0/include')]
+        library_dirs = [osp.join(root, 'deps/glew-2.1.0/lib')]
+        libraries = ['freeimage', 'GL', 'EGL', 'GLESv2', 'GLEW']
+        macros = []
+        if self.cuda:
+            cuda_home = os.environ.get('CUDA_HOME', '/usr/local/cuda')
+            include_dirs.append(osp.join(cuda_home, 'include'))
+            library_dirs.append(osp.join(cuda_home, 'lib64'))
+            libraries.append('cudart')
+        else:
+            macros.append(('NO_CUDA', None))
+
+        compiler = new_compiler()
+        customize_compiler(compiler)
+        objects = compiler.compile(sources, output_dir=osp.join('build', 'benchmark'), macros=macros, include_dirs=include_dirs,
+                                   extra_postargs=['-std=c++17', '-O3', '-pthread'])
+        compiler.link_executable(objects, 'pyegl_benchmark', output_dir='build', libraries=libraries, library_dirs=library_dirs,
+                                 extra_postargs=['-pthread'], target_lang='c++')
+
+
+# the benchmark is built without torch, so the extension is only set up for the other commands
+if sys.argv[1:2] == ['build_benchmark']:
+    ext_modules = []
+    cmdclass = {'build_benchmark': BuildBenchmark}
+else:
+    from torch.utils.cpp_extension import BuildExtension, CUDAExtension
+
+    class BuildExtensionWithShaders(BuildExtension):
+        """Embed the shaders before compiling, only when the extension is actually built."""
+        def run(self):
+            embed_shaders()
+            super().run()
+
+    ext_modules = [
+        CUDAExtension('pyegl', [osp.join('pyegl', 'pyegl.cpp'), osp.join('pyegl', 'renderer.cpp'), osp.join('pyegl', 'render_pool.cpp'), osp.join('pyegl', 'texture_manager.cpp'), osp.join('pyegl', 'opengl_helper.cpp'), osp.join('pyegl', 'interpolate.cpp'), osp.join('pyegl', 'software_rasterizer.cpp'), osp.join('pyegl', 'profiler.cpp'), osp.join('pyegl', 'trajectory.cpp'), osp.join('pyegl', 'mesh_loader.cpp'), osp.join('pyegl', 'mesh_cache.cpp'), osp.join('pyegl', 'glb_loader.cpp'), osp.join('pyegl', 'interpolate_cuda.cu'), osp.join('pyegl', 'deps', 'FreeImageHelper.cpp')],
+                      include_dirs=[osp.join(osp.dirname(osp.realpath(__file__)), 'deps'), osp.join(osp.dirname(osp.realpath(__file__)), 'deps/glew-2.1.0/include')],
+                      library_dirs=[osp.join(osp.dirname(osp.realpath(__file__)), 'deps/glew-2.1.0/lib')],
+                      libraries=['freeimage', 'GL', 'EGL', 'GLESv2', 'GLEW'])
+    ]
+    cmdclass = {'build_ext': BuildExtensionWithShaders, 'build_benchmark': BuildBenchmark}
 
 setup(
     name='pyegl',
     version='0.2',
     author='Andrei Burov',
-    ext_modules=[
-        CUDAExtension('pyegl', [osp.join('pyegl', 'pyegl.cpp'), osp.join('pyegl', 'opengl_helper.cpp'), osp.join('pyegl', 'deps', 'FreeImageHelper.cpp')],
-                      include_dirs=[osp.join(osp.dirname(osp.realpath(__file__)), 'deps'), osp.join(osp.dirname(osp.realpath(__file__)), 'deps/glew-2.1.0/include')],
-                      library_dirs=[osp.join(osp.dirname(osp.realpath(__file__)), 'deps/glew-2.1.0/lib')],
-                      libraries=['dl', 'freeimage', 'GL', 'EGL', 'GLESv2', 'GLEW'])
-    ],
-    data_files=[('shaders', [
-      osp.join('pyegl', 'shaders', 'basic.vs'),
-      osp.join('pyegl', 'shaders', 'basic.gs'),
-      osp.join('pyegl', 'shaders', 'basic.fs')
-      ])
-    ],
-    cmdclass={
-        'build_ext': BuildExtension
-    })
+    ext_modules=ext_modules,
+    cmdclass=cmdclass)